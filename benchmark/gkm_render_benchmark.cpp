@@ -0,0 +1,457 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+// Headless benchmark of 3D view rendering modes.
+// A scene file or a synthetic solid is rendered along a scripted camera path into an offscreen framebuffer,
+// frame times are measured after glFinish(), so they include the whole GPU work of a frame.
+// All modes draw the decimated chunked model of the shared scene, construction of the model is timed apart from the upload.
+// Mesa llvmpipe is enough to compare modes, absolute numbers depend on the driver.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QMatrix4x4>
+#include <QOffscreenSurface>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QSurfaceFormat>
+#include <QVector4D>
+#include <QtMath>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_io.h"
+#include "gkm_solid/gkm_visualizer.h"
+#include "gkm_solid/gkm_mesh_optimizer.h"
+#include "chunk_renderer.h"
+#include "view_3d_scene.h"
+
+namespace
+{
+    // Camera and level of detail settings are the same as for View3DWidget
+    constexpr float FIELD_OF_VIEW = 50.0f;
+    constexpr double MAX_PIXEL_ERROR = 1.0;
+    // Frames which are rendered before measurements, they warm up driver caches
+    constexpr unsigned WARM_UP_FRAME_COUNT = 8;
+
+    enum class EMode
+    {
+        // Finest levels of detail of all chunks in one vertex buffer with three vertices per triangle
+        Soup,
+        // One vertex buffer of shared vertices and one index buffer
+        Indexed,
+        // Indexed mesh whose triangles and vertices are reordered for the vertex cache and vertex fetch
+        Optimized,
+        // Chunks of the shared scene at the finest level of detail, chunks out of the frustum are culled
+        Chunked,
+        // Chunks of the shared scene at levels of detail selected by the projected error
+        Lod,
+        // Cells of the shared scene drawn as instances of the unit cube
+        Instanced
+    };
+
+    struct ModeInfo
+    {
+        EMode mode;
+        const char* name;
+    };
+
+    const ModeInfo MODES[] = {
+        { EMode::Soup, "soup" },
+        { EMode::Indexed, "indexed" },
+        { EMode::Optimized, "optimized" },
+        { EMode::Chunked, "chunked" },
+        { EMode::Lod, "lod" },
+        { EMode::Instanced, "instanced" }
+    };
+
+    struct ModeResult
+    {
+        std::string name;
+        bool supported = true;
+        // Meshing, decimation and the picking hierarchy, mesh modes also include indexing and optimization
+        double construction_milliseconds = 0.0;
+        double upload_milliseconds = 0.0;
+        size_t uploaded_size = 0;
+        // Triangles of the finest levels of detail, cells are counted as 12 triangles
+        size_t mesh_triangle_count = 0;
+        std::vector<double> frame_milliseconds;
+        // Triangles which are submitted to the GPU during measured frames
+        double triangle_count = 0.0;
+    };
+
+    struct Camera
+    {
+        QVector3D position;
+        QMatrix4x4 view_projection;
+    };
+
+    // Plate with a lattice of spherical holes, it stands for a hull part with many features
+    Gkm::Solid::ISolid::Ptr makeSolid(unsigned hole_count)
+    {
+        auto plate = std::make_shared<Gkm::Solid::Cube>();
+        plate->half_edge_size = 2.0;
+        Gkm::Solid::ISolid::Ptr result = plate;
+        auto hole = std::make_shared<Gkm::Solid::Sphere>();
+        hole->radius = 0.3;
+        const unsigned side = std::max(static_cast<unsigned>(std::ceil(std::cbrt(static_cast<double>(hole_count)))), 1u);
+        for (unsigned i = 0; i < hole_count; ++i)
+        {
+            auto translate = std::make_shared<Gkm::Solid::TransformOperator>();
+            translate->solid = hole;
+            translate->translate = Eigen::Vector3d(i % side + 0.5, i / side % side + 0.5, i / side / side + 0.5) * (4.0 / side) - Eigen::Vector3d::Constant(2.0);
+            auto difference = std::make_shared<Gkm::Solid::DifferenceOperator>();
+            difference->left = result;
+            difference->right = translate;
+            result = difference;
+        }
+        return result;
+    }
+
+    // The camera orbits around the solid and comes closer to it, so levels of detail change along the path
+    Camera makeCamera(unsigned frame, unsigned frame_count, const Eigen::AlignedBox3d& box, float aspect)
+    {
+        const double t = frame_count > 1 ? static_cast<double>(frame) / (frame_count - 1) : 0.0;
+        const Eigen::Vector3d center = box.center();
+        const double radius = 0.5 * box.diagonal().norm();
+        const double distance = radius * (3.0 - 2.2 * t);
+        const double angle = 2.0 * EIGEN_PI * t;
+        const Eigen::Vector3d position = center + distance * Eigen::Vector3d(std::cos(angle), 0.4, std::sin(angle)).normalized();
+
+        Camera camera;
+        camera.position = QVector3D(static_cast<float>(position.x()), static_cast<float>(position.y()), static_cast<float>(position.z()));
+        QMatrix4x4 projection_matrix;
+        projection_matrix.perspective(FIELD_OF_VIEW, aspect, 0.125f, 1024.0f);
+        QMatrix4x4 view_matrix;
+        view_matrix.lookAt(camera.position, QVector3D(static_cast<float>(center.x()), static_cast<float>(center.y()), static_cast<float>(center.z())), QVector3D(0, 1, 0));
+        camera.view_projection = projection_matrix * view_matrix;
+        return camera;
+    }
+
+    // Finest levels of detail of all chunks as one triangle soup
+    Gkm::Solid::Model::Ptr makeFinestModel(const Gkm::Solid::ChunkedModel& model)
+    {
+        auto result = std::make_shared<Gkm::Solid::Model>();
+        for (auto& chunk : model.chunks)
+        {
+            if (!chunk.lods.empty())
+            {
+                result->points.insert(result->points.end(), chunk.lods.front()->points.begin(), chunk.lods.front()->points.end());
+            }
+            if (!chunk.indexed_lods.empty())
+            {
+                const Gkm::Solid::IndexedModel& indexed_lod = *chunk.indexed_lods.front();
+                for (uint32_t index : indexed_lod.indices)
+                {
+                    result->points.push_back(indexed_lod.points[index]);
+                }
+            }
+        }
+        return result;
+    }
+
+    double percentile(std::vector<double> values, double fraction)
+    {
+        if (values.empty())
+        {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        const size_t index = static_cast<size_t>(std::ceil(fraction * values.size()));
+        return values[std::min(std::max<size_t>(index, 1), values.size()) - 1];
+    }
+
+    class Benchmark : protected QOpenGLExtraFunctions
+    {
+    public:
+        Benchmark(QOpenGLContext* context_, const Gkm::Solid::ISolid::Ptr& solid_, int width_, int height_, unsigned frame_count_) :
+            context(context_), solid(solid_), width(width_), height(height_), frame_count(frame_count_)
+        {
+            initializeOpenGLFunctions();
+        }
+
+        ModeResult run(const ModeInfo& mode_info)
+        {
+            ModeResult result;
+            result.name = mode_info.name;
+            QOpenGLFramebufferObject framebuffer(width, height, QOpenGLFramebufferObject::Depth);
+            framebuffer.bind();
+            glViewport(0, 0, width, height);
+            glClearColor(0.5f, 0.5f, 0.5f, 1.0f);
+            glEnable(GL_DEPTH_TEST);
+            glDisable(GL_CULL_FACE);
+
+            // Mesh modes take triangles of the scene, so they are built with the same options and are not uploaded as chunks
+            const bool mesh_mode = mode_info.mode == EMode::Soup || mode_info.mode == EMode::Indexed || mode_info.mode == EMode::Optimized;
+            View3DScene::Ptr scene = std::make_shared<View3DScene>();
+            scene->setCellInstances(mode_info.mode == EMode::Instanced);
+            scene->initialize(context);
+            if (mode_info.mode == EMode::Instanced && !scene->hasCellInstances())
+            {
+                result.supported = false;
+                framebuffer.release();
+                return result;
+            }
+            ChunkRenderer renderer;
+            renderer.initialize(scene->hasCellInstances());
+
+            QElapsedTimer construction_timer;
+            construction_timer.start();
+            scene->build(solid);
+            const Gkm::Solid::ChunkedModel::Ptr built_model = scene->getBuiltModel();
+            Gkm::Solid::Model::Ptr model;
+            Gkm::Solid::IndexedModel::Ptr indexed_model;
+            if (mesh_mode)
+            {
+                model = makeFinestModel(*built_model);
+                if (mode_info.mode != EMode::Soup)
+                {
+                    indexed_model = Gkm::Solid::buildIndexedModel(*model);
+                }
+                if (mode_info.mode == EMode::Optimized)
+                {
+                    Gkm::Solid::optimizeMesh(*indexed_model, Gkm::Solid::MeshOptimizationOptions());
+                }
+            }
+            result.construction_milliseconds = construction_timer.nsecsElapsed() / 1e6;
+            for (auto& chunk : built_model->chunks)
+            {
+                if (!chunk.lods.empty())
+                {
+                    result.mesh_triangle_count += chunk.lods.front()->points.size() / 3;
+                }
+                if (!chunk.indexed_lods.empty())
+                {
+                    result.mesh_triangle_count += chunk.indexed_lods.front()->indices.size() / 3;
+                }
+                if (!chunk.instance_lods.empty())
+                {
+                    result.mesh_triangle_count += chunk.instance_lods.front().size() * 12;
+                }
+            }
+
+            QElapsedTimer upload_timer;
+            std::function<size_t(const Camera&)> draw;
+            std::unique_ptr<QOpenGLBuffer> vbo;
+            std::unique_ptr<QOpenGLBuffer> ibo;
+            if (mesh_mode)
+            {
+                upload_timer.start();
+                vbo = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+                vbo->create();
+                vbo->bind();
+                const std::vector<Eigen::Vector3f>& points = indexed_model ? indexed_model->points : model->points;
+                vbo->allocate(points.data(), static_cast<int>(points.size() * sizeof(Eigen::Vector3f)));
+                result.uploaded_size = points.size() * sizeof(Eigen::Vector3f);
+                if (indexed_model)
+                {
+                    ibo = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::IndexBuffer);
+                    ibo->create();
+                    ibo->bind();
+                    ibo->allocate(indexed_model->indices.data(), static_cast<int>(indexed_model->indices.size() * sizeof(uint32_t)));
+                    result.uploaded_size += indexed_model->indices.size() * sizeof(uint32_t);
+                }
+                glFinish();
+                result.upload_milliseconds = upload_timer.nsecsElapsed() / 1e6;
+
+                const GLsizei vertex_count = static_cast<GLsizei>(model->points.size());
+                draw = [&, vertex_count](const Camera& camera)
+                {
+                    // The program of chunks draws float positions with the unit scale
+                    QOpenGLShaderProgram& program = renderer.getProgram();
+                    program.bind();
+                    program.setUniformValue("matrix", camera.view_projection);
+                    program.setUniformValue("position_offset", QVector3D(0.0f, 0.0f, 0.0f));
+                    program.setUniformValue("position_scale", QVector3D(1.0f, 1.0f, 1.0f));
+                    program.setUniformValue("clip_plane", QVector4D(0.0f, 0.0f, 0.0f, 1.0f));
+                    program.enableAttributeArray(PROGRAM_VERTEX_ATTRIBUTE);
+                    vbo->bind();
+                    program.setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_FLOAT, 0, 3, sizeof(Eigen::Vector3f));
+                    if (ibo)
+                    {
+                        ibo->bind();
+                        glDrawElements(GL_TRIANGLES, vertex_count, GL_UNSIGNED_INT, nullptr);
+                    }
+                    else
+                    {
+                        glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+                    }
+                    return static_cast<size_t>(vertex_count / 3);
+                };
+            }
+            else
+            {
+                upload_timer.start();
+                scene->upload();
+                glFinish();
+                result.upload_milliseconds = upload_timer.nsecsElapsed() / 1e6;
+                result.uploaded_size = scene->getBufferHeap().getUploadedSize() + scene->getIndexHeap().getUploadedSize();
+                // Zero error draws the finest levels of detail, the section plane of views keeps everything
+                const double max_pixel_error = mode_info.mode == EMode::Chunked ? 0.0 : MAX_PIXEL_ERROR;
+                const double projection_scale = height / (2.0 * std::tan(qDegreesToRadians(FIELD_OF_VIEW / 2.0)));
+                draw = [&, max_pixel_error, projection_scale](const Camera& camera)
+                {
+                    const Eigen::Vector3d viewer_position(camera.position.x(), camera.position.y(), camera.position.z());
+                    return renderer.draw(*scene, camera.view_projection, viewer_position, projection_scale, max_pixel_error, Eigen::Vector4d(0.0, 0.0, 0.0, 1.0));
+                };
+            }
+
+            for (unsigned frame = 0; frame < WARM_UP_FRAME_COUNT + frame_count; ++frame)
+            {
+                const unsigned path_frame = frame < WARM_UP_FRAME_COUNT ? 0 : frame - WARM_UP_FRAME_COUNT;
+                const Camera camera = makeCamera(path_frame, frame_count, solid->bbox(), static_cast<float>(width) / height);
+                QElapsedTimer frame_timer;
+                frame_timer.start();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                const size_t triangle_count = draw(camera);
+                glFinish();
+                if (frame >= WARM_UP_FRAME_COUNT)
+                {
+                    result.frame_milliseconds.push_back(frame_timer.nsecsElapsed() / 1e6);
+                    result.triangle_count += static_cast<double>(triangle_count);
+                }
+            }
+            framebuffer.release();
+            return result;
+        }
+
+    private:
+        QOpenGLContext* context;
+        Gkm::Solid::ISolid::Ptr solid;
+        int width;
+        int height;
+        unsigned frame_count;
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    QGuiApplication application(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders a synthetic solid offscreen along a scripted camera path and reports frame times of rendering modes");
+    parser.addHelpOption();
+    QCommandLineOption scene_option("scene", "Scene file which is rendered instead of the synthetic plate, see gkm_io.h.", "file");
+    QCommandLineOption holes_option("holes", "Number of spherical holes in the plate.", "count", "100");
+    QCommandLineOption frames_option("frames", "Number of measured frames of the camera path.", "count", "200");
+    QCommandLineOption width_option("width", "Framebuffer width.", "pixels", "1280");
+    QCommandLineOption height_option("height", "Framebuffer height.", "pixels", "720");
+    QCommandLineOption modes_option("modes", "Comma separated modes: soup, indexed, optimized, chunked, lod, instanced.", "modes", "soup,indexed,optimized,chunked,lod,instanced");
+    QCommandLineOption budget_option("budget", "Fails if the 90th percentile frame time of a mode exceeds the budget.", "milliseconds", "0");
+    parser.addOptions({ scene_option, holes_option, frames_option, width_option, height_option, modes_option, budget_option });
+    parser.process(application);
+
+    const unsigned hole_count = parser.value(holes_option).toUInt();
+    const unsigned frame_count = std::max(parser.value(frames_option).toUInt(), 1u);
+    const int width = std::max(parser.value(width_option).toInt(), 1);
+    const int height = std::max(parser.value(height_option).toInt(), 1);
+    // QString::SkipEmptyParts is deprecated since Qt 5.14
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+    const QStringList mode_names = parser.value(modes_option).split(',', Qt::SkipEmptyParts);
+#else
+    const QStringList mode_names = parser.value(modes_option).split(',', QString::SkipEmptyParts);
+#endif
+    const double budget = parser.value(budget_option).toDouble();
+
+    // Instancing needs OpenGL 3.3, the compatibility profile keeps the GLSL 1.10 shaders of the view valid
+    QSurfaceFormat format;
+    format.setDepthBufferSize(24);
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CompatibilityProfile);
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (!context.create())
+    {
+        std::fprintf(stderr, "Failed to create OpenGL context\n");
+        return 1;
+    }
+    QOffscreenSurface surface;
+    surface.setFormat(context.format());
+    surface.create();
+    if (!context.makeCurrent(&surface))
+    {
+        std::fprintf(stderr, "Failed to make OpenGL context current\n");
+        return 1;
+    }
+    const QByteArray renderer(reinterpret_cast<const char*>(context.functions()->glGetString(GL_RENDERER)));
+    std::printf("Renderer: %s, OpenGL %d.%d\n", renderer.constData(), context.format().majorVersion(), context.format().minorVersion());
+
+    Gkm::Solid::ISolid::Ptr solid;
+    if (parser.isSet(scene_option))
+    {
+        const QString scene_file = parser.value(scene_option);
+        std::string error;
+        solid = Gkm::Solid::readScene(scene_file.toStdString(), &error);
+        if (!solid)
+        {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        std::printf("Solid: scene %s, %u frames at %dx%d\n\n", scene_file.toUtf8().constData(), frame_count, width, height);
+    }
+    else
+    {
+        solid = makeSolid(hole_count);
+        std::printf("Solid: plate with %u holes, %u frames at %dx%d\n\n", hole_count, frame_count, width, height);
+    }
+    if (solid->bbox().isEmpty())
+    {
+        std::fprintf(stderr, "Solid is empty\n");
+        return 1;
+    }
+    Benchmark benchmark(&context, solid, width, height, frame_count);
+    std::printf("%-10s %9s %9s %9s %10s %10s %9s %9s %9s %9s %10s\n", "mode", "build ms", "upload ms", "upload MB",
+        "mesh Ktri", "frame Ktri", "p50 ms", "p90 ms", "p99 ms", "max ms", "Mtri/s");
+    bool over_budget = false;
+    for (auto& mode_name : mode_names)
+    {
+        const ModeInfo* mode_info = nullptr;
+        for (auto& info : MODES)
+        {
+            if (mode_name.trimmed() == info.name)
+            {
+                mode_info = &info;
+            }
+        }
+        if (!mode_info)
+        {
+            std::fprintf(stderr, "Unknown mode %s\n", mode_name.toUtf8().constData());
+            return 1;
+        }
+        const ModeResult result = benchmark.run(*mode_info);
+        if (!result.supported)
+        {
+            std::printf("%-10s %10s\n", result.name.c_str(), "unsupported");
+            continue;
+        }
+        double total_milliseconds = 0.0;
+        for (double frame_milliseconds : result.frame_milliseconds)
+        {
+            total_milliseconds += frame_milliseconds;
+        }
+        const double p90 = percentile(result.frame_milliseconds, 0.9);
+        // Frame triangles are the average of triangles which are submitted per measured frame
+        std::printf("%-10s %9.1f %9.1f %9.2f %10.1f %10.1f %9.2f %9.2f %9.2f %9.2f %10.2f\n", result.name.c_str(),
+            result.construction_milliseconds, result.upload_milliseconds, result.uploaded_size / (1024.0 * 1024.0),
+            result.mesh_triangle_count / 1000.0, result.triangle_count / (1000.0 * result.frame_milliseconds.size()),
+            percentile(result.frame_milliseconds, 0.5), p90, percentile(result.frame_milliseconds, 0.99),
+            percentile(result.frame_milliseconds, 1.0),
+            total_milliseconds > 0.0 ? result.triangle_count / (total_milliseconds * 1000.0) : 0.0);
+        if (budget > 0.0 && p90 > budget)
+        {
+            over_budget = true;
+        }
+    }
+    context.doneCurrent();
+    return over_budget ? 2 : 0;
+}
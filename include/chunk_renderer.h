@@ -0,0 +1,43 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QMatrix4x4>
+#include "Eigen/Eigen"
+#include "view_3d_scene.h"
+
+#define PROGRAM_VERTEX_ATTRIBUTE 0
+#define PROGRAM_FACE_ATTRIBUTE 2
+#define PROGRAM_CELL_POSITION_ATTRIBUTE 3
+#define PROGRAM_CELL_INFO_ATTRIBUTE 4
+
+// Draws chunks of the shared scene, 3D views and the rendering benchmark draw chunks by it.
+// Positions are position_offset + position_scale * vertex, fragments on the negative side of the clip plane are discarded.
+// All methods require the current OpenGL context.
+class ChunkRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    // Compiles shaders for meshes or for cell instances, as the scene draws them
+    void initialize(bool cell_instances);
+    // Program of chunks, the vertex attribute of meshes could be set to plain float positions with the unit scale
+    QOpenGLShaderProgram& getProgram();
+    // Draws chunks which intersect the frustum and are not on the negative side of the clip plane, nearer chunks first.
+    // Levels of detail are selected by the projected error, zero error draws the finest ones.
+    // The clip plane is in the form of Frustum planes. Returns the number of submitted triangles.
+    // Shaders are compiled again if the scene switches cell instances.
+    size_t draw(View3DScene& scene, const QMatrix4x4& view_projection, const Eigen::Vector3d& viewer_position,
+        double projection_scale, double max_pixel_error, const Eigen::Vector4d& clip_plane);
+
+private:
+    bool cell_instances = false;
+    std::unique_ptr<QOpenGLShaderProgram> program;
+    // Indices and distances of visible chunks, it is kept between frames to avoid allocations
+    std::vector<std::pair<double, size_t>> visible_chunks;
+};
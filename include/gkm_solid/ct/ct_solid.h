@@ -0,0 +1,261 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Compile-time solids for parts with fixed topology, like profile sections, brackets and lightening holes.
+        // Expression is a plain value type, so the whole tree is inlined into a single branch-free function,
+        // for instance, CT::Difference<CT::Cube, CT::Translate<CT::Sphere>>.
+        // Results are the same as results of the corresponding ISolid trees.
+        namespace CT
+        {
+            struct Cube
+            {
+                double half_edge_size = 1.0;
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    const Scalar size = static_cast<Scalar>(half_edge_size);
+                    return (std::fabs(x) <= size) & (std::fabs(y) <= size) & (std::fabs(z) <= size);
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    return Eigen::AlignedBox3d(Eigen::Vector3d::Constant(-half_edge_size), Eigen::Vector3d::Constant(half_edge_size));
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    cubeRaySpans(half_edge_size, origin, direction, t_min, t_max, spans);
+                }
+            };
+
+            struct Sphere
+            {
+                double radius = 1.0;
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    const Scalar squared_radius = static_cast<Scalar>(radius * radius);
+                    // The same summation order as Eigen uses for squaredNorm()
+                    return (x * x + y * y) + z * z <= squared_radius;
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    return Eigen::AlignedBox3d(Eigen::Vector3d::Constant(-radius), Eigen::Vector3d::Constant(radius));
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    sphereRaySpans(radius, origin, direction, t_min, t_max, spans);
+                }
+            };
+
+            template<class Solid>
+            struct Translate
+            {
+                Solid solid;
+                Eigen::Vector3d translate = Eigen::Vector3d::Zero();
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    return solid.inside(
+                        x - static_cast<Scalar>(translate.x()),
+                        y - static_cast<Scalar>(translate.y()),
+                        z - static_cast<Scalar>(translate.z())
+                    );
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    Eigen::AlignedBox3d bbox = solid.bbox();
+                    bbox.min() += translate;
+                    bbox.max() += translate;
+                    return bbox;
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    solid.raySpans(origin - translate, direction, t_min, t_max, spans);
+                }
+            };
+
+            template<class Left, class Right>
+            struct Union
+            {
+                Left left;
+                Right right;
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    return left.inside(x, y, z) | right.inside(x, y, z);
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    return left.bbox().merged(right.bbox());
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    std::vector<RaySpan> left_spans;
+                    std::vector<RaySpan> right_spans;
+                    left.raySpans(origin, direction, t_min, t_max, left_spans);
+                    right.raySpans(origin, direction, t_min, t_max, right_spans);
+                    uniteSpans(left_spans, right_spans, spans);
+                }
+            };
+
+            template<class Left, class Right>
+            struct Difference
+            {
+                Left left;
+                Right right;
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    return left.inside(x, y, z) & !right.inside(x, y, z);
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    return left.bbox();
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    std::vector<RaySpan> left_spans;
+                    std::vector<RaySpan> right_spans;
+                    left.raySpans(origin, direction, t_min, t_max, left_spans);
+                    right.raySpans(origin, direction, t_min, t_max, right_spans);
+                    subtractSpans(left_spans, right_spans, spans);
+                }
+            };
+
+            template<class Left, class Right>
+            struct Intersection
+            {
+                Left left;
+                Right right;
+
+                template<typename Scalar>
+                bool inside(Scalar x, Scalar y, Scalar z) const
+                {
+                    return left.inside(x, y, z) & right.inside(x, y, z);
+                }
+
+                Eigen::AlignedBox3d bbox() const
+                {
+                    return left.bbox().intersection(right.bbox());
+                }
+
+                void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+                {
+                    std::vector<RaySpan> left_spans;
+                    std::vector<RaySpan> right_spans;
+                    left.raySpans(origin, direction, t_min, t_max, left_spans);
+                    right.raySpans(origin, direction, t_min, t_max, right_spans);
+                    intersectSpans(left_spans, right_spans, spans);
+                }
+            };
+
+            template<class Solid>
+            Translate<Solid> translate(const Solid& solid, const Eigen::Vector3d& translate)
+            {
+                return Translate<Solid>{ solid, translate };
+            }
+
+            template<class Left, class Right>
+            Union<Left, Right> unite(const Left& left, const Right& right)
+            {
+                return Union<Left, Right>{ left, right };
+            }
+
+            template<class Left, class Right>
+            Difference<Left, Right> subtract(const Left& left, const Right& right)
+            {
+                return Difference<Left, Right>{ left, right };
+            }
+
+            template<class Left, class Right>
+            Intersection<Left, Right> intersect(const Left& left, const Right& right)
+            {
+                return Intersection<Left, Right>{ left, right };
+            }
+
+            // Batch kernel, the loop body has no branches and no calls, so compiler could vectorize it
+            template<class Solid>
+            void insideBatch(const Solid& solid, const PointBatch& points, std::vector<unsigned char>& result)
+            {
+                const size_t point_count = points.size();
+                result.resize(point_count);
+                const double* x = points.x.data();
+                const double* y = points.y.data();
+                const double* z = points.z.data();
+                unsigned char* output = result.data();
+                for (size_t i = 0; i < point_count; ++i)
+                {
+                    output[i] = solid.inside(x[i], y[i], z[i]);
+                }
+            }
+
+            // Wraps compile-time solid into ISolid leaf, so it could be a part of any solid tree
+            template<class Solid>
+            struct Leaf : public ISolid
+            {
+                typedef std::shared_ptr<Leaf<Solid>> Ptr;
+
+                Solid solid;
+
+                virtual ESolidType type() const override
+                {
+                    return ESolidType::Custom;
+                }
+
+                virtual bool inside(const Eigen::Vector3d& point) const override
+                {
+                    return solid.inside(point.x(), point.y(), point.z());
+                }
+
+                virtual Eigen::AlignedBox3d bbox() const override
+                {
+                    return solid.bbox();
+                }
+
+                virtual void insideBatch(const PointBatch& points, std::vector<unsigned char>& result) const override
+                {
+                    CT::insideBatch(solid, points, result);
+                }
+
+                virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override
+                {
+                    solid.raySpans(origin, direction, t_min, t_max, spans);
+                }
+            };
+
+            template<class Solid>
+            typename Leaf<Solid>::Ptr makeLeaf(const Solid& solid)
+            {
+                auto leaf = std::make_shared<Leaf<Solid>>();
+                leaf->solid = solid;
+                return leaf;
+            }
+        }
+    }
+}
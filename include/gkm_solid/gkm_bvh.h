@@ -0,0 +1,83 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct MeshRayHit
+        {
+            bool hit = false;
+            double distance = 0.0;
+            // Index of the triangle in the source model
+            uint32_t triangle = 0;
+            uint32_t id = 0;
+            // Unit normal of the triangle by its winding
+            Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+        };
+
+        struct BvhOptions
+        {
+            // Nodes with at most this number of triangles are not split
+            unsigned leaf_size = 4;
+            unsigned thread_count = 0;
+        };
+
+        // Bounding volume hierarchy over triangles of a displayed model, each triangle is tagged by an id.
+        // It is built by the surface area heuristic over binned centroids and flattened in depth-first order,
+        // children of an inner node are adjacent, so a node and its sibling usually share a cache line.
+        class MeshBvh
+        {
+        public:
+            typedef std::shared_ptr<MeshBvh> Ptr;
+
+            struct Node
+            {
+                Eigen::AlignedBox3f box;
+                // Index of the left child of an inner node, the right one follows it, or the first triangle of a leaf
+                uint32_t first = 0;
+                // Number of triangles of a leaf, zero for inner nodes
+                uint32_t count = 0;
+            };
+
+            MeshBvh(const Model& model, const std::vector<uint32_t>& triangle_ids, const BvhOptions& options = BvhOptions());
+
+            // Nearest hit of a ray within [t_min, t_max], both sides of triangles are hit
+            bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, MeshRayHit& hit) const;
+            // Source indices of triangles whose bounding boxes intersect the box
+            void queryBox(const Eigen::AlignedBox3d& box, std::vector<uint32_t>& triangles) const;
+            // Vertex i of the triangle with the given source index
+            Eigen::Vector3f vertex(uint32_t triangle, unsigned i) const;
+            uint32_t triangleId(uint32_t triangle) const;
+            size_t getTriangleCount() const;
+            size_t getNodeCount() const;
+            size_t getMemorySize() const;
+
+        private:
+            std::vector<Node> nodes;
+            // Vertices of triangles in the order of leaves, three per triangle
+            std::vector<Eigen::Vector3f> points;
+            // Source indices and ids of triangles in the order of leaves
+            std::vector<uint32_t> source_triangles;
+            std::vector<uint32_t> ids;
+            // Position of each source triangle in the order of leaves
+            std::vector<uint32_t> slots;
+        };
+
+        // Operands of the top level unions of the solid, they are the parts which are highlighted and selected
+        void collectParts(const ISolid::Ptr& solid, std::vector<ISolid::Ptr>& parts);
+        // Index of the part whose surface is the nearest to each triangle, triangles are expected to wind
+        // counterclockwise around outward normals as meshes of the visualizer do. Triangles are tagged in parallel.
+        std::vector<uint32_t> tagTriangles(const Model& model, const std::vector<ISolid::Ptr>& parts, unsigned thread_count = 0);
+    }
+}
@@ -0,0 +1,53 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Hash-consing table which turns solid trees into DAGs where structurally identical subtrees
+        // are represented by a single shared node. Hash and bounding box of each canonical node are
+        // computed once and could be reused by all identical parts.
+        class SolidDag
+        {
+        public:
+            typedef std::shared_ptr<SolidDag> Ptr;
+
+            // Returns the canonical node which is structurally equal to the solid
+            ISolid::Ptr canonicalize(const ISolid::Ptr& solid);
+            // Hash and bounding box are available for canonical nodes only
+            size_t hash(const ISolid::Ptr& canonical) const;
+            const Eigen::AlignedBox3d& bbox(const ISolid::Ptr& canonical) const;
+            // Number of distinct canonical nodes
+            size_t nodeCount() const;
+            // Number of source nodes which were replaced by an already existing canonical node
+            size_t sharedNodeCount() const;
+
+        private:
+            struct Node
+            {
+                ISolid::Ptr solid;
+                size_t hash = 0;
+                Eigen::AlignedBox3d bbox;
+            };
+
+            const Node& canonicalNode(const ISolid::Ptr& solid);
+            bool equal(const ISolid::Ptr& a, const ISolid::Ptr& b) const;
+
+            std::unordered_map<const ISolid*, Node> nodes;
+            std::unordered_multimap<size_t, ISolid::Ptr> table;
+            // Source nodes are kept alive to make sure their addresses are not reused
+            std::unordered_map<const ISolid*, std::pair<ISolid::Ptr, ISolid::Ptr>> canonical_by_source;
+            size_t shared_node_count = 0;
+        };
+    }
+}
@@ -0,0 +1,33 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct DecimationOptions
+        {
+            // Maximal distance of a vertex from planes of original triangles which are merged into it
+            double max_error = 0.01;
+            // Edge of cubic regions which are decimated independently in parallel
+            double region_size = 1.0;
+            unsigned thread_count = 0;
+        };
+
+        // Collapses edges by quadric error metrics while the error is not more than max_error.
+        // Vertices are not moved, they are only merged. Vertices of edges which are not shared by exactly two triangles
+        // are locked unless they are in the middle of a straight border, where they only slide along the border,
+        // so open borders and T-junctions of the octree mesh do not crack.
+        // Triangles are grouped into regions by their centroids, vertices on borders of regions are locked,
+        // so regions are stitched without cracks.
+        Model::Ptr decimateModel(const Model& model, const DecimationOptions& options);
+        // Decimates a mesh in the calling thread, vertices where the surface crosses the boundary of the box are locked,
+        // so meshes of adjacent boxes still match after each of them is decimated
+        Model::Ptr decimateModel(const Model& model, const Eigen::AlignedBox3d& box, double max_error);
+    }
+}
@@ -0,0 +1,81 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Inside intervals of parallel rays along one axis, rays go through centers of a 2D grid of cells.
+        // Grid axes are u = (axis + 1) % 3 and v = (axis + 2) % 3, spans keep absolute coordinates along the ray axis.
+        struct DexelGrid
+        {
+            unsigned axis = 0;
+            unsigned size_u = 0;
+            unsigned size_v = 0;
+            // Spans of ray r are spans[ray_offsets[r]] ... spans[ray_offsets[r + 1] - 1]
+            std::vector<unsigned> ray_offsets;
+            std::vector<RaySpan> spans;
+
+            size_t rayIndex(unsigned u, unsigned v) const;
+            size_t rayCount() const;
+            size_t spanBegin(size_t ray) const;
+            size_t spanEnd(size_t ray) const;
+        };
+
+        // Tri-dexel model: three dexel grids along X, Y and Z axes over the same lattice of cubic cells.
+        // It is built from a solid once, then volume, section and boolean queries do not evaluate the solid anymore.
+        struct DexelModel
+        {
+            typedef std::shared_ptr<DexelModel> Ptr;
+
+            // Minimal corner of the lattice
+            Eigen::Vector3d origin = Eigen::Vector3d::Zero();
+            double cell_size = 1.0;
+            unsigned sizes[3] = { 0, 0, 0 };
+            DexelGrid grids[3];
+
+            Eigen::AlignedBox3d box() const;
+            // Center coordinate of the cell along the axis
+            double cellCenter(unsigned axis, unsigned index) const;
+            // Booleans are possible only between models with the same lattice
+            bool isCompatible(const DexelModel& other) const;
+            // Uses the nearest ray of X grid, so it is exact along X axis only
+            bool inside(const Eigen::Vector3d& point) const;
+        };
+
+        struct MassProperties
+        {
+            double volume = 0.0;
+            Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+        };
+
+        // Planar section of a dexel model, segments are unordered pairs of points
+        struct Section
+        {
+            unsigned axis = 0;
+            double coordinate = 0.0;
+            std::vector<Eigen::Vector3d> segments;
+        };
+
+        // Rows of rays are cast in parallel
+        DexelModel::Ptr buildDexelModel(const ISolid::Ptr& solid, const Eigen::AlignedBox3d& box, double cell_size, unsigned thread_count = 0);
+        DexelModel::Ptr uniteDexelModels(const DexelModel& left, const DexelModel& right);
+        DexelModel::Ptr subtractDexelModels(const DexelModel& left, const DexelModel& right);
+        DexelModel::Ptr intersectDexelModels(const DexelModel& left, const DexelModel& right);
+        // Averages estimations of the three grids, each of them is exact along its ray axis
+        MassProperties calculateMassProperties(const DexelModel& model);
+        // Section by the plane which is orthogonal to the axis, crossings are snapped to span ends of in-plane rays
+        Section calculateSection(const DexelModel& model, unsigned axis, double coordinate);
+        // Closed mesh of the cells whose centers are inside, faces are emitted in the same way as by buildModel()
+        Model::Ptr buildDexelMesh(const DexelModel& model);
+    }
+}
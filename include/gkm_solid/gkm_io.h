@@ -0,0 +1,34 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <string>
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Scene is a text file with one node per line, operands are names of nodes of previous lines, the last node is the scene.
+        // Text after '#' is a comment. Nodes are:
+        //   empty <name>
+        //   cube <name> <half edge size>
+        //   sphere <name> <radius>
+        //   translate <name> <solid> <x> <y> <z>
+        //   union <name> <left> <right>
+        //   difference <name> <left> <right>
+        //   intersection <name> <left> <right>
+        //   multi_union <name> <solid> <solid>...
+        // Returns nullptr if the file could not be read, the error gets the line and the reason.
+        ISolid::Ptr readScene(const std::string& file_name, std::string* error = nullptr);
+        // Nodes which are shared by several operators are written once, custom solids could not be written
+        bool writeScene(const std::string& file_name, const ISolid::Ptr& solid);
+
+        // Binary STL, normals are calculated from triangles
+        bool writeStl(const std::string& file_name, const Model& model);
+        // Wavefront OBJ with positions and triangles only
+        bool writeObj(const std::string& file_name, const IndexedModel& model);
+    }
+}
@@ -0,0 +1,80 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_tape.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        class ExecutableMemory;
+
+        // Native x86-64 AVX2 code which evaluates a tape for 4 points per iteration
+        class JitKernel
+        {
+        public:
+            typedef std::shared_ptr<JitKernel> Ptr;
+
+            JitKernel(const Tape::Ptr& tape, std::unique_ptr<ExecutableMemory> code);
+            ~JitKernel();
+
+            void evaluate(const PointBatch& points, std::vector<unsigned char>& result) const;
+            const Tape::Ptr& getTape() const;
+
+        private:
+            Tape::Ptr tape;
+            std::unique_ptr<ExecutableMemory> code;
+        };
+
+        // Compiles tapes into native code without any external compiler.
+        // Compiled kernels are cached by tape hash, so identical solids are compiled only once.
+        // Kernels keep their tapes and solids, so the least recently used kernels are evicted beyond the maximal count.
+        class JitCompiler
+        {
+        public:
+            typedef std::shared_ptr<JitCompiler> Ptr;
+
+            explicit JitCompiler(size_t max_kernel_count = 16);
+
+            // Returns true if the current CPU and OS could run AVX2 kernels
+            static bool isSupported();
+
+            // Returns nullptr if the tape could not be compiled, for instance, if it has opaque leaf solids
+            JitKernel::Ptr compile(const Tape::Ptr& tape);
+            size_t getKernelCount() const;
+
+        private:
+            size_t max_kernel_count;
+            mutable std::mutex mutex;
+            // Tape hashes and kernels, the most recently used kernel is the first one
+            std::list<std::pair<size_t, JitKernel::Ptr>> recent_kernels;
+            std::unordered_multimap<size_t, std::list<std::pair<size_t, JitKernel::Ptr>>::iterator> kernels;
+        };
+
+        // Evaluates a solid by a JIT compiled kernel if it is possible, otherwise by the tape interpreter
+        class SolidEvaluator
+        {
+        public:
+            typedef std::shared_ptr<SolidEvaluator> Ptr;
+
+            SolidEvaluator(const ISolid::Ptr& solid, JitCompiler* jit_compiler = nullptr);
+
+            void evaluate(const PointBatch& points, std::vector<unsigned char>& result) const;
+            bool isCompiled() const;
+
+        private:
+            Tape::Ptr tape;
+            JitKernel::Ptr kernel;
+        };
+    }
+}
@@ -0,0 +1,33 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct MeshOptimizationOptions
+        {
+            // Number of entries of the simulated post-transform cache
+            unsigned cache_size = 16;
+            // Clusters of the vertex cache order are cut where their average cache miss ratio is this times the ratio of the whole run,
+            // for instance, 1.05. Smaller clusters are sorted better for overdraw, but vertices on their borders are transformed again.
+            // Zero disables sorting of clusters.
+            double overdraw_threshold = 0.0;
+        };
+
+        // Reorders triangles for the post-transform vertex cache by Tipsify (Sander, Nehab, Barczak 2007).
+        // If overdraw_threshold is set, the mesh is cut into clusters of the cache order,
+        // clusters facing outwards from the center of the mesh are moved first, so they occlude the other ones.
+        void optimizeTriangleOrder(IndexedModel& model, const MeshOptimizationOptions& options);
+        // Renumbers vertices in order of their first use by triangles, so vertex fetches go forward in memory
+        void optimizeVertexOrder(IndexedModel& model);
+        // Both triangle and vertex orders are optimized
+        void optimizeMesh(IndexedModel& model, const MeshOptimizationOptions& options);
+        // Number of vertex shader invocations per triangle with a FIFO cache, it is between 0.5 and 3
+        double averageCacheMissRatio(const IndexedModel& model, unsigned cache_size);
+    }
+}
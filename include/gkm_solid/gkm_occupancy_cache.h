@@ -0,0 +1,76 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Sparse sampled occupancy of a solid which replaces repeated queries to the solid tree by table lookups.
+        // The bounding box is tiled into bricks of cells, bricks away from the surface keep a single constant value,
+        // bricks of the narrow band around the surface keep occupancy at all their lattice points.
+        // Lattice lines of each brick are classified by exact ray spans, so a brick is constant only if no
+        // lattice line crosses the surface within it.
+        class OccupancyCache : public ISolid
+        {
+        public:
+            typedef std::shared_ptr<OccupancyCache> Ptr;
+
+            OccupancyCache(const ISolid::Ptr& solid, double cell_size, unsigned brick_size = 8);
+
+            // Trilinear interpolation of lattice occupancy, 1 is inside and 0 is outside.
+            // Error estimate is the cell diagonal if corners of the cell of the point disagree, otherwise it is zero.
+            // It is a heuristic, not a bound: bricks are classified by lattice lines along X axis only,
+            // so features which pass between lattice lines are missed by the cache and by the estimate.
+            double occupancy(const Eigen::Vector3d& point, double* error_estimate = nullptr) const;
+            double getCellSize() const;
+            size_t getBrickCount() const;
+            size_t getBandBrickCount() const;
+            size_t getMemorySize() const;
+
+            virtual ESolidType type() const override;
+            // Point is inside if its interpolated occupancy is at least one half
+            virtual bool inside(const Eigen::Vector3d& point) const override;
+            virtual Eigen::AlignedBox3d bbox() const override;
+            // Marches the ray through band bricks by half cell steps and skips constant bricks at once,
+            // normals are taken from the occupancy gradient
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+
+        private:
+            enum class EBrickState : unsigned char
+            {
+                Outside,
+                Inside,
+                Band
+            };
+
+            struct Brick
+            {
+                EBrickState state = EBrickState::Outside;
+                // Index of the first lattice value of the band brick
+                size_t value_offset = 0;
+            };
+
+            // Outward unit normal of the cached boundary near the point
+            Eigen::Vector3d occupancyNormal(const Eigen::Vector3d& point) const;
+            // Returns nullptr for points out of the grid, local is the point position in brick cells
+            const Brick* findBrick(const Eigen::Vector3d& point, Eigen::Vector3d& local) const;
+            Eigen::AlignedBox3d brickBox(const Eigen::Vector3d& point) const;
+
+            Eigen::AlignedBox3d solid_bbox;
+            Eigen::Vector3d origin;
+            double cell_size;
+            unsigned brick_size;
+            unsigned brick_counts[3] = { 0, 0, 0 };
+            std::vector<Brick> bricks;
+            std::vector<unsigned char> values;
+        };
+    }
+}
@@ -0,0 +1,60 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct NodeStatistics
+        {
+            uint64_t call_count = 0;
+            uint64_t true_count = 0;
+            // Inclusive evaluation time of the node including its operands
+            uint64_t nanoseconds = 0;
+
+            double averageCost() const;
+            double trueRate() const;
+        };
+
+        // Collects per-node evaluation statistics of a solid.
+        // Instrumented solid could be evaluated from several threads at once.
+        class SolidProfiler
+        {
+        public:
+            typedef std::shared_ptr<SolidProfiler> Ptr;
+
+            // Returns an equivalent solid which records statistics of each node of the source solid
+            ISolid::Ptr instrument(const ISolid::Ptr& solid);
+            // Returns false if the source node was not evaluated by an instrumented solid
+            bool getStatistics(const ISolid* source, NodeStatistics& statistics) const;
+            void reset();
+
+            struct Counters
+            {
+                std::atomic<uint64_t> call_count{ 0 };
+                std::atomic<uint64_t> true_count{ 0 };
+                std::atomic<uint64_t> nanoseconds{ 0 };
+            };
+
+        private:
+            ISolid::Ptr instrumentNode(const ISolid::Ptr& solid);
+
+            std::unordered_map<const ISolid*, std::unique_ptr<Counters>> counters;
+            std::unordered_map<const ISolid*, std::pair<ISolid::Ptr, ISolid::Ptr>> instrumented;
+        };
+
+        // Returns an equivalent solid where operands of unions and intersections are ordered
+        // by the expected cost to decide the result: cheap operands which short-circuit often go first.
+        // Nodes without statistics keep their order.
+        ISolid::Ptr reorder(const ISolid::Ptr& solid, const SolidProfiler& profiler, size_t* reordered_count = nullptr);
+    }
+}
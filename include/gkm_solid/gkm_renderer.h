@@ -0,0 +1,59 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct Camera
+        {
+            Eigen::Vector3d position = Eigen::Vector3d(0.0, 0.0, 3.0);
+            Eigen::Vector3d target = Eigen::Vector3d::Zero();
+            Eigen::Vector3d up = Eigen::Vector3d::UnitY();
+            // Vertical field of view in degrees
+            double field_of_view = 50.0;
+        };
+
+        // Camera which looks along the view direction at the center of the box and sees the whole box
+        Camera fitCamera(const Eigen::AlignedBox3d& box, const Eigen::Vector3d& view_direction, double field_of_view = 50.0);
+
+        struct RenderOptions
+        {
+            unsigned width = 256;
+            unsigned height = 256;
+            // Edge size in pixels of square tiles, rays of a tile are cast as one batch by one thread
+            unsigned tile_size = 16;
+            unsigned thread_count = 0;
+            Eigen::Vector3f color = Eigen::Vector3f(1.0f, 0.0f, 0.0f);
+            Eigen::Vector3f background = Eigen::Vector3f(0.5f, 0.5f, 0.5f);
+            // Part of the color which does not depend on the light, the light comes from the camera
+            float ambient = 0.2f;
+        };
+
+        // 8 bit RGB image, rows go from top to bottom
+        struct Image
+        {
+            typedef std::shared_ptr<Image> Ptr;
+
+            unsigned width = 0;
+            unsigned height = 0;
+            std::vector<unsigned char> pixels;
+
+            // Binary PPM (P6)
+            bool writePpm(const std::string& file_name) const;
+            // PNG with stored deflate blocks, so no compression library is needed
+            bool writePng(const std::string& file_name) const;
+        };
+
+        // Ray casts the solid without OpenGL and without meshing, tiles are rendered by worker threads
+        Image::Ptr render(const ISolid::Ptr& solid, const Camera& camera, const RenderOptions& options = RenderOptions());
+    }
+}
@@ -0,0 +1,26 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct SectionOptions
+        {
+            // Width of rows the section is sampled by, the section is exact along rows
+            double row_size = 0.1;
+            unsigned thread_count = 0;
+        };
+
+        // Caps of the solid cut by the plane, points p with plane.dot((p, 1)) >= 0 are kept as for Frustum.
+        // Rows of the plane are cast by rays in parallel, each span of a row becomes a rectangle.
+        // Triangles face the removed side, so they close the kept part of the solid.
+        Model::Ptr buildSection(const ISolid::Ptr& solid, const Eigen::Vector4d& plane, const SectionOptions& options = SectionOptions());
+    }
+}
@@ -0,0 +1,40 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        struct SimplifyReport
+        {
+            // Number of nodes which are not referenced by the simplified solid anymore
+            size_t removed_node_count = 0;
+            // Differences whose subtrahend does not touch minuend
+            size_t pruned_difference_count = 0;
+            // Differences whose subtrahend covers the whole minuend
+            size_t emptied_difference_count = 0;
+            // Intersections of disjoint operands or intersections where one operand covers another one
+            size_t folded_intersection_count = 0;
+            // Unions where one operand covers another one
+            size_t folded_union_count = 0;
+            // Operators which got an empty operand
+            size_t folded_empty_count = 0;
+            // Nested or identity transforms
+            size_t merged_transform_count = 0;
+            // Union operators which were merged into n-ary unions
+            size_t flattened_union_count = 0;
+            // Roots of the subtrees which were dropped from the solid
+            std::vector<ISolid::Ptr> removed;
+        };
+
+        // Returns an equivalent solid without provably empty or redundant branches.
+        // The source solid is not modified, unchanged subtrees are shared with the result.
+        ISolid::Ptr simplify(const ISolid::Ptr& solid, SimplifyReport* report = nullptr);
+    }
+}
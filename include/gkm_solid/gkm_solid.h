@@ -4,12 +4,62 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include "Eigen/Eigen"
 
 namespace Gkm
 {
     namespace Solid
     {
+        enum class ESolidType
+        {
+            Empty,
+            Cube,
+            Sphere,
+            Union,
+            Difference,
+            Intersection,
+            Transform,
+            MultiUnion,
+            // Solids which are opaque for solid passes, they are asked by inside() and bbox() only
+            Custom
+        };
+
+        // Structure of arrays of points for batch queries
+        struct PointBatch
+        {
+            std::vector<double> x;
+            std::vector<double> y;
+            std::vector<double> z;
+
+            size_t size() const;
+            void reserve(size_t count);
+            void clear();
+            void add(const Eigen::Vector3d& point);
+            Eigen::Vector3d point(size_t index) const;
+        };
+
+        // Closed interval of a ray parameter, ray points origin + t * direction for t in [begin, end] are inside a solid.
+        // Normals are outward normals of the surfaces which bound the span, if the span is clipped by the ray range,
+        // they are normals of the surfaces which would bound the unclipped span.
+        struct RaySpan
+        {
+            double begin = 0.0;
+            double end = 0.0;
+            Eigen::Vector3d begin_normal = Eigen::Vector3d::Zero();
+            Eigen::Vector3d end_normal = Eigen::Vector3d::Zero();
+        };
+
+        // First point where a ray enters a solid, distance is the ray parameter,
+        // so it is the Euclidean distance only for unit directions
+        struct RayHit
+        {
+            bool hit = false;
+            double distance = 0.0;
+            // Outward unit normal, it is zero if the ray starts inside the solid
+            Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+        };
+
         struct NearestPointInfo
         {
             Eigen::Vector3d point;
@@ -20,9 +70,40 @@ namespace Gkm
         {
             typedef std::shared_ptr<ISolid> Ptr;
 
+            virtual ESolidType type() const = 0;
             virtual bool inside(const Eigen::Vector3d& point) const = 0;
             virtual Eigen::AlignedBox3d bbox() const = 0;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const = 0;
+
+            // Evaluates inside() for each point of the batch, solids could override it by a vectorized version
+            virtual void insideBatch(const PointBatch& points, std::vector<unsigned char>& result) const;
+            // Calculates sorted disjoint intervals of the ray within [t_min, t_max] which are inside the solid.
+            // Spans of zero length are dropped, so classification of points exactly on the boundary could differ from inside().
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const = 0;
+            // Finds the first hit within [t_min, t_max], the hit is at t_min if the ray starts inside the solid.
+            // Default implementation takes the first ray span, operators override it to stop at the nearest operand hit.
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const;
+            // Casts a packet of rays with the same range, solids could override it to cull operands for the whole packet
+            virtual void raycastBatch(const PointBatch& origins, const PointBatch& directions, double t_min, double t_max, std::vector<RayHit>& hits) const;
+        };
+
+        // Clips [t_min, t_max] range of the ray by the box, returns false if the ray misses the box
+        bool clipRay(const Eigen::AlignedBox3d& box, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double& t_min, double& t_max);
+        void cubeRaySpans(double half_edge_size, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans);
+        void sphereRaySpans(double radius, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans);
+        // Boolean operations on sorted disjoint span sets, result should not be one of the operands
+        void uniteSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result);
+        void subtractSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result);
+        void intersectSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result);
+
+        struct EmptySolid : public ISolid
+        {
+            typedef std::shared_ptr<EmptySolid> Ptr;
+
+            virtual ESolidType type() const override;
+            virtual bool inside(const Eigen::Vector3d& point) const override;
+            virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
         };
 
         struct Cube : public ISolid
@@ -31,8 +112,10 @@ namespace Gkm
 
             double half_edge_size = 1.0;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
 
@@ -42,8 +125,10 @@ namespace Gkm
 
             double radius = 1.0;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
 
@@ -59,8 +144,11 @@ namespace Gkm
         {
             typedef std::shared_ptr<UnionOperator> Ptr;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
 
@@ -68,8 +156,11 @@ namespace Gkm
         {
             typedef std::shared_ptr<DifferenceOperator> Ptr;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
 
@@ -77,8 +168,11 @@ namespace Gkm
         {
             typedef std::shared_ptr<IntersectionOperator> Ptr;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
 
@@ -89,9 +183,33 @@ namespace Gkm
             Eigen::Vector3d translate;
             ISolid::Ptr solid;
 
+            virtual ESolidType type() const override;
             virtual bool inside(const Eigen::Vector3d& point) const override;
             virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const override;
             //virtual NearestPointInfo calcNearestPointOnBoundary(const Eigen::Vector3d& point) const override;
         };
+
+        // N-ary union which keeps bounding box of each operand to skip operands which can not contain a point.
+        // Operands should be added by add() method to keep solids and bboxes in sync.
+        struct MultiUnionOperator : public ISolid
+        {
+            typedef std::shared_ptr<MultiUnionOperator> Ptr;
+
+            std::vector<ISolid::Ptr> solids;
+            std::vector<Eigen::AlignedBox3d> bboxes;
+
+            void add(const ISolid::Ptr& solid);
+
+            virtual ESolidType type() const override;
+            virtual bool inside(const Eigen::Vector3d& point) const override;
+            virtual Eigen::AlignedBox3d bbox() const override;
+            virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const override;
+            // Operands are visited in order of their bounding box entry and skipped once the box is behind the nearest hit
+            virtual bool raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const override;
+            // Each operand is asked only by the rays of the packet which enter its bounding box before their nearest hit
+            virtual void raycastBatch(const PointBatch& origins, const PointBatch& directions, double t_min, double t_max, std::vector<RayHit>& hits) const override;
+        };
     }
 }
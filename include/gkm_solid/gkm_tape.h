@@ -0,0 +1,96 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        enum class ETapeOpCode
+        {
+            False,
+            Cube,
+            Sphere,
+            Solid,
+            Union,
+            Difference,
+            Intersection
+        };
+
+        enum class EPrecision
+        {
+            // Exact results of ISolid::inside
+            Double,
+            // Twice wider SIMD, points near the boundary could be misclassified
+            Float,
+            // Float evaluation with a conservative error band, points inside the band are re-evaluated in double,
+            // so results are the same as for Double precision
+            Mixed
+        };
+
+        struct TapeInstruction
+        {
+            ETapeOpCode op_code = ETapeOpCode::False;
+            // Operand slots of boolean operations
+            unsigned left = 0;
+            unsigned right = 0;
+            // Range of Tape offsets which are subtracted one by one from a point before leaf test
+            unsigned offset_begin = 0;
+            unsigned offset_count = 0;
+            // Half edge size of cube or radius of sphere
+            double size = 0.0;
+            // Leaf solid which is not known by the tape, it is asked point by point
+            const ISolid* solid = nullptr;
+        };
+
+        // Linear program which evaluates a solid for batches of points.
+        // Each distinct subtree placement of the solid DAG becomes exactly one instruction,
+        // so shared subtrees are evaluated only once per point of a batch.
+        class Tape
+        {
+        public:
+            typedef std::shared_ptr<Tape> Ptr;
+
+            // Number of points which are evaluated by each instruction at once
+            static constexpr size_t BLOCK_SIZE = 256;
+
+            Tape(const ISolid::Ptr& solid);
+
+            // Number of points which were re-evaluated in double precision is added to fallback_count
+            void evaluate(const PointBatch& points, std::vector<unsigned char>& result, EPrecision precision = EPrecision::Double, size_t* fallback_count = nullptr) const;
+            const std::vector<TapeInstruction>& getInstructions() const;
+            const std::vector<Eigen::Vector3d>& getOffsets() const;
+            size_t hash() const;
+
+        private:
+            struct Scratch
+            {
+                std::vector<unsigned char> slots;
+                // Possibly inside masks of Mixed precision, slots keep certainly inside masks
+                std::vector<unsigned char> upper_slots;
+                // Points and results of leaf solids which are not known by the tape
+                PointBatch solid_points;
+                std::vector<unsigned char> solid_result;
+                // Points of Mixed precision which are close to the boundary
+                PointBatch fallback_points;
+                std::vector<unsigned> fallback_indices;
+            };
+
+            template <typename Scalar>
+            void evaluateBlock(const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* result) const;
+            size_t evaluateMixedBlock(const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* result) const;
+            void evaluateSolid(const TapeInstruction& instruction, const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* output) const;
+
+            ISolid::Ptr solid;
+            std::vector<TapeInstruction> instructions;
+            std::vector<Eigen::Vector3d> offsets;
+        };
+    }
+}
@@ -3,7 +3,10 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <utility>
 #include <vector>
 #include "Eigen/Eigen"
 #include "gkm_solid/gkm_solid.h"
@@ -12,6 +15,8 @@ namespace Gkm
 {
     namespace Solid
     {
+        class JitCompiler;
+
         struct Model
         {
             typedef std::shared_ptr<Model> Ptr;
@@ -19,6 +24,174 @@ namespace Gkm
             std::vector<Eigen::Vector3f> points;
         };
 
+        // Mesh where equal vertices of triangles are shared, each three indices are a triangle
+        struct IndexedModel
+        {
+            typedef std::shared_ptr<IndexedModel> Ptr;
+
+            std::vector<Eigen::Vector3f> points;
+            std::vector<uint32_t> indices;
+        };
+
+        enum class EBuildMode
+        {
+            // Recursive subdivision of the bounding box
+            TopDown,
+            // Dense bricks of finest cells are evaluated in parallel, then the octree is assembled bottom-up
+            Bricks
+        };
+
+        // Box with its own tolerances, for instance, bow and stern of a hull
+        struct ToleranceRegion
+        {
+            Eigen::AlignedBox3d box;
+            double tolerance = 0.1;
+            // Zero keeps all boundary cells of the region at the finest size
+            double surface_tolerance = 0.0;
+        };
+
+        struct BuildOptions
+        {
+            EBuildMode mode = EBuildMode::TopDown;
+            // Cells are split until all their sizes are less than the tolerance
+            double tolerance = 0.1;
+            // Maximal deviation of the surface from planar patches, zero disables adaptive refinement.
+            // Boundary cells where the surface is flat enough are not split further and are rendered as cells clipped by planes.
+            // It is supported by top-down mode only.
+            double surface_tolerance = 0.0;
+            // Cells which intersect regions use the smallest tolerances of the options and of these regions.
+            // Surface tolerances of regions are used by top-down mode only.
+            std::vector<ToleranceRegion> regions;
+            // Memory limit of the dense lattice of finest cells of bricks mode, one byte per cell and its ancestors.
+            // If the smallest tolerance needs a larger lattice, it is clamped, see brickLatticeDepth().
+            size_t max_lattice_memory = size_t(1) << 30;
+            // Number of finest cells along an edge of a brick, it is rounded up to a power of two
+            unsigned brick_size = 16;
+            // Number of finest cells along an edge of a chunk of chunked models, it is rounded up to a power of two
+            unsigned chunk_size = 64;
+            // Number of levels of detail of each chunk
+            unsigned lod_count = 4;
+            // Chunks keep filled cells for instanced rendering instead of meshes
+            bool cell_instances = false;
+            // Maximal deviation of decimated chunk meshes, zero disables decimation.
+            // Chunks are decimated in parallel with locked borders, cell instances are not decimated.
+            double decimation_error = 0.0;
+            // Chunks keep indexed meshes instead of triangle soups, their triangles and vertices are reordered in parallel
+            // for the vertex cache, vertex fetch and overdraw, see gkm_mesh_optimizer.h
+            bool indexed_lods = false;
+            // Triangles of indexed meshes are also sorted for overdraw, zero keeps the vertex cache order, see MeshOptimizationOptions
+            double overdraw_threshold = 0.0;
+            // Bricks mode evaluates the solid by kernels of this compiler, so rebuilds of the same solid reuse its kernel cache.
+            // The caller owns it, if it is not set, the kernel is compiled for each build.
+            std::shared_ptr<JitCompiler> jit_compiler;
+            unsigned thread_count = 0;
+        };
+
+        // Filled leaf cell of the octree which is drawn as an instance of the cube
+        struct CellInstance
+        {
+            // Minimal corner in finest cells relative to the chunk box
+            uint16_t x = 0;
+            uint16_t y = 0;
+            uint16_t z = 0;
+            // Cell edge is 2^level finest cells
+            uint8_t level = 0;
+            // Bit i is set if face i is exposed, faces are ordered as for addBoxFace()
+            uint8_t face_mask = 0;
+        };
+
+        // Part of a chunked model, its meshes are closed, so chunks of different levels of detail do not have cracks between them
+        struct ModelChunk
+        {
+            Eigen::AlignedBox3d box;
+            Eigen::Vector3d cell_size = Eigen::Vector3d::Ones();
+            // lods[0] is the finest mesh, cells of lods[l] are 2^l times bigger
+            std::vector<Model::Ptr> lods;
+            // Indexed meshes of each level of detail, they are built instead of lods if BuildOptions::indexed_lods is set
+            std::vector<IndexedModel::Ptr> indexed_lods;
+            // Cells of each level of detail, they are built instead of meshes if BuildOptions::cell_instances is set
+            std::vector<std::vector<CellInstance>> instance_lods;
+            // Cell diagonal of each level of detail plus the decimation error, it bounds the deviation of the mesh from the surface
+            std::vector<double> errors;
+            // Hash of meshes or cells of all levels of detail, it is computed when the chunk is built
+            uint64_t content_hash = 0;
+        };
+
+        struct ChunkedModel
+        {
+            typedef std::shared_ptr<ChunkedModel> Ptr;
+
+            std::vector<ModelChunk> chunks;
+        };
+
+        // Difference between two chunked models, a chunk which is replaced is both removed and added
+        struct ChunkedModelDelta
+        {
+            // Indices of previous chunks which are not in the current model
+            std::vector<size_t> removed;
+            // Indices of current chunks which are not in the previous model
+            std::vector<size_t> added;
+            // Indices of previous and current chunks which are the same
+            std::vector<std::pair<size_t, size_t>> kept;
+        };
+
+        // Mesh with positions quantized to 16 bits per coordinate relative to a box, position = offset + scale * quantized.
+        // Box is divided into 2^15 steps along each axis, so vertices of octree cells of the box are exact.
+        struct QuantizedModel
+        {
+            typedef std::shared_ptr<QuantizedModel> Ptr;
+
+            static constexpr unsigned STEP_COUNT = 32768;
+
+            Eigen::Vector3f offset = Eigen::Vector3f::Zero();
+            Eigen::Vector3f scale = Eigen::Vector3f::Ones();
+            // Three values per vertex
+            std::vector<uint16_t> positions;
+
+            size_t vertexCount() const;
+            Eigen::Vector3f position(size_t index) const;
+        };
+
+        QuantizedModel::Ptr quantizeModel(const Model& model, const Eigen::AlignedBox3d& box);
+
+        // Vertices are merged if their positions are bitwise equal, triangles keep their order
+        IndexedModel::Ptr buildIndexedModel(const Model& model);
+        // Octahedral encoding of a unit normal to two 16 bit values
+        uint32_t packNormal(const Eigen::Vector3f& normal);
+        Eigen::Vector3f unpackNormal(uint32_t packed_normal);
+
+        // Six planes of a view volume, points p with plane.dot((p, 1)) >= 0 are on the inner side of a plane
+        struct Frustum
+        {
+            Eigen::Vector4d planes[6];
+
+            // Conservative test, some boxes which are near frustum corners are reported as intersecting
+            bool intersects(const Eigen::AlignedBox3d& box) const;
+        };
+
+        // Extracts planes from the view projection matrix with OpenGL clip space conventions
+        Frustum makeFrustum(const Eigen::Matrix4d& view_projection);
+
+        // Adds two triangles of the box face, faces are ordered as -X, +X, -Y, +Y, -Z, +Z
+        void addBoxFace(Model& model, const Eigen::AlignedBox3d& box, unsigned face);
+        // Adds exposed faces of cells of the chunk
+        void addCellInstances(Model& model, const ModelChunk& chunk, const std::vector<CellInstance>& instances);
+
         Model::Ptr buildModel(const ISolid::Ptr& solid);
+        Model::Ptr buildModel(const ISolid::Ptr& solid, const BuildOptions& options);
+        // Finest cells of bricks mode are 2^-depth parts of the box. Depth is chosen by the smallest tolerance of the options
+        // and of the regions which intersect the box. If the lattice does not fit max_lattice_memory, it is the deepest lattice
+        // which fits, its cells are larger than the tolerance and clamped_tolerance gets their size, otherwise it gets zero.
+        unsigned brickLatticeDepth(const Eigen::AlignedBox3d& box, const BuildOptions& options, double* clamped_tolerance = nullptr);
+        // Builds the brick octree as Bricks mode does and meshes each chunk at all levels of detail, the mode option is ignored.
+        // Finest cells are cubes of the largest power of two size which is less than the tolerance, and chunks are aligned
+        // to multiples of their size from the world origin, so chunks which an edit does not touch keep their boxes.
+        ChunkedModel::Ptr buildChunkedModel(const ISolid::Ptr& solid, const BuildOptions& options);
+        // Chunks are matched by their boxes and content hashes, so meshes may be already released.
+        // Chunks are replaced if the tolerance changes or a larger bounding box coarsens cells to fit max_lattice_memory.
+        ChunkedModelDelta diffChunkedModels(const ChunkedModel& previous, const ChunkedModel& current);
+        // Coarsest level of detail whose error projected to the screen is not more than max_pixel_error.
+        // Projection scale is the number of pixels per unit length at unit distance from the viewer.
+        unsigned selectLod(const ModelChunk& chunk, const Eigen::Vector3d& viewer_position, double projection_scale, double max_pixel_error);
     }
 }
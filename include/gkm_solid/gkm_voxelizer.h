@@ -0,0 +1,41 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Eigen/Eigen"
+#include "gkm_solid/gkm_solid.h"
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Dense grid of cells, a cell is inside if its center is inside a solid
+        struct VoxelGrid
+        {
+            typedef std::shared_ptr<VoxelGrid> Ptr;
+
+            // Minimal corner of the grid
+            Eigen::Vector3d origin = Eigen::Vector3d::Zero();
+            double cell_size = 1.0;
+            unsigned size_x = 0;
+            unsigned size_y = 0;
+            unsigned size_z = 0;
+            // X index changes fastest
+            std::vector<unsigned char> cells;
+
+            size_t index(unsigned x, unsigned y, unsigned z) const;
+            bool inside(unsigned x, unsigned y, unsigned z) const;
+            Eigen::Vector3d cellCenter(unsigned x, unsigned y, unsigned z) const;
+            size_t insideCount() const;
+        };
+
+        // Classifies whole rows of cells along X axis by one ISolid::raySpans() call per row
+        VoxelGrid::Ptr voxelize(const ISolid::Ptr& solid, const Eigen::AlignedBox3d& box, double cell_size);
+        // Integrates lengths of spans of rays along X axis which go through centers of YZ grid cells with the given step
+        double calculateVolume(const ISolid::Ptr& solid, double step);
+    }
+}
@@ -0,0 +1,57 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <vector>
+#include <QOpenGLBuffer>
+
+// Vertex or index data of many meshes is sub-allocated from a few big buffers (pages),
+// so meshes are replaced one by one without reallocation of other ones.
+// Blocks are taken by the best fit and freed blocks are merged with free neighbours to keep pages unfragmented.
+// All methods require the current OpenGL context.
+class GpuBufferHeap
+{
+public:
+    struct Allocation
+    {
+        size_t page = 0;
+        size_t offset = 0;
+        // Zero for empty allocations which have no storage
+        size_t size = 0;
+    };
+
+    GpuBufferHeap(size_t page_size = 4 * 1024 * 1024, size_t alignment = 16, QOpenGLBuffer::Type type = QOpenGLBuffer::VertexBuffer);
+
+    // Takes a block and uploads the data into it by glBufferSubData, data bigger than a page gets its own page
+    Allocation allocate(const void* data, size_t size);
+    void free(const Allocation& allocation);
+    // Releases all pages
+    void clear();
+    QOpenGLBuffer& buffer(const Allocation& allocation);
+
+    size_t getPageCount() const;
+    // Bytes of all pages
+    size_t getCapacity() const;
+    // Bytes uploaded since the last reset
+    size_t getUploadedSize() const;
+    void resetUploadedSize();
+
+private:
+    struct Page
+    {
+        std::unique_ptr<QOpenGLBuffer> buffer;
+        size_t size = 0;
+        // Offsets and sizes of free blocks
+        std::map<size_t, size_t> free_blocks;
+    };
+
+    size_t page_size;
+    size_t alignment;
+    QOpenGLBuffer::Type type;
+    std::vector<Page> pages;
+    size_t uploaded_size = 0;
+};
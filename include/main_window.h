@@ -4,7 +4,9 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 #include <QObject>
+#include <QPointer>
 #include <QMainWindow>
 #include <QFileDialog>
 #include <QMessageBox>
@@ -26,16 +28,32 @@ class MainWindow : public QMainWindow
 public:
     MainWindow();
     Gkm::Solid::ISolid::Ptr getSolid() const;
+    // Replaces the solid and updates all 3D views
+    void setSolid(const Gkm::Solid::ISolid::Ptr& new_solid);
+    // Opens one more 3D view of the shared scene
+    QMdiSubWindow* addView3D();
+    // Filled cells are drawn as instances of the unit cube instead of decimated meshes, it is off by default
+    void setCellInstances(bool enabled);
 
 protected:
     void showEvent(QShowEvent* event) override;
 
 private:
+    void openScene();
+    // Subtracts a small sphere at a random point of the bounding box, only chunks around it are uploaded again
+    void drillRandomHole();
+
     bool first_show = true;
     Ui::MainWindow main_window;
 
-    View3DWidget* view_3d_widget = nullptr;
+    // Views own the shared scene, so its buffers are released by the last closed view while its context is current.
+    // A view which is opened after that creates a new scene.
+    std::weak_ptr<View3DScene> view_3d_scene;
+    // Views are deleted when their subwindows are closed
+    std::vector<QPointer<View3DWidget>> view_3d_widgets;
     QMdiSubWindow* view_3d_window = nullptr;
+    unsigned view_3d_window_count = 0;
+    bool cell_instances = false;
     QPlainTextEdit* log_view = nullptr;
     QMdiSubWindow* log_window = nullptr;
     Gkm::Solid::ISolid::Ptr solid = nullptr;
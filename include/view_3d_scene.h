@@ -0,0 +1,108 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <QOpenGLContext>
+#include <QOpenGLBuffer>
+#include <QVector3D>
+#include "gkm_solid/gkm_visualizer.h"
+#include "gkm_solid/gkm_bvh.h"
+#include "gkm_solid/gkm_jit.h"
+#include "gpu_buffer_heap.h"
+
+// Model of the solid and its vertex buffers which are shared by all 3D views, only cameras differ per view.
+// OpenGL contexts of views are shared (Qt::AA_ShareOpenGLContexts), so buffers are used by any view.
+class View3DScene
+{
+public:
+    typedef std::shared_ptr<View3DScene> Ptr;
+
+    // Vertices of a level of detail in the buffer of its chunk, for indexed meshes they are indices in the index buffer of the chunk
+    struct LodRange
+    {
+        GLint first = 0;
+        GLsizei count = 0;
+        // Offset of vertices of an indexed mesh from the start of the chunk block, indices of each level of detail start from zero
+        size_t vertex_offset = 0;
+    };
+
+    // All levels of detail of a chunk are kept in one block of the buffer heap.
+    // Vertices are 16 bit positions quantized relative to the chunk box, the vertex shader dequantizes them.
+    // If cell instances are drawn, the buffer keeps cell instances and ranges are ranges of instances.
+    struct ChunkBuffer
+    {
+        GpuBufferHeap::Allocation allocation;
+        // Block of the index heap, it is empty if meshes are not indexed
+        GpuBufferHeap::Allocation index_allocation;
+        // 16 bit indices are used if each level of detail has not more than 65536 vertices
+        GLenum index_type = GL_UNSIGNED_SHORT;
+        std::vector<LodRange> lods;
+        QVector3D position_offset;
+        // Scale of normalized attribute values, it is the quantization step multiplied by 65535.
+        // For cell instances it is the size of the finest cell.
+        QVector3D position_scale;
+    };
+
+    // Detects instancing and 32 bit index support, it does nothing if the scene is already initialized.
+    // Requires the current OpenGL context, as all methods which change buffers do.
+    void initialize(QOpenGLContext* context);
+    // Filled cells are drawn as instances of the unit cube instead of meshes if the context supports instancing.
+    // It is off by default, because cells have no decimated and indexed levels of detail.
+    // A change releases all chunks, the next load() rebuilds the model. It could be called before initialize().
+    void setCellInstances(bool enabled);
+    // Builds the model of the solid and the picking hierarchy without OpenGL calls, the same solid is not rebuilt.
+    // The built model is drawn after upload().
+    void build(const Gkm::Solid::ISolid::Ptr& solid);
+    // Uploads only chunks of the built model which are changed
+    void upload();
+    // build() and upload()
+    void load(const Gkm::Solid::ISolid::Ptr& solid);
+
+    bool isInitialized() const;
+    // Cell instances are requested and the context supports instancing (OpenGL 3.3 or OpenGL ES 3.0)
+    bool hasCellInstances() const;
+    // Simplified and canonicalized solid
+    Gkm::Solid::ISolid::Ptr getSolid() const;
+    // Uploaded model, only boxes, errors and hashes of its chunks are kept
+    Gkm::Solid::ChunkedModel::Ptr getModel() const;
+    // Model which is built and not uploaded yet with all levels of detail, nullptr after upload()
+    Gkm::Solid::ChunkedModel::Ptr getBuiltModel() const;
+    // Element c keeps chunk c of the model
+    const std::vector<ChunkBuffer>& getChunkBuffers() const;
+    // Hierarchy over the finest level of detail of all chunks, triangles are tagged by indices of parts
+    Gkm::Solid::MeshBvh::Ptr getBvh() const;
+    const std::vector<Gkm::Solid::ISolid::Ptr>& getParts() const;
+    GpuBufferHeap& getBufferHeap();
+    // Indices of chunk meshes, meshes are indexed unless cell instances are drawn or the context lacks 32 bit indices (OpenGL ES 2.0)
+    GpuBufferHeap& getIndexHeap();
+    // 36 vertices of the unit cube, each vertex is its corner and the index of its face
+    QOpenGLBuffer& getCubeBuffer();
+
+private:
+    ChunkBuffer uploadChunk(const Gkm::Solid::ModelChunk& chunk);
+    // Applies the requested cell instances to the initialized scene
+    void updateCellInstances();
+
+    bool initialized = false;
+    bool cell_instances_requested = false;
+    bool instancing_supported = false;
+    bool uint_indices_supported = false;
+    bool cell_instances = false;
+    bool indexed_meshes = false;
+    // Solid which is loaded as it is given by the caller
+    Gkm::Solid::ISolid::Ptr source_solid = nullptr;
+    Gkm::Solid::ISolid::Ptr solid = nullptr;
+    Gkm::Solid::ChunkedModel::Ptr model = nullptr;
+    Gkm::Solid::ChunkedModel::Ptr built_model = nullptr;
+    std::vector<ChunkBuffer> chunk_buffers;
+    Gkm::Solid::MeshBvh::Ptr bvh = nullptr;
+    std::vector<Gkm::Solid::ISolid::Ptr> parts;
+    GpuBufferHeap buffer_heap;
+    GpuBufferHeap index_heap{ 4 * 1024 * 1024, 16, QOpenGLBuffer::IndexBuffer };
+    std::unique_ptr<QOpenGLBuffer> cube_vbo;
+    // Kernels of recently built solids, for instance, of a solid which is edited back
+    Gkm::Solid::JitCompiler::Ptr jit_compiler = std::make_shared<Gkm::Solid::JitCompiler>();
+};
@@ -12,14 +12,22 @@
 #include <QOpenGLTexture>
 #include <QOpenGLBuffer>
 #include <QVector3D>
+#include <QMatrix4x4>
 #include "gkm_solid/gkm_visualizer.h"
+#include "chunk_renderer.h"
+#include "view_3d_scene.h"
 
 class View3DWidget : public QOpenGLWidget, protected QOpenGLFunctions
 {
     Q_OBJECT
 
 public:
-    View3DWidget(QWidget *parent);
+    View3DWidget(QWidget *parent, const View3DScene::Ptr& scene);
+    ~View3DWidget();
+    // Loads the solid of the main window into the shared scene, only changed chunks are uploaded
+    void updateSolid();
+    // Switches cell instances of the shared scene and rebuilds it, other views follow the scene when they are painted
+    void setCellInstances(bool enabled);
 
 protected:
     void initializeGL() override;
@@ -27,16 +35,43 @@ protected:
     void mouseMoveEvent(QMouseEvent* event) override;
     void mousePressEvent(QMouseEvent* event) override;
     void mouseReleaseEvent(QMouseEvent* event) override;
+    // Picks a point of the solid under the cursor and makes it the center of rotation
+    void mouseDoubleClickEvent(QMouseEvent* event) override;
     void wheelEvent(QWheelEvent* event) override;
+    // X, Y and Z keys toggle the section plane orthogonal to the axis
+    void keyPressEvent(QKeyEvent* event) override;
 
 private:
     void setDefaultCamera();
+    QMatrix4x4 getViewProjectionMatrix() const;
+    // Ray through the cursor from the near clipping plane (t = 0) to the far one (t = 1)
+    void getCursorRay(const QPointF& position, Eigen::Vector3d& origin, Eigen::Vector3d& direction) const;
+    // Uploads triangles of the part as the highlight mesh, negative part clears it
+    void setHoveredPart(int part);
+    // Plane of the section in the form of Frustum planes, the kept side is positive.
+    // If the section is disabled, the plane keeps everything.
+    Eigen::Vector4d getSectionPlane() const;
+    // Rebuilds caps of the section, rows are coarser while the plane is dragged
+    void updateSection(bool dragging);
+    // Raycasts the picking hierarchy along the cursor ray, the part of the ray on the removed side of the section plane is skipped
+    bool pick(const QPointF& position, Eigen::Vector3d& point, Gkm::Solid::MeshRayHit& hit) const;
 
 private:
-    Gkm::Solid::Model::Ptr model = nullptr;
+    View3DScene::Ptr scene;
+    std::unique_ptr<ChunkRenderer> renderer;
+    // Flat colored triangles, they are the highlight and caps of the section
+    std::unique_ptr<QOpenGLShaderProgram> flat_program;
+    // Hovered part is drawn over the model by its finest triangles
+    std::unique_ptr<QOpenGLBuffer> highlight_vbo;
+    GLsizei highlight_vertex_count = 0;
+    int hovered_part = -1;
 
-    std::unique_ptr<QOpenGLShaderProgram> program;
-    QOpenGLBuffer vbo;
+    // Model is clipped by the plane orthogonal to the section axis, the clipped side is closed by caps
+    bool section_enabled = false;
+    int section_axis = 0;
+    double section_offset = 0.0;
+    std::unique_ptr<QOpenGLBuffer> section_vbo;
+    GLsizei section_vertex_count = 0;
 
     QVector3D viewer_pos;
     QVector3D viewer_target;
@@ -51,5 +86,7 @@ private:
     double rotation_radius = 10.0;
     bool left_mouse_pressed = false;
     bool right_mouse_pressed = false;
+    // Middle mouse button drags the section plane
+    bool middle_mouse_pressed = false;
     QPointF previous_point;
 };
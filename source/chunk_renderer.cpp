@@ -0,0 +1,181 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <QVector4D>
+#include "chunk_renderer.h"
+
+void ChunkRenderer::initialize(bool cell_instances_)
+{
+    initializeOpenGLFunctions();
+    cell_instances = cell_instances_;
+
+    // Faces of cells which are not exposed are collapsed to a point out of the view volume, so they are not rasterized
+    const char* vsrc = cell_instances ?
+        "attribute highp vec3 vertex;\n"
+        "attribute highp float face;\n"
+        "attribute highp vec3 cell_position;\n"
+        "attribute highp vec2 cell_info;\n"
+        "uniform mediump mat4 matrix;\n"
+        "uniform highp vec3 position_offset;\n"
+        "uniform highp vec3 position_scale;\n"
+        "uniform highp vec4 clip_plane;\n"
+        "varying highp float clip_distance;\n"
+        "void main(void)\n"
+        "{\n"
+        "    float exposed = mod(floor(cell_info.y / exp2(face)), 2.0);\n"
+        "    vec3 position = position_offset + position_scale * (cell_position + vertex * exp2(cell_info.x));\n"
+        "    clip_distance = dot(clip_plane, vec4(position, 1.0));\n"
+        "    gl_Position = exposed > 0.5 ? matrix * vec4(position, 1.0) : vec4(2.0, 2.0, 2.0, 1.0);\n"
+        "}\n" :
+        "attribute highp vec3 vertex;\n"
+        "uniform mediump mat4 matrix;\n"
+        "uniform highp vec3 position_offset;\n"
+        "uniform highp vec3 position_scale;\n"
+        "uniform highp vec4 clip_plane;\n"
+        "varying highp float clip_distance;\n"
+        "void main(void)\n"
+        "{\n"
+        "    vec3 position = position_offset + position_scale * vertex;\n"
+        "    clip_distance = dot(clip_plane, vec4(position, 1.0));\n"
+        "    gl_Position = matrix * vec4(position, 1.0);\n"
+        "}\n";
+    // Fragments on the removed side of the section plane are discarded
+    const char* fsrc =
+        "varying highp float clip_distance;\n"
+        "void main(void)\n"
+        "{\n"
+        "    if (clip_distance < 0.0)\n"
+        "        discard;\n"
+        "    gl_FragColor = vec4(1.0, 0.0, 0.0, 1.0);\n"
+        "}\n";
+
+    program = std::make_unique<QOpenGLShaderProgram>();
+    program->addShaderFromSourceCode(QOpenGLShader::Vertex, vsrc);
+    program->addShaderFromSourceCode(QOpenGLShader::Fragment, fsrc);
+    program->bindAttributeLocation("vertex", PROGRAM_VERTEX_ATTRIBUTE);
+    if (cell_instances)
+    {
+        program->bindAttributeLocation("face", PROGRAM_FACE_ATTRIBUTE);
+        program->bindAttributeLocation("cell_position", PROGRAM_CELL_POSITION_ATTRIBUTE);
+        program->bindAttributeLocation("cell_info", PROGRAM_CELL_INFO_ATTRIBUTE);
+    }
+    program->link();
+}
+
+QOpenGLShaderProgram& ChunkRenderer::getProgram()
+{
+    assert(program);
+    return *program;
+}
+
+size_t ChunkRenderer::draw(View3DScene& scene, const QMatrix4x4& view_projection, const Eigen::Vector3d& viewer_position,
+    double projection_scale, double max_pixel_error, const Eigen::Vector4d& clip_plane)
+{
+    assert(program);
+    if (scene.hasCellInstances() != cell_instances)
+    {
+        // Cell instances of the shared scene are switched by another view
+        initialize(scene.hasCellInstances());
+    }
+    const Gkm::Solid::ChunkedModel::Ptr model = scene.getModel();
+    if (!model)
+    {
+        return 0;
+    }
+    const std::vector<View3DScene::ChunkBuffer>& chunk_buffers = scene.getChunkBuffers();
+    GpuBufferHeap& buffer_heap = scene.getBufferHeap();
+    GpuBufferHeap& index_heap = scene.getIndexHeap();
+    program->bind();
+    program->setUniformValue("matrix", view_projection);
+    program->setUniformValue("clip_plane", QVector4D(static_cast<float>(clip_plane.x()), static_cast<float>(clip_plane.y()),
+        static_cast<float>(clip_plane.z()), static_cast<float>(clip_plane.w())));
+    program->enableAttributeArray(PROGRAM_VERTEX_ATTRIBUTE);
+    if (cell_instances)
+    {
+        // Cube vertices are shared by all instances, cell attributes advance once per instance
+        scene.getCubeBuffer().bind();
+        program->setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_FLOAT, 0, 3, 4 * sizeof(float));
+        program->setAttributeBuffer(PROGRAM_FACE_ATTRIBUTE, GL_FLOAT, 3 * sizeof(float), 1, 4 * sizeof(float));
+        program->enableAttributeArray(PROGRAM_FACE_ATTRIBUTE);
+        program->enableAttributeArray(PROGRAM_CELL_POSITION_ATTRIBUTE);
+        program->enableAttributeArray(PROGRAM_CELL_INFO_ATTRIBUTE);
+        glVertexAttribDivisor(PROGRAM_CELL_POSITION_ATTRIBUTE, 1);
+        glVertexAttribDivisor(PROGRAM_CELL_INFO_ATTRIBUTE, 1);
+    }
+
+    // Chunks out of the view frustum are culled, the visible ones are drawn front to back,
+    // so the depth test rejects fragments of farther chunks early
+    const Gkm::Solid::Frustum frustum = Gkm::Solid::makeFrustum(Eigen::Map<const Eigen::Matrix4f>(view_projection.constData()).cast<double>());
+    const Eigen::Vector3d clip_normal = clip_plane.head<3>();
+    visible_chunks.clear();
+    for (size_t i = 0; i < model->chunks.size(); ++i)
+    {
+        const Eigen::AlignedBox3d& box = model->chunks[i].box;
+        // Chunks on the removed side of the clip plane are skipped as a whole
+        const bool clipped = clip_normal.dot(box.center()) + clip_normal.cwiseAbs().dot(0.5 * box.sizes()) + clip_plane.w() < 0.0;
+        if (!clipped && frustum.intersects(box))
+        {
+            visible_chunks.emplace_back(box.exteriorDistance(viewer_position), i);
+        }
+    }
+    std::sort(visible_chunks.begin(), visible_chunks.end());
+
+    size_t triangle_count = 0;
+    for (auto& visible_chunk : visible_chunks)
+    {
+        const size_t i = visible_chunk.second;
+        const unsigned lod = Gkm::Solid::selectLod(model->chunks[i], viewer_position, projection_scale, max_pixel_error);
+        const View3DScene::ChunkBuffer& chunk_buffer = chunk_buffers[i];
+        if (lod >= chunk_buffer.lods.size() || chunk_buffer.lods[lod].count == 0)
+        {
+            continue;
+        }
+        const View3DScene::LodRange& range = chunk_buffer.lods[lod];
+        buffer_heap.buffer(chunk_buffer.allocation).bind();
+        program->setUniformValue("position_offset", chunk_buffer.position_offset);
+        program->setUniformValue("position_scale", chunk_buffer.position_scale);
+        if (cell_instances)
+        {
+            // Integer attributes are converted to floats without normalization
+            const size_t first = chunk_buffer.allocation.offset + static_cast<size_t>(range.first) * sizeof(Gkm::Solid::CellInstance);
+            glVertexAttribPointer(PROGRAM_CELL_POSITION_ATTRIBUTE, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(Gkm::Solid::CellInstance),
+                reinterpret_cast<const void*>(first + offsetof(Gkm::Solid::CellInstance, x)));
+            glVertexAttribPointer(PROGRAM_CELL_INFO_ATTRIBUTE, 2, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(Gkm::Solid::CellInstance),
+                reinterpret_cast<const void*>(first + offsetof(Gkm::Solid::CellInstance, level)));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, 36, range.count);
+            // Hidden faces are collapsed in the vertex shader, but they are still submitted
+            triangle_count += static_cast<size_t>(range.count) * 12;
+        }
+        else
+        {
+            // Normalized attribute values are quantized positions divided by 65535
+            program->setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_UNSIGNED_SHORT, static_cast<int>(chunk_buffer.allocation.offset + range.vertex_offset), 3, 3 * sizeof(uint16_t));
+            if (chunk_buffer.index_allocation.size > 0)
+            {
+                index_heap.buffer(chunk_buffer.index_allocation).bind();
+                const size_t index_size = chunk_buffer.index_type == GL_UNSIGNED_INT ? sizeof(uint32_t) : sizeof(uint16_t);
+                glDrawElements(GL_TRIANGLES, range.count, chunk_buffer.index_type,
+                    reinterpret_cast<const void*>(chunk_buffer.index_allocation.offset + static_cast<size_t>(range.first) * index_size));
+            }
+            else
+            {
+                glDrawArrays(GL_TRIANGLES, range.first, range.count);
+            }
+            triangle_count += static_cast<size_t>(range.count) / 3;
+        }
+    }
+
+    // Divisors are a state of attribute locations, other programs would get per instance attributes otherwise
+    if (cell_instances)
+    {
+        glVertexAttribDivisor(PROGRAM_CELL_POSITION_ATTRIBUTE, 0);
+        glVertexAttribDivisor(PROGRAM_CELL_INFO_ATTRIBUTE, 0);
+        program->disableAttributeArray(PROGRAM_FACE_ATTRIBUTE);
+        program->disableAttributeArray(PROGRAM_CELL_POSITION_ATTRIBUTE);
+        program->disableAttributeArray(PROGRAM_CELL_INFO_ATTRIBUTE);
+    }
+    return triangle_count;
+}
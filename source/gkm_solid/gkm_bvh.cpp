@@ -0,0 +1,598 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include "gkm_solid/gkm_bvh.h"
+#include "gkm_parallel.h"
+
+namespace
+{
+    constexpr unsigned BIN_COUNT = 16;
+    // Cost of visiting a node relative to the cost of a triangle test
+    constexpr float TRAVERSAL_COST = 1.0f;
+    // Leaves which are cheaper than any split are still split if they have more triangles
+    constexpr unsigned MAX_LEAF_SIZE = 16;
+    // Deeper nodes are not split, so the traversal stack never overflows
+    constexpr unsigned MAX_TREE_DEPTH = 62;
+    constexpr unsigned MAX_STACK_SIZE = MAX_TREE_DEPTH + 2;
+    // Triangles are handed out to tagging threads in blocks
+    constexpr size_t TAG_BLOCK_SIZE = 4096;
+
+    float halfArea(const Eigen::AlignedBox3f& box)
+    {
+        if (box.isEmpty())
+        {
+            return 0.0f;
+        }
+        const Eigen::Vector3f sizes = box.sizes();
+        return sizes.x() * sizes.y() + sizes.y() * sizes.z() + sizes.z() * sizes.x();
+    }
+
+    // Entry parameter of the ray into the box or infinity if the ray misses the box within [t_min, t_max]
+    double enterBox(const Eigen::AlignedBox3f& box, const Eigen::Vector3d& origin, const Eigen::Vector3d& inverse_direction, double t_min, double t_max)
+    {
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            double t0 = (box.min()[axis] - origin[axis]) * inverse_direction[axis];
+            double t1 = (box.max()[axis] - origin[axis]) * inverse_direction[axis];
+            if (t0 > t1)
+            {
+                std::swap(t0, t1);
+            }
+            // NaN of a zero direction with the origin on the slab border keeps the interval
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+            if (t_min > t_max)
+            {
+                return std::numeric_limits<double>::infinity();
+            }
+        }
+        return t_min;
+    }
+
+    class BvhBuilder
+    {
+    public:
+        struct Task
+        {
+            uint32_t node = 0;
+            uint32_t begin = 0;
+            uint32_t end = 0;
+            unsigned depth = 0;
+        };
+
+        BvhBuilder(const std::vector<Eigen::AlignedBox3f>& triangle_boxes_, const std::vector<Eigen::Vector3f>& centroids_, std::vector<uint32_t>& order_, unsigned leaf_size_) :
+            triangle_boxes(triangle_boxes_), centroids(centroids_), order(order_), leaf_size(std::max(leaf_size_, 1u))
+        {
+        }
+
+        // Subtrees with at most task_size triangles are not built but recorded as tasks, if tasks are given
+        void build(std::vector<Gkm::Solid::MeshBvh::Node>& nodes, uint32_t node_index, uint32_t begin, uint32_t end, unsigned depth, std::vector<Task>* tasks, uint32_t task_size) const;
+
+    private:
+        const std::vector<Eigen::AlignedBox3f>& triangle_boxes;
+        const std::vector<Eigen::Vector3f>& centroids;
+        std::vector<uint32_t>& order;
+        unsigned leaf_size;
+    };
+
+    void BvhBuilder::build(std::vector<Gkm::Solid::MeshBvh::Node>& nodes, uint32_t node_index, uint32_t begin, uint32_t end, unsigned depth, std::vector<Task>* tasks, uint32_t task_size) const
+    {
+        Eigen::AlignedBox3f box;
+        Eigen::AlignedBox3f centroid_box;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            box.extend(triangle_boxes[order[i]]);
+            centroid_box.extend(centroids[order[i]]);
+        }
+        nodes[node_index].box = box;
+        const uint32_t count = end - begin;
+        if (tasks && count <= task_size)
+        {
+            Task task;
+            task.node = node_index;
+            task.begin = begin;
+            task.end = end;
+            task.depth = depth;
+            tasks->push_back(task);
+            return;
+        }
+        if (count <= leaf_size || depth >= MAX_TREE_DEPTH)
+        {
+            nodes[node_index].first = begin;
+            nodes[node_index].count = count;
+            return;
+        }
+
+        // Binned surface area heuristic over all axes
+        float best_cost = std::numeric_limits<float>::infinity();
+        unsigned best_axis = 0;
+        unsigned best_split = 0;
+        const Eigen::Vector3f extent = centroid_box.sizes();
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            if (!(extent[axis] > 0.0f))
+            {
+                continue;
+            }
+            Eigen::AlignedBox3f bin_boxes[BIN_COUNT];
+            uint32_t bin_counts[BIN_COUNT] = {};
+            const float scale = BIN_COUNT / extent[axis];
+            for (uint32_t i = begin; i < end; ++i)
+            {
+                const unsigned bin = std::min(static_cast<unsigned>((centroids[order[i]][axis] - centroid_box.min()[axis]) * scale), BIN_COUNT - 1);
+                bin_boxes[bin].extend(triangle_boxes[order[i]]);
+                ++bin_counts[bin];
+            }
+            // Right sides are accumulated first, then splits are swept from the left
+            float right_areas[BIN_COUNT];
+            uint32_t right_counts[BIN_COUNT];
+            Eigen::AlignedBox3f right_box;
+            uint32_t right_count = 0;
+            for (unsigned bin = BIN_COUNT - 1; bin > 0; --bin)
+            {
+                right_box.extend(bin_boxes[bin]);
+                right_count += bin_counts[bin];
+                right_areas[bin] = halfArea(right_box);
+                right_counts[bin] = right_count;
+            }
+            Eigen::AlignedBox3f left_box;
+            uint32_t left_count = 0;
+            for (unsigned split = 1; split < BIN_COUNT; ++split)
+            {
+                left_box.extend(bin_boxes[split - 1]);
+                left_count += bin_counts[split - 1];
+                if (left_count == 0 || right_counts[split] == 0)
+                {
+                    continue;
+                }
+                const float cost = halfArea(left_box) * left_count + right_areas[split] * right_counts[split];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = split;
+                }
+            }
+        }
+
+        uint32_t middle = begin;
+        if (best_split > 0)
+        {
+            const float leaf_cost = static_cast<float>(count);
+            const float area = halfArea(box);
+            if (count <= MAX_LEAF_SIZE && (area <= 0.0f || TRAVERSAL_COST + best_cost / area >= leaf_cost))
+            {
+                nodes[node_index].first = begin;
+                nodes[node_index].count = count;
+                return;
+            }
+            const float scale = BIN_COUNT / extent[best_axis];
+            const float min = centroid_box.min()[best_axis];
+            middle = static_cast<uint32_t>(std::partition(order.begin() + begin, order.begin() + end, [&](uint32_t triangle)
+            {
+                return std::min(static_cast<unsigned>((centroids[triangle][best_axis] - min) * scale), BIN_COUNT - 1) < best_split;
+            }) - order.begin());
+        }
+        if (middle == begin || middle == end)
+        {
+            // All centroids coincide, triangles are halved as they are
+            middle = begin + count / 2;
+        }
+
+        const uint32_t left = static_cast<uint32_t>(nodes.size());
+        nodes.resize(nodes.size() + 2);
+        nodes[node_index].first = left;
+        nodes[node_index].count = 0;
+        build(nodes, left, begin, middle, depth + 1, tasks, task_size);
+        build(nodes, left + 1, middle, end, depth + 1, tasks, task_size);
+    }
+}
+
+Gkm::Solid::MeshBvh::MeshBvh(const Model& model, const std::vector<uint32_t>& triangle_ids, const BvhOptions& options)
+{
+    const uint32_t triangle_count = static_cast<uint32_t>(model.points.size() / 3);
+    assert(triangle_ids.size() == triangle_count);
+    if (triangle_count == 0)
+    {
+        return;
+    }
+
+    std::vector<Eigen::AlignedBox3f> triangle_boxes(triangle_count);
+    std::vector<Eigen::Vector3f> centroids(triangle_count);
+    const size_t block_count = (triangle_count + TAG_BLOCK_SIZE - 1) / TAG_BLOCK_SIZE;
+    std::atomic<size_t> next_block(0);
+    runInParallel(options.thread_count, block_count, [&]()
+    {
+        for (size_t block = next_block++; block * TAG_BLOCK_SIZE < triangle_count; block = next_block++)
+        {
+            const size_t block_end = std::min<size_t>((block + 1) * TAG_BLOCK_SIZE, triangle_count);
+            for (size_t i = block * TAG_BLOCK_SIZE; i < block_end; ++i)
+            {
+                Eigen::AlignedBox3f triangle_box(model.points[3 * i]);
+                triangle_box.extend(model.points[3 * i + 1]);
+                triangle_box.extend(model.points[3 * i + 2]);
+                triangle_boxes[i] = triangle_box;
+                centroids[i] = triangle_box.center();
+            }
+        }
+    });
+
+    std::vector<uint32_t> order(triangle_count);
+    for (uint32_t i = 0; i < triangle_count; ++i)
+    {
+        order[i] = i;
+    }
+    BvhBuilder builder(triangle_boxes, centroids, order, options.leaf_size);
+
+    // Top levels are split by one thread until there are enough independent subtrees for all threads
+    const unsigned thread_count = resolveThreadCount(options.thread_count);
+    nodes.resize(1);
+    if (thread_count == 1)
+    {
+        builder.build(nodes, 0, 0, triangle_count, 0, nullptr, 0);
+    }
+    else
+    {
+        std::vector<BvhBuilder::Task> tasks;
+        const uint32_t task_size = std::max<uint32_t>(triangle_count / (thread_count * 16), 1024);
+        builder.build(nodes, 0, 0, triangle_count, 0, &tasks, task_size);
+
+        std::vector<std::vector<Node>> subtrees(tasks.size());
+        std::atomic<size_t> next_task(0);
+        runInParallel(thread_count, tasks.size(), [&]()
+        {
+            for (size_t task = next_task++; task < tasks.size(); task = next_task++)
+            {
+                subtrees[task].resize(1);
+                builder.build(subtrees[task], 0, tasks[task].begin, tasks[task].end, tasks[task].depth, nullptr, 0);
+            }
+        });
+
+        // Roots of subtrees replace their task nodes, other nodes are appended with shifted child indices
+        for (size_t task = 0; task < tasks.size(); ++task)
+        {
+            const std::vector<Node>& subtree = subtrees[task];
+            const uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;
+            for (size_t i = 0; i < subtree.size(); ++i)
+            {
+                Node node = subtree[i];
+                if (node.count == 0)
+                {
+                    node.first += base;
+                }
+                if (i == 0)
+                {
+                    nodes[tasks[task].node] = node;
+                }
+                else
+                {
+                    nodes.push_back(node);
+                }
+            }
+        }
+    }
+    nodes.shrink_to_fit();
+
+    points.resize(static_cast<size_t>(triangle_count) * 3);
+    source_triangles = order;
+    ids.resize(triangle_count);
+    slots.resize(triangle_count);
+    for (uint32_t slot = 0; slot < triangle_count; ++slot)
+    {
+        const uint32_t triangle = order[slot];
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            points[3 * slot + i] = model.points[3 * triangle + i];
+        }
+        ids[slot] = triangle_ids[triangle];
+        slots[triangle] = slot;
+    }
+}
+
+bool Gkm::Solid::MeshBvh::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, MeshRayHit& hit) const
+{
+    hit = MeshRayHit();
+    if (nodes.empty())
+    {
+        return false;
+    }
+    const Eigen::Vector3d inverse_direction = direction.cwiseInverse();
+    double nearest = t_max;
+    uint32_t nearest_slot = 0;
+    uint32_t stack[MAX_STACK_SIZE];
+    unsigned stack_size = 0;
+    if (enterBox(nodes[0].box, origin, inverse_direction, t_min, nearest) <= nearest)
+    {
+        stack[stack_size++] = 0;
+    }
+    while (stack_size > 0)
+    {
+        const Node& node = nodes[stack[--stack_size]];
+        if (node.count > 0)
+        {
+            // Moller-Trumbore intersection
+            for (uint32_t slot = node.first; slot < node.first + node.count; ++slot)
+            {
+                const Eigen::Vector3d a = points[3 * slot].cast<double>();
+                const Eigen::Vector3d edge1 = points[3 * slot + 1].cast<double>() - a;
+                const Eigen::Vector3d edge2 = points[3 * slot + 2].cast<double>() - a;
+                const Eigen::Vector3d p = direction.cross(edge2);
+                const double determinant = edge1.dot(p);
+                if (determinant == 0.0)
+                {
+                    continue;
+                }
+                const double inverse_determinant = 1.0 / determinant;
+                const Eigen::Vector3d s = origin - a;
+                const double u = s.dot(p) * inverse_determinant;
+                if (u < 0.0 || u > 1.0)
+                {
+                    continue;
+                }
+                const Eigen::Vector3d q = s.cross(edge1);
+                const double v = direction.dot(q) * inverse_determinant;
+                if (v < 0.0 || u + v > 1.0)
+                {
+                    continue;
+                }
+                const double t = edge2.dot(q) * inverse_determinant;
+                if (t >= t_min && t <= nearest)
+                {
+                    nearest = t;
+                    nearest_slot = slot;
+                    hit.hit = true;
+                }
+            }
+            continue;
+        }
+        // The nearer child is visited first
+        const double left_entry = enterBox(nodes[node.first].box, origin, inverse_direction, t_min, nearest);
+        const double right_entry = enterBox(nodes[node.first + 1].box, origin, inverse_direction, t_min, nearest);
+        const bool left_first = left_entry <= right_entry;
+        const double far_entry = left_first ? right_entry : left_entry;
+        const double near_entry = left_first ? left_entry : right_entry;
+        assert(stack_size + 2 <= MAX_STACK_SIZE);
+        if (far_entry <= nearest)
+        {
+            stack[stack_size++] = left_first ? node.first + 1 : node.first;
+        }
+        if (near_entry <= nearest)
+        {
+            stack[stack_size++] = left_first ? node.first : node.first + 1;
+        }
+    }
+    if (!hit.hit)
+    {
+        return false;
+    }
+    hit.distance = nearest;
+    hit.triangle = source_triangles[nearest_slot];
+    hit.id = ids[nearest_slot];
+    const Eigen::Vector3d a = points[3 * nearest_slot].cast<double>();
+    hit.normal = (points[3 * nearest_slot + 1].cast<double>() - a).cross(points[3 * nearest_slot + 2].cast<double>() - a).normalized();
+    return true;
+}
+
+void Gkm::Solid::MeshBvh::queryBox(const Eigen::AlignedBox3d& box, std::vector<uint32_t>& triangles) const
+{
+    triangles.clear();
+    if (nodes.empty())
+    {
+        return;
+    }
+    const Eigen::AlignedBox3f query = box.cast<float>();
+    uint32_t stack[MAX_STACK_SIZE];
+    unsigned stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const Node& node = nodes[stack[--stack_size]];
+        if (!node.box.intersects(query))
+        {
+            continue;
+        }
+        if (node.count > 0)
+        {
+            for (uint32_t slot = node.first; slot < node.first + node.count; ++slot)
+            {
+                Eigen::AlignedBox3f triangle_box(points[3 * slot]);
+                triangle_box.extend(points[3 * slot + 1]);
+                triangle_box.extend(points[3 * slot + 2]);
+                if (triangle_box.intersects(query))
+                {
+                    triangles.push_back(source_triangles[slot]);
+                }
+            }
+            continue;
+        }
+        assert(stack_size + 2 <= MAX_STACK_SIZE);
+        stack[stack_size++] = node.first + 1;
+        stack[stack_size++] = node.first;
+    }
+}
+
+Eigen::Vector3f Gkm::Solid::MeshBvh::vertex(uint32_t triangle, unsigned i) const
+{
+    return points[3 * static_cast<size_t>(slots[triangle]) + i];
+}
+
+uint32_t Gkm::Solid::MeshBvh::triangleId(uint32_t triangle) const
+{
+    return ids[slots[triangle]];
+}
+
+size_t Gkm::Solid::MeshBvh::getTriangleCount() const
+{
+    return ids.size();
+}
+
+size_t Gkm::Solid::MeshBvh::getNodeCount() const
+{
+    return nodes.size();
+}
+
+size_t Gkm::Solid::MeshBvh::getMemorySize() const
+{
+    return nodes.size() * sizeof(Node) + points.size() * sizeof(Eigen::Vector3f) +
+        (source_triangles.size() + ids.size() + slots.size()) * sizeof(uint32_t);
+}
+
+void Gkm::Solid::collectParts(const ISolid::Ptr& solid, std::vector<ISolid::Ptr>& parts)
+{
+    switch (solid->type())
+    {
+    case ESolidType::Union:
+    {
+        auto union_operator = std::static_pointer_cast<UnionOperator>(solid);
+        collectParts(union_operator->left, parts);
+        collectParts(union_operator->right, parts);
+        break;
+    }
+    case ESolidType::MultiUnion:
+        for (auto& operand : std::static_pointer_cast<MultiUnionOperator>(solid)->solids)
+        {
+            collectParts(operand, parts);
+        }
+        break;
+    case ESolidType::Empty:
+        break;
+    default:
+        parts.push_back(solid);
+        break;
+    }
+}
+
+std::vector<uint32_t> Gkm::Solid::tagTriangles(const Model& model, const std::vector<ISolid::Ptr>& parts, unsigned thread_count)
+{
+    const size_t triangle_count = model.points.size() / 3;
+    std::vector<uint32_t> result(triangle_count, 0);
+    if (parts.size() <= 1 || triangle_count == 0)
+    {
+        return result;
+    }
+
+    // Uniform grid of part boxes, each grid cell lists parts whose boxes touch the cell or its neighbours
+    std::vector<Eigen::AlignedBox3d> part_boxes;
+    Eigen::AlignedBox3d grid_box;
+    for (auto& part : parts)
+    {
+        part_boxes.push_back(part->bbox());
+        grid_box.extend(part_boxes.back());
+    }
+    const int grid_size = std::min(std::max(static_cast<int>(2.0 * std::cbrt(static_cast<double>(parts.size()))), 1), 64);
+    const Eigen::Vector3d grid_cell_size = (grid_box.sizes() / grid_size).cwiseMax(Eigen::Vector3d::Constant(1e-12));
+    auto grid_index = [&](const Eigen::Vector3d& point, unsigned axis)
+    {
+        return std::min(std::max(static_cast<int>(std::floor((point[axis] - grid_box.min()[axis]) / grid_cell_size[axis])), 0), grid_size - 1);
+    };
+    std::vector<std::vector<uint32_t>> grid(static_cast<size_t>(grid_size) * grid_size * grid_size);
+    for (uint32_t part = 0; part < parts.size(); ++part)
+    {
+        if (part_boxes[part].isEmpty())
+        {
+            continue;
+        }
+        int min[3];
+        int max[3];
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            min[axis] = std::max(grid_index(part_boxes[part].min(), axis) - 1, 0);
+            max[axis] = std::min(grid_index(part_boxes[part].max(), axis) + 1, grid_size - 1);
+        }
+        for (int z = min[2]; z <= max[2]; ++z)
+        {
+            for (int y = min[1]; y <= max[1]; ++y)
+            {
+                for (int x = min[0]; x <= max[0]; ++x)
+                {
+                    grid[(static_cast<size_t>(z) * grid_size + y) * grid_size + x].push_back(part);
+                }
+            }
+        }
+    }
+    const double grid_margin = grid_cell_size.minCoeff();
+
+    const size_t block_count = (triangle_count + TAG_BLOCK_SIZE - 1) / TAG_BLOCK_SIZE;
+    std::atomic<size_t> next_block(0);
+    runInParallel(thread_count, block_count, [&]()
+    {
+        for (size_t block = next_block++; block * TAG_BLOCK_SIZE < triangle_count; block = next_block++)
+        {
+            const size_t block_end = std::min((block + 1) * TAG_BLOCK_SIZE, triangle_count);
+            for (size_t i = block * TAG_BLOCK_SIZE; i < block_end; ++i)
+            {
+                const Eigen::Vector3d a = model.points[3 * i].cast<double>();
+                const Eigen::Vector3d b = model.points[3 * i + 1].cast<double>();
+                const Eigen::Vector3d c = model.points[3 * i + 2].cast<double>();
+                const Eigen::Vector3d normal = (b - a).cross(c - a);
+                const double normal_length = normal.norm();
+                if (normal_length == 0.0)
+                {
+                    continue;
+                }
+                // The point under the center of the triangle is in the filled cell the triangle bounds,
+                // the part whose surface is the nearest below the triangle owns it
+                const double shortest_edge = std::sqrt(std::min({ (b - a).squaredNorm(), (c - b).squaredNorm(), (a - c).squaredNorm() }));
+                const double longest_edge = std::sqrt(std::max({ (b - a).squaredNorm(), (c - b).squaredNorm(), (a - c).squaredNorm() }));
+                const Eigen::Vector3d inward = -normal / normal_length;
+                const Eigen::Vector3d sample = (a + b + c) / 3.0 + inward * (0.25 * shortest_edge);
+                const double margin = 2.0 * longest_edge;
+
+                double nearest = std::numeric_limits<double>::infinity();
+                uint32_t owner = 0;
+                bool found = false;
+                auto castPart = [&](uint32_t part)
+                {
+                    if (part_boxes[part].isEmpty() || part_boxes[part].exteriorDistance(sample) > margin)
+                    {
+                        return;
+                    }
+                    Gkm::Solid::RayHit hit;
+                    if (parts[part]->raycast(sample, inward, 0.0, margin, hit) && hit.distance < nearest)
+                    {
+                        nearest = hit.distance;
+                        owner = part;
+                        found = true;
+                    }
+                };
+                if (margin <= grid_margin)
+                {
+                    // The grid cell lists all parts within the margin of the sample
+                    const size_t cell = (static_cast<size_t>(grid_index(sample, 2)) * grid_size + grid_index(sample, 1)) * grid_size + grid_index(sample, 0);
+                    for (uint32_t part : grid[cell])
+                    {
+                        castPart(part);
+                    }
+                }
+                else
+                {
+                    // Large triangles look further than neighbour grid cells
+                    for (uint32_t part = 0; part < parts.size(); ++part)
+                    {
+                        castPart(part);
+                    }
+                }
+                if (!found)
+                {
+                    // Part whose box is the nearest, it is only a guess when several boxes contain the sample
+                    for (uint32_t part = 0; part < parts.size(); ++part)
+                    {
+                        const double distance = part_boxes[part].isEmpty() ? std::numeric_limits<double>::infinity() : part_boxes[part].exteriorDistance(sample);
+                        if (distance < nearest)
+                        {
+                            nearest = distance;
+                            owner = part;
+                        }
+                    }
+                }
+                result[i] = owner;
+            }
+        }
+    });
+    return result;
+}
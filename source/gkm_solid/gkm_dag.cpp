@@ -0,0 +1,243 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <cassert>
+#include <functional>
+#include "gkm_solid/gkm_dag.h"
+
+namespace
+{
+    void hashCombine(size_t& seed, size_t value)
+    {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    size_t hashDouble(double value)
+    {
+        // Adding zero turns -0.0 into 0.0, so equal values produce equal hashes
+        return std::hash<double>()(value + 0.0);
+    }
+
+    size_t hashVector(const Eigen::Vector3d& value)
+    {
+        size_t seed = hashDouble(value.x());
+        hashCombine(seed, hashDouble(value.y()));
+        hashCombine(seed, hashDouble(value.z()));
+        return seed;
+    }
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::SolidDag::canonicalize(const ISolid::Ptr& solid)
+{
+    return canonicalNode(solid).solid;
+}
+
+size_t Gkm::Solid::SolidDag::hash(const ISolid::Ptr& canonical) const
+{
+    auto found_it = nodes.find(canonical.get());
+    assert(found_it != nodes.end());
+    return found_it->second.hash;
+}
+
+const Eigen::AlignedBox3d& Gkm::Solid::SolidDag::bbox(const ISolid::Ptr& canonical) const
+{
+    auto found_it = nodes.find(canonical.get());
+    assert(found_it != nodes.end());
+    return found_it->second.bbox;
+}
+
+size_t Gkm::Solid::SolidDag::nodeCount() const
+{
+    return nodes.size();
+}
+
+size_t Gkm::Solid::SolidDag::sharedNodeCount() const
+{
+    return shared_node_count;
+}
+
+const Gkm::Solid::SolidDag::Node& Gkm::Solid::SolidDag::canonicalNode(const ISolid::Ptr& solid)
+{
+    auto canonical_it = nodes.find(solid.get());
+    if (canonical_it != nodes.end())
+    {
+        return canonical_it->second;
+    }
+    auto source_it = canonical_by_source.find(solid.get());
+    if (source_it != canonical_by_source.end())
+    {
+        return nodes.at(source_it->second.second.get());
+    }
+
+    // Build a candidate node which refers to canonical children only
+    Node candidate;
+    candidate.hash = static_cast<size_t>(solid->type());
+    switch (solid->type())
+    {
+    case ESolidType::Empty:
+        candidate.solid = solid;
+        candidate.bbox = solid->bbox();
+        break;
+    case ESolidType::Cube:
+        candidate.solid = solid;
+        candidate.bbox = solid->bbox();
+        hashCombine(candidate.hash, hashDouble(std::static_pointer_cast<Cube>(solid)->half_edge_size));
+        break;
+    case ESolidType::Sphere:
+        candidate.solid = solid;
+        candidate.bbox = solid->bbox();
+        hashCombine(candidate.hash, hashDouble(std::static_pointer_cast<Sphere>(solid)->radius));
+        break;
+    case ESolidType::Union:
+    case ESolidType::Difference:
+    case ESolidType::Intersection:
+    {
+        auto boolean_operator = std::static_pointer_cast<IBooleanOperator>(solid);
+        const Node& left = canonicalNode(boolean_operator->left);
+        const Node& right = canonicalNode(boolean_operator->right);
+        hashCombine(candidate.hash, left.hash);
+        hashCombine(candidate.hash, right.hash);
+        if (left.solid == boolean_operator->left && right.solid == boolean_operator->right)
+        {
+            candidate.solid = solid;
+        }
+        else
+        {
+            IBooleanOperator::Ptr result;
+            if (solid->type() == ESolidType::Union)
+            {
+                result = std::make_shared<UnionOperator>();
+            }
+            else if (solid->type() == ESolidType::Difference)
+            {
+                result = std::make_shared<DifferenceOperator>();
+            }
+            else
+            {
+                result = std::make_shared<IntersectionOperator>();
+            }
+            result->left = left.solid;
+            result->right = right.solid;
+            candidate.solid = result;
+        }
+        if (solid->type() == ESolidType::Union)
+        {
+            candidate.bbox = left.bbox.merged(right.bbox);
+        }
+        else if (solid->type() == ESolidType::Difference)
+        {
+            candidate.bbox = left.bbox;
+        }
+        else
+        {
+            candidate.bbox = left.bbox.intersection(right.bbox);
+        }
+        break;
+    }
+    case ESolidType::Transform:
+    {
+        auto transform_operator = std::static_pointer_cast<TransformOperator>(solid);
+        const Node& child = canonicalNode(transform_operator->solid);
+        hashCombine(candidate.hash, hashVector(transform_operator->translate));
+        hashCombine(candidate.hash, child.hash);
+        if (child.solid == transform_operator->solid)
+        {
+            candidate.solid = solid;
+        }
+        else
+        {
+            auto result = std::make_shared<TransformOperator>();
+            result->translate = transform_operator->translate;
+            result->solid = child.solid;
+            candidate.solid = result;
+        }
+        candidate.bbox = child.bbox;
+        candidate.bbox.min() += transform_operator->translate;
+        candidate.bbox.max() += transform_operator->translate;
+        break;
+    }
+    case ESolidType::MultiUnion:
+    {
+        auto multi_union_operator = std::static_pointer_cast<MultiUnionOperator>(solid);
+        auto result = std::make_shared<MultiUnionOperator>();
+        bool changed = false;
+        for (auto& source_child : multi_union_operator->solids)
+        {
+            const Node& child = canonicalNode(source_child);
+            hashCombine(candidate.hash, child.hash);
+            result->solids.push_back(child.solid);
+            result->bboxes.push_back(child.bbox);
+            candidate.bbox.extend(child.bbox);
+            changed = changed || child.solid != source_child;
+        }
+        candidate.solid = changed ? result : solid;
+        break;
+    }
+    default:
+        // Unknown solids could be shared only by identity
+        candidate.solid = solid;
+        candidate.bbox = solid->bbox();
+        hashCombine(candidate.hash, std::hash<const ISolid*>()(solid.get()));
+        break;
+    }
+
+    ISolid::Ptr canonical;
+    auto range = table.equal_range(candidate.hash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (equal(candidate.solid, it->second))
+        {
+            canonical = it->second;
+            ++shared_node_count;
+            break;
+        }
+    }
+    if (!canonical)
+    {
+        canonical = candidate.solid;
+        table.emplace(candidate.hash, canonical);
+        nodes.emplace(canonical.get(), candidate);
+    }
+    canonical_by_source.emplace(solid.get(), std::make_pair(solid, canonical));
+    return nodes.at(canonical.get());
+}
+
+bool Gkm::Solid::SolidDag::equal(const ISolid::Ptr& a, const ISolid::Ptr& b) const
+{
+    if (a == b)
+    {
+        return true;
+    }
+    if (a->type() != b->type())
+    {
+        return false;
+    }
+    // Children of both nodes are canonical, so they could be compared by identity
+    switch (a->type())
+    {
+    case ESolidType::Empty:
+        return true;
+    case ESolidType::Cube:
+        return std::static_pointer_cast<Cube>(a)->half_edge_size == std::static_pointer_cast<Cube>(b)->half_edge_size;
+    case ESolidType::Sphere:
+        return std::static_pointer_cast<Sphere>(a)->radius == std::static_pointer_cast<Sphere>(b)->radius;
+    case ESolidType::Union:
+    case ESolidType::Difference:
+    case ESolidType::Intersection:
+    {
+        auto a_operator = std::static_pointer_cast<IBooleanOperator>(a);
+        auto b_operator = std::static_pointer_cast<IBooleanOperator>(b);
+        return a_operator->left == b_operator->left && a_operator->right == b_operator->right;
+    }
+    case ESolidType::Transform:
+    {
+        auto a_operator = std::static_pointer_cast<TransformOperator>(a);
+        auto b_operator = std::static_pointer_cast<TransformOperator>(b);
+        return a_operator->translate == b_operator->translate && a_operator->solid == b_operator->solid;
+    }
+    case ESolidType::MultiUnion:
+        return std::static_pointer_cast<MultiUnionOperator>(a)->solids == std::static_pointer_cast<MultiUnionOperator>(b)->solids;
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,599 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "gkm_solid/gkm_decimator.h"
+#include "gkm_parallel.h"
+
+namespace
+{
+    // Collapses which turn a triangle by a bigger angle are rejected, it keeps the mesh from folding
+    constexpr double MIN_NORMAL_COS = 0.25;
+    // Sine of the angle between border edges up to which a border vertex is in the middle of a straight border
+    constexpr double MAX_BORDER_SIN = 1e-6;
+    constexpr uint32_t NO_VERTEX = UINT32_MAX;
+
+    struct Collapse
+    {
+        double error = 0.0;
+        uint32_t from = 0;
+        uint32_t to = 0;
+        // Versions of both vertices when the collapse was evaluated, the collapse is stale if they changed
+        uint32_t from_version = 0;
+        uint32_t to_version = 0;
+
+        bool operator<(const Collapse& other) const
+        {
+            // Priority queue keeps the biggest element on the top
+            return error > other.error;
+        }
+    };
+
+    // Half-edge collapse decimation of one welded mesh, vertices keep their original positions
+    class MeshDecimator
+    {
+    public:
+        MeshDecimator(const std::vector<Eigen::Vector3f>& points_, std::vector<uint32_t>& indices_, std::vector<char>& locked_) :
+            points(points_), indices(indices_), locked(locked_)
+        {
+        }
+
+        // Triangles which are removed get UINT32_MAX indices
+        void decimate(double max_error);
+
+    private:
+        bool isBorder(uint32_t vertex) const;
+        Eigen::Vector3d position(uint32_t vertex) const;
+        Eigen::Vector3d triangleNormal(size_t triangle, uint32_t from, const Eigen::Vector3d& to_position) const;
+        double collapseError(uint32_t from, uint32_t to) const;
+        void pushEdge(uint32_t a, uint32_t b);
+        bool canCollapse(uint32_t from, uint32_t to);
+        void collapse(uint32_t from, uint32_t to);
+        void removeTriangle(size_t triangle);
+
+        const std::vector<Eigen::Vector3f>& points;
+        std::vector<uint32_t>& indices;
+        std::vector<char>& locked;
+        double max_squared_error = 0.0;
+        std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> quadrics;
+        std::vector<std::vector<uint32_t>> vertex_triangles;
+        // Neighbours along border edges, a border vertex in the middle of a straight border could only slide along it,
+        // so the border keeps its shape and matches the mesh on the other side, for instance, a bigger octree face
+        std::vector<std::array<uint32_t, 2>> border_neighbours;
+        std::vector<uint32_t> versions;
+        std::vector<char> removed;
+        std::priority_queue<Collapse> collapses;
+        std::vector<uint32_t> from_neighbours;
+        std::vector<uint32_t> to_neighbours;
+    };
+
+    bool MeshDecimator::isBorder(uint32_t vertex) const
+    {
+        return border_neighbours[vertex][0] != NO_VERTEX;
+    }
+
+    Eigen::Vector3d MeshDecimator::position(uint32_t vertex) const
+    {
+        return points[vertex].cast<double>();
+    }
+
+    Eigen::Vector3d MeshDecimator::triangleNormal(size_t triangle, uint32_t from, const Eigen::Vector3d& to_position) const
+    {
+        Eigen::Vector3d corners[3];
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            const uint32_t vertex = indices[3 * triangle + i];
+            corners[i] = vertex == from ? to_position : position(vertex);
+        }
+        return (corners[1] - corners[0]).cross(corners[2] - corners[0]);
+    }
+
+    double MeshDecimator::collapseError(uint32_t from, uint32_t to) const
+    {
+        const Eigen::Vector4d point = position(to).homogeneous();
+        return point.dot((quadrics[from] + quadrics[to]) * point);
+    }
+
+    void MeshDecimator::pushEdge(uint32_t a, uint32_t b)
+    {
+        // The vertex which is removed goes to the other one, the cheaper direction is taken
+        Collapse best;
+        bool found = false;
+        for (unsigned direction = 0; direction < 2; ++direction)
+        {
+            const uint32_t from = direction ? b : a;
+            const uint32_t to = direction ? a : b;
+            if (locked[from] || (isBorder(from) && border_neighbours[from][0] != to && border_neighbours[from][1] != to))
+            {
+                continue;
+            }
+            const double error = collapseError(from, to);
+            if (error <= max_squared_error && (!found || error < best.error))
+            {
+                found = true;
+                best.error = error;
+                best.from = from;
+                best.to = to;
+            }
+        }
+        if (found)
+        {
+            best.from_version = versions[best.from];
+            best.to_version = versions[best.to];
+            collapses.push(best);
+        }
+    }
+
+    bool MeshDecimator::canCollapse(uint32_t from, uint32_t to)
+    {
+        // Link condition: an interior edge has exactly two common neighbours and a border edge has one,
+        // otherwise the mesh becomes non-manifold
+        auto collect = [this](uint32_t vertex, std::vector<uint32_t>& neighbours)
+        {
+            neighbours.clear();
+            for (uint32_t triangle : vertex_triangles[vertex])
+            {
+                for (unsigned i = 0; i < 3; ++i)
+                {
+                    if (indices[3 * triangle + i] != vertex)
+                    {
+                        neighbours.push_back(indices[3 * triangle + i]);
+                    }
+                }
+            }
+            std::sort(neighbours.begin(), neighbours.end());
+            neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+        };
+        collect(from, from_neighbours);
+        collect(to, to_neighbours);
+        size_t common_count = 0;
+        for (auto from_it = from_neighbours.begin(), to_it = to_neighbours.begin(); from_it != from_neighbours.end() && to_it != to_neighbours.end();)
+        {
+            if (*from_it < *to_it)
+            {
+                ++from_it;
+            }
+            else if (*to_it < *from_it)
+            {
+                ++to_it;
+            }
+            else
+            {
+                ++common_count;
+                ++from_it;
+                ++to_it;
+            }
+        }
+        if (common_count != (isBorder(from) ? 1u : 2u))
+        {
+            return false;
+        }
+
+        // Triangles which stay must not flip, degenerate or become copies of triangles of the merged vertex,
+        // the last happens around vertices of valence three which the link condition does not catch
+        const Eigen::Vector3d to_position = position(to);
+        for (uint32_t triangle : vertex_triangles[from])
+        {
+            const uint32_t* corners = &indices[3 * triangle];
+            if (corners[0] == to || corners[1] == to || corners[2] == to)
+            {
+                continue;
+            }
+            for (uint32_t to_triangle : vertex_triangles[to])
+            {
+                const uint32_t* to_corners = &indices[3 * to_triangle];
+                unsigned shared_count = 0;
+                for (unsigned i = 0; i < 3; ++i)
+                {
+                    if (corners[i] != from && (to_corners[0] == corners[i] || to_corners[1] == corners[i] || to_corners[2] == corners[i]))
+                    {
+                        ++shared_count;
+                    }
+                }
+                if (shared_count == 2)
+                {
+                    return false;
+                }
+            }
+            const Eigen::Vector3d old_normal = triangleNormal(triangle, from, position(from));
+            const Eigen::Vector3d new_normal = triangleNormal(triangle, from, to_position);
+            const double old_norm = old_normal.norm();
+            const double new_norm = new_normal.norm();
+            if (new_norm <= 1e-12 * old_norm || old_normal.dot(new_normal) < MIN_NORMAL_COS * old_norm * new_norm)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void MeshDecimator::removeTriangle(size_t triangle)
+    {
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            std::vector<uint32_t>& triangles = vertex_triangles[indices[3 * triangle + i]];
+            triangles.erase(std::find(triangles.begin(), triangles.end(), static_cast<uint32_t>(triangle)));
+            indices[3 * triangle + i] = UINT32_MAX;
+        }
+    }
+
+    void MeshDecimator::collapse(uint32_t from, uint32_t to)
+    {
+        const std::vector<uint32_t> from_triangles = vertex_triangles[from];
+        for (uint32_t triangle : from_triangles)
+        {
+            uint32_t* corners = &indices[3 * triangle];
+            if (corners[0] == to || corners[1] == to || corners[2] == to)
+            {
+                removeTriangle(triangle);
+                continue;
+            }
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                if (corners[i] == from)
+                {
+                    corners[i] = to;
+                }
+            }
+            vertex_triangles[to].push_back(triangle);
+        }
+        vertex_triangles[from].clear();
+        if (isBorder(from))
+        {
+            // The border goes from the other neighbour of the removed vertex directly to the merged one
+            const uint32_t other = border_neighbours[from][0] == to ? border_neighbours[from][1] : border_neighbours[from][0];
+            std::replace(border_neighbours[to].begin(), border_neighbours[to].end(), from, other);
+            std::replace(border_neighbours[other].begin(), border_neighbours[other].end(), from, to);
+        }
+        removed[from] = true;
+        quadrics[to] += quadrics[from];
+        ++versions[to];
+
+        // Errors of all edges around the merged vertex change with its quadric
+        for (uint32_t triangle : vertex_triangles[to])
+        {
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                const uint32_t vertex = indices[3 * triangle + i];
+                if (vertex != to)
+                {
+                    pushEdge(to, vertex);
+                }
+            }
+        }
+    }
+
+    void MeshDecimator::decimate(double max_error)
+    {
+        max_squared_error = max_error * max_error;
+        const size_t vertex_count = points.size();
+        const size_t triangle_count = indices.size() / 3;
+        quadrics.assign(vertex_count, Eigen::Matrix4d::Zero());
+        vertex_triangles.assign(vertex_count, std::vector<uint32_t>());
+        versions.assign(vertex_count, 0);
+        removed.assign(vertex_count, false);
+        border_neighbours.assign(vertex_count, { NO_VERTEX, NO_VERTEX });
+
+        // Quadric of a vertex is the sum of squared distances to planes of its triangles, planes are not weighted,
+        // so the square root of the quadric error bounds the distance to each of them
+        std::vector<std::pair<uint32_t, uint32_t>> edges;
+        edges.reserve(indices.size());
+        for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+        {
+            const uint32_t* corners = &indices[3 * triangle];
+            const Eigen::Vector3d normal = triangleNormal(triangle, NO_VERTEX, Eigen::Vector3d::Zero());
+            const double norm = normal.norm();
+            if (norm > 0.0)
+            {
+                Eigen::Vector4d plane;
+                plane.head<3>() = normal / norm;
+                plane.w() = -plane.head<3>().dot(position(corners[0]));
+                const Eigen::Matrix4d quadric = plane * plane.transpose();
+                for (unsigned i = 0; i < 3; ++i)
+                {
+                    quadrics[corners[i]] += quadric;
+                }
+            }
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                vertex_triangles[corners[i]].push_back(static_cast<uint32_t>(triangle));
+                const uint32_t a = corners[i];
+                const uint32_t b = corners[(i + 1) % 3];
+                edges.emplace_back(std::min(a, b), std::max(a, b));
+            }
+        }
+
+        // Vertices of non-manifold edges which are used by more than two triangles are locked,
+        // border edges are used by one triangle and their vertices are locked unless the border is straight there
+        std::sort(edges.begin(), edges.end());
+        for (size_t begin = 0, end = 0; begin < edges.size(); begin = end)
+        {
+            for (end = begin + 1; end < edges.size() && edges[end] == edges[begin]; ++end)
+            {
+            }
+            const uint32_t ends[2] = { edges[begin].first, edges[begin].second };
+            if (end - begin > 2)
+            {
+                locked[ends[0]] = true;
+                locked[ends[1]] = true;
+            }
+            else if (end - begin == 1)
+            {
+                for (unsigned i = 0; i < 2; ++i)
+                {
+                    std::array<uint32_t, 2>& neighbours = border_neighbours[ends[i]];
+                    if (neighbours[0] == NO_VERTEX)
+                    {
+                        neighbours[0] = ends[1 - i];
+                    }
+                    else if (neighbours[1] == NO_VERTEX)
+                    {
+                        neighbours[1] = ends[1 - i];
+                    }
+                    else
+                    {
+                        locked[ends[i]] = true;
+                    }
+                }
+            }
+        }
+        for (uint32_t vertex = 0; vertex < vertex_count; ++vertex)
+        {
+            const std::array<uint32_t, 2>& neighbours = border_neighbours[vertex];
+            if (!isBorder(vertex) || locked[vertex])
+            {
+                continue;
+            }
+            if (neighbours[1] == NO_VERTEX)
+            {
+                locked[vertex] = true;
+                continue;
+            }
+            const Eigen::Vector3d first = position(neighbours[0]) - position(vertex);
+            const Eigen::Vector3d second = position(neighbours[1]) - position(vertex);
+            if (first.dot(second) >= 0.0 || first.cross(second).norm() > MAX_BORDER_SIN * first.norm() * second.norm())
+            {
+                locked[vertex] = true;
+            }
+        }
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        for (auto& edge : edges)
+        {
+            pushEdge(edge.first, edge.second);
+        }
+
+        while (!collapses.empty())
+        {
+            const Collapse top = collapses.top();
+            collapses.pop();
+            if (removed[top.from] || removed[top.to] || versions[top.from] != top.from_version || versions[top.to] != top.to_version)
+            {
+                continue;
+            }
+            if (canCollapse(top.from, top.to))
+            {
+                collapse(top.from, top.to);
+            }
+        }
+    }
+
+    // A closed piece of the surface which is smaller than the error could be collapsed to the same triangle
+    // with opposite orientations, for instance, by both regions it is split between, such pairs are removed
+    void removeCoincidentTriangles(Gkm::Solid::Model& model)
+    {
+        const Gkm::Solid::IndexedModel::Ptr mesh = Gkm::Solid::buildIndexedModel(model);
+        const size_t triangle_count = mesh->indices.size() / 3;
+        std::map<std::array<uint32_t, 3>, std::vector<uint32_t>> triangles;
+        for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+        {
+            std::array<uint32_t, 3> key = { mesh->indices[3 * triangle], mesh->indices[3 * triangle + 1], mesh->indices[3 * triangle + 2] };
+            std::sort(key.begin(), key.end());
+            triangles[key].push_back(static_cast<uint32_t>(triangle));
+        }
+        std::vector<char> removed(triangle_count, false);
+        bool found = false;
+        for (auto& same_triangles : triangles)
+        {
+            if (same_triangles.second.size() == 2)
+            {
+                removed[same_triangles.second[0]] = true;
+                removed[same_triangles.second[1]] = true;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            return;
+        }
+        std::vector<Eigen::Vector3f> points;
+        points.reserve(model.points.size());
+        for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+        {
+            if (!removed[triangle])
+            {
+                points.insert(points.end(), model.points.begin() + 3 * triangle, model.points.begin() + 3 * triangle + 3);
+            }
+        }
+        model.points.swap(points);
+    }
+
+    // Decimates the welded triangles and appends the kept ones to the model
+    void decimateTriangles(const Gkm::Solid::IndexedModel& mesh, const std::vector<uint32_t>& triangles,
+        const std::vector<char>& shared, double max_error, Gkm::Solid::Model& result)
+    {
+        std::unordered_map<uint32_t, uint32_t> local_vertices;
+        std::vector<Eigen::Vector3f> points;
+        std::vector<uint32_t> indices;
+        std::vector<char> locked;
+        indices.reserve(triangles.size() * 3);
+        for (uint32_t triangle : triangles)
+        {
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                const uint32_t vertex = mesh.indices[3 * triangle + i];
+                const auto inserted = local_vertices.emplace(vertex, static_cast<uint32_t>(points.size()));
+                if (inserted.second)
+                {
+                    points.push_back(mesh.points[vertex]);
+                    locked.push_back(shared[vertex]);
+                }
+                indices.push_back(inserted.first->second);
+            }
+        }
+        MeshDecimator decimator(points, indices, locked);
+        decimator.decimate(max_error);
+        for (uint32_t index : indices)
+        {
+            if (index != UINT32_MAX)
+            {
+                result.points.push_back(points[index]);
+            }
+        }
+    }
+}
+
+Gkm::Solid::Model::Ptr Gkm::Solid::decimateModel(const Model& model, const DecimationOptions& options)
+{
+    auto result = std::make_shared<Model>();
+    const IndexedModel::Ptr mesh = buildIndexedModel(model);
+    const size_t triangle_count = mesh->indices.size() / 3;
+    if (triangle_count == 0)
+    {
+        return result;
+    }
+    Eigen::AlignedBox3f box;
+    for (auto& point : mesh->points)
+    {
+        box.extend(point);
+    }
+
+    // Regions are cells of a lattice, a triangle belongs to the region of its centroid
+    const double region_size = options.region_size > 0.0 ? options.region_size : box.diagonal().norm() + 1.0;
+    std::map<std::tuple<int64_t, int64_t, int64_t>, std::vector<uint32_t>> region_triangles;
+    std::vector<uint32_t> vertex_regions(mesh->points.size(), UINT32_MAX);
+    std::vector<char> shared(mesh->points.size(), false);
+    for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+    {
+        Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            centroid += mesh->points[mesh->indices[3 * triangle + i]].cast<double>() / 3.0;
+        }
+        const Eigen::Vector3d cell = ((centroid - box.min().cast<double>()) / region_size).array().floor();
+        region_triangles[std::make_tuple(static_cast<int64_t>(cell.x()), static_cast<int64_t>(cell.y()), static_cast<int64_t>(cell.z()))].push_back(static_cast<uint32_t>(triangle));
+    }
+    std::vector<const std::vector<uint32_t>*> regions;
+    for (auto& region : region_triangles)
+    {
+        const uint32_t region_index = static_cast<uint32_t>(regions.size());
+        regions.push_back(&region.second);
+        for (uint32_t triangle : region.second)
+        {
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                const uint32_t vertex = mesh->indices[3 * triangle + i];
+                if (vertex_regions[vertex] == UINT32_MAX)
+                {
+                    vertex_regions[vertex] = region_index;
+                }
+                else if (vertex_regions[vertex] != region_index)
+                {
+                    shared[vertex] = true;
+                }
+            }
+        }
+    }
+
+    // Each thread decimates whole regions, results are merged in order of regions
+    std::vector<Model> region_models(regions.size());
+    std::atomic<size_t> next_region(0);
+    auto worker = [&]()
+    {
+        for (size_t region = next_region++; region < regions.size(); region = next_region++)
+        {
+            decimateTriangles(*mesh, *regions[region], shared, options.max_error, region_models[region]);
+        }
+    };
+
+    runInParallel(options.thread_count, regions.size(), worker);
+
+    size_t point_count = 0;
+    for (auto& region_model : region_models)
+    {
+        point_count += region_model.points.size();
+    }
+    result->points.reserve(point_count);
+    for (auto& region_model : region_models)
+    {
+        result->points.insert(result->points.end(), region_model.points.begin(), region_model.points.end());
+    }
+    removeCoincidentTriangles(*result);
+    return result;
+}
+
+Gkm::Solid::Model::Ptr Gkm::Solid::decimateModel(const Model& model, const Eigen::AlignedBox3d& box, double max_error)
+{
+    auto result = std::make_shared<Model>();
+    const IndexedModel::Ptr mesh = buildIndexedModel(model);
+    const size_t triangle_count = mesh->indices.size() / 3;
+    if (triangle_count == 0)
+    {
+        return result;
+    }
+
+    // Bit f of a vertex mask is set if the vertex is on face f of the box up to float precision
+    const Eigen::Vector3d tolerance = box.sizes() * 1e-6;
+    std::vector<uint8_t> face_masks(mesh->points.size(), 0);
+    for (size_t i = 0; i < mesh->points.size(); ++i)
+    {
+        const Eigen::Vector3d point = mesh->points[i].cast<double>();
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            if (std::fabs(point[axis] - box.min()[axis]) <= tolerance[axis])
+            {
+                face_masks[i] |= 1 << (2 * axis);
+            }
+            if (std::fabs(point[axis] - box.max()[axis]) <= tolerance[axis])
+            {
+                face_masks[i] |= 1 << (2 * axis + 1);
+            }
+        }
+    }
+
+    // Surface crosses the box where a vertex on a box face has a triangle out of this face, such vertices are locked
+    // as vertices on box edges are. Other vertices on box faces, for instance, of caps of closed chunk meshes
+    // or of flat surfaces which lie on the box, slide within their face.
+    std::vector<char> locked(mesh->points.size(), false);
+    for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+    {
+        const uint32_t* corners = &mesh->indices[3 * triangle];
+        const uint8_t triangle_mask = face_masks[corners[0]] & face_masks[corners[1]] & face_masks[corners[2]];
+        for (unsigned i = 0; i < 3; ++i)
+        {
+            const uint8_t mask = face_masks[corners[i]];
+            if ((mask & (mask - 1)) != 0 || (mask & ~triangle_mask) != 0)
+            {
+                locked[corners[i]] = true;
+            }
+        }
+    }
+    std::vector<uint32_t> triangles(triangle_count);
+    for (size_t triangle = 0; triangle < triangle_count; ++triangle)
+    {
+        triangles[triangle] = static_cast<uint32_t>(triangle);
+    }
+    result->points.reserve(model.points.size());
+    decimateTriangles(*mesh, triangles, locked, max_error, *result);
+    removeCoincidentTriangles(*result);
+    return result;
+}
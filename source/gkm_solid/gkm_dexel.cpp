@@ -0,0 +1,455 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include "gkm_solid/gkm_dexel.h"
+#include "gkm_parallel.h"
+
+namespace
+{
+    typedef void (*SpanOperation)(const std::vector<Gkm::Solid::RaySpan>& left, const std::vector<Gkm::Solid::RaySpan>& right, std::vector<Gkm::Solid::RaySpan>& result);
+
+    // Marching squares segments as pairs of cell edges, saddles are resolved as separate corners
+    const int SEGMENT_EDGES[16][4] = {
+        { -1, -1, -1, -1 },
+        { 3, 0, -1, -1 },
+        { 0, 1, -1, -1 },
+        { 3, 1, -1, -1 },
+        { 1, 2, -1, -1 },
+        { 3, 0, 1, 2 },
+        { 0, 2, -1, -1 },
+        { 3, 2, -1, -1 },
+        { 2, 3, -1, -1 },
+        { 0, 2, -1, -1 },
+        { 0, 1, 2, 3 },
+        { 1, 2, -1, -1 },
+        { 1, 3, -1, -1 },
+        { 0, 1, -1, -1 },
+        { 0, 3, -1, -1 },
+        { -1, -1, -1, -1 }
+    };
+
+    unsigned cellCount(double length, double cell_size)
+    {
+        return std::max(1u, static_cast<unsigned>(std::ceil(length / cell_size)));
+    }
+
+    // Center of the cell, index could be out of the lattice by one cell
+    double cellCenter(const Gkm::Solid::DexelModel& model, unsigned axis, int index)
+    {
+        return model.origin[axis] + (index + 0.5) * model.cell_size;
+    }
+
+    bool insideRay(const Gkm::Solid::DexelGrid& grid, size_t ray, double coordinate)
+    {
+        const auto begin_it = grid.spans.begin() + grid.spanBegin(ray);
+        const auto end_it = grid.spans.begin() + grid.spanEnd(ray);
+        // The first span which ends not before the coordinate
+        auto found_it = std::lower_bound(begin_it, end_it, coordinate, [](const Gkm::Solid::RaySpan& span, double value) { return span.end < value; });
+        return found_it != end_it && found_it->begin <= coordinate;
+    }
+
+    Gkm::Solid::DexelModel::Ptr combine(const Gkm::Solid::DexelModel& left, const Gkm::Solid::DexelModel& right, SpanOperation operation)
+    {
+        assert(left.isCompatible(right));
+        auto result = std::make_shared<Gkm::Solid::DexelModel>();
+        result->origin = left.origin;
+        result->cell_size = left.cell_size;
+        std::copy(left.sizes, left.sizes + 3, result->sizes);
+
+        std::vector<Gkm::Solid::RaySpan> left_spans;
+        std::vector<Gkm::Solid::RaySpan> right_spans;
+        std::vector<Gkm::Solid::RaySpan> spans;
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            const Gkm::Solid::DexelGrid& left_grid = left.grids[axis];
+            const Gkm::Solid::DexelGrid& right_grid = right.grids[axis];
+            Gkm::Solid::DexelGrid& grid = result->grids[axis];
+            grid.axis = axis;
+            grid.size_u = left_grid.size_u;
+            grid.size_v = left_grid.size_v;
+            grid.ray_offsets.reserve(left_grid.ray_offsets.size());
+            grid.ray_offsets.push_back(0);
+            const size_t ray_count = left_grid.rayCount();
+            for (size_t ray = 0; ray < ray_count; ++ray)
+            {
+                left_spans.assign(left_grid.spans.begin() + left_grid.spanBegin(ray), left_grid.spans.begin() + left_grid.spanEnd(ray));
+                right_spans.assign(right_grid.spans.begin() + right_grid.spanBegin(ray), right_grid.spans.begin() + right_grid.spanEnd(ray));
+                operation(left_spans, right_spans, spans);
+                grid.spans.insert(grid.spans.end(), spans.begin(), spans.end());
+                grid.ray_offsets.push_back(static_cast<unsigned>(grid.spans.size()));
+            }
+        }
+        return result;
+    }
+
+    class SectionBuilder
+    {
+        const Gkm::Solid::DexelModel& model;
+        unsigned axis;
+        unsigned axis_u;
+        unsigned axis_v;
+        double coordinate;
+        // Index of the cell layer which contains the section plane
+        unsigned layer;
+
+        bool sample(int u, int v) const;
+        // Coordinate along the edge axis where the solid boundary crosses the edge between cells index and index + 1
+        double crossing(unsigned edge_axis, int index, unsigned other_axis, int other_index) const;
+        Eigen::Vector3d edgePoint(int u, int v, int edge) const;
+
+    public:
+        SectionBuilder(const Gkm::Solid::DexelModel& model, unsigned axis, double coordinate);
+        void build(std::vector<Eigen::Vector3d>& segments) const;
+    };
+
+    SectionBuilder::SectionBuilder(const Gkm::Solid::DexelModel& model_, unsigned axis_, double coordinate_) :
+        model(model_), axis(axis_), axis_u((axis_ + 1) % 3), axis_v((axis_ + 2) % 3), coordinate(coordinate_)
+    {
+        const double position = std::floor((coordinate - model.origin[axis]) / model.cell_size);
+        layer = static_cast<unsigned>(std::min(std::max(position, 0.0), model.sizes[axis] - 1.0));
+    }
+
+    bool SectionBuilder::sample(int u, int v) const
+    {
+        if (u < 0 || v < 0 || u >= static_cast<int>(model.sizes[axis_u]) || v >= static_cast<int>(model.sizes[axis_v]))
+        {
+            return false;
+        }
+        const Gkm::Solid::DexelGrid& grid = model.grids[axis];
+        return insideRay(grid, grid.rayIndex(static_cast<unsigned>(u), static_cast<unsigned>(v)), coordinate);
+    }
+
+    double SectionBuilder::crossing(unsigned edge_axis, int index, unsigned other_axis, int other_index) const
+    {
+        const double from = cellCenter(model, edge_axis, index);
+        const double to = cellCenter(model, edge_axis, index + 1);
+        // Ray of the edge axis grid which lies in the section layer
+        unsigned lattice_index[3];
+        lattice_index[axis] = layer;
+        lattice_index[other_axis] = static_cast<unsigned>(other_index);
+        lattice_index[edge_axis] = 0;
+        const Gkm::Solid::DexelGrid& grid = model.grids[edge_axis];
+        const size_t ray = grid.rayIndex(lattice_index[(edge_axis + 1) % 3], lattice_index[(edge_axis + 2) % 3]);
+        for (size_t span_index = grid.spanBegin(ray); span_index < grid.spanEnd(ray); ++span_index)
+        {
+            const Gkm::Solid::RaySpan& span = grid.spans[span_index];
+            if (span.begin > from && span.begin < to)
+            {
+                return span.begin;
+            }
+            if (span.end > from && span.end < to)
+            {
+                return span.end;
+            }
+        }
+        return 0.5 * (from + to);
+    }
+
+    Eigen::Vector3d SectionBuilder::edgePoint(int u, int v, int edge) const
+    {
+        // Edges 0 and 2 go along U axis, edges 1 and 3 go along V axis
+        Eigen::Vector3d point;
+        point[axis] = coordinate;
+        switch (edge)
+        {
+        case 0:
+            point[axis_u] = crossing(axis_u, u, axis_v, v);
+            point[axis_v] = cellCenter(model, axis_v, v);
+            break;
+        case 1:
+            point[axis_u] = cellCenter(model, axis_u, u + 1);
+            point[axis_v] = crossing(axis_v, v, axis_u, u + 1);
+            break;
+        case 2:
+            point[axis_u] = crossing(axis_u, u, axis_v, v + 1);
+            point[axis_v] = cellCenter(model, axis_v, v + 1);
+            break;
+        default:
+            point[axis_u] = cellCenter(model, axis_u, u);
+            point[axis_v] = crossing(axis_v, v, axis_u, u);
+            break;
+        }
+        return point;
+    }
+
+    void SectionBuilder::build(std::vector<Eigen::Vector3d>& segments) const
+    {
+        // Samples out of the lattice are outside, so all contours are closed
+        const int size_u = static_cast<int>(model.sizes[axis_u]);
+        const int size_v = static_cast<int>(model.sizes[axis_v]);
+        for (int v = -1; v < size_v; ++v)
+        {
+            for (int u = -1; u < size_u; ++u)
+            {
+                const unsigned square_case =
+                    (sample(u, v) ? 1 : 0) |
+                    (sample(u + 1, v) ? 2 : 0) |
+                    (sample(u + 1, v + 1) ? 4 : 0) |
+                    (sample(u, v + 1) ? 8 : 0);
+                const int* edges = SEGMENT_EDGES[square_case];
+                for (unsigned i = 0; i < 4 && edges[i] >= 0; i += 2)
+                {
+                    segments.push_back(edgePoint(u, v, edges[i]));
+                    segments.push_back(edgePoint(u, v, edges[i + 1]));
+                }
+            }
+        }
+    }
+}
+
+size_t Gkm::Solid::DexelGrid::rayIndex(unsigned u, unsigned v) const
+{
+    return static_cast<size_t>(v) * size_u + u;
+}
+
+size_t Gkm::Solid::DexelGrid::rayCount() const
+{
+    return static_cast<size_t>(size_u) * size_v;
+}
+
+size_t Gkm::Solid::DexelGrid::spanBegin(size_t ray) const
+{
+    return ray_offsets[ray];
+}
+
+size_t Gkm::Solid::DexelGrid::spanEnd(size_t ray) const
+{
+    return ray_offsets[ray + 1];
+}
+
+Eigen::AlignedBox3d Gkm::Solid::DexelModel::box() const
+{
+    const Eigen::Vector3d max = origin + Eigen::Vector3d(sizes[0], sizes[1], sizes[2]) * cell_size;
+    return Eigen::AlignedBox3d(origin, max);
+}
+
+double Gkm::Solid::DexelModel::cellCenter(unsigned axis, unsigned index) const
+{
+    return origin[axis] + (index + 0.5) * cell_size;
+}
+
+bool Gkm::Solid::DexelModel::isCompatible(const DexelModel& other) const
+{
+    return origin == other.origin && cell_size == other.cell_size && std::equal(sizes, sizes + 3, other.sizes);
+}
+
+bool Gkm::Solid::DexelModel::inside(const Eigen::Vector3d& point) const
+{
+    const double u = std::floor((point.y() - origin.y()) / cell_size);
+    const double v = std::floor((point.z() - origin.z()) / cell_size);
+    if (u < 0.0 || v < 0.0 || u >= sizes[1] || v >= sizes[2])
+    {
+        return false;
+    }
+    const DexelGrid& grid = grids[0];
+    return insideRay(grid, grid.rayIndex(static_cast<unsigned>(u), static_cast<unsigned>(v)), point.x());
+}
+
+Gkm::Solid::DexelModel::Ptr Gkm::Solid::buildDexelModel(const ISolid::Ptr& solid, const Eigen::AlignedBox3d& box, double cell_size, unsigned thread_count)
+{
+    auto model = std::make_shared<DexelModel>();
+    if (box.isEmpty() || cell_size <= 0.0)
+    {
+        return model;
+    }
+    const Eigen::Vector3d box_sizes = box.sizes();
+    model->origin = box.min();
+    model->cell_size = cell_size;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        model->sizes[axis] = cellCount(box_sizes[axis], cell_size);
+    }
+
+    // There is no batch query of all spans of rays, so rows of rays are cast by threads, they are merged in order of rows
+    std::vector<std::vector<RaySpan>> row_spans;
+    std::vector<std::vector<unsigned>> row_counts;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        const unsigned axis_u = (axis + 1) % 3;
+        const unsigned axis_v = (axis + 2) % 3;
+        DexelGrid& grid = model->grids[axis];
+        grid.axis = axis;
+        grid.size_u = model->sizes[axis_u];
+        grid.size_v = model->sizes[axis_v];
+
+        // Ray parameter is equal to the absolute coordinate along the axis
+        Eigen::Vector3d direction = Eigen::Vector3d::Zero();
+        direction[axis] = 1.0;
+        const double t_min = model->origin[axis];
+        const double t_max = model->origin[axis] + model->sizes[axis] * cell_size;
+        row_spans.assign(grid.size_v, std::vector<RaySpan>());
+        row_counts.assign(grid.size_v, std::vector<unsigned>());
+        std::atomic<unsigned> next_row(0);
+        runInParallel(thread_count, grid.size_v, [&]()
+        {
+            std::vector<RaySpan> spans;
+            for (unsigned v = next_row++; v < grid.size_v; v = next_row++)
+            {
+                row_counts[v].reserve(grid.size_u);
+                for (unsigned u = 0; u < grid.size_u; ++u)
+                {
+                    Eigen::Vector3d ray_origin = Eigen::Vector3d::Zero();
+                    ray_origin[axis_u] = model->cellCenter(axis_u, u);
+                    ray_origin[axis_v] = model->cellCenter(axis_v, v);
+                    solid->raySpans(ray_origin, direction, t_min, t_max, spans);
+                    row_spans[v].insert(row_spans[v].end(), spans.begin(), spans.end());
+                    row_counts[v].push_back(static_cast<unsigned>(spans.size()));
+                }
+            }
+        });
+
+        size_t span_count = 0;
+        for (auto& spans : row_spans)
+        {
+            span_count += spans.size();
+        }
+        grid.spans.reserve(span_count);
+        grid.ray_offsets.reserve(grid.rayCount() + 1);
+        grid.ray_offsets.push_back(0);
+        for (unsigned v = 0; v < grid.size_v; ++v)
+        {
+            grid.spans.insert(grid.spans.end(), row_spans[v].begin(), row_spans[v].end());
+            for (unsigned count : row_counts[v])
+            {
+                grid.ray_offsets.push_back(grid.ray_offsets.back() + count);
+            }
+        }
+    }
+    return model;
+}
+
+Gkm::Solid::DexelModel::Ptr Gkm::Solid::uniteDexelModels(const DexelModel& left, const DexelModel& right)
+{
+    return combine(left, right, &uniteSpans);
+}
+
+Gkm::Solid::DexelModel::Ptr Gkm::Solid::subtractDexelModels(const DexelModel& left, const DexelModel& right)
+{
+    return combine(left, right, &subtractSpans);
+}
+
+Gkm::Solid::DexelModel::Ptr Gkm::Solid::intersectDexelModels(const DexelModel& left, const DexelModel& right)
+{
+    return combine(left, right, &intersectSpans);
+}
+
+Gkm::Solid::MassProperties Gkm::Solid::calculateMassProperties(const DexelModel& model)
+{
+    MassProperties properties;
+    double volume = 0.0;
+    Eigen::Vector3d moment = Eigen::Vector3d::Zero();
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        const unsigned axis_u = (axis + 1) % 3;
+        const unsigned axis_v = (axis + 2) % 3;
+        const DexelGrid& grid = model.grids[axis];
+        for (unsigned v = 0; v < grid.size_v; ++v)
+        {
+            for (unsigned u = 0; u < grid.size_u; ++u)
+            {
+                const size_t ray = grid.rayIndex(u, v);
+                for (size_t span_index = grid.spanBegin(ray); span_index < grid.spanEnd(ray); ++span_index)
+                {
+                    const RaySpan& span = grid.spans[span_index];
+                    const double length = span.end - span.begin;
+                    volume += length;
+                    moment[axis] += 0.5 * (span.end * span.end - span.begin * span.begin);
+                    moment[axis_u] += length * model.cellCenter(axis_u, u);
+                    moment[axis_v] += length * model.cellCenter(axis_v, v);
+                }
+            }
+        }
+    }
+    if (volume > 0.0)
+    {
+        properties.volume = volume * model.cell_size * model.cell_size / 3.0;
+        properties.centroid = moment / volume;
+    }
+    return properties;
+}
+
+Gkm::Solid::Section Gkm::Solid::calculateSection(const DexelModel& model, unsigned axis, double coordinate)
+{
+    Section section;
+    section.axis = axis;
+    section.coordinate = coordinate;
+    if (model.sizes[axis] == 0)
+    {
+        return section;
+    }
+    SectionBuilder builder(model, axis, coordinate);
+    builder.build(section.segments);
+    return section;
+}
+
+Gkm::Solid::Model::Ptr Gkm::Solid::buildDexelMesh(const DexelModel& model)
+{
+    auto result = std::make_shared<Model>();
+    const unsigned size_x = model.sizes[0];
+    const unsigned size_y = model.sizes[1];
+    const unsigned size_z = model.sizes[2];
+    if (size_x == 0 || size_y == 0 || size_z == 0)
+    {
+        return result;
+    }
+
+    // Cells are classified by rays of X grid which go through their centers
+    std::vector<unsigned char> cells(static_cast<size_t>(size_x) * size_y * size_z, 0);
+    const DexelGrid& grid = model.grids[0];
+    for (unsigned z = 0; z < size_z; ++z)
+    {
+        for (unsigned y = 0; y < size_y; ++y)
+        {
+            const size_t ray = grid.rayIndex(y, z);
+            unsigned char* row = &cells[ray * size_x];
+            for (size_t span_index = grid.spanBegin(ray); span_index < grid.spanEnd(ray); ++span_index)
+            {
+                const RaySpan& span = grid.spans[span_index];
+                const double first = std::max(0.0, std::ceil((span.begin - model.origin.x()) / model.cell_size - 0.5));
+                const double last = std::min(size_x - 1.0, std::floor((span.end - model.origin.x()) / model.cell_size - 0.5));
+                if (first <= last)
+                {
+                    std::fill(row + static_cast<size_t>(first), row + static_cast<size_t>(last) + 1, static_cast<unsigned char>(1));
+                }
+            }
+        }
+    }
+
+    auto cellInside = [&](int x, int y, int z)
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= static_cast<int>(size_x) || y >= static_cast<int>(size_y) || z >= static_cast<int>(size_z))
+        {
+            return false;
+        }
+        return cells[(static_cast<size_t>(z) * size_y + y) * size_x + x] != 0;
+    };
+
+    const int neighbours[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+    for (int z = 0; z < static_cast<int>(size_z); ++z)
+    {
+        for (int y = 0; y < static_cast<int>(size_y); ++y)
+        {
+            for (int x = 0; x < static_cast<int>(size_x); ++x)
+            {
+                if (!cellInside(x, y, z))
+                {
+                    continue;
+                }
+                const Eigen::Vector3d cell_min = model.origin + Eigen::Vector3d(x, y, z) * model.cell_size;
+                const Eigen::AlignedBox3d cell(cell_min, cell_min + Eigen::Vector3d::Constant(model.cell_size));
+                for (unsigned face = 0; face < 6; ++face)
+                {
+                    if (!cellInside(x + neighbours[face][0], y + neighbours[face][1], z + neighbours[face][2]))
+                    {
+                        addBoxFace(*result, cell, face);
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
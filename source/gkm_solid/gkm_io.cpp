@@ -0,0 +1,355 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include "gkm_solid/gkm_io.h"
+
+namespace
+{
+    bool parseNumber(const std::string& token, double& value)
+    {
+        std::istringstream stream(token);
+        stream >> value;
+        return !stream.fail() && stream.eof();
+    }
+
+    // Writes operands before their operators, names are n0, n1, ... in order of writing
+    class SceneWriter
+    {
+    public:
+        explicit SceneWriter(std::ofstream& file_) :
+            file(file_)
+        {
+        }
+
+        // Returns an empty name if the solid could not be written
+        std::string write(const Gkm::Solid::ISolid::Ptr& solid);
+
+    private:
+        std::ofstream& file;
+        std::unordered_map<const Gkm::Solid::ISolid*, std::string> names;
+    };
+
+    std::string SceneWriter::write(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        const auto found = names.find(solid.get());
+        if (found != names.end())
+        {
+            return found->second;
+        }
+
+        std::vector<std::string> operands;
+        std::ostringstream line;
+        line.precision(17);
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Empty:
+            line << "empty";
+            break;
+        case Gkm::Solid::ESolidType::Cube:
+            line << "cube";
+            break;
+        case Gkm::Solid::ESolidType::Sphere:
+            line << "sphere";
+            break;
+        case Gkm::Solid::ESolidType::Union:
+        case Gkm::Solid::ESolidType::Difference:
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            const auto boolean_operator = std::static_pointer_cast<Gkm::Solid::IBooleanOperator>(solid);
+            operands.push_back(write(boolean_operator->left));
+            operands.push_back(write(boolean_operator->right));
+            line << (solid->type() == Gkm::Solid::ESolidType::Union ? "union" : solid->type() == Gkm::Solid::ESolidType::Difference ? "difference" : "intersection");
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+            operands.push_back(write(std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid)->solid));
+            line << "translate";
+            break;
+        case Gkm::Solid::ESolidType::MultiUnion:
+            for (auto& operand : std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid)->solids)
+            {
+                operands.push_back(write(operand));
+            }
+            line << "multi_union";
+            break;
+        default:
+            return std::string();
+        }
+        for (auto& operand : operands)
+        {
+            if (operand.empty())
+            {
+                return std::string();
+            }
+        }
+
+        const std::string name = "n" + std::to_string(names.size());
+        line << " " << name;
+        for (auto& operand : operands)
+        {
+            line << " " << operand;
+        }
+        if (solid->type() == Gkm::Solid::ESolidType::Cube)
+        {
+            line << " " << std::static_pointer_cast<Gkm::Solid::Cube>(solid)->half_edge_size;
+        }
+        else if (solid->type() == Gkm::Solid::ESolidType::Sphere)
+        {
+            line << " " << std::static_pointer_cast<Gkm::Solid::Sphere>(solid)->radius;
+        }
+        else if (solid->type() == Gkm::Solid::ESolidType::Transform)
+        {
+            const Eigen::Vector3d& translate = std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid)->translate;
+            line << " " << translate.x() << " " << translate.y() << " " << translate.z();
+        }
+        file << line.str() << "\n";
+        names.emplace(solid.get(), name);
+        return name;
+    }
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::readScene(const std::string& file_name, std::string* error)
+{
+    std::ifstream file(file_name);
+    if (!file)
+    {
+        if (error)
+        {
+            *error = "could not open " + file_name;
+        }
+        return nullptr;
+    }
+
+    std::unordered_map<std::string, ISolid::Ptr> nodes;
+    ISolid::Ptr last_node = nullptr;
+    std::string line;
+    std::string reason;
+    size_t line_number = 0;
+    while (std::getline(file, line))
+    {
+        ++line_number;
+        std::istringstream line_stream(line.substr(0, line.find('#')));
+        std::vector<std::string> tokens;
+        std::string token;
+        while (line_stream >> token)
+        {
+            tokens.push_back(token);
+        }
+        if (tokens.empty())
+        {
+            continue;
+        }
+        if (tokens.size() < 2)
+        {
+            reason = "node has no name";
+            break;
+        }
+        const std::string& kind = tokens[0];
+        const std::string& name = tokens[1];
+        if (nodes.count(name))
+        {
+            reason = "node " + name + " is already defined";
+            break;
+        }
+
+        // Operands are given by names, numbers follow them
+        size_t operand_count = 0;
+        size_t number_count = 0;
+        if (kind == "cube" || kind == "sphere")
+        {
+            number_count = 1;
+        }
+        else if (kind == "translate")
+        {
+            operand_count = 1;
+            number_count = 3;
+        }
+        else if (kind == "union" || kind == "difference" || kind == "intersection")
+        {
+            operand_count = 2;
+        }
+        else if (kind == "multi_union")
+        {
+            operand_count = tokens.size() - 2;
+        }
+        else if (kind != "empty")
+        {
+            reason = "unknown node " + kind;
+            break;
+        }
+        if (tokens.size() != 2 + operand_count + number_count)
+        {
+            reason = "wrong number of arguments of " + kind;
+            break;
+        }
+        std::vector<ISolid::Ptr> operands;
+        for (size_t i = 0; i < operand_count && reason.empty(); ++i)
+        {
+            const auto operand = nodes.find(tokens[2 + i]);
+            if (operand == nodes.end())
+            {
+                reason = "node " + tokens[2 + i] + " is not defined";
+            }
+            else
+            {
+                operands.push_back(operand->second);
+            }
+        }
+        std::vector<double> numbers(number_count);
+        for (size_t i = 0; i < number_count && reason.empty(); ++i)
+        {
+            if (!parseNumber(tokens[2 + operand_count + i], numbers[i]))
+            {
+                reason = "wrong number " + tokens[2 + operand_count + i];
+            }
+        }
+        if (!reason.empty())
+        {
+            break;
+        }
+
+        ISolid::Ptr node;
+        if (kind == "empty")
+        {
+            node = std::make_shared<EmptySolid>();
+        }
+        else if (kind == "cube")
+        {
+            auto cube = std::make_shared<Cube>();
+            cube->half_edge_size = numbers[0];
+            node = cube;
+        }
+        else if (kind == "sphere")
+        {
+            auto sphere = std::make_shared<Sphere>();
+            sphere->radius = numbers[0];
+            node = sphere;
+        }
+        else if (kind == "translate")
+        {
+            auto transform = std::make_shared<TransformOperator>();
+            transform->solid = operands[0];
+            transform->translate = Eigen::Vector3d(numbers[0], numbers[1], numbers[2]);
+            node = transform;
+        }
+        else if (kind == "multi_union")
+        {
+            auto multi_union = std::make_shared<MultiUnionOperator>();
+            for (auto& operand : operands)
+            {
+                multi_union->add(operand);
+            }
+            node = multi_union;
+        }
+        else
+        {
+            IBooleanOperator::Ptr boolean_operator;
+            if (kind == "union")
+            {
+                boolean_operator = std::make_shared<UnionOperator>();
+            }
+            else if (kind == "difference")
+            {
+                boolean_operator = std::make_shared<DifferenceOperator>();
+            }
+            else
+            {
+                boolean_operator = std::make_shared<IntersectionOperator>();
+            }
+            boolean_operator->left = operands[0];
+            boolean_operator->right = operands[1];
+            node = boolean_operator;
+        }
+        nodes.emplace(name, node);
+        last_node = node;
+    }
+    if (reason.empty() && !last_node)
+    {
+        reason = "scene has no nodes";
+    }
+    if (!reason.empty())
+    {
+        if (error)
+        {
+            *error = file_name + ":" + std::to_string(line_number) + ": " + reason;
+        }
+        return nullptr;
+    }
+    return last_node;
+}
+
+bool Gkm::Solid::writeScene(const std::string& file_name, const ISolid::Ptr& solid)
+{
+    std::ofstream file(file_name);
+    if (!file)
+    {
+        return false;
+    }
+    SceneWriter writer(file);
+    return !writer.write(solid).empty() && static_cast<bool>(file);
+}
+
+bool Gkm::Solid::writeStl(const std::string& file_name, const Model& model)
+{
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    // Values are little-endian as on all supported platforms
+    char header[80] = "gkm_solid";
+    file.write(header, sizeof(header));
+    const uint32_t triangle_count = static_cast<uint32_t>(model.points.size() / 3);
+    file.write(reinterpret_cast<const char*>(&triangle_count), sizeof(triangle_count));
+    std::vector<char> data(static_cast<size_t>(triangle_count) * 50, 0);
+    for (size_t i = 0; i < triangle_count; ++i)
+    {
+        const Eigen::Vector3f& a = model.points[3 * i];
+        const Eigen::Vector3f& b = model.points[3 * i + 1];
+        const Eigen::Vector3f& c = model.points[3 * i + 2];
+        Eigen::Vector3f normal = (b - a).cross(c - a);
+        if (normal.norm() > 0.0f)
+        {
+            normal.normalize();
+        }
+        // Normal, three vertices and zero attribute byte count
+        char* triangle = &data[50 * i];
+        std::memcpy(triangle, normal.data(), 3 * sizeof(float));
+        std::memcpy(triangle + 12, a.data(), 3 * sizeof(float));
+        std::memcpy(triangle + 24, b.data(), 3 * sizeof(float));
+        std::memcpy(triangle + 36, c.data(), 3 * sizeof(float));
+    }
+    file.write(data.data(), data.size());
+    return static_cast<bool>(file);
+}
+
+bool Gkm::Solid::writeObj(const std::string& file_name, const IndexedModel& model)
+{
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    std::string text;
+    char line[96];
+    for (auto& point : model.points)
+    {
+        const int size = std::snprintf(line, sizeof(line), "v %.9g %.9g %.9g\n", point.x(), point.y(), point.z());
+        text.append(line, static_cast<size_t>(size));
+    }
+    // Indices of OBJ start from one
+    for (size_t i = 0; i + 2 < model.indices.size(); i += 3)
+    {
+        const int size = std::snprintf(line, sizeof(line), "f %u %u %u\n", model.indices[i] + 1, model.indices[i + 1] + 1, model.indices[i + 2] + 1);
+        text.append(line, static_cast<size_t>(size));
+    }
+    file.write(text.data(), text.size());
+    return static_cast<bool>(file);
+}
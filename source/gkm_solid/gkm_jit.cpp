@@ -0,0 +1,789 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#if defined(_WIN32)
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "gkm_solid/gkm_jit.h"
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define GKM_JIT_X86_64
+#endif
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Read-only executable copy of machine code
+        class ExecutableMemory
+        {
+        public:
+            ExecutableMemory();
+            ~ExecutableMemory();
+            bool load(const std::vector<unsigned char>& code);
+            const void* get() const;
+
+        private:
+            void* memory = nullptr;
+            size_t size = 0;
+        };
+    }
+}
+
+namespace
+{
+    // Arguments of the kernel are passed by a single pointer, so the same code works for Windows and System V ABIs
+    struct KernelArguments
+    {
+        const double* x;
+        const double* y;
+        const double* z;
+        unsigned char* result;
+        size_t count;
+        double* slots;
+    };
+
+    typedef void (*KernelFunction)(const KernelArguments* arguments);
+
+    constexpr size_t LANE_COUNT = 4;
+    constexpr size_t SLOT_SIZE = LANE_COUNT * sizeof(double);
+
+    enum ERegister
+    {
+        Rax = 0,
+        Rcx = 1,
+        Rdx = 2,
+        Rdi = 7,
+        R8 = 8,
+        R9 = 9,
+        R10 = 10,
+        R11 = 11
+    };
+
+    // Operand which is encoded by ModRM.rm field
+    struct Operand
+    {
+        enum class EKind
+        {
+            Register,
+            Memory,
+            Constant
+        };
+
+        EKind kind = EKind::Register;
+        unsigned index = 0;
+        int32_t displacement = 0;
+
+        static Operand reg(unsigned index);
+        static Operand memory(unsigned base, int32_t displacement);
+        static Operand constant(unsigned constant_index);
+    };
+
+    Operand Operand::reg(unsigned index)
+    {
+        Operand result;
+        result.kind = EKind::Register;
+        result.index = index;
+        return result;
+    }
+
+    Operand Operand::memory(unsigned base, int32_t displacement)
+    {
+        Operand result;
+        result.kind = EKind::Memory;
+        result.index = base;
+        result.displacement = displacement;
+        return result;
+    }
+
+    Operand Operand::constant(unsigned constant_index)
+    {
+        Operand result;
+        result.kind = EKind::Constant;
+        result.index = constant_index;
+        return result;
+    }
+
+    // Minimal x86-64 assembler for the instructions used by the kernels.
+    // Constants are placed after the code and addressed relative to RIP.
+    class Assembler
+    {
+        struct ConstantFixup
+        {
+            size_t displacement_position;
+            size_t instruction_end;
+            unsigned constant_index;
+        };
+
+        std::vector<unsigned char> code;
+        std::vector<std::vector<unsigned char>> constants;
+        std::map<std::vector<unsigned char>, unsigned> constant_index;
+        std::vector<ConstantFixup> fixups;
+
+        void emitByte(unsigned value);
+        void emitInt32(int32_t value);
+        void emitModRm(unsigned reg, const Operand& rm);
+        void emitVex(unsigned map, bool wide, unsigned reg, unsigned source, const Operand& rm, unsigned opcode, int immediate = -1);
+
+    public:
+        static constexpr unsigned MAP_0F = 1;
+        static constexpr unsigned MAP_0F38 = 2;
+        static constexpr unsigned MAP_0F3A = 3;
+
+        unsigned addConstant(const void* data, size_t size);
+        unsigned addBroadcast(double value);
+        unsigned addBroadcast(uint64_t bits);
+
+        size_t position() const;
+        // General purpose instructions
+        void movLoad(unsigned destination, unsigned base, int32_t displacement);
+        void addImmediate(unsigned destination, int8_t value);
+        void decrement(unsigned destination);
+        void test(unsigned a, unsigned b);
+        size_t jumpIfZero();
+        size_t jump();
+        void patchJump(size_t jump_position, size_t target);
+        void ret();
+        // AVX instructions on ymm registers, source is encoded by VEX.vvvv
+        void vmovupdLoad(unsigned destination, const Operand& source);
+        void vmovupdStore(const Operand& destination, unsigned source);
+        void vpd(unsigned opcode, unsigned destination, unsigned source, const Operand& operand);
+        void vcmppd(unsigned destination, unsigned source, const Operand& operand, unsigned predicate);
+        void vextractf128(unsigned destination, unsigned source, unsigned index);
+        // AVX instructions on xmm registers
+        void vpshufb(unsigned destination, unsigned source, const Operand& operand);
+        void vpxmm(unsigned opcode, unsigned destination, unsigned source, const Operand& operand);
+        void vmovdStore(const Operand& destination, unsigned source);
+        void vzeroupper();
+
+        std::vector<unsigned char> finish();
+    };
+
+    constexpr unsigned Assembler::MAP_0F;
+    constexpr unsigned Assembler::MAP_0F38;
+    constexpr unsigned Assembler::MAP_0F3A;
+
+    // Opcodes of packed double operations in 0F map with 66 prefix
+    constexpr unsigned VANDPD = 0x54;
+    constexpr unsigned VANDNPD = 0x55;
+    constexpr unsigned VORPD = 0x56;
+    constexpr unsigned VXORPD = 0x57;
+    constexpr unsigned VADDPD = 0x58;
+    constexpr unsigned VMULPD = 0x59;
+    constexpr unsigned VSUBPD = 0x5C;
+    constexpr unsigned VPAND = 0xDB;
+    constexpr unsigned VPOR = 0xEB;
+    constexpr unsigned CMP_LE_OS = 0x02;
+
+    void Assembler::emitByte(unsigned value)
+    {
+        code.push_back(static_cast<unsigned char>(value));
+    }
+
+    void Assembler::emitInt32(int32_t value)
+    {
+        const uint32_t bits = static_cast<uint32_t>(value);
+        for (unsigned i = 0; i < 4; ++i)
+        {
+            emitByte((bits >> (i * 8)) & 0xFF);
+        }
+    }
+
+    void Assembler::emitModRm(unsigned reg, const Operand& rm)
+    {
+        switch (rm.kind)
+        {
+        case Operand::EKind::Register:
+            emitByte(0xC0 | ((reg & 7) << 3) | (rm.index & 7));
+            break;
+        case Operand::EKind::Memory:
+            // Base registers used by the kernels never require SIB byte
+            emitByte(0x80 | ((reg & 7) << 3) | (rm.index & 7));
+            emitInt32(rm.displacement);
+            break;
+        case Operand::EKind::Constant:
+            emitByte(0x00 | ((reg & 7) << 3) | 0x05);
+            fixups.push_back(ConstantFixup{ code.size(), 0, rm.index });
+            emitInt32(0);
+            break;
+        }
+    }
+
+    void Assembler::emitVex(unsigned map, bool wide, unsigned reg, unsigned source, const Operand& rm, unsigned opcode, int immediate)
+    {
+        const unsigned rm_extension = rm.kind == Operand::EKind::Constant ? 0 : (rm.index >> 3);
+        // Three bytes VEX prefix with 66 implied prefix
+        emitByte(0xC4);
+        emitByte(((~reg >> 3) & 1) << 7 | 1 << 6 | ((~rm_extension) & 1) << 5 | map);
+        emitByte(((~source) & 15) << 3 | (wide ? 1 : 0) << 2 | 1);
+        emitByte(opcode);
+        const size_t fixup_count = fixups.size();
+        emitModRm(reg, rm);
+        if (immediate >= 0)
+        {
+            emitByte(static_cast<unsigned>(immediate));
+        }
+        if (fixups.size() != fixup_count)
+        {
+            fixups.back().instruction_end = code.size();
+        }
+    }
+
+    unsigned Assembler::addConstant(const void* data, size_t size)
+    {
+        std::vector<unsigned char> bytes(SLOT_SIZE, 0);
+        std::memcpy(bytes.data(), data, std::min(size, SLOT_SIZE));
+        auto found_it = constant_index.find(bytes);
+        if (found_it != constant_index.end())
+        {
+            return found_it->second;
+        }
+        const unsigned index = static_cast<unsigned>(constants.size());
+        constants.push_back(bytes);
+        constant_index.emplace(bytes, index);
+        return index;
+    }
+
+    unsigned Assembler::addBroadcast(double value)
+    {
+        const double values[LANE_COUNT] = { value, value, value, value };
+        return addConstant(values, sizeof(values));
+    }
+
+    unsigned Assembler::addBroadcast(uint64_t bits)
+    {
+        const uint64_t values[LANE_COUNT] = { bits, bits, bits, bits };
+        return addConstant(values, sizeof(values));
+    }
+
+    size_t Assembler::position() const
+    {
+        return code.size();
+    }
+
+    void Assembler::movLoad(unsigned destination, unsigned base, int32_t displacement)
+    {
+        emitByte(0x48 | ((destination >> 3) << 2) | (base >> 3));
+        emitByte(0x8B);
+        emitModRm(destination, Operand::memory(base, displacement));
+    }
+
+    void Assembler::addImmediate(unsigned destination, int8_t value)
+    {
+        emitByte(0x48 | (destination >> 3));
+        emitByte(0x83);
+        emitModRm(0, Operand::reg(destination));
+        emitByte(static_cast<unsigned char>(value));
+    }
+
+    void Assembler::decrement(unsigned destination)
+    {
+        emitByte(0x48 | (destination >> 3));
+        emitByte(0xFF);
+        emitModRm(1, Operand::reg(destination));
+    }
+
+    void Assembler::test(unsigned a, unsigned b)
+    {
+        emitByte(0x48 | ((b >> 3) << 2) | (a >> 3));
+        emitByte(0x85);
+        emitModRm(b, Operand::reg(a));
+    }
+
+    size_t Assembler::jumpIfZero()
+    {
+        emitByte(0x0F);
+        emitByte(0x84);
+        emitInt32(0);
+        return code.size();
+    }
+
+    size_t Assembler::jump()
+    {
+        emitByte(0xE9);
+        emitInt32(0);
+        return code.size();
+    }
+
+    void Assembler::patchJump(size_t jump_position, size_t target)
+    {
+        const int32_t offset = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(jump_position));
+        std::memcpy(&code[jump_position - 4], &offset, sizeof(offset));
+    }
+
+    void Assembler::ret()
+    {
+        emitByte(0xC3);
+    }
+
+    void Assembler::vmovupdLoad(unsigned destination, const Operand& source)
+    {
+        emitVex(MAP_0F, true, destination, 0, source, 0x10);
+    }
+
+    void Assembler::vmovupdStore(const Operand& destination, unsigned source)
+    {
+        emitVex(MAP_0F, true, source, 0, destination, 0x11);
+    }
+
+    void Assembler::vpd(unsigned opcode, unsigned destination, unsigned source, const Operand& operand)
+    {
+        emitVex(MAP_0F, true, destination, source, operand, opcode);
+    }
+
+    void Assembler::vcmppd(unsigned destination, unsigned source, const Operand& operand, unsigned predicate)
+    {
+        emitVex(MAP_0F, true, destination, source, operand, 0xC2, static_cast<int>(predicate));
+    }
+
+    void Assembler::vextractf128(unsigned destination, unsigned source, unsigned index)
+    {
+        emitVex(MAP_0F3A, true, source, 0, Operand::reg(destination), 0x19, static_cast<int>(index));
+    }
+
+    void Assembler::vpshufb(unsigned destination, unsigned source, const Operand& operand)
+    {
+        emitVex(MAP_0F38, false, destination, source, operand, 0x00);
+    }
+
+    void Assembler::vpxmm(unsigned opcode, unsigned destination, unsigned source, const Operand& operand)
+    {
+        emitVex(MAP_0F, false, destination, source, operand, opcode);
+    }
+
+    void Assembler::vmovdStore(const Operand& destination, unsigned source)
+    {
+        emitVex(MAP_0F, false, source, 0, destination, 0x7E);
+    }
+
+    void Assembler::vzeroupper()
+    {
+        emitByte(0xC5);
+        emitByte(0xF8);
+        emitByte(0x77);
+    }
+
+    std::vector<unsigned char> Assembler::finish()
+    {
+        std::vector<unsigned char> result = code;
+        // Align constants by the size of ymm register
+        while (result.size() % SLOT_SIZE)
+        {
+            result.push_back(0xCC);
+        }
+        const size_t constants_position = result.size();
+        for (auto& constant : constants)
+        {
+            result.insert(result.end(), constant.begin(), constant.end());
+        }
+        for (auto& fixup : fixups)
+        {
+            const int64_t target = static_cast<int64_t>(constants_position + fixup.constant_index * SLOT_SIZE);
+            const int32_t displacement = static_cast<int32_t>(target - static_cast<int64_t>(fixup.instruction_end));
+            std::memcpy(&result[fixup.displacement_position], &displacement, sizeof(displacement));
+        }
+        return result;
+    }
+
+    // Emits code which leaves local coordinate of a point along the axis in ymm register
+    void emitLocalCoordinate(Assembler& assembler, const Gkm::Solid::Tape& tape, const Gkm::Solid::TapeInstruction& instruction, unsigned axis, unsigned destination)
+    {
+        unsigned source = axis;
+        for (unsigned i = 0; i < instruction.offset_count; ++i)
+        {
+            const double offset = tape.getOffsets()[instruction.offset_begin + i][axis];
+            assembler.vpd(VSUBPD, destination, source, Operand::constant(assembler.addBroadcast(offset)));
+            source = destination;
+        }
+        if (source != destination)
+        {
+            // Copy by bitwise or with itself
+            assembler.vpd(VORPD, destination, source, Operand::reg(source));
+        }
+    }
+
+    bool emitKernel(const Gkm::Solid::Tape& tape, Assembler& assembler)
+    {
+        // ymm0, ymm1, ymm2 keep coordinates of 4 points, ymm3, ymm4 are temporary registers,
+        // only registers which are volatile in both Windows and System V ABIs are used.
+        const auto& instructions = tape.getInstructions();
+        for (auto& instruction : instructions)
+        {
+            if (instruction.op_code == Gkm::Solid::ETapeOpCode::Solid)
+            {
+                return false;
+            }
+        }
+
+        const unsigned abs_mask = assembler.addBroadcast(static_cast<uint64_t>(0x7FFFFFFFFFFFFFFFull));
+        const unsigned char shuffle_low_bytes[16] = { 0, 8, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+        const unsigned char shuffle_high_bytes[16] = { 0x80, 0x80, 0, 8, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+        const unsigned char one_bytes[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 };
+        const unsigned shuffle_low = assembler.addConstant(shuffle_low_bytes, sizeof(shuffle_low_bytes));
+        const unsigned shuffle_high = assembler.addConstant(shuffle_high_bytes, sizeof(shuffle_high_bytes));
+        const unsigned ones = assembler.addConstant(one_bytes, sizeof(one_bytes));
+
+#if defined(_WIN32)
+        const unsigned arguments = Rcx;
+#else
+        const unsigned arguments = Rdi;
+#endif
+        assembler.movLoad(R8, arguments, offsetof(KernelArguments, x));
+        assembler.movLoad(R9, arguments, offsetof(KernelArguments, y));
+        assembler.movLoad(R10, arguments, offsetof(KernelArguments, z));
+        assembler.movLoad(R11, arguments, offsetof(KernelArguments, result));
+        assembler.movLoad(Rdx, arguments, offsetof(KernelArguments, count));
+        // It should be the last one, because rcx keeps arguments on Windows
+        assembler.movLoad(Rcx, arguments, offsetof(KernelArguments, slots));
+
+        const size_t loop_start = assembler.position();
+        assembler.test(Rdx, Rdx);
+        const size_t exit_jump = assembler.jumpIfZero();
+        assembler.vmovupdLoad(0, Operand::memory(R8, 0));
+        assembler.vmovupdLoad(1, Operand::memory(R9, 0));
+        assembler.vmovupdLoad(2, Operand::memory(R10, 0));
+
+        for (size_t instruction_index = 0; instruction_index < instructions.size(); ++instruction_index)
+        {
+            const Gkm::Solid::TapeInstruction& instruction = instructions[instruction_index];
+            const Operand left = Operand::memory(Rcx, static_cast<int32_t>(instruction.left * SLOT_SIZE));
+            const Operand right = Operand::memory(Rcx, static_cast<int32_t>(instruction.right * SLOT_SIZE));
+            switch (instruction.op_code)
+            {
+            case Gkm::Solid::ETapeOpCode::False:
+                assembler.vpd(VXORPD, 3, 3, Operand::reg(3));
+                break;
+            case Gkm::Solid::ETapeOpCode::Cube:
+            {
+                const Operand half_edge_size = Operand::constant(assembler.addBroadcast(instruction.size));
+                for (unsigned axis = 0; axis < 3; ++axis)
+                {
+                    const unsigned destination = axis == 0 ? 3 : 4;
+                    emitLocalCoordinate(assembler, tape, instruction, axis, destination);
+                    assembler.vpd(VANDPD, destination, destination, Operand::constant(abs_mask));
+                    assembler.vcmppd(destination, destination, half_edge_size, CMP_LE_OS);
+                    if (axis != 0)
+                    {
+                        assembler.vpd(VANDPD, 3, 3, Operand::reg(4));
+                    }
+                }
+                break;
+            }
+            case Gkm::Solid::ETapeOpCode::Sphere:
+                for (unsigned axis = 0; axis < 3; ++axis)
+                {
+                    const unsigned destination = axis == 0 ? 3 : 4;
+                    emitLocalCoordinate(assembler, tape, instruction, axis, destination);
+                    assembler.vpd(VMULPD, destination, destination, Operand::reg(destination));
+                    if (axis != 0)
+                    {
+                        assembler.vpd(VADDPD, 3, 3, Operand::reg(4));
+                    }
+                }
+                assembler.vcmppd(3, 3, Operand::constant(assembler.addBroadcast(instruction.size * instruction.size)), CMP_LE_OS);
+                break;
+            case Gkm::Solid::ETapeOpCode::Union:
+                assembler.vmovupdLoad(3, left);
+                assembler.vpd(VORPD, 3, 3, right);
+                break;
+            case Gkm::Solid::ETapeOpCode::Difference:
+                assembler.vmovupdLoad(3, right);
+                assembler.vpd(VANDNPD, 3, 3, left);
+                break;
+            case Gkm::Solid::ETapeOpCode::Intersection:
+                assembler.vmovupdLoad(3, left);
+                assembler.vpd(VANDPD, 3, 3, right);
+                break;
+            case Gkm::Solid::ETapeOpCode::Solid:
+                return false;
+            }
+            assembler.vmovupdStore(Operand::memory(Rcx, static_cast<int32_t>(instruction_index * SLOT_SIZE)), 3);
+        }
+
+        // Convert 4 lane masks of the last instruction into 4 bytes with 0 or 1 values
+        assembler.vextractf128(4, 3, 1);
+        assembler.vpshufb(3, 3, Operand::constant(shuffle_low));
+        assembler.vpshufb(4, 4, Operand::constant(shuffle_high));
+        assembler.vpxmm(VPOR, 3, 3, Operand::reg(4));
+        assembler.vpxmm(VPAND, 3, 3, Operand::constant(ones));
+        assembler.vmovdStore(Operand::memory(R11, 0), 3);
+
+        assembler.addImmediate(R8, static_cast<int8_t>(SLOT_SIZE));
+        assembler.addImmediate(R9, static_cast<int8_t>(SLOT_SIZE));
+        assembler.addImmediate(R10, static_cast<int8_t>(SLOT_SIZE));
+        assembler.addImmediate(R11, static_cast<int8_t>(LANE_COUNT));
+        assembler.decrement(Rdx);
+        assembler.patchJump(assembler.jump(), loop_start);
+        assembler.patchJump(exit_jump, assembler.position());
+        assembler.vzeroupper();
+        assembler.ret();
+        return true;
+    }
+
+    bool sameTapes(const Gkm::Solid::Tape& a, const Gkm::Solid::Tape& b)
+    {
+        const auto& a_instructions = a.getInstructions();
+        const auto& b_instructions = b.getInstructions();
+        if (a_instructions.size() != b_instructions.size() || a.getOffsets() != b.getOffsets())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a_instructions.size(); ++i)
+        {
+            const Gkm::Solid::TapeInstruction& a_instruction = a_instructions[i];
+            const Gkm::Solid::TapeInstruction& b_instruction = b_instructions[i];
+            if (a_instruction.op_code != b_instruction.op_code ||
+                a_instruction.left != b_instruction.left ||
+                a_instruction.right != b_instruction.right ||
+                a_instruction.offset_begin != b_instruction.offset_begin ||
+                a_instruction.offset_count != b_instruction.offset_count ||
+                a_instruction.size != b_instruction.size ||
+                a_instruction.solid != b_instruction.solid)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool detectAvx2()
+    {
+#if defined(GKM_JIT_X86_64)
+#if defined(_MSC_VER)
+        int info[4] = { 0 };
+        __cpuid(info, 0);
+        if (info[0] < 7)
+        {
+            return false;
+        }
+        __cpuid(info, 1);
+        const bool os_xsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        // OS should save ymm registers on context switches
+        if (!os_xsave || !avx || (_xgetbv(0) & 6) != 6)
+        {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+#else
+        return false;
+#endif
+    }
+}
+
+Gkm::Solid::ExecutableMemory::ExecutableMemory()
+{
+}
+
+Gkm::Solid::ExecutableMemory::~ExecutableMemory()
+{
+    if (!memory)
+    {
+        return;
+    }
+#if defined(_WIN32)
+    VirtualFree(memory, 0, MEM_RELEASE);
+#else
+    munmap(memory, size);
+#endif
+}
+
+bool Gkm::Solid::ExecutableMemory::load(const std::vector<unsigned char>& code)
+{
+    size = code.size();
+#if defined(_WIN32)
+    memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if (!memory)
+    {
+        return false;
+    }
+    std::memcpy(memory, code.data(), size);
+    DWORD old_protection = 0;
+    if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &old_protection))
+    {
+        return false;
+    }
+    FlushInstructionCache(GetCurrentProcess(), memory, size);
+    return true;
+#else
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    memory = mapped;
+    std::memcpy(memory, code.data(), size);
+    // Memory is never writable and executable at the same time
+    return mprotect(memory, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+const void* Gkm::Solid::ExecutableMemory::get() const
+{
+    return memory;
+}
+
+Gkm::Solid::JitKernel::JitKernel(const Tape::Ptr& tape_, std::unique_ptr<ExecutableMemory> code_) :
+    tape(tape_), code(std::move(code_))
+{
+}
+
+Gkm::Solid::JitKernel::~JitKernel()
+{
+}
+
+void Gkm::Solid::JitKernel::evaluate(const PointBatch& points, std::vector<unsigned char>& result) const
+{
+    const size_t point_count = points.size();
+    result.resize(point_count);
+    std::vector<double> slots(tape->getInstructions().size() * LANE_COUNT);
+    const KernelFunction function = reinterpret_cast<KernelFunction>(const_cast<void*>(code->get()));
+
+    KernelArguments arguments;
+    arguments.x = points.x.data();
+    arguments.y = points.y.data();
+    arguments.z = points.z.data();
+    arguments.result = result.data();
+    arguments.count = point_count / LANE_COUNT;
+    arguments.slots = slots.data();
+    function(&arguments);
+
+    // The tail is padded by copies of the last point
+    const size_t tail_start = arguments.count * LANE_COUNT;
+    if (tail_start < point_count)
+    {
+        double tail_x[LANE_COUNT];
+        double tail_y[LANE_COUNT];
+        double tail_z[LANE_COUNT];
+        unsigned char tail_result[LANE_COUNT];
+        for (size_t i = 0; i < LANE_COUNT; ++i)
+        {
+            const size_t index = std::min(tail_start + i, point_count - 1);
+            tail_x[i] = points.x[index];
+            tail_y[i] = points.y[index];
+            tail_z[i] = points.z[index];
+        }
+        arguments.x = tail_x;
+        arguments.y = tail_y;
+        arguments.z = tail_z;
+        arguments.result = tail_result;
+        arguments.count = 1;
+        function(&arguments);
+        std::copy(tail_result, tail_result + (point_count - tail_start), &result[tail_start]);
+    }
+}
+
+const Gkm::Solid::Tape::Ptr& Gkm::Solid::JitKernel::getTape() const
+{
+    return tape;
+}
+
+bool Gkm::Solid::JitCompiler::isSupported()
+{
+    static const bool supported = detectAvx2();
+    return supported;
+}
+
+Gkm::Solid::JitCompiler::JitCompiler(size_t max_kernel_count_) :
+    max_kernel_count(std::max<size_t>(max_kernel_count_, 1))
+{
+}
+
+Gkm::Solid::JitKernel::Ptr Gkm::Solid::JitCompiler::compile(const Tape::Ptr& tape)
+{
+    if (!isSupported())
+    {
+        return nullptr;
+    }
+
+    const size_t tape_hash = tape->hash();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto range = kernels.equal_range(tape_hash);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (sameTapes(*it->second->second->getTape(), *tape))
+            {
+                recent_kernels.splice(recent_kernels.begin(), recent_kernels, it->second);
+                return it->second->second;
+            }
+        }
+    }
+
+    Assembler assembler;
+    if (!emitKernel(*tape, assembler))
+    {
+        return nullptr;
+    }
+    auto code = std::make_unique<ExecutableMemory>();
+    if (!code->load(assembler.finish()))
+    {
+        return nullptr;
+    }
+    auto kernel = std::make_shared<JitKernel>(tape, std::move(code));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    recent_kernels.emplace_front(tape_hash, kernel);
+    kernels.emplace(tape_hash, recent_kernels.begin());
+    if (recent_kernels.size() > max_kernel_count)
+    {
+        // Evaluators which use the evicted kernel keep it alive
+        auto range = kernels.equal_range(recent_kernels.back().first);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == std::prev(recent_kernels.end()))
+            {
+                kernels.erase(it);
+                break;
+            }
+        }
+        recent_kernels.pop_back();
+    }
+    return kernel;
+}
+
+size_t Gkm::Solid::JitCompiler::getKernelCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return kernels.size();
+}
+
+Gkm::Solid::SolidEvaluator::SolidEvaluator(const ISolid::Ptr& solid, JitCompiler* jit_compiler)
+{
+    tape = std::make_shared<Tape>(solid);
+    if (jit_compiler)
+    {
+        kernel = jit_compiler->compile(tape);
+    }
+}
+
+void Gkm::Solid::SolidEvaluator::evaluate(const PointBatch& points, std::vector<unsigned char>& result) const
+{
+    if (kernel)
+    {
+        kernel->evaluate(points, result);
+    }
+    else
+    {
+        tape->evaluate(points, result, EPrecision::Mixed);
+    }
+}
+
+bool Gkm::Solid::SolidEvaluator::isCompiled() const
+{
+    return kernel != nullptr;
+}
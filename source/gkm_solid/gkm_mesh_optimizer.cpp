@@ -0,0 +1,349 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "gkm_solid/gkm_mesh_optimizer.h"
+
+namespace
+{
+    constexpr uint32_t NO_VERTEX = UINT32_MAX;
+
+    // Triangles of vertex v are triangles[offsets[v]] to triangles[offsets[v + 1]] exclusive
+    struct VertexTriangles
+    {
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> triangles;
+
+        VertexTriangles(const std::vector<uint32_t>& indices, size_t vertex_count)
+        {
+            offsets.assign(vertex_count + 1, 0);
+            for (uint32_t vertex : indices)
+            {
+                ++offsets[vertex + 1];
+            }
+            for (size_t i = 0; i < vertex_count; ++i)
+            {
+                offsets[i + 1] += offsets[i];
+            }
+            triangles.resize(indices.size());
+            std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (size_t i = 0; i < indices.size(); ++i)
+            {
+                triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+            }
+        }
+    };
+
+    // FIFO cache where a vertex is cached if fewer than cache_size misses happened since it was loaded
+    class CacheSimulator
+    {
+    public:
+        CacheSimulator(size_t vertex_count, unsigned cache_size_) :
+            cache_size(cache_size_), load_times(vertex_count, 0), time(cache_size_ + 1)
+        {
+        }
+
+        // Returns true if the vertex is missed and loaded
+        bool access(uint32_t vertex)
+        {
+            if (time - load_times[vertex] <= cache_size)
+            {
+                return false;
+            }
+            load_times[vertex] = time++;
+            return true;
+        }
+
+        void flush()
+        {
+            time += cache_size + 1;
+        }
+
+    private:
+        uint64_t cache_size;
+        std::vector<uint64_t> load_times;
+        uint64_t time;
+    };
+
+    // Tipsify emits all remaining triangles around a fanning vertex, then chooses the next fanning vertex among vertices of
+    // these triangles which are still in the cache and have the fewest remaining triangles.
+    // Positions where it has to jump to a vertex out of the last fan are stored to hard_boundaries.
+    std::vector<uint32_t> tipsify(const std::vector<uint32_t>& indices, size_t vertex_count, unsigned cache_size, std::vector<size_t>& hard_boundaries)
+    {
+        const size_t triangle_count = indices.size() / 3;
+        const VertexTriangles vertex_triangles(indices, vertex_count);
+        std::vector<uint32_t> live_counts(vertex_count);
+        for (size_t i = 0; i < vertex_count; ++i)
+        {
+            live_counts[i] = vertex_triangles.offsets[i + 1] - vertex_triangles.offsets[i];
+        }
+        std::vector<uint64_t> cache_times(vertex_count, 0);
+        uint64_t time = cache_size + 1;
+        std::vector<char> emitted(triangle_count, 0);
+        std::vector<uint32_t> dead_ends;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> order;
+        order.reserve(triangle_count);
+        size_t cursor = 0;
+
+        uint32_t fanning = NO_VERTEX;
+        while (cursor < vertex_count && live_counts[cursor] == 0)
+        {
+            ++cursor;
+        }
+        if (cursor < vertex_count)
+        {
+            fanning = static_cast<uint32_t>(cursor);
+        }
+        while (fanning != NO_VERTEX)
+        {
+            candidates.clear();
+            for (uint32_t k = vertex_triangles.offsets[fanning]; k < vertex_triangles.offsets[fanning + 1]; ++k)
+            {
+                const uint32_t triangle = vertex_triangles.triangles[k];
+                if (emitted[triangle])
+                {
+                    continue;
+                }
+                emitted[triangle] = 1;
+                order.push_back(triangle);
+                for (unsigned corner = 0; corner < 3; ++corner)
+                {
+                    const uint32_t vertex = indices[3 * triangle + corner];
+                    dead_ends.push_back(vertex);
+                    candidates.push_back(vertex);
+                    --live_counts[vertex];
+                    if (time - cache_times[vertex] > cache_size)
+                    {
+                        cache_times[vertex] = time++;
+                    }
+                }
+            }
+
+            // Vertex which stays in the cache until all its triangles are emitted and which is the oldest one of them
+            uint32_t next = NO_VERTEX;
+            int64_t best_priority = -1;
+            for (uint32_t vertex : candidates)
+            {
+                if (live_counts[vertex] == 0)
+                {
+                    continue;
+                }
+                int64_t priority = 0;
+                if (time - cache_times[vertex] + 2 * live_counts[vertex] <= cache_size)
+                {
+                    priority = static_cast<int64_t>(time - cache_times[vertex]);
+                }
+                if (priority > best_priority)
+                {
+                    best_priority = priority;
+                    next = vertex;
+                }
+            }
+            if (next == NO_VERTEX)
+            {
+                // Dead end, recently used vertices are tried first, then the lowest vertex which is not finished
+                while (!dead_ends.empty() && next == NO_VERTEX)
+                {
+                    const uint32_t vertex = dead_ends.back();
+                    dead_ends.pop_back();
+                    if (live_counts[vertex] > 0)
+                    {
+                        next = vertex;
+                    }
+                }
+                while (next == NO_VERTEX && cursor < vertex_count)
+                {
+                    if (live_counts[cursor] > 0)
+                    {
+                        next = static_cast<uint32_t>(cursor);
+                    }
+                    ++cursor;
+                }
+                if (next != NO_VERTEX)
+                {
+                    hard_boundaries.push_back(order.size());
+                }
+            }
+            fanning = next;
+        }
+        return order;
+    }
+
+    // Cuts each run between hard boundaries where the cache miss ratio of the current cluster started with the empty cache
+    // falls to threshold times the ratio of the whole run, so a cluster costs little more than if it stays in the run
+    std::vector<size_t> splitClusters(const std::vector<uint32_t>& indices, size_t vertex_count, unsigned cache_size, double threshold,
+        const std::vector<size_t>& hard_boundaries)
+    {
+        const size_t triangle_count = indices.size() / 3;
+        std::vector<size_t> run_starts;
+        run_starts.push_back(0);
+        run_starts.insert(run_starts.end(), hard_boundaries.begin(), hard_boundaries.end());
+        run_starts.push_back(triangle_count);
+
+        std::vector<size_t> cluster_starts;
+        CacheSimulator cache(vertex_count, cache_size);
+        for (size_t run = 0; run + 1 < run_starts.size(); ++run)
+        {
+            const size_t begin = run_starts[run];
+            const size_t end = run_starts[run + 1];
+            if (begin == end)
+            {
+                continue;
+            }
+            cache.flush();
+            size_t run_misses = 0;
+            for (size_t i = 3 * begin; i < 3 * end; ++i)
+            {
+                run_misses += cache.access(indices[i]) ? 1 : 0;
+            }
+            const double max_ratio = threshold * static_cast<double>(run_misses) / static_cast<double>(end - begin);
+
+            cache.flush();
+            cluster_starts.push_back(begin);
+            size_t cluster_misses = 0;
+            for (size_t triangle = begin; triangle < end; ++triangle)
+            {
+                for (unsigned corner = 0; corner < 3; ++corner)
+                {
+                    cluster_misses += cache.access(indices[3 * triangle + corner]) ? 1 : 0;
+                }
+                const size_t cluster_size = triangle + 1 - cluster_starts.back();
+                if (triangle + 1 < end && static_cast<double>(cluster_misses) <= max_ratio * static_cast<double>(cluster_size))
+                {
+                    cluster_starts.push_back(triangle + 1);
+                    cluster_misses = 0;
+                    cache.flush();
+                }
+            }
+        }
+        cluster_starts.push_back(triangle_count);
+        return cluster_starts;
+    }
+
+    struct Cluster
+    {
+        size_t begin = 0;
+        size_t end = 0;
+        double outwardness = 0.0;
+    };
+}
+
+void Gkm::Solid::optimizeTriangleOrder(IndexedModel& model, const MeshOptimizationOptions& options)
+{
+    const size_t vertex_count = model.points.size();
+    const size_t triangle_count = model.indices.size() / 3;
+    if (triangle_count == 0)
+    {
+        return;
+    }
+    const unsigned cache_size = std::max(options.cache_size, 3u);
+    std::vector<size_t> hard_boundaries;
+    const std::vector<uint32_t> order = tipsify(model.indices, vertex_count, cache_size, hard_boundaries);
+    std::vector<uint32_t> indices;
+    indices.reserve(model.indices.size());
+    for (uint32_t triangle : order)
+    {
+        indices.insert(indices.end(), model.indices.begin() + 3 * triangle, model.indices.begin() + 3 * triangle + 3);
+    }
+    if (options.overdraw_threshold <= 0.0)
+    {
+        model.indices.swap(indices);
+        return;
+    }
+
+    // Clusters which face away from the center of the mesh are likely on the outer surface, they are drawn first,
+    // so the depth test rejects fragments of inner clusters from most of view directions
+    const std::vector<size_t> cluster_starts = splitClusters(indices, vertex_count, cache_size, options.overdraw_threshold, hard_boundaries);
+    std::vector<Cluster> clusters(cluster_starts.size() - 1);
+    std::vector<Eigen::Vector3d> centroids(clusters.size(), Eigen::Vector3d::Zero());
+    std::vector<Eigen::Vector3d> normals(clusters.size(), Eigen::Vector3d::Zero());
+    Eigen::Vector3d mesh_centroid = Eigen::Vector3d::Zero();
+    double mesh_area = 0.0;
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        clusters[c].begin = cluster_starts[c];
+        clusters[c].end = cluster_starts[c + 1];
+        double area = 0.0;
+        for (size_t triangle = clusters[c].begin; triangle < clusters[c].end; ++triangle)
+        {
+            const Eigen::Vector3d a = model.points[indices[3 * triangle]].cast<double>();
+            const Eigen::Vector3d b = model.points[indices[3 * triangle + 1]].cast<double>();
+            const Eigen::Vector3d d = model.points[indices[3 * triangle + 2]].cast<double>();
+            const Eigen::Vector3d normal = (b - a).cross(d - a);
+            const double triangle_area = normal.norm();
+            centroids[c] += triangle_area * (a + b + d) / 3.0;
+            normals[c] += normal;
+            area += triangle_area;
+        }
+        mesh_centroid += centroids[c];
+        mesh_area += area;
+        if (area > 0.0)
+        {
+            centroids[c] /= area;
+        }
+    }
+    if (mesh_area > 0.0)
+    {
+        mesh_centroid /= mesh_area;
+    }
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        const double normal_length = normals[c].norm();
+        if (normal_length > 0.0)
+        {
+            clusters[c].outwardness = (centroids[c] - mesh_centroid).dot(normals[c]) / normal_length;
+        }
+    }
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster& left, const Cluster& right)
+    {
+        return left.outwardness > right.outwardness;
+    });
+    model.indices.clear();
+    for (auto& cluster : clusters)
+    {
+        model.indices.insert(model.indices.end(), indices.begin() + 3 * cluster.begin, indices.begin() + 3 * cluster.end);
+    }
+}
+
+void Gkm::Solid::optimizeVertexOrder(IndexedModel& model)
+{
+    std::vector<uint32_t> remap(model.points.size(), NO_VERTEX);
+    std::vector<Eigen::Vector3f> points;
+    points.reserve(model.points.size());
+    for (uint32_t& vertex : model.indices)
+    {
+        if (remap[vertex] == NO_VERTEX)
+        {
+            remap[vertex] = static_cast<uint32_t>(points.size());
+            points.push_back(model.points[vertex]);
+        }
+        vertex = remap[vertex];
+    }
+    // Vertices which are not used by triangles are dropped
+    model.points.swap(points);
+}
+
+void Gkm::Solid::optimizeMesh(IndexedModel& model, const MeshOptimizationOptions& options)
+{
+    optimizeTriangleOrder(model, options);
+    optimizeVertexOrder(model);
+}
+
+double Gkm::Solid::averageCacheMissRatio(const IndexedModel& model, unsigned cache_size)
+{
+    const size_t triangle_count = model.indices.size() / 3;
+    if (triangle_count == 0)
+    {
+        return 0.0;
+    }
+    CacheSimulator cache(model.points.size(), cache_size);
+    size_t misses = 0;
+    for (uint32_t vertex : model.indices)
+    {
+        misses += cache.access(vertex) ? 1 : 0;
+    }
+    return static_cast<double>(misses) / static_cast<double>(triangle_count);
+}
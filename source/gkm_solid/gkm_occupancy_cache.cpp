@@ -0,0 +1,288 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cmath>
+#include "gkm_solid/gkm_occupancy_cache.h"
+
+namespace
+{
+    // Number of bisection steps which locate a boundary crossing of a ray within a half cell step
+    constexpr unsigned BISECTION_STEP_COUNT = 24;
+}
+
+Gkm::Solid::OccupancyCache::OccupancyCache(const ISolid::Ptr& solid, double cell_size_, unsigned brick_size_) :
+    solid_bbox(solid->bbox()), cell_size(cell_size_), brick_size(std::max(brick_size_, 1u))
+{
+    if (solid_bbox.isEmpty() || cell_size <= 0.0)
+    {
+        origin = Eigen::Vector3d::Zero();
+        return;
+    }
+
+    // One cell margin keeps the surface off the grid border
+    origin = solid_bbox.min() - Eigen::Vector3d::Constant(cell_size);
+    const Eigen::Vector3d sizes = solid_bbox.sizes() + Eigen::Vector3d::Constant(2.0 * cell_size);
+    const double brick_length = brick_size * cell_size;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        brick_counts[axis] = std::max(1u, static_cast<unsigned>(std::ceil(sizes[axis] / brick_length)));
+    }
+    bricks.resize(static_cast<size_t>(brick_counts[0]) * brick_counts[1] * brick_counts[2]);
+
+    const unsigned lattice_size = brick_size + 1;
+    const size_t brick_value_count = static_cast<size_t>(lattice_size) * lattice_size * lattice_size;
+    std::vector<unsigned char> brick_values(brick_value_count);
+    std::vector<RaySpan> spans;
+    const Eigen::Vector3d direction(1.0, 0.0, 0.0);
+    size_t brick_index = 0;
+    for (unsigned brick_z = 0; brick_z < brick_counts[2]; ++brick_z)
+    {
+        for (unsigned brick_y = 0; brick_y < brick_counts[1]; ++brick_y)
+        {
+            for (unsigned brick_x = 0; brick_x < brick_counts[0]; ++brick_x, ++brick_index)
+            {
+                const Eigen::Vector3d brick_min = origin + Eigen::Vector3d(brick_x, brick_y, brick_z) * brick_length;
+                bool has_inside = false;
+                bool has_outside = false;
+                for (unsigned k = 0; k < lattice_size; ++k)
+                {
+                    for (unsigned j = 0; j < lattice_size; ++j)
+                    {
+                        // Lattice line along X axis, the ray parameter is the absolute X coordinate
+                        const Eigen::Vector3d line_origin(0.0, brick_min.y() + j * cell_size, brick_min.z() + k * cell_size);
+                        solid->raySpans(line_origin, direction, brick_min.x(), brick_min.x() + brick_length, spans);
+                        if (spans.empty())
+                        {
+                            has_outside = true;
+                        }
+                        else if (spans.size() > 1 || spans.front().begin > brick_min.x() || spans.front().end < brick_min.x() + brick_length)
+                        {
+                            has_inside = true;
+                            has_outside = true;
+                        }
+                        else
+                        {
+                            has_inside = true;
+                        }
+                        unsigned char* line_values = &brick_values[(static_cast<size_t>(k) * lattice_size + j) * lattice_size];
+                        size_t span_index = 0;
+                        for (unsigned i = 0; i < lattice_size; ++i)
+                        {
+                            const double x = brick_min.x() + i * cell_size;
+                            while (span_index < spans.size() && spans[span_index].end < x)
+                            {
+                                ++span_index;
+                            }
+                            line_values[i] = span_index < spans.size() && spans[span_index].begin <= x;
+                        }
+                    }
+                }
+
+                Brick& brick = bricks[brick_index];
+                if (has_inside && has_outside)
+                {
+                    brick.state = EBrickState::Band;
+                    brick.value_offset = values.size();
+                    values.insert(values.end(), brick_values.begin(), brick_values.end());
+                }
+                else
+                {
+                    brick.state = has_inside ? EBrickState::Inside : EBrickState::Outside;
+                }
+            }
+        }
+    }
+}
+
+double Gkm::Solid::OccupancyCache::occupancy(const Eigen::Vector3d& point, double* error_estimate) const
+{
+    if (error_estimate)
+    {
+        *error_estimate = 0.0;
+    }
+    Eigen::Vector3d local;
+    const Brick* brick = findBrick(point, local);
+    if (!brick || brick->state == EBrickState::Outside)
+    {
+        return 0.0;
+    }
+    if (brick->state == EBrickState::Inside)
+    {
+        return 1.0;
+    }
+
+    const unsigned lattice_size = brick_size + 1;
+    unsigned cell[3];
+    Eigen::Vector3d fraction;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        const double position = std::min(std::max(local[axis], 0.0), static_cast<double>(brick_size));
+        cell[axis] = std::min(static_cast<unsigned>(position), brick_size - 1);
+        fraction[axis] = position - cell[axis];
+    }
+    const unsigned char* brick_values = &values[brick->value_offset];
+    double result = 0.0;
+    unsigned inside_count = 0;
+    for (unsigned corner = 0; corner < 8; ++corner)
+    {
+        const unsigned dx = corner & 1;
+        const unsigned dy = (corner >> 1) & 1;
+        const unsigned dz = (corner >> 2) & 1;
+        const unsigned char value = brick_values[((static_cast<size_t>(cell[2] + dz) * lattice_size + cell[1] + dy) * lattice_size) + cell[0] + dx];
+        const double weight = (dx ? fraction.x() : 1.0 - fraction.x()) * (dy ? fraction.y() : 1.0 - fraction.y()) * (dz ? fraction.z() : 1.0 - fraction.z());
+        result += weight * value;
+        inside_count += value;
+    }
+    if (error_estimate && inside_count != 0 && inside_count != 8)
+    {
+        *error_estimate = std::sqrt(3.0) * cell_size;
+    }
+    return result;
+}
+
+double Gkm::Solid::OccupancyCache::getCellSize() const
+{
+    return cell_size;
+}
+
+size_t Gkm::Solid::OccupancyCache::getBrickCount() const
+{
+    return bricks.size();
+}
+
+size_t Gkm::Solid::OccupancyCache::getBandBrickCount() const
+{
+    const size_t lattice_size = brick_size + 1;
+    return values.size() / (lattice_size * lattice_size * lattice_size);
+}
+
+size_t Gkm::Solid::OccupancyCache::getMemorySize() const
+{
+    return bricks.size() * sizeof(Brick) + values.size();
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::OccupancyCache::type() const
+{
+    return ESolidType::Custom;
+}
+
+bool Gkm::Solid::OccupancyCache::inside(const Eigen::Vector3d& point) const
+{
+    return occupancy(point) >= 0.5;
+}
+
+Eigen::AlignedBox3d Gkm::Solid::OccupancyCache::bbox() const
+{
+    return solid_bbox;
+}
+
+void Gkm::Solid::OccupancyCache::raySpans(const Eigen::Vector3d& origin_, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    spans.clear();
+    const Eigen::Vector3d grid_max = origin + Eigen::Vector3d(brick_counts[0], brick_counts[1], brick_counts[2]) * (brick_size * cell_size);
+    const double direction_length = direction.norm();
+    if (bricks.empty() || direction_length == 0.0 || !clipRay(Eigen::AlignedBox3d(origin, grid_max), origin_, direction, t_min, t_max))
+    {
+        return;
+    }
+
+    // Ray parameter step of a half cell
+    const double step = 0.5 * cell_size / direction_length;
+    auto at = [&](double t) { return Eigen::Vector3d(origin_ + t * direction); };
+    double t = t_min;
+    bool current = inside(at(t));
+    double span_begin = t;
+    Eigen::Vector3d span_begin_normal = Eigen::Vector3d::Zero();
+    while (t < t_max)
+    {
+        double next_t = std::min(t + step, t_max);
+        // Constant bricks are crossed at once, their occupancy could change only at their border
+        Eigen::Vector3d local;
+        const Brick* brick = findBrick(at(0.5 * (t + next_t)), local);
+        if (brick && brick->state != EBrickState::Band)
+        {
+            double brick_t_min = t;
+            double brick_t_max = t_max;
+            if (clipRay(brickBox(at(0.5 * (t + next_t))), origin_, direction, brick_t_min, brick_t_max))
+            {
+                next_t = std::max(next_t, brick_t_max);
+            }
+        }
+        const bool next = inside(at(next_t));
+        if (next != current)
+        {
+            // Bisection on the cached occupancy
+            double low = t;
+            double high = next_t;
+            for (unsigned i = 0; i < BISECTION_STEP_COUNT; ++i)
+            {
+                const double middle = 0.5 * (low + high);
+                if (inside(at(middle)) == current)
+                {
+                    low = middle;
+                }
+                else
+                {
+                    high = middle;
+                }
+            }
+            const double crossing = 0.5 * (low + high);
+            const Eigen::Vector3d normal = occupancyNormal(at(crossing));
+            if (current && crossing > span_begin)
+            {
+                spans.push_back(RaySpan{ span_begin, crossing, span_begin_normal, normal });
+            }
+            span_begin = crossing;
+            span_begin_normal = normal;
+            current = next;
+        }
+        t = next_t;
+    }
+    if (current && t_max > span_begin)
+    {
+        spans.push_back(RaySpan{ span_begin, t_max, span_begin_normal, Eigen::Vector3d::Zero() });
+    }
+}
+
+Eigen::Vector3d Gkm::Solid::OccupancyCache::occupancyNormal(const Eigen::Vector3d& point) const
+{
+    // Occupancy decreases outwards, so the normal is the negated central difference gradient
+    const double step = 0.5 * cell_size;
+    Eigen::Vector3d gradient;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        const Eigen::Vector3d offset = Eigen::Vector3d::Unit(axis) * step;
+        gradient[axis] = occupancy(point + offset) - occupancy(point - offset);
+    }
+    const double length = gradient.norm();
+    return length > 0.0 ? Eigen::Vector3d(-gradient / length) : Eigen::Vector3d::Zero();
+}
+
+const Gkm::Solid::OccupancyCache::Brick* Gkm::Solid::OccupancyCache::findBrick(const Eigen::Vector3d& point, Eigen::Vector3d& local) const
+{
+    const Eigen::Vector3d position = (point - origin) / cell_size;
+    unsigned brick_index[3];
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        const double brick_position = std::floor(position[axis] / brick_size);
+        if (!(brick_position >= 0.0 && brick_position < brick_counts[axis]))
+        {
+            return nullptr;
+        }
+        brick_index[axis] = static_cast<unsigned>(brick_position);
+        local[axis] = position[axis] - static_cast<double>(brick_index[axis]) * brick_size;
+    }
+    return &bricks[(static_cast<size_t>(brick_index[2]) * brick_counts[1] + brick_index[1]) * brick_counts[0] + brick_index[0]];
+}
+
+Eigen::AlignedBox3d Gkm::Solid::OccupancyCache::brickBox(const Eigen::Vector3d& point) const
+{
+    const double brick_length = brick_size * cell_size;
+    Eigen::Vector3d min;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        min[axis] = origin[axis] + std::floor((point[axis] - origin[axis]) / brick_length) * brick_length;
+    }
+    return Eigen::AlignedBox3d(min, min + Eigen::Vector3d::Constant(brick_length));
+}
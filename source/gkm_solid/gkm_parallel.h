@@ -0,0 +1,81 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Gkm
+{
+    namespace Solid
+    {
+        // Thread count of options of parallel algorithms, zero means the number of hardware threads
+        inline unsigned resolveThreadCount(unsigned thread_count)
+        {
+            thread_count = thread_count ? thread_count : std::thread::hardware_concurrency();
+            return std::max(thread_count, 1u);
+        }
+
+        // Runs the worker by the calling thread and additional threads, workers take tasks themselves,
+        // there are no more threads than tasks.
+        // The first exception of workers or of thread creation is rethrown after all started threads are joined.
+        template<typename Function>
+        void runInParallel(unsigned thread_count, size_t task_count, Function worker)
+        {
+            thread_count = static_cast<unsigned>(std::min<size_t>(resolveThreadCount(thread_count), std::max<size_t>(task_count, 1)));
+            std::exception_ptr exception;
+            std::mutex exception_mutex;
+            auto guarded_worker = [&exception, &exception_mutex, worker]() mutable
+            {
+                try
+                {
+                    worker();
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(exception_mutex);
+                    if (!exception)
+                    {
+                        exception = std::current_exception();
+                    }
+                }
+            };
+            std::vector<std::thread> threads;
+            std::exception_ptr start_exception;
+            try
+            {
+                threads.reserve(thread_count - 1);
+                for (unsigned i = 1; i < thread_count; ++i)
+                {
+                    threads.emplace_back(guarded_worker);
+                }
+            }
+            catch (...)
+            {
+                start_exception = std::current_exception();
+            }
+            // Started threads take all tasks, so the calling thread only waits for them after a failed start
+            if (!start_exception)
+            {
+                guarded_worker();
+            }
+            for (auto& thread : threads)
+            {
+                thread.join();
+            }
+            if (start_exception)
+            {
+                std::rethrow_exception(start_exception);
+            }
+            if (exception)
+            {
+                std::rethrow_exception(exception);
+            }
+        }
+    }
+}
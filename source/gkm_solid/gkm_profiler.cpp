@@ -0,0 +1,329 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include "gkm_solid/gkm_profiler.h"
+
+namespace
+{
+    struct ProfiledSolid : public Gkm::Solid::ISolid
+    {
+        ISolid::Ptr solid;
+        Gkm::Solid::SolidProfiler::Counters* counters = nullptr;
+
+        virtual Gkm::Solid::ESolidType type() const override;
+        virtual bool inside(const Eigen::Vector3d& point) const override;
+        virtual Eigen::AlignedBox3d bbox() const override;
+        virtual void raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<Gkm::Solid::RaySpan>& spans) const override;
+    };
+
+    Gkm::Solid::ESolidType ProfiledSolid::type() const
+    {
+        return Gkm::Solid::ESolidType::Custom;
+    }
+
+    bool ProfiledSolid::inside(const Eigen::Vector3d& point) const
+    {
+        const auto start = std::chrono::steady_clock::now();
+        const bool result = solid->inside(point);
+        const auto finish = std::chrono::steady_clock::now();
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+        counters->call_count.fetch_add(1, std::memory_order_relaxed);
+        counters->true_count.fetch_add(result ? 1 : 0, std::memory_order_relaxed);
+        counters->nanoseconds.fetch_add(static_cast<uint64_t>(nanoseconds), std::memory_order_relaxed);
+        return result;
+    }
+
+    Eigen::AlignedBox3d ProfiledSolid::bbox() const
+    {
+        return solid->bbox();
+    }
+
+    void ProfiledSolid::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<Gkm::Solid::RaySpan>& spans) const
+    {
+        // Only point queries are profiled
+        solid->raySpans(origin, direction, t_min, t_max, spans);
+    }
+
+    class Reorderer
+    {
+        const Gkm::Solid::SolidProfiler& profiler;
+        size_t reordered_count = 0;
+        std::unordered_map<const Gkm::Solid::ISolid*, Gkm::Solid::ISolid::Ptr> reordered;
+
+        // Expected cost of the work which is done before the operand decides the result of the operator.
+        // Union is decided by a true operand, intersection is decided by a false one.
+        double rank(const Gkm::Solid::ISolid::Ptr& operand, bool decisive_value) const;
+        Gkm::Solid::ISolid::Ptr reorderNode(const Gkm::Solid::ISolid::Ptr& solid);
+
+    public:
+        Reorderer(const Gkm::Solid::SolidProfiler& profiler);
+        Gkm::Solid::ISolid::Ptr reorder(const Gkm::Solid::ISolid::Ptr& solid);
+        size_t getReorderedCount() const;
+    };
+
+    Reorderer::Reorderer(const Gkm::Solid::SolidProfiler& profiler_) : profiler(profiler_)
+    {
+    }
+
+    double Reorderer::rank(const Gkm::Solid::ISolid::Ptr& operand, bool decisive_value) const
+    {
+        Gkm::Solid::NodeStatistics statistics;
+        if (!profiler.getStatistics(operand.get(), statistics) || statistics.call_count == 0)
+        {
+            return std::numeric_limits<double>::quiet_NaN();
+        }
+        const double true_rate = statistics.trueRate();
+        const double decisive_rate = decisive_value ? true_rate : 1.0 - true_rate;
+        return statistics.averageCost() / std::max(decisive_rate, 1e-6);
+    }
+
+    Gkm::Solid::ISolid::Ptr Reorderer::reorderNode(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        auto found_it = reordered.find(solid.get());
+        if (found_it != reordered.end())
+        {
+            return found_it->second;
+        }
+
+        Gkm::Solid::ISolid::Ptr result = solid;
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Union:
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            auto boolean_operator = std::static_pointer_cast<Gkm::Solid::IBooleanOperator>(solid);
+            Gkm::Solid::ISolid::Ptr left = reorderNode(boolean_operator->left);
+            Gkm::Solid::ISolid::Ptr right = reorderNode(boolean_operator->right);
+            const bool decisive_value = solid->type() == Gkm::Solid::ESolidType::Union;
+            // Comparison with NaN is false, so operands without statistics keep their order
+            if (rank(boolean_operator->right, decisive_value) < rank(boolean_operator->left, decisive_value))
+            {
+                std::swap(left, right);
+                ++reordered_count;
+            }
+            if (left != boolean_operator->left || right != boolean_operator->right)
+            {
+                Gkm::Solid::IBooleanOperator::Ptr new_operator;
+                if (decisive_value)
+                {
+                    new_operator = std::make_shared<Gkm::Solid::UnionOperator>();
+                }
+                else
+                {
+                    new_operator = std::make_shared<Gkm::Solid::IntersectionOperator>();
+                }
+                new_operator->left = left;
+                new_operator->right = right;
+                result = new_operator;
+            }
+            break;
+        }
+        case Gkm::Solid::ESolidType::Difference:
+        {
+            // Operands of difference are not interchangeable, only their subtrees are reordered
+            auto difference_operator = std::static_pointer_cast<Gkm::Solid::DifferenceOperator>(solid);
+            Gkm::Solid::ISolid::Ptr left = reorderNode(difference_operator->left);
+            Gkm::Solid::ISolid::Ptr right = reorderNode(difference_operator->right);
+            if (left != difference_operator->left || right != difference_operator->right)
+            {
+                auto new_operator = std::make_shared<Gkm::Solid::DifferenceOperator>();
+                new_operator->left = left;
+                new_operator->right = right;
+                result = new_operator;
+            }
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+        {
+            auto transform_operator = std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid);
+            Gkm::Solid::ISolid::Ptr child = reorderNode(transform_operator->solid);
+            if (child != transform_operator->solid)
+            {
+                auto new_operator = std::make_shared<Gkm::Solid::TransformOperator>();
+                new_operator->translate = transform_operator->translate;
+                new_operator->solid = child;
+                result = new_operator;
+            }
+            break;
+        }
+        case Gkm::Solid::ESolidType::MultiUnion:
+        {
+            auto multi_union_operator = std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid);
+            const size_t solid_count = multi_union_operator->solids.size();
+            std::vector<double> ranks(solid_count);
+            std::vector<size_t> order(solid_count);
+            for (size_t i = 0; i < solid_count; ++i)
+            {
+                ranks[i] = rank(multi_union_operator->solids[i], true);
+                // Operands without statistics go last
+                if (std::isnan(ranks[i]))
+                {
+                    ranks[i] = std::numeric_limits<double>::infinity();
+                }
+            }
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&ranks](size_t a, size_t b) { return ranks[a] < ranks[b]; });
+
+            auto new_operator = std::make_shared<Gkm::Solid::MultiUnionOperator>();
+            bool changed = false;
+            for (size_t i = 0; i < solid_count; ++i)
+            {
+                const size_t source_index = order[i];
+                Gkm::Solid::ISolid::Ptr child = reorderNode(multi_union_operator->solids[source_index]);
+                new_operator->solids.push_back(child);
+                new_operator->bboxes.push_back(multi_union_operator->bboxes[source_index]);
+                if (source_index != i)
+                {
+                    ++reordered_count;
+                }
+                changed = changed || source_index != i || child != multi_union_operator->solids[source_index];
+            }
+            if (changed)
+            {
+                result = new_operator;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        reordered.emplace(solid.get(), result);
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Reorderer::reorder(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        return reorderNode(solid);
+    }
+
+    size_t Reorderer::getReorderedCount() const
+    {
+        return reordered_count;
+    }
+}
+
+double Gkm::Solid::NodeStatistics::averageCost() const
+{
+    return call_count ? static_cast<double>(nanoseconds) / call_count : 0.0;
+}
+
+double Gkm::Solid::NodeStatistics::trueRate() const
+{
+    return call_count ? static_cast<double>(true_count) / call_count : 0.0;
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::SolidProfiler::instrument(const ISolid::Ptr& solid)
+{
+    return instrumentNode(solid);
+}
+
+bool Gkm::Solid::SolidProfiler::getStatistics(const ISolid* source, NodeStatistics& statistics) const
+{
+    auto found_it = counters.find(source);
+    if (found_it == counters.end())
+    {
+        return false;
+    }
+    statistics.call_count = found_it->second->call_count.load(std::memory_order_relaxed);
+    statistics.true_count = found_it->second->true_count.load(std::memory_order_relaxed);
+    statistics.nanoseconds = found_it->second->nanoseconds.load(std::memory_order_relaxed);
+    return true;
+}
+
+void Gkm::Solid::SolidProfiler::reset()
+{
+    for (auto& node_counters : counters)
+    {
+        node_counters.second->call_count = 0;
+        node_counters.second->true_count = 0;
+        node_counters.second->nanoseconds = 0;
+    }
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::SolidProfiler::instrumentNode(const ISolid::Ptr& solid)
+{
+    auto found_it = instrumented.find(solid.get());
+    if (found_it != instrumented.end())
+    {
+        return found_it->second.second;
+    }
+
+    // Instrumented copy of the node refers to instrumented operands
+    ISolid::Ptr copy = solid;
+    switch (solid->type())
+    {
+    case ESolidType::Union:
+    case ESolidType::Difference:
+    case ESolidType::Intersection:
+    {
+        auto boolean_operator = std::static_pointer_cast<IBooleanOperator>(solid);
+        IBooleanOperator::Ptr new_operator;
+        if (solid->type() == ESolidType::Union)
+        {
+            new_operator = std::make_shared<UnionOperator>();
+        }
+        else if (solid->type() == ESolidType::Difference)
+        {
+            new_operator = std::make_shared<DifferenceOperator>();
+        }
+        else
+        {
+            new_operator = std::make_shared<IntersectionOperator>();
+        }
+        new_operator->left = instrumentNode(boolean_operator->left);
+        new_operator->right = instrumentNode(boolean_operator->right);
+        copy = new_operator;
+        break;
+    }
+    case ESolidType::Transform:
+    {
+        auto transform_operator = std::static_pointer_cast<TransformOperator>(solid);
+        auto new_operator = std::make_shared<TransformOperator>();
+        new_operator->translate = transform_operator->translate;
+        new_operator->solid = instrumentNode(transform_operator->solid);
+        copy = new_operator;
+        break;
+    }
+    case ESolidType::MultiUnion:
+    {
+        auto multi_union_operator = std::static_pointer_cast<MultiUnionOperator>(solid);
+        auto new_operator = std::make_shared<MultiUnionOperator>();
+        for (size_t i = 0; i < multi_union_operator->solids.size(); ++i)
+        {
+            new_operator->solids.push_back(instrumentNode(multi_union_operator->solids[i]));
+            new_operator->bboxes.push_back(multi_union_operator->bboxes[i]);
+        }
+        copy = new_operator;
+        break;
+    }
+    default:
+        break;
+    }
+
+    std::unique_ptr<Counters>& node_counters = counters[solid.get()];
+    if (!node_counters)
+    {
+        node_counters = std::make_unique<Counters>();
+    }
+    auto profiled_solid = std::make_shared<ProfiledSolid>();
+    profiled_solid->solid = copy;
+    profiled_solid->counters = node_counters.get();
+    instrumented.emplace(solid.get(), std::make_pair(solid, profiled_solid));
+    return profiled_solid;
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::reorder(const ISolid::Ptr& solid, const SolidProfiler& profiler, size_t* reordered_count)
+{
+    Reorderer reorderer(profiler);
+    ISolid::Ptr result = reorderer.reorder(solid);
+    if (reordered_count)
+    {
+        *reordered_count = reorderer.getReorderedCount();
+    }
+    return result;
+}
@@ -0,0 +1,238 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include "gkm_solid/gkm_renderer.h"
+#include "gkm_parallel.h"
+
+namespace
+{
+    constexpr double PI = 3.14159265358979323846;
+    // Maximal length of a stored deflate block
+    constexpr size_t MAX_STORED_BLOCK_SIZE = 65535;
+
+    uint32_t updateCrc(uint32_t crc, const unsigned char* data, size_t size)
+    {
+        static const std::vector<uint32_t> table = []()
+        {
+            std::vector<uint32_t> result(256);
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t value = i;
+                for (unsigned bit = 0; bit < 8; ++bit)
+                {
+                    value = (value & 1) ? 0xEDB88320u ^ (value >> 1) : value >> 1;
+                }
+                result[i] = value;
+            }
+            return result;
+        }();
+        for (size_t i = 0; i < size; ++i)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return crc;
+    }
+
+    void appendBigEndian(std::vector<unsigned char>& data, uint32_t value)
+    {
+        data.push_back(static_cast<unsigned char>(value >> 24));
+        data.push_back(static_cast<unsigned char>(value >> 16));
+        data.push_back(static_cast<unsigned char>(value >> 8));
+        data.push_back(static_cast<unsigned char>(value));
+    }
+
+    void writePngChunk(std::ofstream& file, const char* type, const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> header;
+        appendBigEndian(header, static_cast<uint32_t>(data.size()));
+        header.insert(header.end(), type, type + 4);
+        uint32_t crc = updateCrc(0xFFFFFFFFu, &header[4], 4);
+        crc = updateCrc(crc, data.data(), data.size()) ^ 0xFFFFFFFFu;
+        std::vector<unsigned char> footer;
+        appendBigEndian(footer, crc);
+        file.write(reinterpret_cast<const char*>(header.data()), header.size());
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+    }
+
+    unsigned char toByte(float value)
+    {
+        return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+}
+
+Gkm::Solid::Camera Gkm::Solid::fitCamera(const Eigen::AlignedBox3d& box, const Eigen::Vector3d& view_direction, double field_of_view)
+{
+    Camera camera;
+    camera.field_of_view = field_of_view;
+    if (box.isEmpty() || view_direction.squaredNorm() == 0.0)
+    {
+        return camera;
+    }
+    const Eigen::Vector3d direction = view_direction.normalized();
+    // Bounding sphere of the box fits into the narrowest field of view
+    const double radius = std::max(0.5 * box.diagonal().norm(), 1e-6);
+    const double distance = radius / std::sin(0.5 * field_of_view * PI / 180.0);
+    camera.target = box.center();
+    camera.position = camera.target - direction * distance;
+    camera.up = std::fabs(direction.y()) < 0.99 ? Eigen::Vector3d::UnitY() : Eigen::Vector3d::UnitZ();
+    return camera;
+}
+
+bool Gkm::Solid::Image::writePpm(const std::string& file_name) const
+{
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+    return static_cast<bool>(file);
+}
+
+bool Gkm::Solid::Image::writePng(const std::string& file_name) const
+{
+    assert(pixels.size() == static_cast<size_t>(width) * height * 3);
+    std::ofstream file(file_name, std::ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+    const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<unsigned char> header;
+    appendBigEndian(header, width);
+    appendBigEndian(header, height);
+    // 8 bits per channel, RGB color, deflate compression, adaptive filtering, no interlace
+    const unsigned char format[5] = { 8, 2, 0, 0, 0 };
+    header.insert(header.end(), format, format + sizeof(format));
+    writePngChunk(file, "IHDR", header);
+
+    // Each row starts with filter type 0 which keeps bytes as is
+    const size_t row_size = static_cast<size_t>(width) * 3;
+    std::vector<unsigned char> raw;
+    raw.reserve((row_size + 1) * height);
+    for (unsigned y = 0; y < height; ++y)
+    {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels.begin() + y * row_size, pixels.begin() + (y + 1) * row_size);
+    }
+
+    // Zlib stream of stored blocks and Adler-32 checksum of the raw data
+    std::vector<unsigned char> data = { 0x78, 0x01 };
+    size_t offset = 0;
+    do
+    {
+        const size_t block_size = std::min(raw.size() - offset, MAX_STORED_BLOCK_SIZE);
+        const bool final_block = offset + block_size == raw.size();
+        data.push_back(final_block ? 1 : 0);
+        data.push_back(static_cast<unsigned char>(block_size));
+        data.push_back(static_cast<unsigned char>(block_size >> 8));
+        data.push_back(static_cast<unsigned char>(~block_size));
+        data.push_back(static_cast<unsigned char>(~block_size >> 8));
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + block_size);
+        offset += block_size;
+    } while (offset < raw.size());
+    uint32_t adler_a = 1;
+    uint32_t adler_b = 0;
+    for (unsigned char value : raw)
+    {
+        adler_a = (adler_a + value) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+    appendBigEndian(data, (adler_b << 16) | adler_a);
+    writePngChunk(file, "IDAT", data);
+    writePngChunk(file, "IEND", std::vector<unsigned char>());
+    return static_cast<bool>(file);
+}
+
+Gkm::Solid::Image::Ptr Gkm::Solid::render(const ISolid::Ptr& solid, const Camera& camera, const RenderOptions& options)
+{
+    auto image = std::make_shared<Image>();
+    image->width = options.width;
+    image->height = options.height;
+    image->pixels.resize(static_cast<size_t>(options.width) * options.height * 3);
+    for (size_t i = 0; i < image->pixels.size(); i += 3)
+    {
+        image->pixels[i] = toByte(options.background.x());
+        image->pixels[i + 1] = toByte(options.background.y());
+        image->pixels[i + 2] = toByte(options.background.z());
+    }
+    const Eigen::AlignedBox3d box = solid->bbox();
+    if (box.isEmpty() || options.width == 0 || options.height == 0)
+    {
+        return image;
+    }
+
+    const Eigen::Vector3d forward = (camera.target - camera.position).normalized();
+    const Eigen::Vector3d right = forward.cross(camera.up).normalized();
+    const Eigen::Vector3d up = right.cross(forward);
+    const double half_height = std::tan(0.5 * camera.field_of_view * PI / 180.0);
+    const double half_width = half_height * options.width / options.height;
+    // Rays are unit, so they end behind the farthest point of the bounding box
+    const double t_max = (camera.position - box.center()).norm() + box.diagonal().norm();
+
+    const unsigned tile_size = std::max(options.tile_size, 1u);
+    const unsigned tile_count_x = (options.width + tile_size - 1) / tile_size;
+    const unsigned tile_count_y = (options.height + tile_size - 1) / tile_size;
+    const size_t tile_count = static_cast<size_t>(tile_count_x) * tile_count_y;
+    std::atomic<size_t> next_tile(0);
+
+    auto worker = [&]()
+    {
+        PointBatch origins;
+        PointBatch directions;
+        std::vector<RayHit> hits;
+        for (size_t tile = next_tile++; tile < tile_count; tile = next_tile++)
+        {
+            const unsigned x_begin = static_cast<unsigned>(tile % tile_count_x) * tile_size;
+            const unsigned y_begin = static_cast<unsigned>(tile / tile_count_x) * tile_size;
+            const unsigned x_end = std::min(x_begin + tile_size, options.width);
+            const unsigned y_end = std::min(y_begin + tile_size, options.height);
+            origins.clear();
+            directions.clear();
+            for (unsigned y = y_begin; y < y_end; ++y)
+            {
+                const double v = (1.0 - 2.0 * (y + 0.5) / options.height) * half_height;
+                for (unsigned x = x_begin; x < x_end; ++x)
+                {
+                    const double u = (2.0 * (x + 0.5) / options.width - 1.0) * half_width;
+                    origins.add(camera.position);
+                    directions.add((forward + u * right + v * up).normalized());
+                }
+            }
+            solid->raycastBatch(origins, directions, 0.0, t_max, hits);
+
+            size_t ray_index = 0;
+            for (unsigned y = y_begin; y < y_end; ++y)
+            {
+                for (unsigned x = x_begin; x < x_end; ++x, ++ray_index)
+                {
+                    const RayHit& hit = hits[ray_index];
+                    if (!hit.hit)
+                    {
+                        continue;
+                    }
+                    // Two-sided diffuse lighting by the light from the camera
+                    const float diffuse = static_cast<float>(std::fabs(hit.normal.dot(directions.point(ray_index))));
+                    const Eigen::Vector3f color = options.color * (options.ambient + (1.0f - options.ambient) * diffuse);
+                    unsigned char* pixel = &image->pixels[(static_cast<size_t>(y) * options.width + x) * 3];
+                    pixel[0] = toByte(color.x());
+                    pixel[1] = toByte(color.y());
+                    pixel[2] = toByte(color.z());
+                }
+            }
+        }
+    };
+
+    runInParallel(options.thread_count, tile_count, worker);
+    return image;
+}
@@ -0,0 +1,95 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "gkm_solid/gkm_section.h"
+#include "gkm_parallel.h"
+
+namespace
+{
+    // Rows are handed out to threads in blocks
+    constexpr size_t ROW_BLOCK_SIZE = 16;
+}
+
+Gkm::Solid::Model::Ptr Gkm::Solid::buildSection(const ISolid::Ptr& solid, const Eigen::Vector4d& plane, const SectionOptions& options)
+{
+    auto result = std::make_shared<Model>();
+    const Eigen::AlignedBox3d box = solid->bbox();
+    const double normal_length = plane.head<3>().norm();
+    if (box.isEmpty() || normal_length == 0.0 || !(options.row_size > 0.0))
+    {
+        return result;
+    }
+
+    // Orthonormal frame of the plane, rows go along u and follow each other along v
+    const Eigen::Vector3d normal = plane.head<3>() / normal_length;
+    const Eigen::Vector3d plane_origin = -normal * (plane.w() / normal_length);
+    const Eigen::Vector3d u = (std::fabs(normal.x()) < 0.9 ? Eigen::Vector3d::UnitX() : Eigen::Vector3d::UnitY()).cross(normal).normalized();
+    const Eigen::Vector3d v = normal.cross(u);
+    double u_min = std::numeric_limits<double>::infinity();
+    double u_max = -u_min;
+    double v_min = u_min;
+    double v_max = -u_min;
+    for (unsigned corner = 0; corner < 8; ++corner)
+    {
+        const Eigen::Vector3d point = box.corner(static_cast<Eigen::AlignedBox3d::CornerType>(corner)) - plane_origin;
+        u_min = std::min(u_min, point.dot(u));
+        u_max = std::max(u_max, point.dot(u));
+        v_min = std::min(v_min, point.dot(v));
+        v_max = std::max(v_max, point.dot(v));
+    }
+    const size_t row_count = static_cast<size_t>(std::ceil((v_max - v_min) / options.row_size));
+    if (row_count == 0)
+    {
+        return result;
+    }
+
+    // Each thread keeps rectangles of its rows, they are merged in order of rows
+    const size_t block_count = (row_count + ROW_BLOCK_SIZE - 1) / ROW_BLOCK_SIZE;
+    std::vector<std::vector<Eigen::Vector3f>> block_points(block_count);
+    std::atomic<size_t> next_block(0);
+    auto worker = [&]()
+    {
+        std::vector<RaySpan> spans;
+        for (size_t block = next_block++; block < block_count; block = next_block++)
+        {
+            std::vector<Eigen::Vector3f>& points = block_points[block];
+            const size_t row_end = std::min((block + 1) * ROW_BLOCK_SIZE, row_count);
+            for (size_t row = block * ROW_BLOCK_SIZE; row < row_end; ++row)
+            {
+                const double row_begin = v_min + row * options.row_size;
+                const double row_center = row_begin + 0.5 * options.row_size;
+                solid->raySpans(plane_origin + v * row_center, u, u_min, u_max, spans);
+                const Eigen::Vector3d bottom = plane_origin + v * row_begin;
+                const Eigen::Vector3d top = plane_origin + v * (row_begin + options.row_size);
+                for (auto& span : spans)
+                {
+                    const Eigen::Vector3f a = (bottom + u * span.begin).cast<float>();
+                    const Eigen::Vector3f b = (bottom + u * span.end).cast<float>();
+                    const Eigen::Vector3f c = (top + u * span.end).cast<float>();
+                    const Eigen::Vector3f d = (top + u * span.begin).cast<float>();
+                    // u x v is the plane normal, so clockwise order around it faces the removed side
+                    points.insert(points.end(), { a, c, b, a, d, c });
+                }
+            }
+        }
+    };
+
+    runInParallel(options.thread_count, block_count, worker);
+
+    size_t point_count = 0;
+    for (auto& points : block_points)
+    {
+        point_count += points.size();
+    }
+    result->points.reserve(point_count);
+    for (auto& points : block_points)
+    {
+        result->points.insert(result->points.end(), points.begin(), points.end());
+    }
+    return result;
+}
@@ -0,0 +1,482 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <unordered_map>
+#include <unordered_set>
+#include "gkm_solid/gkm_simplifier.h"
+
+namespace
+{
+    bool isEmpty(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        return solid->type() == Gkm::Solid::ESolidType::Empty;
+    }
+
+    bool isUnion(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        return solid->type() == Gkm::Solid::ESolidType::Union || solid->type() == Gkm::Solid::ESolidType::MultiUnion;
+    }
+
+    bool disjoint(const Eigen::AlignedBox3d& a, const Eigen::AlignedBox3d& b)
+    {
+        return a.intersection(b).isEmpty();
+    }
+
+    void collectNodes(const Gkm::Solid::ISolid::Ptr& solid, std::unordered_set<const Gkm::Solid::ISolid*>& nodes)
+    {
+        if (!nodes.insert(solid.get()).second)
+        {
+            return;
+        }
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Union:
+        case Gkm::Solid::ESolidType::Difference:
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            auto boolean_operator = std::static_pointer_cast<Gkm::Solid::IBooleanOperator>(solid);
+            collectNodes(boolean_operator->left, nodes);
+            collectNodes(boolean_operator->right, nodes);
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+            collectNodes(std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid)->solid, nodes);
+            break;
+        case Gkm::Solid::ESolidType::MultiUnion:
+            for (auto& child : std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid)->solids)
+            {
+                collectNodes(child, nodes);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    class Simplifier
+    {
+        Gkm::Solid::SimplifyReport& report;
+        Gkm::Solid::ISolid::Ptr empty;
+        std::unordered_map<const Gkm::Solid::ISolid*, Gkm::Solid::ISolid::Ptr> simplified;
+        std::unordered_map<const Gkm::Solid::ISolid*, Eigen::AlignedBox3d> bboxes;
+
+        const Eigen::AlignedBox3d& bbox(const Gkm::Solid::ISolid::Ptr& solid);
+        bool contains(const Gkm::Solid::ISolid::Ptr& solid, const Eigen::AlignedBox3d& box);
+        void drop(const Gkm::Solid::ISolid::Ptr& solid);
+        void addUnionOperands(const Gkm::Solid::ISolid::Ptr& solid, const Gkm::Solid::MultiUnionOperator::Ptr& result);
+        Gkm::Solid::ISolid::Ptr simplifyNode(const Gkm::Solid::ISolid::Ptr& solid);
+        Gkm::Solid::ISolid::Ptr simplifyUnion(const Gkm::Solid::UnionOperator::Ptr& solid);
+        Gkm::Solid::ISolid::Ptr simplifyDifference(const Gkm::Solid::DifferenceOperator::Ptr& solid);
+        Gkm::Solid::ISolid::Ptr simplifyIntersection(const Gkm::Solid::IntersectionOperator::Ptr& solid);
+        Gkm::Solid::ISolid::Ptr simplifyTransform(const Gkm::Solid::TransformOperator::Ptr& solid);
+        Gkm::Solid::ISolid::Ptr simplifyMultiUnion(const Gkm::Solid::MultiUnionOperator::Ptr& solid);
+
+    public:
+        Simplifier(Gkm::Solid::SimplifyReport& report);
+        Gkm::Solid::ISolid::Ptr simplify(const Gkm::Solid::ISolid::Ptr& solid);
+    };
+
+    Simplifier::Simplifier(Gkm::Solid::SimplifyReport& report_) : report(report_)
+    {
+        empty = std::make_shared<Gkm::Solid::EmptySolid>();
+    }
+
+    const Eigen::AlignedBox3d& Simplifier::bbox(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        auto found_it = bboxes.find(solid.get());
+        if (found_it != bboxes.end())
+        {
+            return found_it->second;
+        }
+
+        // Bounds of operators are composed from the cached bounds of their operands,
+        // so each node of the tree is visited only once
+        Eigen::AlignedBox3d result;
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Union:
+        {
+            auto union_operator = std::static_pointer_cast<Gkm::Solid::UnionOperator>(solid);
+            result = bbox(union_operator->left).merged(bbox(union_operator->right));
+            break;
+        }
+        case Gkm::Solid::ESolidType::Difference:
+            result = bbox(std::static_pointer_cast<Gkm::Solid::DifferenceOperator>(solid)->left);
+            break;
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            auto intersection_operator = std::static_pointer_cast<Gkm::Solid::IntersectionOperator>(solid);
+            result = bbox(intersection_operator->left).intersection(bbox(intersection_operator->right));
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+        {
+            auto transform_operator = std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid);
+            result = bbox(transform_operator->solid);
+            result.min() += transform_operator->translate;
+            result.max() += transform_operator->translate;
+            break;
+        }
+        default:
+            // Primitives and n-ary unions are cheap to ask
+            result = solid->bbox();
+            break;
+        }
+        return bboxes.emplace(solid.get(), result).first->second;
+    }
+
+    // Returns true if the solid is proven to contain the whole box
+    bool Simplifier::contains(const Gkm::Solid::ISolid::Ptr& solid, const Eigen::AlignedBox3d& box)
+    {
+        if (box.isEmpty())
+        {
+            return true;
+        }
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Cube:
+            return solid->bbox().contains(box);
+        case Gkm::Solid::ESolidType::Sphere:
+        {
+            const double radius = std::static_pointer_cast<Gkm::Solid::Sphere>(solid)->radius;
+            const Eigen::Vector3d farthest_corner = box.min().cwiseAbs().cwiseMax(box.max().cwiseAbs());
+            return farthest_corner.squaredNorm() <= radius * radius;
+        }
+        case Gkm::Solid::ESolidType::Union:
+        {
+            auto union_operator = std::static_pointer_cast<Gkm::Solid::UnionOperator>(solid);
+            return contains(union_operator->left, box) || contains(union_operator->right, box);
+        }
+        case Gkm::Solid::ESolidType::Difference:
+        {
+            auto difference_operator = std::static_pointer_cast<Gkm::Solid::DifferenceOperator>(solid);
+            return disjoint(bbox(difference_operator->right), box) && contains(difference_operator->left, box);
+        }
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            auto intersection_operator = std::static_pointer_cast<Gkm::Solid::IntersectionOperator>(solid);
+            return contains(intersection_operator->left, box) && contains(intersection_operator->right, box);
+        }
+        case Gkm::Solid::ESolidType::Transform:
+        {
+            auto transform_operator = std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid);
+            Eigen::AlignedBox3d local_box = box;
+            local_box.min() -= transform_operator->translate;
+            local_box.max() -= transform_operator->translate;
+            return contains(transform_operator->solid, local_box);
+        }
+        case Gkm::Solid::ESolidType::MultiUnion:
+            for (auto& child : std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid)->solids)
+            {
+                if (contains(child, box))
+                {
+                    return true;
+                }
+            }
+            return false;
+        default:
+            return false;
+        }
+    }
+
+    void Simplifier::drop(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        report.removed.push_back(solid);
+    }
+
+    void Simplifier::addUnionOperands(const Gkm::Solid::ISolid::Ptr& solid, const Gkm::Solid::MultiUnionOperator::Ptr& result)
+    {
+        if (solid->type() == Gkm::Solid::ESolidType::Union)
+        {
+            auto union_operator = std::static_pointer_cast<Gkm::Solid::UnionOperator>(solid);
+            addUnionOperands(union_operator->left, result);
+            addUnionOperands(union_operator->right, result);
+            ++report.flattened_union_count;
+        }
+        else if (solid->type() == Gkm::Solid::ESolidType::MultiUnion)
+        {
+            auto multi_union_operator = std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid);
+            for (size_t i = 0; i < multi_union_operator->solids.size(); ++i)
+            {
+                result->solids.push_back(multi_union_operator->solids[i]);
+                result->bboxes.push_back(multi_union_operator->bboxes[i]);
+            }
+            ++report.flattened_union_count;
+        }
+        else
+        {
+            result->solids.push_back(solid);
+            result->bboxes.push_back(bbox(solid));
+        }
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyUnion(const Gkm::Solid::UnionOperator::Ptr& solid)
+    {
+        Gkm::Solid::ISolid::Ptr left = simplifyNode(solid->left);
+        Gkm::Solid::ISolid::Ptr right = simplifyNode(solid->right);
+        if (isEmpty(left))
+        {
+            ++report.folded_empty_count;
+            drop(solid->left);
+            return right;
+        }
+        if (isEmpty(right))
+        {
+            ++report.folded_empty_count;
+            drop(solid->right);
+            return left;
+        }
+        if (left == right)
+        {
+            ++report.folded_union_count;
+            return left;
+        }
+        if (contains(left, bbox(right)))
+        {
+            ++report.folded_union_count;
+            drop(solid->right);
+            return left;
+        }
+        if (contains(right, bbox(left)))
+        {
+            ++report.folded_union_count;
+            drop(solid->left);
+            return right;
+        }
+        if (isUnion(left) || isUnion(right))
+        {
+            auto result = std::make_shared<Gkm::Solid::MultiUnionOperator>();
+            addUnionOperands(left, result);
+            addUnionOperands(right, result);
+            return result;
+        }
+        if (left == solid->left && right == solid->right)
+        {
+            return solid;
+        }
+        auto result = std::make_shared<Gkm::Solid::UnionOperator>();
+        result->left = left;
+        result->right = right;
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyDifference(const Gkm::Solid::DifferenceOperator::Ptr& solid)
+    {
+        Gkm::Solid::ISolid::Ptr left = simplifyNode(solid->left);
+        if (isEmpty(left))
+        {
+            ++report.folded_empty_count;
+            drop(solid->right);
+            return left;
+        }
+        Gkm::Solid::ISolid::Ptr right = simplifyNode(solid->right);
+        if (isEmpty(right))
+        {
+            ++report.folded_empty_count;
+            drop(solid->right);
+            return left;
+        }
+        if (disjoint(bbox(left), bbox(right)))
+        {
+            ++report.pruned_difference_count;
+            drop(solid->right);
+            return left;
+        }
+        if (contains(right, bbox(left)))
+        {
+            ++report.emptied_difference_count;
+            drop(solid);
+            return empty;
+        }
+        if (left == solid->left && right == solid->right)
+        {
+            return solid;
+        }
+        auto result = std::make_shared<Gkm::Solid::DifferenceOperator>();
+        result->left = left;
+        result->right = right;
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyIntersection(const Gkm::Solid::IntersectionOperator::Ptr& solid)
+    {
+        Gkm::Solid::ISolid::Ptr left = simplifyNode(solid->left);
+        if (isEmpty(left))
+        {
+            ++report.folded_empty_count;
+            drop(solid->right);
+            return left;
+        }
+        Gkm::Solid::ISolid::Ptr right = simplifyNode(solid->right);
+        if (isEmpty(right))
+        {
+            ++report.folded_empty_count;
+            drop(solid->left);
+            return right;
+        }
+        if (left == right)
+        {
+            ++report.folded_intersection_count;
+            return left;
+        }
+        if (disjoint(bbox(left), bbox(right)))
+        {
+            ++report.folded_intersection_count;
+            drop(solid);
+            return empty;
+        }
+        if (contains(right, bbox(left)))
+        {
+            ++report.folded_intersection_count;
+            drop(solid->right);
+            return left;
+        }
+        if (contains(left, bbox(right)))
+        {
+            ++report.folded_intersection_count;
+            drop(solid->left);
+            return right;
+        }
+        if (left == solid->left && right == solid->right)
+        {
+            return solid;
+        }
+        auto result = std::make_shared<Gkm::Solid::IntersectionOperator>();
+        result->left = left;
+        result->right = right;
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyTransform(const Gkm::Solid::TransformOperator::Ptr& solid)
+    {
+        Gkm::Solid::ISolid::Ptr child = simplifyNode(solid->solid);
+        if (isEmpty(child))
+        {
+            ++report.folded_empty_count;
+            return child;
+        }
+        if (solid->translate.isZero(0.0))
+        {
+            ++report.merged_transform_count;
+            return child;
+        }
+        if (child->type() == Gkm::Solid::ESolidType::Transform)
+        {
+            ++report.merged_transform_count;
+            auto child_transform = std::static_pointer_cast<Gkm::Solid::TransformOperator>(child);
+            auto result = std::make_shared<Gkm::Solid::TransformOperator>();
+            result->translate = solid->translate + child_transform->translate;
+            result->solid = child_transform->solid;
+            return result;
+        }
+        if (child == solid->solid)
+        {
+            return solid;
+        }
+        auto result = std::make_shared<Gkm::Solid::TransformOperator>();
+        result->translate = solid->translate;
+        result->solid = child;
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyMultiUnion(const Gkm::Solid::MultiUnionOperator::Ptr& solid)
+    {
+        bool changed = false;
+        std::vector<Gkm::Solid::ISolid::Ptr> children;
+        children.reserve(solid->solids.size());
+        for (auto& source_child : solid->solids)
+        {
+            Gkm::Solid::ISolid::Ptr child = simplifyNode(source_child);
+            if (isEmpty(child))
+            {
+                ++report.folded_empty_count;
+                drop(source_child);
+                changed = true;
+                continue;
+            }
+            changed = changed || child != source_child || isUnion(child);
+            children.push_back(child);
+        }
+        if (children.empty())
+        {
+            return empty;
+        }
+        if (children.size() == 1)
+        {
+            return children.front();
+        }
+        if (!changed)
+        {
+            return solid;
+        }
+        auto result = std::make_shared<Gkm::Solid::MultiUnionOperator>();
+        for (auto& child : children)
+        {
+            addUnionOperands(child, result);
+        }
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplifyNode(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        // Shared subtrees are simplified only once
+        auto found_it = simplified.find(solid.get());
+        if (found_it != simplified.end())
+        {
+            return found_it->second;
+        }
+
+        Gkm::Solid::ISolid::Ptr result;
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Empty:
+            result = empty;
+            break;
+        case Gkm::Solid::ESolidType::Union:
+            result = simplifyUnion(std::static_pointer_cast<Gkm::Solid::UnionOperator>(solid));
+            break;
+        case Gkm::Solid::ESolidType::Difference:
+            result = simplifyDifference(std::static_pointer_cast<Gkm::Solid::DifferenceOperator>(solid));
+            break;
+        case Gkm::Solid::ESolidType::Intersection:
+            result = simplifyIntersection(std::static_pointer_cast<Gkm::Solid::IntersectionOperator>(solid));
+            break;
+        case Gkm::Solid::ESolidType::Transform:
+            result = simplifyTransform(std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid));
+            break;
+        case Gkm::Solid::ESolidType::MultiUnion:
+            result = simplifyMultiUnion(std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid));
+            break;
+        default:
+            result = solid;
+            break;
+        }
+        simplified.emplace(solid.get(), result);
+        return result;
+    }
+
+    Gkm::Solid::ISolid::Ptr Simplifier::simplify(const Gkm::Solid::ISolid::Ptr& solid)
+    {
+        Gkm::Solid::ISolid::Ptr result = simplifyNode(solid);
+
+        std::unordered_set<const Gkm::Solid::ISolid*> source_nodes;
+        std::unordered_set<const Gkm::Solid::ISolid*> result_nodes;
+        collectNodes(solid, source_nodes);
+        collectNodes(result, result_nodes);
+        for (auto node : source_nodes)
+        {
+            if (result_nodes.find(node) == result_nodes.end())
+            {
+                ++report.removed_node_count;
+            }
+        }
+        return result;
+    }
+}
+
+Gkm::Solid::ISolid::Ptr Gkm::Solid::simplify(const ISolid::Ptr& solid, SimplifyReport* report)
+{
+    SimplifyReport local_report;
+    Simplifier simplifier(report ? *report : local_report);
+    return simplifier.simplify(solid);
+}
@@ -1,8 +1,345 @@
 // Copyright 2020 Petr Petrovich Petrov. All rights reserved.
 // License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
 
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
 #include "gkm_solid/gkm_solid.h"
 
+namespace
+{
+    // Number of rays of a batch which share operand culling by their common bounding box
+    constexpr size_t RAY_PACKET_SIZE = 64;
+
+    // Same as Gkm::Solid::clipRay() but multiplies by the precomputed inverse direction, so a ray is tested against many boxes fast
+    bool clipRayByInverse(const Eigen::AlignedBox3d& box, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, const Eigen::Vector3d& inverse_direction, double& t_min, double& t_max)
+    {
+        if (box.isEmpty())
+        {
+            return false;
+        }
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            if (direction[axis] == 0.0)
+            {
+                if (origin[axis] < box.min()[axis] || origin[axis] > box.max()[axis])
+                {
+                    return false;
+                }
+                continue;
+            }
+            double t_enter = (box.min()[axis] - origin[axis]) * inverse_direction[axis];
+            double t_exit = (box.max()[axis] - origin[axis]) * inverse_direction[axis];
+            if (t_enter > t_exit)
+            {
+                std::swap(t_enter, t_exit);
+            }
+            t_min = std::max(t_min, t_enter);
+            t_max = std::min(t_max, t_exit);
+        }
+        return t_min <= t_max;
+    }
+}
+
+size_t Gkm::Solid::PointBatch::size() const
+{
+    return x.size();
+}
+
+void Gkm::Solid::PointBatch::reserve(size_t count)
+{
+    x.reserve(count);
+    y.reserve(count);
+    z.reserve(count);
+}
+
+void Gkm::Solid::PointBatch::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+}
+
+void Gkm::Solid::PointBatch::add(const Eigen::Vector3d& point)
+{
+    x.push_back(point.x());
+    y.push_back(point.y());
+    z.push_back(point.z());
+}
+
+Eigen::Vector3d Gkm::Solid::PointBatch::point(size_t index) const
+{
+    return Eigen::Vector3d(x[index], y[index], z[index]);
+}
+
+void Gkm::Solid::ISolid::insideBatch(const PointBatch& points, std::vector<unsigned char>& result) const
+{
+    const size_t point_count = points.size();
+    result.resize(point_count);
+    for (size_t i = 0; i < point_count; ++i)
+    {
+        result[i] = inside(Eigen::Vector3d(points.x[i], points.y[i], points.z[i]));
+    }
+}
+
+bool Gkm::Solid::ISolid::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    hit = RayHit();
+    std::vector<RaySpan> spans;
+    raySpans(origin, direction, t_min, t_max, spans);
+    if (spans.empty())
+    {
+        return false;
+    }
+    hit.hit = true;
+    hit.distance = spans.front().begin;
+    if (hit.distance > t_min)
+    {
+        hit.normal = spans.front().begin_normal;
+    }
+    return true;
+}
+
+void Gkm::Solid::ISolid::raycastBatch(const PointBatch& origins, const PointBatch& directions, double t_min, double t_max, std::vector<RayHit>& hits) const
+{
+    assert(origins.size() == directions.size());
+    const size_t ray_count = origins.size();
+    hits.resize(ray_count);
+    for (size_t i = 0; i < ray_count; ++i)
+    {
+        raycast(origins.point(i), directions.point(i), t_min, t_max, hits[i]);
+    }
+}
+
+bool Gkm::Solid::clipRay(const Eigen::AlignedBox3d& box, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double& t_min, double& t_max)
+{
+    if (box.isEmpty())
+    {
+        return false;
+    }
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        if (direction[axis] == 0.0)
+        {
+            // The ray is parallel to the slab
+            if (origin[axis] < box.min()[axis] || origin[axis] > box.max()[axis])
+            {
+                return false;
+            }
+            continue;
+        }
+        double t_enter = (box.min()[axis] - origin[axis]) / direction[axis];
+        double t_exit = (box.max()[axis] - origin[axis]) / direction[axis];
+        if (t_enter > t_exit)
+        {
+            std::swap(t_enter, t_exit);
+        }
+        t_min = std::max(t_min, t_enter);
+        t_max = std::min(t_max, t_exit);
+    }
+    return t_min <= t_max;
+}
+
+void Gkm::Solid::cubeRaySpans(double half_edge_size, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans)
+{
+    spans.clear();
+    // Slab intersection as in clipRay() which also keeps the axes of the entry and exit faces
+    double t_enter = -std::numeric_limits<double>::infinity();
+    double t_exit = std::numeric_limits<double>::infinity();
+    unsigned enter_axis = 3;
+    unsigned exit_axis = 3;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        if (direction[axis] == 0.0)
+        {
+            if (origin[axis] < -half_edge_size || origin[axis] > half_edge_size)
+            {
+                return;
+            }
+            continue;
+        }
+        double t_near = (-half_edge_size - origin[axis]) / direction[axis];
+        double t_far = (half_edge_size - origin[axis]) / direction[axis];
+        if (t_near > t_far)
+        {
+            std::swap(t_near, t_far);
+        }
+        if (t_near > t_enter)
+        {
+            t_enter = t_near;
+            enter_axis = axis;
+        }
+        if (t_far < t_exit)
+        {
+            t_exit = t_far;
+            exit_axis = axis;
+        }
+    }
+    RaySpan span;
+    span.begin = std::max(t_enter, t_min);
+    span.end = std::min(t_exit, t_max);
+    if (span.begin < span.end)
+    {
+        if (enter_axis < 3)
+        {
+            span.begin_normal[enter_axis] = direction[enter_axis] > 0.0 ? -1.0 : 1.0;
+        }
+        if (exit_axis < 3)
+        {
+            span.end_normal[exit_axis] = direction[exit_axis] > 0.0 ? 1.0 : -1.0;
+        }
+        spans.push_back(span);
+    }
+}
+
+void Gkm::Solid::sphereRaySpans(double radius, const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans)
+{
+    spans.clear();
+    // Roots of |origin + t * direction|^2 = radius^2
+    const double a = direction.squaredNorm();
+    const double b = origin.dot(direction);
+    const double c = origin.squaredNorm() - radius * radius;
+    const double discriminant = b * b - a * c;
+    if (a == 0.0 || discriminant <= 0.0)
+    {
+        return;
+    }
+    // Numerically stable form which avoids cancellation
+    const double q = -(b + std::copysign(std::sqrt(discriminant), b));
+    double t_enter = q / a;
+    double t_exit = q != 0.0 ? c / q : -t_enter;
+    if (t_enter > t_exit)
+    {
+        std::swap(t_enter, t_exit);
+    }
+    RaySpan span;
+    span.begin = std::max(t_enter, t_min);
+    span.end = std::min(t_exit, t_max);
+    if (span.begin < span.end)
+    {
+        span.begin_normal = (origin + t_enter * direction) / radius;
+        span.end_normal = (origin + t_exit * direction) / radius;
+        spans.push_back(span);
+    }
+}
+
+void Gkm::Solid::uniteSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result)
+{
+    result.clear();
+    size_t left_index = 0;
+    size_t right_index = 0;
+    while (left_index < left.size() || right_index < right.size())
+    {
+        // Take the span which starts first
+        const bool take_left = right_index == right.size() || (left_index < left.size() && left[left_index].begin <= right[right_index].begin);
+        const RaySpan& span = take_left ? left[left_index++] : right[right_index++];
+        if (!result.empty() && span.begin <= result.back().end)
+        {
+            if (span.end > result.back().end)
+            {
+                result.back().end = span.end;
+                result.back().end_normal = span.end_normal;
+            }
+        }
+        else
+        {
+            result.push_back(span);
+        }
+    }
+}
+
+void Gkm::Solid::subtractSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result)
+{
+    result.clear();
+    size_t right_index = 0;
+    for (auto& span : left)
+    {
+        RaySpan piece = span;
+        // Skip right spans which end before the current span
+        while (right_index < right.size() && right[right_index].end <= piece.begin)
+        {
+            ++right_index;
+        }
+        size_t cut_index = right_index;
+        while (cut_index < right.size() && right[cut_index].begin < span.end)
+        {
+            // Boundaries which come from the right operand have flipped normals
+            const RaySpan& cut = right[cut_index];
+            if (cut.begin > piece.begin)
+            {
+                piece.end = cut.begin;
+                piece.end_normal = -cut.begin_normal;
+                result.push_back(piece);
+            }
+            if (cut.end > piece.begin)
+            {
+                piece.begin = cut.end;
+                piece.begin_normal = -cut.end_normal;
+            }
+            ++cut_index;
+        }
+        if (piece.begin < span.end)
+        {
+            piece.end = span.end;
+            piece.end_normal = span.end_normal;
+            result.push_back(piece);
+        }
+    }
+}
+
+void Gkm::Solid::intersectSpans(const std::vector<RaySpan>& left, const std::vector<RaySpan>& right, std::vector<RaySpan>& result)
+{
+    result.clear();
+    size_t left_index = 0;
+    size_t right_index = 0;
+    while (left_index < left.size() && right_index < right.size())
+    {
+        const RaySpan& left_span = left[left_index];
+        const RaySpan& right_span = right[right_index];
+        const RaySpan& begin_span = left_span.begin >= right_span.begin ? left_span : right_span;
+        const RaySpan& end_span = left_span.end <= right_span.end ? left_span : right_span;
+        if (begin_span.begin < end_span.end)
+        {
+            result.push_back(RaySpan{ begin_span.begin, end_span.end, begin_span.begin_normal, end_span.end_normal });
+        }
+        if (left[left_index].end < right[right_index].end)
+        {
+            ++left_index;
+        }
+        else
+        {
+            ++right_index;
+        }
+    }
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::EmptySolid::type() const
+{
+    return ESolidType::Empty;
+}
+
+bool Gkm::Solid::EmptySolid::inside(const Eigen::Vector3d& /*point*/) const
+{
+    return false;
+}
+
+Eigen::AlignedBox3d Gkm::Solid::EmptySolid::bbox() const
+{
+    return Eigen::AlignedBox3d();
+}
+
+void Gkm::Solid::EmptySolid::raySpans(const Eigen::Vector3d& /*origin*/, const Eigen::Vector3d& /*direction*/, double /*t_min*/, double /*t_max*/, std::vector<RaySpan>& spans) const
+{
+    spans.clear();
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::Cube::type() const
+{
+    return ESolidType::Cube;
+}
+
 bool Gkm::Solid::Cube::inside(const Eigen::Vector3d& point) const
 {
     return std::fabs(point.x()) <= half_edge_size && std::fabs(point.y()) <= half_edge_size && std::fabs(point.z()) <= half_edge_size;
@@ -16,15 +353,25 @@ Eigen::AlignedBox3d Gkm::Solid::Cube::bbox() const
     return bbox;
 }
 
+void Gkm::Solid::Cube::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    cubeRaySpans(half_edge_size, origin, direction, t_min, t_max, spans);
+}
+
 //Gkm::Solid::NearestPointInfo Gkm::Solid::Cube::calcNearestPointOnBoundary(const Eigen::Vector3d& point) const
 //{
 //    Gkm::Solid::Cube::
 //}
 
+Gkm::Solid::ESolidType Gkm::Solid::Sphere::type() const
+{
+    return ESolidType::Sphere;
+}
+
 bool Gkm::Solid::Sphere::inside(const Eigen::Vector3d& point) const
 {
     const double length = point.squaredNorm();
-    return length <= radius;
+    return length <= radius * radius;
 }
 
 Eigen::AlignedBox3d Gkm::Solid::Sphere::bbox() const
@@ -35,6 +382,16 @@ Eigen::AlignedBox3d Gkm::Solid::Sphere::bbox() const
     return bbox;
 }
 
+void Gkm::Solid::Sphere::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    sphereRaySpans(radius, origin, direction, t_min, t_max, spans);
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::UnionOperator::type() const
+{
+    return ESolidType::Union;
+}
+
 bool Gkm::Solid::UnionOperator::inside(const Eigen::Vector3d& point) const
 {
     return left->inside(point) || right->inside(point);
@@ -46,6 +403,32 @@ Eigen::AlignedBox3d Gkm::Solid::UnionOperator::bbox() const
     return bbox.merged(right->bbox());
 }
 
+void Gkm::Solid::UnionOperator::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    std::vector<RaySpan> left_spans;
+    std::vector<RaySpan> right_spans;
+    left->raySpans(origin, direction, t_min, t_max, left_spans);
+    right->raySpans(origin, direction, t_min, t_max, right_spans);
+    uniteSpans(left_spans, right_spans, spans);
+}
+
+bool Gkm::Solid::UnionOperator::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    // The right operand is asked only before the left hit
+    const bool left_hit = left->raycast(origin, direction, t_min, t_max, hit);
+    RayHit right_hit;
+    if (right->raycast(origin, direction, t_min, left_hit ? hit.distance : t_max, right_hit) && (!left_hit || right_hit.distance < hit.distance))
+    {
+        hit = right_hit;
+    }
+    return hit.hit;
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::DifferenceOperator::type() const
+{
+    return ESolidType::Difference;
+}
+
 bool Gkm::Solid::DifferenceOperator::inside(const Eigen::Vector3d& point) const
 {
     return left->inside(point) && !right->inside(point);
@@ -56,6 +439,55 @@ Eigen::AlignedBox3d Gkm::Solid::DifferenceOperator::bbox() const
     return left->bbox();
 }
 
+void Gkm::Solid::DifferenceOperator::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    std::vector<RaySpan> left_spans;
+    left->raySpans(origin, direction, t_min, t_max, left_spans);
+    if (left_spans.empty())
+    {
+        spans.clear();
+        return;
+    }
+    // The right operand matters only within the left spans
+    std::vector<RaySpan> right_spans;
+    right->raySpans(origin, direction, left_spans.front().begin, left_spans.back().end, right_spans);
+    subtractSpans(left_spans, right_spans, spans);
+}
+
+bool Gkm::Solid::DifferenceOperator::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    // Walks along the ray from one left entry to another, skipping the right spans which cover them
+    double t = t_min;
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    RayHit left_hit;
+    std::vector<RaySpan> right_spans;
+    while (left->raycast(origin, direction, t, t_max, left_hit))
+    {
+        if (left_hit.distance > t)
+        {
+            t = left_hit.distance;
+            normal = left_hit.normal;
+        }
+        right->raySpans(origin, direction, t, t_max, right_spans);
+        if (right_spans.empty() || right_spans.front().begin > t)
+        {
+            hit.hit = true;
+            hit.distance = t;
+            hit.normal = normal;
+            return true;
+        }
+        t = right_spans.front().end;
+        normal = -right_spans.front().end_normal;
+    }
+    hit = RayHit();
+    return false;
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::IntersectionOperator::type() const
+{
+    return ESolidType::Intersection;
+}
+
 bool Gkm::Solid::IntersectionOperator::inside(const Eigen::Vector3d& point) const
 {
     return left->inside(point) && right->inside(point);
@@ -63,7 +495,61 @@ bool Gkm::Solid::IntersectionOperator::inside(const Eigen::Vector3d& point) cons
 
 Eigen::AlignedBox3d Gkm::Solid::IntersectionOperator::bbox() const
 {
-    return left->bbox();
+    Eigen::AlignedBox3d bbox = left->bbox();
+    return bbox.intersection(right->bbox());
+}
+
+void Gkm::Solid::IntersectionOperator::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    std::vector<RaySpan> left_spans;
+    left->raySpans(origin, direction, t_min, t_max, left_spans);
+    if (left_spans.empty())
+    {
+        spans.clear();
+        return;
+    }
+    std::vector<RaySpan> right_spans;
+    right->raySpans(origin, direction, left_spans.front().begin, left_spans.back().end, right_spans);
+    intersectSpans(left_spans, right_spans, spans);
+}
+
+bool Gkm::Solid::IntersectionOperator::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    // Operands are asked in turn from the current point until both of them contain it
+    const ISolid* operands[2] = { left.get(), right.get() };
+    double t = t_min;
+    Eigen::Vector3d normal = Eigen::Vector3d::Zero();
+    unsigned containing_count = 0;
+    unsigned operand_index = 0;
+    RayHit operand_hit;
+    while (containing_count < 2)
+    {
+        if (!operands[operand_index]->raycast(origin, direction, t, t_max, operand_hit))
+        {
+            hit = RayHit();
+            return false;
+        }
+        if (operand_hit.distance > t)
+        {
+            t = operand_hit.distance;
+            normal = operand_hit.normal;
+            containing_count = 1;
+        }
+        else
+        {
+            ++containing_count;
+        }
+        operand_index ^= 1;
+    }
+    hit.hit = true;
+    hit.distance = t;
+    hit.normal = normal;
+    return true;
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::TransformOperator::type() const
+{
+    return ESolidType::Transform;
 }
 
 bool Gkm::Solid::TransformOperator::inside(const Eigen::Vector3d& point) const
@@ -78,3 +564,179 @@ Eigen::AlignedBox3d Gkm::Solid::TransformOperator::bbox() const
     bbox.max() += translate;
     return bbox;
 }
+
+void Gkm::Solid::TransformOperator::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    solid->raySpans(origin - translate, direction, t_min, t_max, spans);
+}
+
+bool Gkm::Solid::TransformOperator::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    return solid->raycast(origin - translate, direction, t_min, t_max, hit);
+}
+
+void Gkm::Solid::MultiUnionOperator::add(const ISolid::Ptr& solid)
+{
+    solids.push_back(solid);
+    bboxes.push_back(solid->bbox());
+}
+
+Gkm::Solid::ESolidType Gkm::Solid::MultiUnionOperator::type() const
+{
+    return ESolidType::MultiUnion;
+}
+
+bool Gkm::Solid::MultiUnionOperator::inside(const Eigen::Vector3d& point) const
+{
+    const size_t solid_count = solids.size();
+    for (size_t i = 0; i < solid_count; ++i)
+    {
+        if (bboxes[i].contains(point) && solids[i]->inside(point))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+Eigen::AlignedBox3d Gkm::Solid::MultiUnionOperator::bbox() const
+{
+    Eigen::AlignedBox3d bbox;
+    for (auto& solid_bbox : bboxes)
+    {
+        bbox.extend(solid_bbox);
+    }
+    return bbox;
+}
+
+void Gkm::Solid::MultiUnionOperator::raySpans(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, std::vector<RaySpan>& spans) const
+{
+    spans.clear();
+    std::vector<RaySpan> solid_spans;
+    std::vector<RaySpan> united_spans;
+    const size_t solid_count = solids.size();
+    for (size_t i = 0; i < solid_count; ++i)
+    {
+        // Operands which are missed by the ray are skipped, the others are asked only within their bounding boxes
+        double solid_t_min = t_min;
+        double solid_t_max = t_max;
+        if (!clipRay(bboxes[i], origin, direction, solid_t_min, solid_t_max))
+        {
+            continue;
+        }
+        solids[i]->raySpans(origin, direction, solid_t_min, solid_t_max, solid_spans);
+        if (solid_spans.empty())
+        {
+            continue;
+        }
+        uniteSpans(spans, solid_spans, united_spans);
+        spans.swap(united_spans);
+    }
+}
+
+bool Gkm::Solid::MultiUnionOperator::raycast(const Eigen::Vector3d& origin, const Eigen::Vector3d& direction, double t_min, double t_max, RayHit& hit) const
+{
+    hit = RayHit();
+    std::vector<std::pair<double, size_t>> entries;
+    const Eigen::Vector3d inverse_direction = direction.cwiseInverse();
+    const size_t solid_count = solids.size();
+    for (size_t i = 0; i < solid_count; ++i)
+    {
+        double solid_t_min = t_min;
+        double solid_t_max = t_max;
+        if (clipRayByInverse(bboxes[i], origin, direction, inverse_direction, solid_t_min, solid_t_max))
+        {
+            entries.emplace_back(solid_t_min, i);
+        }
+    }
+    std::sort(entries.begin(), entries.end());
+    RayHit solid_hit;
+    for (auto& entry : entries)
+    {
+        if (hit.hit && entry.first >= hit.distance)
+        {
+            break;
+        }
+        // Operands are asked from t_min, so a ray which starts inside an operand is detected
+        if (solids[entry.second]->raycast(origin, direction, t_min, hit.hit ? hit.distance : t_max, solid_hit) && (!hit.hit || solid_hit.distance < hit.distance))
+        {
+            hit = solid_hit;
+        }
+    }
+    return hit.hit;
+}
+
+void Gkm::Solid::MultiUnionOperator::raycastBatch(const PointBatch& origins, const PointBatch& directions, double t_min, double t_max, std::vector<RayHit>& hits) const
+{
+    assert(origins.size() == directions.size());
+    const size_t ray_count = origins.size();
+    hits.assign(ray_count, RayHit());
+    RayHit solid_hit;
+    const size_t solid_count = solids.size();
+    std::vector<std::pair<double, size_t>> order(solid_count);
+    std::vector<Eigen::Vector3d> inverse_directions(RAY_PACKET_SIZE);
+    const Eigen::AlignedBox3d box = bbox();
+    for (size_t packet_begin = 0; packet_begin < ray_count; packet_begin += RAY_PACKET_SIZE)
+    {
+        const size_t packet_end = std::min(packet_begin + RAY_PACKET_SIZE, ray_count);
+        // Operands are visited front to back along the average direction, so early hits shorten the rays
+        Eigen::Vector3d average_direction = Eigen::Vector3d::Zero();
+        for (size_t ray_index = packet_begin; ray_index < packet_end; ++ray_index)
+        {
+            average_direction += directions.point(ray_index);
+            inverse_directions[ray_index - packet_begin] = directions.point(ray_index).cwiseInverse();
+        }
+        for (size_t i = 0; i < solid_count; ++i)
+        {
+            order[i] = std::make_pair(bboxes[i].center().dot(average_direction), i);
+        }
+        std::sort(order.begin(), order.end());
+
+        // Box of the remaining ray segments of the packet within the box of the operator, so infinite rays give finite bounds.
+        // It is updated after hits only.
+        Eigen::AlignedBox3d packet_box;
+        bool packet_box_valid = false;
+        for (auto& entry : order)
+        {
+            const size_t i = entry.second;
+            if (!packet_box_valid)
+            {
+                packet_box.setEmpty();
+                for (size_t ray_index = packet_begin; ray_index < packet_end; ++ray_index)
+                {
+                    const Eigen::Vector3d origin = origins.point(ray_index);
+                    const Eigen::Vector3d direction = directions.point(ray_index);
+                    double segment_t_min = t_min;
+                    double segment_t_max = hits[ray_index].hit ? hits[ray_index].distance : t_max;
+                    if (clipRayByInverse(box, origin, direction, inverse_directions[ray_index - packet_begin], segment_t_min, segment_t_max))
+                    {
+                        packet_box.extend(Eigen::Vector3d(origin + segment_t_min * direction));
+                        packet_box.extend(Eigen::Vector3d(origin + segment_t_max * direction));
+                    }
+                }
+                packet_box_valid = true;
+            }
+            if (!packet_box.intersects(bboxes[i]))
+            {
+                continue;
+            }
+            for (size_t ray_index = packet_begin; ray_index < packet_end; ++ray_index)
+            {
+                RayHit& hit = hits[ray_index];
+                const Eigen::Vector3d origin = origins.point(ray_index);
+                const Eigen::Vector3d direction = directions.point(ray_index);
+                double solid_t_min = t_min;
+                double solid_t_max = hit.hit ? hit.distance : t_max;
+                if (!clipRayByInverse(bboxes[i], origin, direction, inverse_directions[ray_index - packet_begin], solid_t_min, solid_t_max) || (hit.hit && solid_t_min >= hit.distance))
+                {
+                    continue;
+                }
+                if (solids[i]->raycast(origin, direction, t_min, hit.hit ? hit.distance : t_max, solid_hit) && (!hit.hit || solid_hit.distance < hit.distance))
+                {
+                    hit = solid_hit;
+                    packet_box_valid = false;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,515 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <map>
+#include <tuple>
+#include "gkm_solid/gkm_tape.h"
+
+namespace
+{
+    void hashCombine(size_t& seed, size_t value)
+    {
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    }
+
+    // Subtracts translation offsets one by one from points, the same way as nested TransformOperator::inside calls do
+    template <typename Scalar>
+    void localCoordinates(const Gkm::Solid::PointBatch& points, size_t start, size_t count, const Eigen::Vector3d* offsets, unsigned offset_count, Scalar* local_x, Scalar* local_y, Scalar* local_z)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            local_x[i] = static_cast<Scalar>(points.x[start + i]);
+            local_y[i] = static_cast<Scalar>(points.y[start + i]);
+            local_z[i] = static_cast<Scalar>(points.z[start + i]);
+        }
+        for (unsigned offset_index = 0; offset_index < offset_count; ++offset_index)
+        {
+            const Scalar offset_x = static_cast<Scalar>(offsets[offset_index].x());
+            const Scalar offset_y = static_cast<Scalar>(offsets[offset_index].y());
+            const Scalar offset_z = static_cast<Scalar>(offsets[offset_index].z());
+            for (size_t i = 0; i < count; ++i)
+            {
+                local_x[i] -= offset_x;
+                local_y[i] -= offset_y;
+                local_z[i] -= offset_z;
+            }
+        }
+    }
+
+    // Upper bound of the difference between float and exact local coordinates.
+    // Conversion of a point and of each offset and each subtraction add at most half float epsilon
+    // relative to the largest intermediate value, the bound is doubled for safety.
+    double coordinateMargin(double max_coordinate, const Eigen::Vector3d* offsets, unsigned offset_count)
+    {
+        double max_value = max_coordinate;
+        for (unsigned offset_index = 0; offset_index < offset_count; ++offset_index)
+        {
+            max_value += offsets[offset_index].cwiseAbs().maxCoeff();
+        }
+        return (offset_count + 2) * max_value * std::numeric_limits<float>::epsilon();
+    }
+
+    float roundDown(double value)
+    {
+        float result = static_cast<float>(value);
+        if (result > value)
+        {
+            result = std::nextafter(result, -std::numeric_limits<float>::infinity());
+        }
+        return result;
+    }
+
+    float roundUp(double value)
+    {
+        float result = static_cast<float>(value);
+        if (result < value)
+        {
+            result = std::nextafter(result, std::numeric_limits<float>::infinity());
+        }
+        return result;
+    }
+
+    class TapeCompiler
+    {
+        typedef std::tuple<unsigned, double, double, double> ChainKey;
+
+        std::vector<Gkm::Solid::TapeInstruction>& instructions;
+        std::vector<Eigen::Vector3d>& offsets;
+        // Translation chains are interned, chain 0 is the empty one
+        std::vector<std::vector<Eigen::Vector3d>> chains;
+        std::map<ChainKey, unsigned> chain_index;
+        std::map<std::pair<const Gkm::Solid::ISolid*, unsigned>, unsigned> slots;
+
+        unsigned addChain(unsigned chain, const Eigen::Vector3d& translate);
+        unsigned addLeaf(Gkm::Solid::ETapeOpCode op_code, double size, const Gkm::Solid::ISolid* solid, unsigned chain);
+        unsigned addOperation(Gkm::Solid::ETapeOpCode op_code, unsigned left, unsigned right);
+
+    public:
+        TapeCompiler(std::vector<Gkm::Solid::TapeInstruction>& instructions, std::vector<Eigen::Vector3d>& offsets);
+        unsigned compile(const Gkm::Solid::ISolid::Ptr& solid, unsigned chain);
+    };
+
+    TapeCompiler::TapeCompiler(std::vector<Gkm::Solid::TapeInstruction>& instructions_, std::vector<Eigen::Vector3d>& offsets_) :
+        instructions(instructions_), offsets(offsets_)
+    {
+        chains.emplace_back();
+    }
+
+    unsigned TapeCompiler::addChain(unsigned chain, const Eigen::Vector3d& translate)
+    {
+        const ChainKey key(chain, translate.x(), translate.y(), translate.z());
+        auto found_it = chain_index.find(key);
+        if (found_it != chain_index.end())
+        {
+            return found_it->second;
+        }
+        // Inner transforms are applied after outer ones, exactly like nested TransformOperator::inside calls do
+        std::vector<Eigen::Vector3d> new_chain = chains[chain];
+        new_chain.push_back(translate);
+        const unsigned new_chain_index = static_cast<unsigned>(chains.size());
+        chains.push_back(std::move(new_chain));
+        chain_index.emplace(key, new_chain_index);
+        return new_chain_index;
+    }
+
+    unsigned TapeCompiler::addLeaf(Gkm::Solid::ETapeOpCode op_code, double size, const Gkm::Solid::ISolid* solid, unsigned chain)
+    {
+        Gkm::Solid::TapeInstruction instruction;
+        instruction.op_code = op_code;
+        instruction.size = size;
+        instruction.solid = solid;
+        instruction.offset_begin = static_cast<unsigned>(offsets.size());
+        instruction.offset_count = static_cast<unsigned>(chains[chain].size());
+        offsets.insert(offsets.end(), chains[chain].begin(), chains[chain].end());
+        instructions.push_back(instruction);
+        return static_cast<unsigned>(instructions.size() - 1);
+    }
+
+    unsigned TapeCompiler::addOperation(Gkm::Solid::ETapeOpCode op_code, unsigned left, unsigned right)
+    {
+        Gkm::Solid::TapeInstruction instruction;
+        instruction.op_code = op_code;
+        instruction.left = left;
+        instruction.right = right;
+        instructions.push_back(instruction);
+        return static_cast<unsigned>(instructions.size() - 1);
+    }
+
+    unsigned TapeCompiler::compile(const Gkm::Solid::ISolid::Ptr& solid, unsigned chain)
+    {
+        const auto key = std::make_pair(static_cast<const Gkm::Solid::ISolid*>(solid.get()), chain);
+        auto found_it = slots.find(key);
+        if (found_it != slots.end())
+        {
+            return found_it->second;
+        }
+
+        unsigned result = 0;
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Empty:
+            result = addLeaf(Gkm::Solid::ETapeOpCode::False, 0.0, nullptr, 0);
+            break;
+        case Gkm::Solid::ESolidType::Cube:
+            result = addLeaf(Gkm::Solid::ETapeOpCode::Cube, std::static_pointer_cast<Gkm::Solid::Cube>(solid)->half_edge_size, nullptr, chain);
+            break;
+        case Gkm::Solid::ESolidType::Sphere:
+            result = addLeaf(Gkm::Solid::ETapeOpCode::Sphere, std::static_pointer_cast<Gkm::Solid::Sphere>(solid)->radius, nullptr, chain);
+            break;
+        case Gkm::Solid::ESolidType::Union:
+        case Gkm::Solid::ESolidType::Difference:
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            auto boolean_operator = std::static_pointer_cast<Gkm::Solid::IBooleanOperator>(solid);
+            const unsigned left = compile(boolean_operator->left, chain);
+            const unsigned right = compile(boolean_operator->right, chain);
+            Gkm::Solid::ETapeOpCode op_code = Gkm::Solid::ETapeOpCode::Union;
+            if (solid->type() == Gkm::Solid::ESolidType::Difference)
+            {
+                op_code = Gkm::Solid::ETapeOpCode::Difference;
+            }
+            else if (solid->type() == Gkm::Solid::ESolidType::Intersection)
+            {
+                op_code = Gkm::Solid::ETapeOpCode::Intersection;
+            }
+            result = addOperation(op_code, left, right);
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+        {
+            auto transform_operator = std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid);
+            result = compile(transform_operator->solid, addChain(chain, transform_operator->translate));
+            break;
+        }
+        case Gkm::Solid::ESolidType::MultiUnion:
+        {
+            auto multi_union_operator = std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid);
+            if (multi_union_operator->solids.empty())
+            {
+                result = addLeaf(Gkm::Solid::ETapeOpCode::False, 0.0, nullptr, 0);
+                break;
+            }
+            result = compile(multi_union_operator->solids.front(), chain);
+            for (size_t i = 1; i < multi_union_operator->solids.size(); ++i)
+            {
+                result = addOperation(Gkm::Solid::ETapeOpCode::Union, result, compile(multi_union_operator->solids[i], chain));
+            }
+            break;
+        }
+        default:
+            result = addLeaf(Gkm::Solid::ETapeOpCode::Solid, 0.0, solid.get(), chain);
+            break;
+        }
+        slots.emplace(key, result);
+        return result;
+    }
+}
+
+constexpr size_t Gkm::Solid::Tape::BLOCK_SIZE;
+
+Gkm::Solid::Tape::Tape(const ISolid::Ptr& solid_) : solid(solid_)
+{
+    TapeCompiler compiler(instructions, offsets);
+    const unsigned result = compiler.compile(solid, 0);
+    // The result of the last instruction is the result of the tape
+    if (result + 1 != instructions.size())
+    {
+        TapeInstruction instruction;
+        instruction.op_code = ETapeOpCode::Union;
+        instruction.left = result;
+        instruction.right = result;
+        instructions.push_back(instruction);
+    }
+}
+
+void Gkm::Solid::Tape::evaluate(const PointBatch& points, std::vector<unsigned char>& result, EPrecision precision, size_t* fallback_count) const
+{
+    const size_t point_count = points.size();
+    result.resize(point_count);
+    Scratch scratch;
+    scratch.slots.resize(instructions.size() * BLOCK_SIZE);
+    if (precision == EPrecision::Mixed)
+    {
+        scratch.upper_slots.resize(instructions.size() * BLOCK_SIZE);
+    }
+    size_t fallback_point_count = 0;
+    for (size_t start = 0; start < point_count; start += BLOCK_SIZE)
+    {
+        const size_t count = std::min(BLOCK_SIZE, point_count - start);
+        switch (precision)
+        {
+        case EPrecision::Double:
+            evaluateBlock<double>(points, start, count, scratch, &result[start]);
+            break;
+        case EPrecision::Float:
+            evaluateBlock<float>(points, start, count, scratch, &result[start]);
+            break;
+        case EPrecision::Mixed:
+            fallback_point_count += evaluateMixedBlock(points, start, count, scratch, &result[start]);
+            break;
+        }
+    }
+    if (fallback_count)
+    {
+        *fallback_count += fallback_point_count;
+    }
+}
+
+const std::vector<Gkm::Solid::TapeInstruction>& Gkm::Solid::Tape::getInstructions() const
+{
+    return instructions;
+}
+
+const std::vector<Eigen::Vector3d>& Gkm::Solid::Tape::getOffsets() const
+{
+    return offsets;
+}
+
+size_t Gkm::Solid::Tape::hash() const
+{
+    std::hash<double> hash_double;
+    size_t seed = instructions.size();
+    for (auto& instruction : instructions)
+    {
+        hashCombine(seed, static_cast<size_t>(instruction.op_code));
+        hashCombine(seed, instruction.left);
+        hashCombine(seed, instruction.right);
+        hashCombine(seed, instruction.offset_count);
+        hashCombine(seed, hash_double(instruction.size + 0.0));
+        hashCombine(seed, std::hash<const ISolid*>()(instruction.solid));
+        for (unsigned i = 0; i < instruction.offset_count; ++i)
+        {
+            const Eigen::Vector3d& offset = offsets[instruction.offset_begin + i];
+            hashCombine(seed, hash_double(offset.x() + 0.0));
+            hashCombine(seed, hash_double(offset.y() + 0.0));
+            hashCombine(seed, hash_double(offset.z() + 0.0));
+        }
+    }
+    return seed;
+}
+
+template <typename Scalar>
+void Gkm::Solid::Tape::evaluateBlock(const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* result) const
+{
+    std::vector<unsigned char>& slots = scratch.slots;
+    Scalar local_x[BLOCK_SIZE];
+    Scalar local_y[BLOCK_SIZE];
+    Scalar local_z[BLOCK_SIZE];
+
+    const size_t instruction_count = instructions.size();
+    for (size_t instruction_index = 0; instruction_index < instruction_count; ++instruction_index)
+    {
+        const TapeInstruction& instruction = instructions[instruction_index];
+        unsigned char* output = &slots[instruction_index * BLOCK_SIZE];
+        switch (instruction.op_code)
+        {
+        case ETapeOpCode::Cube:
+        case ETapeOpCode::Sphere:
+            localCoordinates(points, start, count, offsets.data() + instruction.offset_begin, instruction.offset_count, local_x, local_y, local_z);
+            break;
+        default:
+            break;
+        }
+
+        const unsigned char* left = &slots[instruction.left * BLOCK_SIZE];
+        const unsigned char* right = &slots[instruction.right * BLOCK_SIZE];
+        switch (instruction.op_code)
+        {
+        case ETapeOpCode::False:
+            std::fill(output, output + count, static_cast<unsigned char>(0));
+            break;
+        case ETapeOpCode::Cube:
+        {
+            const Scalar half_edge_size = static_cast<Scalar>(instruction.size);
+            for (size_t i = 0; i < count; ++i)
+            {
+                output[i] = (std::abs(local_x[i]) <= half_edge_size) & (std::abs(local_y[i]) <= half_edge_size) & (std::abs(local_z[i]) <= half_edge_size);
+            }
+            break;
+        }
+        case ETapeOpCode::Sphere:
+        {
+            const Scalar squared_radius = static_cast<Scalar>(instruction.size * instruction.size);
+            for (size_t i = 0; i < count; ++i)
+            {
+                // The same summation order as Eigen uses for squaredNorm()
+                const Scalar length = (local_x[i] * local_x[i] + local_y[i] * local_y[i]) + local_z[i] * local_z[i];
+                output[i] = length <= squared_radius;
+            }
+            break;
+        }
+        case ETapeOpCode::Solid:
+            evaluateSolid(instruction, points, start, count, scratch, output);
+            break;
+        case ETapeOpCode::Union:
+            for (size_t i = 0; i < count; ++i)
+            {
+                output[i] = left[i] | right[i];
+            }
+            break;
+        case ETapeOpCode::Difference:
+            for (size_t i = 0; i < count; ++i)
+            {
+                output[i] = left[i] & (right[i] ^ 1);
+            }
+            break;
+        case ETapeOpCode::Intersection:
+            for (size_t i = 0; i < count; ++i)
+            {
+                output[i] = left[i] & right[i];
+            }
+            break;
+        }
+    }
+    const unsigned char* tape_result = &slots[(instruction_count - 1) * BLOCK_SIZE];
+    std::copy(tape_result, tape_result + count, result);
+}
+
+size_t Gkm::Solid::Tape::evaluateMixedBlock(const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* result) const
+{
+    // Each slot keeps two masks: lower is certainly inside, upper is possibly inside
+    std::vector<unsigned char>& lower_slots = scratch.slots;
+    std::vector<unsigned char>& upper_slots = scratch.upper_slots;
+    float local_x[BLOCK_SIZE];
+    float local_y[BLOCK_SIZE];
+    float local_z[BLOCK_SIZE];
+
+    double max_coordinate = 0.0;
+    for (size_t i = start; i < start + count; ++i)
+    {
+        max_coordinate = std::max(max_coordinate, std::max(std::fabs(points.x[i]), std::max(std::fabs(points.y[i]), std::fabs(points.z[i]))));
+    }
+
+    const size_t instruction_count = instructions.size();
+    for (size_t instruction_index = 0; instruction_index < instruction_count; ++instruction_index)
+    {
+        const TapeInstruction& instruction = instructions[instruction_index];
+        unsigned char* lower = &lower_slots[instruction_index * BLOCK_SIZE];
+        unsigned char* upper = &upper_slots[instruction_index * BLOCK_SIZE];
+        double margin = 0.0;
+        switch (instruction.op_code)
+        {
+        case ETapeOpCode::Cube:
+        case ETapeOpCode::Sphere:
+            localCoordinates(points, start, count, offsets.data() + instruction.offset_begin, instruction.offset_count, local_x, local_y, local_z);
+            margin = coordinateMargin(max_coordinate, offsets.data() + instruction.offset_begin, instruction.offset_count);
+            break;
+        default:
+            break;
+        }
+
+        const unsigned char* left_lower = &lower_slots[instruction.left * BLOCK_SIZE];
+        const unsigned char* right_lower = &lower_slots[instruction.right * BLOCK_SIZE];
+        const unsigned char* left_upper = &upper_slots[instruction.left * BLOCK_SIZE];
+        const unsigned char* right_upper = &upper_slots[instruction.right * BLOCK_SIZE];
+        switch (instruction.op_code)
+        {
+        case ETapeOpCode::False:
+            std::fill(lower, lower + count, static_cast<unsigned char>(0));
+            std::fill(upper, upper + count, static_cast<unsigned char>(0));
+            break;
+        case ETapeOpCode::Cube:
+        {
+            // |local| <= size - margin proves that the point is inside, |local| > size + margin proves that it is outside
+            const float inner = roundDown(instruction.size - margin);
+            const float outer = roundUp(instruction.size + margin);
+            for (size_t i = 0; i < count; ++i)
+            {
+                const float abs_x = std::abs(local_x[i]);
+                const float abs_y = std::abs(local_y[i]);
+                const float abs_z = std::abs(local_z[i]);
+                lower[i] = (abs_x <= inner) & (abs_y <= inner) & (abs_z <= inner);
+                upper[i] = (abs_x <= outer) & (abs_y <= outer) & (abs_z <= outer);
+            }
+            break;
+        }
+        case ETapeOpCode::Sphere:
+        {
+            // Local point is shifted by at most sqrt(3) * margin, its squared length has at most 3 float roundings
+            const double distance_margin = std::sqrt(3.0) * margin;
+            const double inner_radius = instruction.size - distance_margin;
+            const double outer_radius = instruction.size + distance_margin;
+            const double length_error = 4.0 * std::numeric_limits<float>::epsilon();
+            const float inner = inner_radius > 0.0 ? roundDown(inner_radius * inner_radius * (1.0 - length_error)) : -1.0f;
+            const float outer = roundUp(outer_radius * outer_radius * (1.0 + length_error));
+            for (size_t i = 0; i < count; ++i)
+            {
+                const float length = (local_x[i] * local_x[i] + local_y[i] * local_y[i]) + local_z[i] * local_z[i];
+                lower[i] = length <= inner;
+                upper[i] = length <= outer;
+            }
+            break;
+        }
+        case ETapeOpCode::Solid:
+            // Leaf solids which are not known by the tape are always evaluated exactly
+            evaluateSolid(instruction, points, start, count, scratch, lower);
+            std::copy(lower, lower + count, upper);
+            break;
+        case ETapeOpCode::Union:
+            for (size_t i = 0; i < count; ++i)
+            {
+                lower[i] = left_lower[i] | right_lower[i];
+                upper[i] = left_upper[i] | right_upper[i];
+            }
+            break;
+        case ETapeOpCode::Difference:
+            for (size_t i = 0; i < count; ++i)
+            {
+                lower[i] = left_lower[i] & (right_upper[i] ^ 1);
+                upper[i] = left_upper[i] & (right_lower[i] ^ 1);
+            }
+            break;
+        case ETapeOpCode::Intersection:
+            for (size_t i = 0; i < count; ++i)
+            {
+                lower[i] = left_lower[i] & right_lower[i];
+                upper[i] = left_upper[i] & right_upper[i];
+            }
+            break;
+        }
+    }
+
+    const unsigned char* tape_lower = &lower_slots[(instruction_count - 1) * BLOCK_SIZE];
+    const unsigned char* tape_upper = &upper_slots[(instruction_count - 1) * BLOCK_SIZE];
+    std::copy(tape_lower, tape_lower + count, result);
+    PointBatch& fallback_points = scratch.fallback_points;
+    std::vector<unsigned>& fallback_indices = scratch.fallback_indices;
+    fallback_points.clear();
+    fallback_indices.clear();
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (tape_lower[i] != tape_upper[i])
+        {
+            fallback_indices.push_back(static_cast<unsigned>(i));
+            fallback_points.x.push_back(points.x[start + i]);
+            fallback_points.y.push_back(points.y[start + i]);
+            fallback_points.z.push_back(points.z[start + i]);
+        }
+    }
+    const size_t fallback_count = fallback_indices.size();
+    if (fallback_count)
+    {
+        unsigned char fallback_result[BLOCK_SIZE];
+        evaluateBlock<double>(fallback_points, 0, fallback_count, scratch, fallback_result);
+        for (size_t i = 0; i < fallback_count; ++i)
+        {
+            result[fallback_indices[i]] = fallback_result[i];
+        }
+    }
+    return fallback_count;
+}
+
+void Gkm::Solid::Tape::evaluateSolid(const TapeInstruction& instruction, const PointBatch& points, size_t start, size_t count, Scratch& scratch, unsigned char* output) const
+{
+    PointBatch& solid_points = scratch.solid_points;
+    solid_points.x.resize(count);
+    solid_points.y.resize(count);
+    solid_points.z.resize(count);
+    localCoordinates(points, start, count, offsets.data() + instruction.offset_begin, instruction.offset_count, solid_points.x.data(), solid_points.y.data(), solid_points.z.data());
+    instruction.solid->insideBatch(solid_points, scratch.solid_result);
+    std::copy(scratch.solid_result.begin(), scratch.solid_result.end(), output);
+}
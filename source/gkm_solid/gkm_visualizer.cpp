@@ -1,7 +1,20 @@
 // Copyright 2020 Petr Petrovich Petrov. All rights reserved.
 // License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <list>
+#include <map>
+#include <cstring>
+#include <unordered_map>
 #include "gkm_solid/gkm_visualizer.h"
+#include "gkm_solid/gkm_decimator.h"
+#include "gkm_solid/gkm_mesh_optimizer.h"
+#include "gkm_solid/gkm_jit.h"
+#include "gkm_parallel.h"
 
 namespace
 {
@@ -27,6 +40,10 @@ namespace
 
         Eigen::Vector3d point;
         bool hollow = false;
+        // Boundary cube which is approximated by a plane, it is rendered as the cube clipped by the plane
+        bool planar = false;
+        Eigen::Vector3d plane_point;
+        Eigen::Vector3d plane_normal;
         int point_index = 0;
 
         bool isCube() const;
@@ -199,22 +216,31 @@ namespace
         return &points.back()[last_index++];
     }
 
+    // Samples along each edge of a cube which are checked by checkAndSplitCube()
+    constexpr size_t CHECK_COUNT = 5;
+
     class ModelBuilder
     {
-        double TOLERANCE = 0.1;
+        // Planar cubes could be at most this number of surface tolerances large, so samples are dense enough to see the surface
+        static constexpr double MAX_PLANAR_CUBE_SIZE = 16.0;
+
+        Gkm::Solid::BuildOptions options;
         Gkm::Solid::ISolid::Ptr solid;
         Cubes cubes;
 
         Point* addPointX(Point* start_x, Point* end_x);
         Point* addPointY(Point* start_y, Point* end_y);
         Point* addPointZ(Point* start_z, Point* end_z);
+        // Returns the smallest tolerances of the options and of the regions which intersect the cube
+        void getTolerances(const Point* cube, double& tolerance, double& surface_tolerance) const;
+        bool fitPlane(Point* cube, const bool (&inside)[CHECK_COUNT][CHECK_COUNT][CHECK_COUNT], double surface_tolerance) const;
         bool split(Point* cube);
         bool checkAndSplitCube(Point* cube);
         void checkAndSplitCubes();
         Gkm::Solid::Model::Ptr buildModel();
 
     public:
-        ModelBuilder(const Gkm::Solid::ISolid::Ptr& solid);
+        ModelBuilder(const Gkm::Solid::ISolid::Ptr& solid, const Gkm::Solid::BuildOptions& options);
         Gkm::Solid::Model::Ptr build();
     };
 
@@ -284,13 +310,136 @@ namespace
         return new_point;
     }
 
+    constexpr double ModelBuilder::MAX_PLANAR_CUBE_SIZE;
+
+    void ModelBuilder::getTolerances(const Point* cube, double& tolerance, double& surface_tolerance) const
+    {
+        tolerance = options.tolerance;
+        surface_tolerance = options.surface_tolerance;
+        const Eigen::AlignedBox3d cube_box(cube->point, cube->end_cube_xyz->point);
+        for (auto& region : options.regions)
+        {
+            if (region.box.intersects(cube_box))
+            {
+                tolerance = std::min(tolerance, region.tolerance);
+                surface_tolerance = std::min(surface_tolerance, region.surface_tolerance);
+            }
+        }
+    }
+
+    bool ModelBuilder::fitPlane(Point* cube, const bool (&inside)[CHECK_COUNT][CHECK_COUNT][CHECK_COUNT], double surface_tolerance) const
+    {
+        const Eigen::Vector3d min = cube->point;
+        const Eigen::Vector3d step = (cube->end_cube_xyz->point - min) / (CHECK_COUNT - 1);
+        auto samplePoint = [&](size_t ix, size_t iy, size_t iz)
+        {
+            return Eigen::Vector3d(min.x() + step.x() * ix, min.y() + step.y() * iy, min.z() + step.z() * iz);
+        };
+
+        // Boundary crossings are estimated by middles of sample edges with different classification
+        std::vector<Eigen::Vector3d> crossings;
+        Eigen::Vector3d inside_sum = Eigen::Vector3d::Zero();
+        Eigen::Vector3d outside_sum = Eigen::Vector3d::Zero();
+        size_t inside_count = 0;
+        for (size_t ix = 0; ix < CHECK_COUNT; ++ix)
+        {
+            for (size_t iy = 0; iy < CHECK_COUNT; ++iy)
+            {
+                for (size_t iz = 0; iz < CHECK_COUNT; ++iz)
+                {
+                    const Eigen::Vector3d point = samplePoint(ix, iy, iz);
+                    if (inside[ix][iy][iz])
+                    {
+                        inside_sum += point;
+                        ++inside_count;
+                    }
+                    else
+                    {
+                        outside_sum += point;
+                    }
+                    if (ix + 1 < CHECK_COUNT && inside[ix][iy][iz] != inside[ix + 1][iy][iz])
+                    {
+                        crossings.push_back(0.5 * (point + samplePoint(ix + 1, iy, iz)));
+                    }
+                    if (iy + 1 < CHECK_COUNT && inside[ix][iy][iz] != inside[ix][iy + 1][iz])
+                    {
+                        crossings.push_back(0.5 * (point + samplePoint(ix, iy + 1, iz)));
+                    }
+                    if (iz + 1 < CHECK_COUNT && inside[ix][iy][iz] != inside[ix][iy][iz + 1])
+                    {
+                        crossings.push_back(0.5 * (point + samplePoint(ix, iy, iz + 1)));
+                    }
+                }
+            }
+        }
+        if (crossings.size() < 3)
+        {
+            return false;
+        }
+
+        // Least squares plane: normal is the direction of the smallest variance of crossings
+        Eigen::Vector3d centroid = Eigen::Vector3d::Zero();
+        for (auto& crossing : crossings)
+        {
+            centroid += crossing;
+        }
+        centroid /= static_cast<double>(crossings.size());
+        Eigen::Matrix3d covariance = Eigen::Matrix3d::Zero();
+        for (auto& crossing : crossings)
+        {
+            const Eigen::Vector3d offset = crossing - centroid;
+            covariance += offset * offset.transpose();
+        }
+        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+        Eigen::Vector3d normal = solver.eigenvectors().col(0);
+        const size_t sample_count = CHECK_COUNT * CHECK_COUNT * CHECK_COUNT;
+        const Eigen::Vector3d inside_center = inside_sum / static_cast<double>(inside_count);
+        const Eigen::Vector3d outside_center = outside_sum / static_cast<double>(sample_count - inside_count);
+        if (normal.dot(outside_center - inside_center) < 0.0)
+        {
+            normal = -normal;
+        }
+
+        // Surface deviation from the plane is estimated by crossings
+        for (auto& crossing : crossings)
+        {
+            if (std::fabs(normal.dot(crossing - centroid)) > surface_tolerance)
+            {
+                return false;
+            }
+        }
+        // All samples should be on the proper side of the plane out of the tolerance band
+        for (size_t ix = 0; ix < CHECK_COUNT; ++ix)
+        {
+            for (size_t iy = 0; iy < CHECK_COUNT; ++iy)
+            {
+                for (size_t iz = 0; iz < CHECK_COUNT; ++iz)
+                {
+                    const double distance = normal.dot(samplePoint(ix, iy, iz) - centroid);
+                    if (inside[ix][iy][iz] ? distance > surface_tolerance : distance < -surface_tolerance)
+                    {
+                        return false;
+                    }
+                }
+            }
+        }
+
+        cube->planar = true;
+        cube->plane_point = centroid;
+        cube->plane_normal = normal;
+        return true;
+    }
+
     bool ModelBuilder::split(Point* cube)
     {
         const Eigen::Vector3d min = cube->point;
         const Eigen::Vector3d max = cube->end_cube_xyz->point;
         const Eigen::Vector3d sizes = max - min;
 
-        if (sizes.x() < TOLERANCE && sizes.y() < TOLERANCE && sizes.z() < TOLERANCE)
+        double tolerance = 0.0;
+        double surface_tolerance = 0.0;
+        getTolerances(cube, tolerance, surface_tolerance);
+        if (sizes.x() < tolerance && sizes.y() < tolerance && sizes.z() < tolerance)
         {
             return true;
         }
@@ -380,7 +529,6 @@ namespace
 
     bool ModelBuilder::checkAndSplitCube(Point* cube)
     {
-        constexpr size_t CHECK_COUNT = 5;
         static_assert(CHECK_COUNT > 0, "CHECK_COUNT must be greater than 0");
 
         const Eigen::Vector3d min = cube->point;
@@ -393,6 +541,7 @@ namespace
 
         bool all_outside = true;
         bool all_inside = true;
+        bool inside[CHECK_COUNT][CHECK_COUNT][CHECK_COUNT];
 
         for (size_t ix = 0; ix < CHECK_COUNT; ++ix)
         {
@@ -404,7 +553,8 @@ namespace
                     const double point_y = min.y() + dy * iy;
                     const double point_z = min.z() + dz * iz;
 
-                    if (solid->inside(Eigen::Vector3d(point_x, point_y, point_z)))
+                    inside[ix][iy][iz] = solid->inside(Eigen::Vector3d(point_x, point_y, point_z));
+                    if (inside[ix][iy][iz])
                     {
                         all_outside = false;
                     }
@@ -426,6 +576,14 @@ namespace
             cube->hollow = true;
             return true;
         }
+        double tolerance = 0.0;
+        double surface_tolerance = 0.0;
+        getTolerances(cube, tolerance, surface_tolerance);
+        if (surface_tolerance > 0.0 && sizes.maxCoeff() <= MAX_PLANAR_CUBE_SIZE * surface_tolerance && fitPlane(cube, inside, surface_tolerance))
+        {
+            // Boundary is flat enough within the cube, pass it
+            return true;
+        }
         return split(cube);
     }
 
@@ -462,6 +620,115 @@ namespace
         );
     }
 
+    // Cube clipped by a plane has the plane polygon with at most 6 vertices, so 4 triangles,
+    // and 6 clipped faces with at most 5 vertices, so 3 triangles each
+    constexpr size_t MAX_PLANAR_VERTEX_COUNT = 3 * (4 + 6 * 3);
+
+    // Corners of cube faces in counter-clockwise order around outward normals, bit i of a corner index selects max along axis i
+    const unsigned CUBE_FACE_CORNERS[6][4] = { { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, { 0, 2, 3, 1 }, { 4, 5, 7, 6 } };
+
+    void addPolygon(Gkm::Solid::Model& model, const std::vector<Eigen::Vector3d>& polygon)
+    {
+        for (size_t i = 1; i + 1 < polygon.size(); ++i)
+        {
+            model.points.push_back(toFloat(polygon[0]));
+            model.points.push_back(toFloat(polygon[i]));
+            model.points.push_back(toFloat(polygon[i + 1]));
+        }
+    }
+
+    // Emits the closed boundary of the part of the cube inside the plane. Neighbour cubes treat planar cubes as hollow,
+    // so their faces close the mesh where the plane does not reach the cube faces.
+    void addPlanarCube(Gkm::Solid::Model& model, const Point& cube)
+    {
+        const Eigen::Vector3d min = cube.point;
+        const Eigen::Vector3d max = cube.end_cube_xyz->point;
+        const Eigen::Vector3d& normal = cube.plane_normal;
+
+        Eigen::Vector3d corners[8];
+        double distances[8];
+        for (unsigned corner = 0; corner < 8; ++corner)
+        {
+            corners[corner] = Eigen::Vector3d(corner & 1 ? max.x() : min.x(), corner & 2 ? max.y() : min.y(), corner & 4 ? max.z() : min.z());
+            distances[corner] = normal.dot(corners[corner] - cube.plane_point);
+        }
+        // Edges are interpolated from their smaller corner, so faces and the plane polygon get the same points
+        auto crossing = [&](unsigned a, unsigned b)
+        {
+            if (a > b)
+            {
+                std::swap(a, b);
+            }
+            if (distances[b] == 0.0)
+            {
+                return corners[b];
+            }
+            const double t = distances[a] / (distances[a] - distances[b]);
+            return Eigen::Vector3d(corners[a] + t * (corners[b] - corners[a]));
+        };
+        auto push = [](std::vector<Eigen::Vector3d>& polygon, const Eigen::Vector3d& point)
+        {
+            // Plane through a corner crosses its edges at the corner itself
+            if (std::find(polygon.begin(), polygon.end(), point) == polygon.end())
+            {
+                polygon.push_back(point);
+            }
+        };
+
+        std::vector<Eigen::Vector3d> polygon;
+        for (auto& face : CUBE_FACE_CORNERS)
+        {
+            polygon.clear();
+            for (unsigned i = 0; i < 4; ++i)
+            {
+                const unsigned a = face[i];
+                const unsigned b = face[(i + 1) % 4];
+                if (distances[a] <= 0.0)
+                {
+                    push(polygon, corners[a]);
+                }
+                if ((distances[a] <= 0.0) != (distances[b] <= 0.0))
+                {
+                    push(polygon, crossing(a, b));
+                }
+            }
+            addPolygon(model, polygon);
+        }
+
+        // Intersections of the plane with the cube edges
+        polygon.clear();
+        for (unsigned a = 0; a < 8; ++a)
+        {
+            for (unsigned axis = 0; axis < 3; ++axis)
+            {
+                const unsigned b = a | (1u << axis);
+                if (b != a && (distances[a] <= 0.0) != (distances[b] <= 0.0))
+                {
+                    push(polygon, crossing(a, b));
+                }
+            }
+        }
+        if (polygon.size() < 3)
+        {
+            return;
+        }
+
+        // Counter-clockwise order around the outward normal
+        Eigen::Vector3d center = Eigen::Vector3d::Zero();
+        for (auto& point : polygon)
+        {
+            center += point;
+        }
+        center /= static_cast<double>(polygon.size());
+        const Eigen::Vector3d u = normal.unitOrthogonal();
+        const Eigen::Vector3d v = normal.cross(u);
+        std::sort(polygon.begin(), polygon.end(), [&](const Eigen::Vector3d& a, const Eigen::Vector3d& b)
+        {
+            return std::atan2(v.dot(a - center), u.dot(a - center)) < std::atan2(v.dot(b - center), u.dot(b - center));
+        });
+        addPolygon(model, polygon);
+    }
+
     Gkm::Solid::Model::Ptr ModelBuilder::buildModel()
     {
         Gkm::Solid::Model::Ptr result = std::make_shared<Gkm::Solid::Model>();
@@ -475,18 +742,23 @@ namespace
                 auto& point = *point_it;
                 if (point.isCube() && !point.hollow)
                 {
+                    if (point.planar)
+                    {
+                        vertex_count += MAX_PLANAR_VERTEX_COUNT;
+                        continue;
+                    }
                     bool prev_x_hollow = true;
-                    if (point.prev_point_x) prev_x_hollow = point.prev_point_x->hollow;
+                    if (point.prev_point_x) prev_x_hollow = point.prev_point_x->hollow || point.prev_point_x->planar;
                     bool next_x_hollow = true;
-                    if (point.next_point_x) next_x_hollow = point.next_point_x->hollow;
+                    if (point.next_point_x) next_x_hollow = point.next_point_x->hollow || point.next_point_x->planar;
                     bool prev_y_hollow = true;
-                    if (point.prev_point_y) prev_y_hollow = point.prev_point_y->hollow;
+                    if (point.prev_point_y) prev_y_hollow = point.prev_point_y->hollow || point.prev_point_y->planar;
                     bool next_y_hollow = true;
-                    if (point.next_point_y) next_y_hollow = point.next_point_y->hollow;
+                    if (point.next_point_y) next_y_hollow = point.next_point_y->hollow || point.next_point_y->planar;
                     bool prev_z_hollow = true;
-                    if (point.prev_point_z) prev_z_hollow = point.prev_point_z->hollow;
+                    if (point.prev_point_z) prev_z_hollow = point.prev_point_z->hollow || point.prev_point_z->planar;
                     bool next_z_hollow = true;
-                    if (point.next_point_z) next_z_hollow = point.next_point_z->hollow;
+                    if (point.next_point_z) next_z_hollow = point.next_point_z->hollow || point.next_point_z->planar;
                     if (prev_x_hollow) vertex_count += 6;
                     if (next_x_hollow) vertex_count += 6;
                     if (prev_y_hollow) vertex_count += 6;
@@ -506,18 +778,23 @@ namespace
                 auto& point = *point_it;
                 if (point.isCube() && !point.hollow)
                 {
+                    if (point.planar)
+                    {
+                        addPlanarCube(*result, point);
+                        continue;
+                    }
                     bool prev_x_hollow = true;
-                    if (point.prev_point_x) prev_x_hollow = point.prev_point_x->hollow;
+                    if (point.prev_point_x) prev_x_hollow = point.prev_point_x->hollow || point.prev_point_x->planar;
                     bool next_x_hollow = true;
-                    if (point.next_point_x) next_x_hollow = point.next_point_x->hollow;
+                    if (point.next_point_x) next_x_hollow = point.next_point_x->hollow || point.next_point_x->planar;
                     bool prev_y_hollow = true;
-                    if (point.prev_point_y) prev_y_hollow = point.prev_point_y->hollow;
+                    if (point.prev_point_y) prev_y_hollow = point.prev_point_y->hollow || point.prev_point_y->planar;
                     bool next_y_hollow = true;
-                    if (point.next_point_y) next_y_hollow = point.next_point_y->hollow;
+                    if (point.next_point_y) next_y_hollow = point.next_point_y->hollow || point.next_point_y->planar;
                     bool prev_z_hollow = true;
-                    if (point.prev_point_z) prev_z_hollow = point.prev_point_z->hollow;
+                    if (point.prev_point_z) prev_z_hollow = point.prev_point_z->hollow || point.prev_point_z->planar;
                     bool next_z_hollow = true;
-                    if (point.next_point_z) next_z_hollow = point.next_point_z->hollow;
+                    if (point.next_point_z) next_z_hollow = point.next_point_z->hollow || point.next_point_z->planar;
                     if (prev_x_hollow)
                     {
                         result->points.push_back(toFloat(point.end_cube_y->point));
@@ -585,7 +862,7 @@ namespace
         return result;
     }
 
-    ModelBuilder::ModelBuilder(const Gkm::Solid::ISolid::Ptr& solid_) : solid(solid_)
+    ModelBuilder::ModelBuilder(const Gkm::Solid::ISolid::Ptr& solid_, const Gkm::Solid::BuildOptions& options_) : options(options_), solid(solid_)
     {
     }
 
@@ -645,10 +922,928 @@ namespace
         checkAndSplitCubes();
         return buildModel();
     }
+
+    enum class ENodeState : unsigned char
+    {
+        Outside,
+        Inside,
+        // Finest cell which is crossed by the boundary, it is rendered as filled one
+        Boundary,
+        // Node whose children are not the same
+        Split
+    };
+
+    // FNV-1a hash of bytes
+    uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            hash = (hash ^ bytes[i]) * 0x100000001B3ull;
+        }
+        return hash;
+    }
+
+    uint64_t hashChunk(const Gkm::Solid::ModelChunk& chunk)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (auto& lod : chunk.lods)
+        {
+            const size_t count = lod->points.size();
+            hash = hashBytes(hash, &count, sizeof(count));
+            hash = hashBytes(hash, lod->points.data(), count * sizeof(Eigen::Vector3f));
+        }
+        for (auto& indexed_lod : chunk.indexed_lods)
+        {
+            const size_t counts[2] = { indexed_lod->points.size(), indexed_lod->indices.size() };
+            hash = hashBytes(hash, counts, sizeof(counts));
+            hash = hashBytes(hash, indexed_lod->points.data(), counts[0] * sizeof(Eigen::Vector3f));
+            hash = hashBytes(hash, indexed_lod->indices.data(), counts[1] * sizeof(uint32_t));
+        }
+        for (auto& instance_lod : chunk.instance_lods)
+        {
+            const size_t count = instance_lod.size();
+            hash = hashBytes(hash, &count, sizeof(count));
+            hash = hashBytes(hash, instance_lod.data(), count * sizeof(Gkm::Solid::CellInstance));
+        }
+        return hashBytes(hash, chunk.cell_size.data(), 3 * sizeof(double));
+    }
+
+    // Coordinates of cell instances are 16 bit
+    constexpr unsigned MAX_LATTICE_DEPTH = 16;
+
+    // Tiles the bounding box into dense bricks of finest cells, evaluates each brick by one batch call,
+    // then collapses uniform nodes bottom-up. Bricks are independent, so they are evaluated in parallel.
+    class BrickModelBuilder
+    {
+        // Samples are taken at corners, edge middles and centers of finest cells, adjacent cells share samples
+        static constexpr unsigned SAMPLES_PER_CELL = 2;
+
+        Gkm::Solid::ISolid::Ptr solid;
+        Gkm::Solid::BuildOptions options;
+        // Lattice box and bounding box of the solid, they differ for chunked models only
+        Eigen::AlignedBox3d box;
+        Eigen::AlignedBox3d solid_box;
+        Eigen::Vector3d cell_size;
+        unsigned depth = 0;
+        unsigned brick_depth = 0;
+        // levels[l] keeps states of nodes whose edges are 2^l finest cells
+        std::vector<std::vector<ENodeState>> levels;
+
+        // Part of the lattice which is meshed, nodes out of it are treated as outside, so the mesh of a range is closed.
+        // Split nodes of the minimal level are rendered as filled ones.
+        struct EmitRange
+        {
+            unsigned min_level = 0;
+            // Finest cells from min to max exclusive
+            int min[3] = { 0, 0, 0 };
+            int max[3] = { 0, 0, 0 };
+        };
+
+        unsigned levelSize(unsigned level) const;
+        size_t nodeIndex(unsigned level, unsigned x, unsigned y, unsigned z) const;
+        // Nodes out of the lattice are outside
+        ENodeState nodeState(unsigned level, int x, int y, int z) const;
+        ENodeState rangeState(const EmitRange& range, unsigned level, int x, int y, int z) const;
+        Eigen::AlignedBox3d nodeBox(unsigned level, int x, int y, int z) const;
+        // Nodes which are smaller than the tolerance of their box are not split, they are rendered as filled ones
+        bool isFinest(unsigned level, unsigned x, unsigned y, unsigned z) const;
+        // Coarsest level of boundary nodes of the subtree, it bounds the deviation of its mesh
+        unsigned maxBoundaryLevel(unsigned level, unsigned x, unsigned y, unsigned z) const;
+        void collapse(unsigned level, unsigned x, unsigned y, unsigned z);
+        void evaluateBrick(const Gkm::Solid::SolidEvaluator& evaluator, unsigned brick_x, unsigned brick_y, unsigned brick_z, Gkm::Solid::PointBatch& samples, std::vector<unsigned char>& sample_result);
+        void evaluateBricks();
+        // Finest cells are cubes of a power of two size and the lattice box is aligned to chunks in world coordinates,
+        // so chunks keep their boxes when the bounding box of the solid changes
+        void anchorLattice();
+        // Returns false if the solid is empty
+        bool buildLevels(bool anchored);
+        // Emits the face of the filled node which is adjacent to the given neighbour node
+        void emitFace(Gkm::Solid::Model& model, const EmitRange& range, unsigned level, int x, int y, int z, unsigned face) const;
+        void emitNode(Gkm::Solid::Model& model, const EmitRange& range, unsigned level, unsigned x, unsigned y, unsigned z) const;
+        void emitInstances(std::vector<Gkm::Solid::CellInstance>& instances, const EmitRange& range, unsigned level, unsigned x, unsigned y, unsigned z) const;
+        // Decimates meshes of all levels of detail of chunks and converts them to optimized indexed meshes in parallel
+        void processChunks(Gkm::Solid::ChunkedModel& model) const;
+
+    public:
+        BrickModelBuilder(const Gkm::Solid::ISolid::Ptr& solid, const Gkm::Solid::BuildOptions& options);
+        Gkm::Solid::Model::Ptr build();
+        Gkm::Solid::ChunkedModel::Ptr buildChunked();
+    };
+
+    constexpr unsigned BrickModelBuilder::SAMPLES_PER_CELL;
+
+    const int FACE_DIRECTIONS[6][3] = { { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 } };
+
+    BrickModelBuilder::BrickModelBuilder(const Gkm::Solid::ISolid::Ptr& solid_, const Gkm::Solid::BuildOptions& options_) :
+        solid(solid_), options(options_)
+    {
+    }
+
+    unsigned BrickModelBuilder::levelSize(unsigned level) const
+    {
+        return (1u << depth) >> level;
+    }
+
+    size_t BrickModelBuilder::nodeIndex(unsigned level, unsigned x, unsigned y, unsigned z) const
+    {
+        const size_t size = levelSize(level);
+        return (z * size + y) * size + x;
+    }
+
+    ENodeState BrickModelBuilder::nodeState(unsigned level, int x, int y, int z) const
+    {
+        const int size = static_cast<int>(levelSize(level));
+        if (x < 0 || y < 0 || z < 0 || x >= size || y >= size || z >= size)
+        {
+            return ENodeState::Outside;
+        }
+        return levels[level][nodeIndex(level, static_cast<unsigned>(x), static_cast<unsigned>(y), static_cast<unsigned>(z))];
+    }
+
+    ENodeState BrickModelBuilder::rangeState(const EmitRange& range, unsigned level, int x, int y, int z) const
+    {
+        // Range borders are aligned to nodes of the level
+        const int scale = 1 << level;
+        if (x * scale < range.min[0] || y * scale < range.min[1] || z * scale < range.min[2] ||
+            x * scale >= range.max[0] || y * scale >= range.max[1] || z * scale >= range.max[2])
+        {
+            return ENodeState::Outside;
+        }
+        return nodeState(level, x, y, z);
+    }
+
+    Eigen::AlignedBox3d BrickModelBuilder::nodeBox(unsigned level, int x, int y, int z) const
+    {
+        const double scale = static_cast<double>(1u << level);
+        const Eigen::Vector3d min = box.min() + Eigen::Vector3d(x, y, z).cwiseProduct(cell_size) * scale;
+        return Eigen::AlignedBox3d(min, min + cell_size * scale);
+    }
+
+    bool BrickModelBuilder::isFinest(unsigned level, unsigned x, unsigned y, unsigned z) const
+    {
+        const Eigen::AlignedBox3d node_box = nodeBox(level, static_cast<int>(x), static_cast<int>(y), static_cast<int>(z));
+        double tolerance = options.tolerance;
+        for (auto& region : options.regions)
+        {
+            if (region.box.intersects(node_box))
+            {
+                tolerance = std::min(tolerance, region.tolerance);
+            }
+        }
+        return node_box.sizes().maxCoeff() < tolerance;
+    }
+
+    unsigned BrickModelBuilder::maxBoundaryLevel(unsigned level, unsigned x, unsigned y, unsigned z) const
+    {
+        switch (levels[level][nodeIndex(level, x, y, z)])
+        {
+        case ENodeState::Boundary:
+            return level;
+        case ENodeState::Split:
+        {
+            unsigned result = 0;
+            for (unsigned child = 0; child < 8; ++child)
+            {
+                result = std::max(result, maxBoundaryLevel(level - 1, 2 * x + (child & 1), 2 * y + ((child >> 1) & 1), 2 * z + ((child >> 2) & 1)));
+            }
+            return result;
+        }
+        default:
+            return 0;
+        }
+    }
+
+    void BrickModelBuilder::collapse(unsigned level, unsigned x, unsigned y, unsigned z)
+    {
+        const ENodeState first = levels[level - 1][nodeIndex(level - 1, 2 * x, 2 * y, 2 * z)];
+        ENodeState state = first;
+        if (first == ENodeState::Boundary || first == ENodeState::Split)
+        {
+            state = ENodeState::Split;
+        }
+        for (unsigned child = 1; child < 8 && state != ENodeState::Split; ++child)
+        {
+            const unsigned child_x = 2 * x + (child & 1);
+            const unsigned child_y = 2 * y + ((child >> 1) & 1);
+            const unsigned child_z = 2 * z + ((child >> 2) & 1);
+            if (levels[level - 1][nodeIndex(level - 1, child_x, child_y, child_z)] != first)
+            {
+                state = ENodeState::Split;
+            }
+        }
+        // Regions make the lattice as fine as their smallest tolerance, nodes out of them stop at the tolerance of the options
+        if (state == ENodeState::Split && !options.regions.empty() && isFinest(level, x, y, z))
+        {
+            state = ENodeState::Boundary;
+        }
+        levels[level][nodeIndex(level, x, y, z)] = state;
+    }
+
+    void BrickModelBuilder::evaluateBrick(const Gkm::Solid::SolidEvaluator& evaluator, unsigned brick_x, unsigned brick_y, unsigned brick_z, Gkm::Solid::PointBatch& samples, std::vector<unsigned char>& sample_result)
+    {
+        const unsigned brick_size = 1u << brick_depth;
+        const unsigned sample_count = brick_size * SAMPLES_PER_CELL + 1;
+        const Eigen::Vector3d sample_step = cell_size / SAMPLES_PER_CELL;
+        const unsigned first_cell[3] = { brick_x * brick_size, brick_y * brick_size, brick_z * brick_size };
+        const Eigen::AlignedBox3d brick_box = nodeBox(brick_depth, static_cast<int>(brick_x), static_cast<int>(brick_y), static_cast<int>(brick_z));
+
+        // Sample coordinates depend on global sample indices only, so samples on brick borders are the same for both bricks
+        samples.clear();
+        for (unsigned k = 0; k < sample_count; ++k)
+        {
+            const double z = box.min().z() + (first_cell[2] * SAMPLES_PER_CELL + k) * sample_step.z();
+            for (unsigned j = 0; j < sample_count; ++j)
+            {
+                const double y = box.min().y() + (first_cell[1] * SAMPLES_PER_CELL + j) * sample_step.y();
+                for (unsigned i = 0; i < sample_count; ++i)
+                {
+                    const double x = box.min().x() + (first_cell[0] * SAMPLES_PER_CELL + i) * sample_step.x();
+                    samples.x.push_back(x);
+                    samples.y.push_back(y);
+                    samples.z.push_back(z);
+                }
+            }
+        }
+        // Bricks of the lattice box out of the solid box are outside
+        if (brick_box.intersects(solid_box))
+        {
+            evaluator.evaluate(samples, sample_result);
+        }
+        else
+        {
+            sample_result.assign(samples.x.size(), 0);
+        }
+
+        std::vector<ENodeState>& finest = levels[0];
+        for (unsigned cell_z = 0; cell_z < brick_size; ++cell_z)
+        {
+            for (unsigned cell_y = 0; cell_y < brick_size; ++cell_y)
+            {
+                for (unsigned cell_x = 0; cell_x < brick_size; ++cell_x)
+                {
+                    unsigned inside_count = 0;
+                    for (unsigned k = 0; k <= SAMPLES_PER_CELL; ++k)
+                    {
+                        for (unsigned j = 0; j <= SAMPLES_PER_CELL; ++j)
+                        {
+                            const size_t row = ((cell_z * SAMPLES_PER_CELL + k) * sample_count + cell_y * SAMPLES_PER_CELL + j) * sample_count + cell_x * SAMPLES_PER_CELL;
+                            for (unsigned i = 0; i <= SAMPLES_PER_CELL; ++i)
+                            {
+                                inside_count += sample_result[row + i];
+                            }
+                        }
+                    }
+                    const unsigned cell_sample_count = (SAMPLES_PER_CELL + 1) * (SAMPLES_PER_CELL + 1) * (SAMPLES_PER_CELL + 1);
+                    // Cells which only touch the solid box by a face are outside, as if the lattice box is the solid box
+                    const Eigen::AlignedBox3d cell_box = nodeBox(0, static_cast<int>(first_cell[0] + cell_x), static_cast<int>(first_cell[1] + cell_y), static_cast<int>(first_cell[2] + cell_z));
+                    const bool touches = (cell_box.min().array() >= solid_box.max().array()).any() || (cell_box.max().array() <= solid_box.min().array()).any();
+                    ENodeState state = ENodeState::Boundary;
+                    if (inside_count == 0 || touches)
+                    {
+                        state = ENodeState::Outside;
+                    }
+                    else if (inside_count == cell_sample_count)
+                    {
+                        state = ENodeState::Inside;
+                    }
+                    finest[nodeIndex(0, first_cell[0] + cell_x, first_cell[1] + cell_y, first_cell[2] + cell_z)] = state;
+                }
+            }
+        }
+
+        // Levels inside the brick are collapsed right away while the brick is hot in cache
+        for (unsigned level = 1; level <= brick_depth; ++level)
+        {
+            const unsigned level_brick_size = brick_size >> level;
+            for (unsigned z = 0; z < level_brick_size; ++z)
+            {
+                for (unsigned y = 0; y < level_brick_size; ++y)
+                {
+                    for (unsigned x = 0; x < level_brick_size; ++x)
+                    {
+                        collapse(level, brick_x * level_brick_size + x, brick_y * level_brick_size + y, brick_z * level_brick_size + z);
+                    }
+                }
+            }
+        }
+    }
+
+    void BrickModelBuilder::evaluateBricks()
+    {
+        // Kernels are cached by the compiler of the caller, otherwise the kernel is compiled for this build only
+        Gkm::Solid::JitCompiler build_jit_compiler;
+        const Gkm::Solid::SolidEvaluator evaluator(solid, options.jit_compiler ? options.jit_compiler.get() : &build_jit_compiler);
+        const unsigned bricks_per_axis = levelSize(brick_depth);
+        const size_t brick_count = static_cast<size_t>(bricks_per_axis) * bricks_per_axis * bricks_per_axis;
+        std::atomic<size_t> next_brick(0);
+
+        auto worker = [&]()
+        {
+            Gkm::Solid::PointBatch samples;
+            std::vector<unsigned char> sample_result;
+            for (size_t brick = next_brick++; brick < brick_count; brick = next_brick++)
+            {
+                const unsigned brick_x = static_cast<unsigned>(brick % bricks_per_axis);
+                const unsigned brick_y = static_cast<unsigned>(brick / bricks_per_axis % bricks_per_axis);
+                const unsigned brick_z = static_cast<unsigned>(brick / bricks_per_axis / bricks_per_axis);
+                evaluateBrick(evaluator, brick_x, brick_y, brick_z, samples, sample_result);
+            }
+        };
+
+        Gkm::Solid::runInParallel(options.thread_count, brick_count, worker);
+    }
+
+    void BrickModelBuilder::emitFace(Gkm::Solid::Model& model, const EmitRange& range, unsigned level, int x, int y, int z, unsigned face) const
+    {
+        switch (rangeState(range, level, x, y, z))
+        {
+        case ENodeState::Outside:
+        {
+            // The face of the filled side box of the same size
+            const int* direction = FACE_DIRECTIONS[face];
+            Gkm::Solid::addBoxFace(model, nodeBox(level, x - direction[0], y - direction[1], z - direction[2]), face);
+            break;
+        }
+        case ENodeState::Split:
+        {
+            if (level == range.min_level)
+            {
+                break;
+            }
+            // Children of the neighbour which touch the face
+            const int* direction = FACE_DIRECTIONS[face];
+            for (unsigned child = 0; child < 8; ++child)
+            {
+                const int offset[3] = { static_cast<int>(child & 1), static_cast<int>((child >> 1) & 1), static_cast<int>((child >> 2) & 1) };
+                bool touches = true;
+                for (unsigned axis = 0; axis < 3; ++axis)
+                {
+                    if (direction[axis] != 0 && offset[axis] != (direction[axis] > 0 ? 0 : 1))
+                    {
+                        touches = false;
+                    }
+                }
+                if (touches)
+                {
+                    emitFace(model, range, level - 1, 2 * x + offset[0], 2 * y + offset[1], 2 * z + offset[2], face);
+                }
+            }
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    void BrickModelBuilder::emitNode(Gkm::Solid::Model& model, const EmitRange& range, unsigned level, unsigned x, unsigned y, unsigned z) const
+    {
+        ENodeState state = levels[level][nodeIndex(level, x, y, z)];
+        if (state == ENodeState::Split && level == range.min_level)
+        {
+            state = ENodeState::Boundary;
+        }
+        switch (state)
+        {
+        case ENodeState::Inside:
+        case ENodeState::Boundary:
+            for (unsigned face = 0; face < 6; ++face)
+            {
+                const int* direction = FACE_DIRECTIONS[face];
+                emitFace(model, range, level, static_cast<int>(x) + direction[0], static_cast<int>(y) + direction[1], static_cast<int>(z) + direction[2], face);
+            }
+            break;
+        case ENodeState::Split:
+            for (unsigned child = 0; child < 8; ++child)
+            {
+                emitNode(model, range, level - 1, 2 * x + (child & 1), 2 * y + ((child >> 1) & 1), 2 * z + ((child >> 2) & 1));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    void BrickModelBuilder::anchorLattice()
+    {
+        double tolerance = options.tolerance;
+        for (auto& region : options.regions)
+        {
+            if (region.box.intersects(solid_box))
+            {
+                tolerance = std::min(tolerance, region.tolerance);
+            }
+        }
+        unsigned chunk_level = 0;
+        while ((1u << chunk_level) < options.chunk_size && chunk_level < MAX_LATTICE_DEPTH)
+        {
+            ++chunk_level;
+        }
+        // The largest power of two which is less than the tolerance, it is doubled while the lattice does not fit the memory
+        double cell = std::exp2(std::floor(std::log2(tolerance)));
+        if (cell >= tolerance)
+        {
+            cell /= 2;
+        }
+        for (;;)
+        {
+            const double chunk_extent = cell * static_cast<double>(1u << chunk_level);
+            const Eigen::Vector3d min = (solid_box.min() / chunk_extent).array().floor().matrix() * chunk_extent;
+            const double max_size = (solid_box.max() - min).maxCoeff();
+            depth = chunk_level;
+            while (cell * static_cast<double>(1u << depth) < max_size && depth <= MAX_LATTICE_DEPTH)
+            {
+                ++depth;
+            }
+            const bool fits = depth <= MAX_LATTICE_DEPTH && (size_t(8) << (3 * depth)) / 7 <= options.max_lattice_memory;
+            if (fits || depth == chunk_level)
+            {
+                box = Eigen::AlignedBox3d(min, min + Eigen::Vector3d::Constant(cell * static_cast<double>(1u << depth)));
+                cell_size = Eigen::Vector3d::Constant(cell);
+                return;
+            }
+            cell *= 2;
+        }
+    }
+
+    bool BrickModelBuilder::buildLevels(bool anchored)
+    {
+        solid_box = solid->bbox();
+        if (solid_box.isEmpty())
+        {
+            return false;
+        }
+
+        if (anchored)
+        {
+            anchorLattice();
+        }
+        else
+        {
+            box = solid_box;
+            depth = Gkm::Solid::brickLatticeDepth(box, options);
+            cell_size = box.sizes() / static_cast<double>(1u << depth);
+        }
+        brick_depth = 0;
+        while ((1u << brick_depth) < options.brick_size && brick_depth < depth)
+        {
+            ++brick_depth;
+        }
+
+        levels.resize(depth + 1);
+        for (unsigned level = 0; level <= depth; ++level)
+        {
+            const size_t size = levelSize(level);
+            levels[level].resize(size * size * size);
+        }
+
+        evaluateBricks();
+        for (unsigned level = brick_depth + 1; level <= depth; ++level)
+        {
+            const unsigned size = levelSize(level);
+            for (unsigned z = 0; z < size; ++z)
+            {
+                for (unsigned y = 0; y < size; ++y)
+                {
+                    for (unsigned x = 0; x < size; ++x)
+                    {
+                        collapse(level, x, y, z);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void BrickModelBuilder::emitInstances(std::vector<Gkm::Solid::CellInstance>& instances, const EmitRange& range, unsigned level, unsigned x, unsigned y, unsigned z) const
+    {
+        ENodeState state = levels[level][nodeIndex(level, x, y, z)];
+        if (state == ENodeState::Split && level == range.min_level)
+        {
+            state = ENodeState::Boundary;
+        }
+        switch (state)
+        {
+        case ENodeState::Inside:
+        case ENodeState::Boundary:
+        {
+            Gkm::Solid::CellInstance instance;
+            const int scale = 1 << level;
+            instance.x = static_cast<uint16_t>(static_cast<int>(x) * scale - range.min[0]);
+            instance.y = static_cast<uint16_t>(static_cast<int>(y) * scale - range.min[1]);
+            instance.z = static_cast<uint16_t>(static_cast<int>(z) * scale - range.min[2]);
+            instance.level = static_cast<uint8_t>(level);
+            // The whole face is drawn if any part of it is exposed, its hidden parts are covered by filled neighbour cells
+            for (unsigned face = 0; face < 6; ++face)
+            {
+                const int* direction = FACE_DIRECTIONS[face];
+                const ENodeState neighbour = rangeState(range, level, static_cast<int>(x) + direction[0], static_cast<int>(y) + direction[1], static_cast<int>(z) + direction[2]);
+                if (neighbour == ENodeState::Outside || (neighbour == ENodeState::Split && level > range.min_level))
+                {
+                    instance.face_mask |= static_cast<uint8_t>(1u << face);
+                }
+            }
+            if (instance.face_mask)
+            {
+                instances.push_back(instance);
+            }
+            break;
+        }
+        case ENodeState::Split:
+            for (unsigned child = 0; child < 8; ++child)
+            {
+                emitInstances(instances, range, level - 1, 2 * x + (child & 1), 2 * y + ((child >> 1) & 1), 2 * z + ((child >> 2) & 1));
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    Gkm::Solid::Model::Ptr BrickModelBuilder::build()
+    {
+        auto result = std::make_shared<Gkm::Solid::Model>();
+        if (!buildLevels(false))
+        {
+            return result;
+        }
+        EmitRange range;
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            range.max[axis] = static_cast<int>(levelSize(0));
+        }
+        emitNode(*result, range, depth, 0, 0, 0);
+        return result;
+    }
+
+    Gkm::Solid::ChunkedModel::Ptr BrickModelBuilder::buildChunked()
+    {
+        auto result = std::make_shared<Gkm::Solid::ChunkedModel>();
+        if (!buildLevels(true))
+        {
+            return result;
+        }
+        unsigned chunk_level = 0;
+        while ((1u << chunk_level) < options.chunk_size && chunk_level < depth)
+        {
+            ++chunk_level;
+        }
+        const unsigned lod_count = std::min(std::max(options.lod_count, 1u), chunk_level + 1);
+        const unsigned chunk_count = levelSize(chunk_level);
+        const int chunk_cells = 1 << chunk_level;
+        for (unsigned z = 0; z < chunk_count; ++z)
+        {
+            for (unsigned y = 0; y < chunk_count; ++y)
+            {
+                for (unsigned x = 0; x < chunk_count; ++x)
+                {
+                    if (levels[chunk_level][nodeIndex(chunk_level, x, y, z)] == ENodeState::Outside)
+                    {
+                        continue;
+                    }
+                    // Each chunk is meshed as if it is alone, so its meshes are closed at any level of detail
+                    Gkm::Solid::ModelChunk chunk;
+                    chunk.box = nodeBox(chunk_level, x, y, z);
+                    chunk.cell_size = cell_size;
+                    const unsigned boundary_level = maxBoundaryLevel(chunk_level, x, y, z);
+                    EmitRange range;
+                    const unsigned chunk_index[3] = { x, y, z };
+                    for (unsigned axis = 0; axis < 3; ++axis)
+                    {
+                        range.min[axis] = static_cast<int>(chunk_index[axis]) * chunk_cells;
+                        range.max[axis] = range.min[axis] + chunk_cells;
+                    }
+                    for (unsigned lod = 0; lod < lod_count; ++lod)
+                    {
+                        range.min_level = lod;
+                        if (options.cell_instances)
+                        {
+                            chunk.instance_lods.emplace_back();
+                            emitInstances(chunk.instance_lods.back(), range, chunk_level, x, y, z);
+                        }
+                        else
+                        {
+                            auto model = std::make_shared<Gkm::Solid::Model>();
+                            emitNode(*model, range, chunk_level, x, y, z);
+                            chunk.lods.push_back(model);
+                        }
+                        chunk.errors.push_back(cell_size.norm() * static_cast<double>(1u << std::max(lod, boundary_level)));
+                    }
+                    result->chunks.push_back(chunk);
+                }
+            }
+        }
+        if ((options.decimation_error > 0.0 || options.indexed_lods) && !options.cell_instances)
+        {
+            processChunks(*result);
+        }
+        for (auto& chunk : result->chunks)
+        {
+            chunk.content_hash = hashChunk(chunk);
+        }
+        return result;
+    }
+
+    void BrickModelBuilder::processChunks(Gkm::Solid::ChunkedModel& model) const
+    {
+        // Vertices on chunk boxes are locked, so each chunk is decimated alone and still matches its neighbours
+        std::atomic<size_t> next_chunk(0);
+        Gkm::Solid::MeshOptimizationOptions optimization_options;
+        optimization_options.overdraw_threshold = options.overdraw_threshold;
+        auto worker = [&]()
+        {
+            for (size_t i = next_chunk++; i < model.chunks.size(); i = next_chunk++)
+            {
+                Gkm::Solid::ModelChunk& chunk = model.chunks[i];
+                for (size_t lod = 0; lod < chunk.lods.size(); ++lod)
+                {
+                    if (options.decimation_error > 0.0)
+                    {
+                        chunk.lods[lod] = Gkm::Solid::decimateModel(*chunk.lods[lod], chunk.box, options.decimation_error);
+                        chunk.errors[lod] += options.decimation_error;
+                    }
+                    if (options.indexed_lods)
+                    {
+                        // Order of the mesher follows the octree walk, it is poor for the vertex cache
+                        auto indexed_lod = Gkm::Solid::buildIndexedModel(*chunk.lods[lod]);
+                        Gkm::Solid::optimizeMesh(*indexed_lod, optimization_options);
+                        chunk.indexed_lods.push_back(indexed_lod);
+                    }
+                }
+                if (options.indexed_lods)
+                {
+                    chunk.lods.clear();
+                }
+            }
+        };
+
+        Gkm::Solid::runInParallel(options.thread_count, model.chunks.size(), worker);
+    }
+}
+
+constexpr unsigned Gkm::Solid::QuantizedModel::STEP_COUNT;
+
+size_t Gkm::Solid::QuantizedModel::vertexCount() const
+{
+    return positions.size() / 3;
+}
+
+Eigen::Vector3f Gkm::Solid::QuantizedModel::position(size_t index) const
+{
+    const Eigen::Vector3f quantized(positions[3 * index], positions[3 * index + 1], positions[3 * index + 2]);
+    return offset + scale.cwiseProduct(quantized);
+}
+
+Gkm::Solid::QuantizedModel::Ptr Gkm::Solid::quantizeModel(const Model& model, const Eigen::AlignedBox3d& box)
+{
+    auto result = std::make_shared<QuantizedModel>();
+    result->offset = box.min().cast<float>();
+    result->scale = (box.sizes() / static_cast<double>(QuantizedModel::STEP_COUNT)).cast<float>();
+    const Eigen::Vector3d step = box.sizes() / static_cast<double>(QuantizedModel::STEP_COUNT);
+    result->positions.reserve(model.points.size() * 3);
+    for (auto& point : model.points)
+    {
+        for (unsigned axis = 0; axis < 3; ++axis)
+        {
+            const double quantized = step[axis] > 0.0 ? std::round((point[axis] - box.min()[axis]) / step[axis]) : 0.0;
+            result->positions.push_back(static_cast<uint16_t>(std::min(std::max(quantized, 0.0), 65535.0)));
+        }
+    }
+    return result;
+}
+
+Gkm::Solid::IndexedModel::Ptr Gkm::Solid::buildIndexedModel(const Model& model)
+{
+    auto result = std::make_shared<IndexedModel>();
+    // Key is the bit pattern of the position, so -0 and 0 are different vertices, it does not break the mesh
+    struct PositionHash
+    {
+        size_t operator()(const std::array<uint32_t, 3>& key) const
+        {
+            uint64_t hash = 14695981039346656037ull;
+            for (uint32_t value : key)
+            {
+                hash = (hash ^ value) * 1099511628211ull;
+            }
+            return static_cast<size_t>(hash);
+        }
+    };
+    std::unordered_map<std::array<uint32_t, 3>, uint32_t, PositionHash> vertex_indices;
+    vertex_indices.reserve(model.points.size() / 4);
+    result->indices.reserve(model.points.size());
+    for (auto& point : model.points)
+    {
+        std::array<uint32_t, 3> key;
+        std::memcpy(key.data(), point.data(), sizeof(key));
+        const auto inserted = vertex_indices.emplace(key, static_cast<uint32_t>(result->points.size()));
+        if (inserted.second)
+        {
+            result->points.push_back(point);
+        }
+        result->indices.push_back(inserted.first->second);
+    }
+    return result;
+}
+
+uint32_t Gkm::Solid::packNormal(const Eigen::Vector3f& normal)
+{
+    // Projection to the octahedron |x| + |y| + |z| = 1, its lower half is folded over the diagonals
+    const float length = std::fabs(normal.x()) + std::fabs(normal.y()) + std::fabs(normal.z());
+    if (length == 0.0f)
+    {
+        return 0x80008000u;
+    }
+    float u = normal.x() / length;
+    float v = normal.y() / length;
+    if (normal.z() < 0.0f)
+    {
+        const float folded_u = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        const float folded_v = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = folded_u;
+        v = folded_v;
+    }
+    const uint32_t packed_u = static_cast<uint32_t>(std::round((u * 0.5f + 0.5f) * 65535.0f));
+    const uint32_t packed_v = static_cast<uint32_t>(std::round((v * 0.5f + 0.5f) * 65535.0f));
+    return packed_u | (packed_v << 16);
+}
+
+Eigen::Vector3f Gkm::Solid::unpackNormal(uint32_t packed_normal)
+{
+    const float u = (packed_normal & 0xFFFF) / 65535.0f * 2.0f - 1.0f;
+    const float v = (packed_normal >> 16) / 65535.0f * 2.0f - 1.0f;
+    Eigen::Vector3f normal(u, v, 1.0f - std::fabs(u) - std::fabs(v));
+    if (normal.z() < 0.0f)
+    {
+        normal.x() = (1.0f - std::fabs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        normal.y() = (1.0f - std::fabs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normal.normalized();
+}
+
+bool Gkm::Solid::Frustum::intersects(const Eigen::AlignedBox3d& box) const
+{
+    for (auto& plane : planes)
+    {
+        // The box corner which is the farthest along the plane normal
+        const Eigen::Vector3d corner(
+            plane.x() >= 0.0 ? box.max().x() : box.min().x(),
+            plane.y() >= 0.0 ? box.max().y() : box.min().y(),
+            plane.z() >= 0.0 ? box.max().z() : box.min().z()
+        );
+        if (plane.head<3>().dot(corner) + plane.w() < 0.0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Gkm::Solid::Frustum Gkm::Solid::makeFrustum(const Eigen::Matrix4d& view_projection)
+{
+    // Clip space point (x, y, z, w) is visible if -w <= x, y, z <= w
+    Frustum frustum;
+    for (unsigned axis = 0; axis < 3; ++axis)
+    {
+        frustum.planes[2 * axis] = (view_projection.row(3) + view_projection.row(axis)).transpose();
+        frustum.planes[2 * axis + 1] = (view_projection.row(3) - view_projection.row(axis)).transpose();
+    }
+    return frustum;
+}
+
+void Gkm::Solid::addBoxFace(Model& model, const Eigen::AlignedBox3d& box, unsigned face)
+{
+    // Corners of the box are numbered as x | y << 1 | z << 2, triangles have the same winding as top-down build ones
+    static const unsigned FACE_CORNERS[6][6] = {
+        { 2, 0, 4, 6, 2, 4 },
+        { 1, 3, 5, 5, 3, 7 },
+        { 0, 1, 5, 0, 5, 4 },
+        { 3, 2, 6, 3, 6, 7 },
+        { 2, 3, 1, 0, 2, 1 },
+        { 4, 5, 7, 4, 7, 6 }
+    };
+    for (unsigned i = 0; i < 6; ++i)
+    {
+        const unsigned corner = FACE_CORNERS[face][i];
+        const Eigen::Vector3d point(
+            corner & 1 ? box.max().x() : box.min().x(),
+            corner & 2 ? box.max().y() : box.min().y(),
+            corner & 4 ? box.max().z() : box.min().z()
+        );
+        model.points.push_back(toFloat(point));
+    }
+}
+
+void Gkm::Solid::addCellInstances(Model& model, const ModelChunk& chunk, const std::vector<CellInstance>& instances)
+{
+    for (auto& instance : instances)
+    {
+        const Eigen::Vector3d min = chunk.box.min() + chunk.cell_size.cwiseProduct(Eigen::Vector3d(instance.x, instance.y, instance.z));
+        const Eigen::AlignedBox3d box(min, min + chunk.cell_size * static_cast<double>(1u << instance.level));
+        for (unsigned face = 0; face < 6; ++face)
+        {
+            if (instance.face_mask & (1u << face))
+            {
+                addBoxFace(model, box, face);
+            }
+        }
+    }
 }
 
 Gkm::Solid::Model::Ptr Gkm::Solid::buildModel(const ISolid::Ptr& solid)
 {
-    ModelBuilder model_buider(solid);
+    return buildModel(solid, BuildOptions());
+}
+
+Gkm::Solid::Model::Ptr Gkm::Solid::buildModel(const ISolid::Ptr& solid, const BuildOptions& options)
+{
+    if (options.mode == EBuildMode::Bricks)
+    {
+        BrickModelBuilder model_builder(solid, options);
+        return model_builder.build();
+    }
+    ModelBuilder model_buider(solid, options);
     return model_buider.build();
 }
+
+unsigned Gkm::Solid::brickLatticeDepth(const Eigen::AlignedBox3d& box, const BuildOptions& options, double* clamped_tolerance)
+{
+    double tolerance = options.tolerance;
+    for (auto& region : options.regions)
+    {
+        if (region.box.intersects(box))
+        {
+            tolerance = std::min(tolerance, region.tolerance);
+        }
+    }
+    // The same finest level as the top-down subdivision reaches, all levels together are 8/7 of the finest one
+    double max_size = box.sizes().maxCoeff();
+    unsigned depth = 0;
+    while (max_size >= tolerance && depth < MAX_LATTICE_DEPTH && (size_t(8) << (3 * (depth + 1))) / 7 <= options.max_lattice_memory)
+    {
+        max_size /= 2;
+        ++depth;
+    }
+    if (clamped_tolerance)
+    {
+        *clamped_tolerance = max_size >= tolerance ? max_size : 0.0;
+    }
+    return depth;
+}
+
+Gkm::Solid::ChunkedModel::Ptr Gkm::Solid::buildChunkedModel(const ISolid::Ptr& solid, const BuildOptions& options)
+{
+    BrickModelBuilder model_builder(solid, options);
+    return model_builder.buildChunked();
+}
+
+Gkm::Solid::ChunkedModelDelta Gkm::Solid::diffChunkedModels(const ChunkedModel& previous, const ChunkedModel& current)
+{
+    typedef std::pair<std::vector<double>, uint64_t> ChunkKey;
+    auto make_key = [](const ModelChunk& chunk)
+    {
+        const Eigen::Vector3d& min = chunk.box.min();
+        const Eigen::Vector3d& max = chunk.box.max();
+        return ChunkKey({ min.x(), min.y(), min.z(), max.x(), max.y(), max.z() }, chunk.content_hash);
+    };
+    std::map<ChunkKey, size_t> previous_chunks;
+    for (size_t i = 0; i < previous.chunks.size(); ++i)
+    {
+        previous_chunks.emplace(make_key(previous.chunks[i]), i);
+    }
+
+    ChunkedModelDelta delta;
+    std::vector<bool> previous_kept(previous.chunks.size(), false);
+    for (size_t i = 0; i < current.chunks.size(); ++i)
+    {
+        auto found = previous_chunks.find(make_key(current.chunks[i]));
+        if (found != previous_chunks.end() && !previous_kept[found->second])
+        {
+            previous_kept[found->second] = true;
+            delta.kept.emplace_back(found->second, i);
+        }
+        else
+        {
+            delta.added.push_back(i);
+        }
+    }
+    for (size_t i = 0; i < previous.chunks.size(); ++i)
+    {
+        if (!previous_kept[i])
+        {
+            delta.removed.push_back(i);
+        }
+    }
+    return delta;
+}
+
+unsigned Gkm::Solid::selectLod(const ModelChunk& chunk, const Eigen::Vector3d& viewer_position, double projection_scale, double max_pixel_error)
+{
+    // The nearest point of the chunk gives the largest projected error
+    const double distance = std::max(chunk.box.exteriorDistance(viewer_position), 1e-6);
+    unsigned lod = 0;
+    while (lod + 1 < chunk.errors.size() && chunk.errors[lod + 1] * projection_scale / distance <= max_pixel_error)
+    {
+        ++lod;
+    }
+    return lod;
+}
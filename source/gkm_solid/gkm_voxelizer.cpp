@@ -0,0 +1,102 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cmath>
+#include "gkm_solid/gkm_voxelizer.h"
+
+namespace
+{
+    unsigned cellCount(double length, double cell_size)
+    {
+        return std::max(1u, static_cast<unsigned>(std::ceil(length / cell_size)));
+    }
+}
+
+size_t Gkm::Solid::VoxelGrid::index(unsigned x, unsigned y, unsigned z) const
+{
+    return (static_cast<size_t>(z) * size_y + y) * size_x + x;
+}
+
+bool Gkm::Solid::VoxelGrid::inside(unsigned x, unsigned y, unsigned z) const
+{
+    return cells[index(x, y, z)] != 0;
+}
+
+Eigen::Vector3d Gkm::Solid::VoxelGrid::cellCenter(unsigned x, unsigned y, unsigned z) const
+{
+    return origin + Eigen::Vector3d(x + 0.5, y + 0.5, z + 0.5) * cell_size;
+}
+
+size_t Gkm::Solid::VoxelGrid::insideCount() const
+{
+    return static_cast<size_t>(std::count(cells.begin(), cells.end(), static_cast<unsigned char>(1)));
+}
+
+Gkm::Solid::VoxelGrid::Ptr Gkm::Solid::voxelize(const ISolid::Ptr& solid, const Eigen::AlignedBox3d& box, double cell_size)
+{
+    auto grid = std::make_shared<VoxelGrid>();
+    if (box.isEmpty() || cell_size <= 0.0)
+    {
+        return grid;
+    }
+    const Eigen::Vector3d sizes = box.sizes();
+    grid->origin = box.min();
+    grid->cell_size = cell_size;
+    grid->size_x = cellCount(sizes.x(), cell_size);
+    grid->size_y = cellCount(sizes.y(), cell_size);
+    grid->size_z = cellCount(sizes.z(), cell_size);
+    grid->cells.assign(static_cast<size_t>(grid->size_x) * grid->size_y * grid->size_z, 0);
+
+    const Eigen::Vector3d direction(1.0, 0.0, 0.0);
+    const double row_length = grid->size_x * cell_size;
+    std::vector<RaySpan> spans;
+    for (unsigned z = 0; z < grid->size_z; ++z)
+    {
+        for (unsigned y = 0; y < grid->size_y; ++y)
+        {
+            const Eigen::Vector3d row_origin = grid->cellCenter(0, y, z) - Eigen::Vector3d(0.5 * cell_size, 0.0, 0.0);
+            solid->raySpans(row_origin, direction, 0.0, row_length, spans);
+            unsigned char* row = &grid->cells[grid->index(0, y, z)];
+            for (auto& span : spans)
+            {
+                // Cells whose centers (x + 0.5) * cell_size are within the span
+                const double first = std::max(0.0, std::ceil(span.begin / cell_size - 0.5));
+                const double last = std::min(grid->size_x - 1.0, std::floor(span.end / cell_size - 0.5));
+                if (first <= last)
+                {
+                    std::fill(row + static_cast<size_t>(first), row + static_cast<size_t>(last) + 1, static_cast<unsigned char>(1));
+                }
+            }
+        }
+    }
+    return grid;
+}
+
+double Gkm::Solid::calculateVolume(const ISolid::Ptr& solid, double step)
+{
+    const Eigen::AlignedBox3d box = solid->bbox();
+    if (box.isEmpty() || step <= 0.0)
+    {
+        return 0.0;
+    }
+    const Eigen::Vector3d sizes = box.sizes();
+    const unsigned size_y = cellCount(sizes.y(), step);
+    const unsigned size_z = cellCount(sizes.z(), step);
+    const Eigen::Vector3d direction(1.0, 0.0, 0.0);
+    std::vector<RaySpan> spans;
+    double length_sum = 0.0;
+    for (unsigned z = 0; z < size_z; ++z)
+    {
+        for (unsigned y = 0; y < size_y; ++y)
+        {
+            const Eigen::Vector3d row_origin(box.min().x(), box.min().y() + (y + 0.5) * step, box.min().z() + (z + 0.5) * step);
+            solid->raySpans(row_origin, direction, 0.0, sizes.x(), spans);
+            for (auto& span : spans)
+            {
+                length_sum += span.end - span.begin;
+            }
+        }
+    }
+    return length_sum * step * step;
+}
@@ -0,0 +1,154 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include "gpu_buffer_heap.h"
+
+GpuBufferHeap::GpuBufferHeap(size_t page_size_, size_t alignment_, QOpenGLBuffer::Type type_) :
+    page_size(page_size_), alignment(std::max<size_t>(alignment_, 1)), type(type_)
+{
+}
+
+GpuBufferHeap::Allocation GpuBufferHeap::allocate(const void* data, size_t size)
+{
+    Allocation allocation;
+    if (size == 0)
+    {
+        return allocation;
+    }
+    const size_t block_size = (size + alignment - 1) / alignment * alignment;
+
+    // The smallest free block which fits
+    bool found = false;
+    for (size_t i = 0; i < pages.size(); ++i)
+    {
+        for (auto& free_block : pages[i].free_blocks)
+        {
+            if (free_block.second >= block_size && (!found || free_block.second < allocation.size))
+            {
+                found = true;
+                allocation.page = i;
+                allocation.offset = free_block.first;
+                allocation.size = free_block.second;
+            }
+        }
+    }
+
+    if (!found)
+    {
+        // Slots of released pages are reused, so indices of other pages do not change
+        allocation.page = pages.size();
+        for (size_t i = 0; i < pages.size(); ++i)
+        {
+            if (!pages[i].buffer)
+            {
+                allocation.page = i;
+                break;
+            }
+        }
+        if (allocation.page == pages.size())
+        {
+            pages.emplace_back();
+        }
+        Page& page = pages[allocation.page];
+        page.size = std::max(page_size, block_size);
+        page.buffer = std::make_unique<QOpenGLBuffer>(type);
+        page.buffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+        page.buffer->create();
+        page.buffer->bind();
+        page.buffer->allocate(static_cast<int>(page.size));
+        page.free_blocks.emplace(0, page.size);
+        allocation.offset = 0;
+        allocation.size = page.size;
+    }
+
+    Page& page = pages[allocation.page];
+    page.free_blocks.erase(allocation.offset);
+    if (allocation.size > block_size)
+    {
+        page.free_blocks.emplace(allocation.offset + block_size, allocation.size - block_size);
+    }
+    allocation.size = block_size;
+
+    page.buffer->bind();
+    page.buffer->write(static_cast<int>(allocation.offset), data, static_cast<int>(size));
+    uploaded_size += size;
+    return allocation;
+}
+
+void GpuBufferHeap::free(const Allocation& allocation)
+{
+    if (allocation.size == 0)
+    {
+        return;
+    }
+    assert(allocation.page < pages.size() && pages[allocation.page].buffer);
+    Page& page = pages[allocation.page];
+    size_t offset = allocation.offset;
+    size_t size = allocation.size;
+
+    // Merge with the previous and the next free blocks
+    auto next = page.free_blocks.lower_bound(offset);
+    if (next != page.free_blocks.begin())
+    {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size += previous->second;
+            page.free_blocks.erase(previous);
+        }
+    }
+    if (next != page.free_blocks.end() && offset + size == next->first)
+    {
+        size += next->second;
+        page.free_blocks.erase(next);
+    }
+    page.free_blocks.emplace(offset, size);
+
+    // Pages of big meshes are released as soon as they are free, regular pages are kept for reuse
+    if (size == page.size && page.size > page_size)
+    {
+        page.buffer.reset();
+        page.free_blocks.clear();
+        page.size = 0;
+    }
+}
+
+void GpuBufferHeap::clear()
+{
+    pages.clear();
+}
+
+QOpenGLBuffer& GpuBufferHeap::buffer(const Allocation& allocation)
+{
+    assert(allocation.page < pages.size() && pages[allocation.page].buffer);
+    return *pages[allocation.page].buffer;
+}
+
+size_t GpuBufferHeap::getPageCount() const
+{
+    return static_cast<size_t>(std::count_if(pages.begin(), pages.end(), [](const Page& page) { return page.buffer != nullptr; }));
+}
+
+size_t GpuBufferHeap::getCapacity() const
+{
+    size_t capacity = 0;
+    for (auto& page : pages)
+    {
+        capacity += page.size;
+    }
+    return capacity;
+}
+
+size_t GpuBufferHeap::getUploadedSize() const
+{
+    return uploaded_size;
+}
+
+void GpuBufferHeap::resetUploadedSize()
+{
+    uploaded_size = 0;
+}
@@ -14,6 +14,8 @@
 
 int main(int argc, char *argv[])
 {
+    // 3D views share buffers of one scene
+    QApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
     QApplication application(argc, argv);
     MainWindow main_window;
 
@@ -1,7 +1,10 @@
 // Copyright 2020 Petr Petrovich Petrov. All rights reserved.
 // License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
 
+#include <algorithm>
+#include <QAction>
 #include <QMenu>
+#include <QMenuBar>
 #include <QToolBar>
 #include <QDockWidget>
 #include <QTextEdit>
@@ -13,6 +16,7 @@
 #include <QHeaderView>
 #include <QPushButton>
 #include "main_window.h"
+#include "gkm_solid/gkm_io.h"
 
 extern MainWindow* g_main_window = nullptr;
 
@@ -33,9 +37,16 @@ MainWindow::MainWindow()
     solid = difference;
     std::srand(static_cast<unsigned int>(time(0)));
 
-    view_3d_widget = new View3DWidget(main_window.centralwidget);
-    view_3d_window = main_window.centralwidget->addSubWindow(view_3d_widget);
-    view_3d_window->setWindowTitle(tr("3D View"));
+    view_3d_window = addView3D();
+    QMenu* file_menu = menuBar()->addMenu(tr("&File"));
+    file_menu->addAction(tr("Open Scene..."), this, [this]() { openScene(); });
+    QMenu* edit_menu = menuBar()->addMenu(tr("&Edit"));
+    edit_menu->addAction(tr("Drill Random Hole"), this, [this]() { drillRandomHole(); });
+    QMenu* view_menu = menuBar()->addMenu(tr("&View"));
+    view_menu->addAction(tr("New 3D View"), this, [this]() { addView3D()->show(); });
+    QAction* cell_instances_action = view_menu->addAction(tr("Draw Cells as Instances"), this, [this](bool checked) { setCellInstances(checked); });
+    cell_instances_action->setCheckable(true);
+    cell_instances_action->setChecked(cell_instances);
 
     log_view = new QPlainTextEdit(main_window.centralwidget);
     log_view->setReadOnly(true);
@@ -50,6 +61,98 @@ Gkm::Solid::ISolid::Ptr MainWindow::getSolid() const
     return solid;
 }
 
+void MainWindow::setSolid(const Gkm::Solid::ISolid::Ptr& new_solid)
+{
+    solid = new_solid;
+    const View3DScene::Ptr scene = view_3d_scene.lock();
+    if (scene)
+    {
+        scene->getBufferHeap().resetUploadedSize();
+        scene->getIndexHeap().resetUploadedSize();
+    }
+    for (auto& view_3d_widget : view_3d_widgets)
+    {
+        if (view_3d_widget)
+        {
+            view_3d_widget->updateSolid();
+        }
+    }
+    if (scene)
+    {
+        statusBar()->showMessage(tr("Uploaded %1 KB of vertex data and %2 KB of index data")
+            .arg(scene->getBufferHeap().getUploadedSize() / 1024).arg(scene->getIndexHeap().getUploadedSize() / 1024));
+    }
+}
+
+QMdiSubWindow* MainWindow::addView3D()
+{
+    View3DScene::Ptr scene = view_3d_scene.lock();
+    if (!scene)
+    {
+        scene = std::make_shared<View3DScene>();
+        scene->setCellInstances(cell_instances);
+        view_3d_scene = scene;
+    }
+    auto view_3d_widget = new View3DWidget(main_window.centralwidget, scene);
+    auto closed = [](const QPointer<View3DWidget>& view) { return view.isNull(); };
+    view_3d_widgets.erase(std::remove_if(view_3d_widgets.begin(), view_3d_widgets.end(), closed), view_3d_widgets.end());
+    view_3d_widgets.push_back(view_3d_widget);
+    QMdiSubWindow* window = main_window.centralwidget->addSubWindow(view_3d_widget);
+    window->setAttribute(Qt::WA_DeleteOnClose);
+    ++view_3d_window_count;
+    window->setWindowTitle(view_3d_window_count == 1 ? tr("3D View") : tr("3D View %1").arg(view_3d_window_count));
+    return window;
+}
+
+void MainWindow::setCellInstances(bool enabled)
+{
+    cell_instances = enabled;
+    // The scene is shared, so the first view switches it and the other ones only repaint
+    for (auto& view_3d_widget : view_3d_widgets)
+    {
+        if (view_3d_widget)
+        {
+            view_3d_widget->setCellInstances(enabled);
+        }
+    }
+}
+
+void MainWindow::openScene()
+{
+    const QString file_name = QFileDialog::getOpenFileName(this, tr("Open Scene"), QString(), tr("Scenes (*.gkm)"));
+    if (file_name.isEmpty())
+    {
+        return;
+    }
+    std::string error;
+    const Gkm::Solid::ISolid::Ptr new_solid = Gkm::Solid::readScene(file_name.toStdString(), &error);
+    if (!new_solid)
+    {
+        QMessageBox::warning(this, tr("Open Scene"), QString::fromStdString(error));
+        return;
+    }
+    setSolid(new_solid);
+}
+
+void MainWindow::drillRandomHole()
+{
+    const Eigen::AlignedBox3d box = solid->bbox();
+    if (box.isEmpty())
+    {
+        return;
+    }
+    // Chunks are anchored to the world grid, so only chunks which the sphere touches are uploaded again
+    auto sphere = std::make_shared<Gkm::Solid::Sphere>();
+    sphere->radius = 0.05 * box.diagonal().norm();
+    auto translate = std::make_shared<Gkm::Solid::TransformOperator>();
+    translate->translate = box.min() + box.sizes().cwiseProduct(Eigen::Vector3d(std::rand(), std::rand(), std::rand()) / static_cast<double>(RAND_MAX));
+    translate->solid = sphere;
+    auto difference = std::make_shared<Gkm::Solid::DifferenceOperator>();
+    difference->left = solid;
+    difference->right = translate;
+    setSolid(difference);
+}
+
 void MainWindow::showEvent(QShowEvent* event)
 {
     QMainWindow::showEvent(event);
@@ -0,0 +1,306 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include "gkm_solid/gkm_simplifier.h"
+#include "gkm_solid/gkm_dag.h"
+#include "view_3d_scene.h"
+
+void View3DScene::initialize(QOpenGLContext* context)
+{
+    if (initialized)
+    {
+        return;
+    }
+    initialized = true;
+
+    const QSurfaceFormat format = context->format();
+    instancing_supported = context->isOpenGLES() ? format.majorVersion() >= 3 : format.version() >= qMakePair(3, 3);
+    // Big chunks need 32 bit indices, OpenGL ES 2.0 draws triangle soups without the extension
+    uint_indices_supported = !context->isOpenGLES() || format.majorVersion() >= 3 || context->hasExtension("GL_OES_element_index_uint");
+    updateCellInstances();
+}
+
+void View3DScene::setCellInstances(bool enabled)
+{
+    cell_instances_requested = enabled;
+    if (initialized)
+    {
+        updateCellInstances();
+    }
+}
+
+void View3DScene::build(const Gkm::Solid::ISolid::Ptr& new_source_solid)
+{
+    assert(initialized);
+    if ((model || built_model) && new_source_solid == source_solid)
+    {
+        return;
+    }
+    source_solid = new_source_solid;
+    Gkm::Solid::SolidDag solid_dag;
+    solid = solid_dag.canonicalize(Gkm::Solid::simplify(source_solid));
+    Gkm::Solid::BuildOptions build_options;
+    build_options.cell_instances = cell_instances;
+    // Flat regions of the octree mesh are over-tessellated, decimation within half of the tolerance removes most of their triangles
+    build_options.decimation_error = 0.5 * build_options.tolerance;
+    build_options.indexed_lods = indexed_meshes;
+    build_options.jit_compiler = jit_compiler;
+    built_model = Gkm::Solid::buildChunkedModel(solid, build_options);
+
+    // Picking and highlighting use the finest level of detail
+    Gkm::Solid::Model picking_model;
+    for (auto& chunk : built_model->chunks)
+    {
+        if (!chunk.lods.empty())
+        {
+            picking_model.points.insert(picking_model.points.end(), chunk.lods.front()->points.begin(), chunk.lods.front()->points.end());
+        }
+        if (!chunk.indexed_lods.empty())
+        {
+            const Gkm::Solid::IndexedModel& indexed_lod = *chunk.indexed_lods.front();
+            for (uint32_t index : indexed_lod.indices)
+            {
+                picking_model.points.push_back(indexed_lod.points[index]);
+            }
+        }
+        if (!chunk.instance_lods.empty())
+        {
+            Gkm::Solid::addCellInstances(picking_model, chunk, chunk.instance_lods.front());
+        }
+    }
+    parts.clear();
+    Gkm::Solid::collectParts(solid, parts);
+    bvh = std::make_shared<Gkm::Solid::MeshBvh>(picking_model, Gkm::Solid::tagTriangles(picking_model, parts));
+}
+
+void View3DScene::upload()
+{
+    assert(initialized);
+    if (!built_model)
+    {
+        return;
+    }
+
+    // Only chunks which are changed are uploaded, buffers of the same chunks are kept
+    std::vector<ChunkBuffer> new_chunk_buffers(built_model->chunks.size());
+    Gkm::Solid::ChunkedModelDelta delta;
+    if (model)
+    {
+        delta = Gkm::Solid::diffChunkedModels(*model, *built_model);
+    }
+    else
+    {
+        for (size_t i = 0; i < built_model->chunks.size(); ++i)
+        {
+            delta.added.push_back(i);
+        }
+    }
+    for (size_t i : delta.removed)
+    {
+        buffer_heap.free(chunk_buffers[i].allocation);
+        index_heap.free(chunk_buffers[i].index_allocation);
+    }
+    for (auto& kept : delta.kept)
+    {
+        new_chunk_buffers[kept.second] = chunk_buffers[kept.first];
+    }
+    for (size_t i : delta.added)
+    {
+        new_chunk_buffers[i] = uploadChunk(built_model->chunks[i]);
+    }
+
+    // Only boxes, errors and hashes of chunks are needed after upload
+    for (auto& chunk : built_model->chunks)
+    {
+        for (auto& lod : chunk.lods)
+        {
+            std::vector<Eigen::Vector3f>().swap(lod->points);
+        }
+        for (auto& indexed_lod : chunk.indexed_lods)
+        {
+            std::vector<Eigen::Vector3f>().swap(indexed_lod->points);
+            std::vector<uint32_t>().swap(indexed_lod->indices);
+        }
+        for (auto& instance_lod : chunk.instance_lods)
+        {
+            std::vector<Gkm::Solid::CellInstance>().swap(instance_lod);
+        }
+    }
+    chunk_buffers = std::move(new_chunk_buffers);
+    model = built_model;
+    built_model = nullptr;
+}
+
+void View3DScene::load(const Gkm::Solid::ISolid::Ptr& new_source_solid)
+{
+    build(new_source_solid);
+    upload();
+}
+
+bool View3DScene::isInitialized() const
+{
+    return initialized;
+}
+
+bool View3DScene::hasCellInstances() const
+{
+    return cell_instances;
+}
+
+Gkm::Solid::ISolid::Ptr View3DScene::getSolid() const
+{
+    return solid;
+}
+
+Gkm::Solid::ChunkedModel::Ptr View3DScene::getModel() const
+{
+    return model;
+}
+
+Gkm::Solid::ChunkedModel::Ptr View3DScene::getBuiltModel() const
+{
+    return built_model;
+}
+
+const std::vector<View3DScene::ChunkBuffer>& View3DScene::getChunkBuffers() const
+{
+    return chunk_buffers;
+}
+
+Gkm::Solid::MeshBvh::Ptr View3DScene::getBvh() const
+{
+    return bvh;
+}
+
+const std::vector<Gkm::Solid::ISolid::Ptr>& View3DScene::getParts() const
+{
+    return parts;
+}
+
+GpuBufferHeap& View3DScene::getBufferHeap()
+{
+    return buffer_heap;
+}
+
+GpuBufferHeap& View3DScene::getIndexHeap()
+{
+    return index_heap;
+}
+
+QOpenGLBuffer& View3DScene::getCubeBuffer()
+{
+    assert(cube_vbo);
+    return *cube_vbo;
+}
+
+void View3DScene::updateCellInstances()
+{
+    const bool new_cell_instances = cell_instances_requested && instancing_supported;
+    indexed_meshes = !new_cell_instances && uint_indices_supported;
+    if (new_cell_instances == cell_instances)
+    {
+        return;
+    }
+    cell_instances = new_cell_instances;
+
+    // Chunks of the other kind are released, the same solid is rebuilt by the next load()
+    buffer_heap.clear();
+    index_heap.clear();
+    chunk_buffers.clear();
+    model = nullptr;
+    built_model = nullptr;
+    source_solid = nullptr;
+    if (cell_instances && !cube_vbo)
+    {
+        // Unit cube is built from the same faces as meshes are
+        Gkm::Solid::Model cube;
+        for (unsigned face = 0; face < 6; ++face)
+        {
+            Gkm::Solid::addBoxFace(cube, Eigen::AlignedBox3d(Eigen::Vector3d::Zero(), Eigen::Vector3d::Ones()), face);
+        }
+        std::vector<float> cube_vertices;
+        for (size_t i = 0; i < cube.points.size(); ++i)
+        {
+            cube_vertices.insert(cube_vertices.end(), { cube.points[i].x(), cube.points[i].y(), cube.points[i].z(), static_cast<float>(i / 6) });
+        }
+        cube_vbo = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+        cube_vbo->create();
+        cube_vbo->bind();
+        cube_vbo->allocate(cube_vertices.data(), static_cast<int>(cube_vertices.size() * sizeof(float)));
+    }
+}
+
+View3DScene::ChunkBuffer View3DScene::uploadChunk(const Gkm::Solid::ModelChunk& chunk)
+{
+    ChunkBuffer chunk_buffer;
+    if (cell_instances)
+    {
+        std::vector<Gkm::Solid::CellInstance> instances;
+        for (auto& instance_lod : chunk.instance_lods)
+        {
+            LodRange range;
+            range.first = static_cast<GLint>(instances.size());
+            range.count = static_cast<GLsizei>(instance_lod.size());
+            instances.insert(instances.end(), instance_lod.begin(), instance_lod.end());
+            chunk_buffer.lods.push_back(range);
+        }
+        const Eigen::Vector3d& min = chunk.box.min();
+        chunk_buffer.position_offset = QVector3D(static_cast<float>(min.x()), static_cast<float>(min.y()), static_cast<float>(min.z()));
+        chunk_buffer.position_scale = QVector3D(static_cast<float>(chunk.cell_size.x()), static_cast<float>(chunk.cell_size.y()), static_cast<float>(chunk.cell_size.z()));
+        chunk_buffer.allocation = buffer_heap.allocate(instances.data(), instances.size() * sizeof(Gkm::Solid::CellInstance));
+        return chunk_buffer;
+    }
+    std::vector<uint16_t> positions;
+    Gkm::Solid::QuantizedModel::Ptr quantized_lod;
+    if (!chunk.indexed_lods.empty())
+    {
+        // Vertices of each level of detail follow the previous ones, the attribute pointer is moved to them before the draw
+        std::vector<uint32_t> indices;
+        size_t max_vertex_count = 0;
+        Gkm::Solid::Model vertices;
+        for (auto& indexed_lod : chunk.indexed_lods)
+        {
+            vertices.points = indexed_lod->points;
+            quantized_lod = Gkm::Solid::quantizeModel(vertices, chunk.box);
+            LodRange range;
+            range.first = static_cast<GLint>(indices.size());
+            range.count = static_cast<GLsizei>(indexed_lod->indices.size());
+            range.vertex_offset = positions.size() * sizeof(uint16_t);
+            positions.insert(positions.end(), quantized_lod->positions.begin(), quantized_lod->positions.end());
+            indices.insert(indices.end(), indexed_lod->indices.begin(), indexed_lod->indices.end());
+            max_vertex_count = std::max(max_vertex_count, indexed_lod->points.size());
+            chunk_buffer.lods.push_back(range);
+        }
+        if (max_vertex_count <= 65536)
+        {
+            const std::vector<uint16_t> short_indices(indices.begin(), indices.end());
+            chunk_buffer.index_type = GL_UNSIGNED_SHORT;
+            chunk_buffer.index_allocation = index_heap.allocate(short_indices.data(), short_indices.size() * sizeof(uint16_t));
+        }
+        else
+        {
+            chunk_buffer.index_type = GL_UNSIGNED_INT;
+            chunk_buffer.index_allocation = index_heap.allocate(indices.data(), indices.size() * sizeof(uint32_t));
+        }
+    }
+    for (auto& lod : chunk.lods)
+    {
+        quantized_lod = Gkm::Solid::quantizeModel(*lod, chunk.box);
+        LodRange range;
+        range.first = static_cast<GLint>(positions.size() / 3);
+        range.count = static_cast<GLsizei>(quantized_lod->vertexCount());
+        positions.insert(positions.end(), quantized_lod->positions.begin(), quantized_lod->positions.end());
+        chunk_buffer.lods.push_back(range);
+    }
+    if (quantized_lod)
+    {
+        const Eigen::Vector3f position_scale = quantized_lod->scale * 65535.0f;
+        chunk_buffer.position_offset = QVector3D(quantized_lod->offset.x(), quantized_lod->offset.y(), quantized_lod->offset.z());
+        chunk_buffer.position_scale = QVector3D(position_scale.x(), position_scale.y(), position_scale.z());
+    }
+    chunk_buffer.allocation = buffer_heap.allocate(positions.data(), positions.size() * sizeof(uint16_t));
+    return chunk_buffer;
+}
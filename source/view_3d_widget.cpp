@@ -1,7 +1,9 @@
 // Copyright 2020 Petr Petrovich Petrov. All rights reserved.
 // License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
 
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cmath>
 #include <fstream>
@@ -13,21 +15,42 @@
 #include <QPainter>
 #include <QApplication>
 #include <QStatusBar>
+#include <QOpenGLContext>
 #include <QOpenGLShader>
+#include <QKeyEvent>
+#include <QVector4D>
+#include <QtMath>
+#include "gkm_solid/gkm_section.h"
 #include "main_window.h"
 #include "view_3d_widget.h"
 
-#define PROGRAM_VERTEX_ATTRIBUTE 0
-#define PROGRAM_TEXCOORD_ATTRIBUTE 1
-
 constexpr size_t VERTEX_COUNT = 1000000;
+constexpr float FIELD_OF_VIEW = 50.0f;
+// Maximal projected error of levels of detail in pixels, a coarser proxy is drawn while the camera is dragged
+constexpr double MAX_PIXEL_ERROR = 1.0;
+constexpr double DRAG_MAX_PIXEL_ERROR = 8.0;
+// Rows of section caps are this number of finest cells wide while the section plane is dragged
+constexpr double DRAG_SECTION_ROW_CELLS = 4.0;
 
-View3DWidget::View3DWidget(QWidget *parent) : QOpenGLWidget(parent)
+View3DWidget::View3DWidget(QWidget *parent, const View3DScene::Ptr& scene_) : QOpenGLWidget(parent), scene(scene_)
 {
     setMouseTracking(true);
+    setFocusPolicy(Qt::StrongFocus);
     setDefaultCamera();
 }
 
+View3DWidget::~View3DWidget()
+{
+    // Views are the only owners of the shared scene, so the last view releases its buffers and a context has to be current
+    makeCurrent();
+    renderer.reset();
+    flat_program.reset();
+    highlight_vbo.reset();
+    section_vbo.reset();
+    scene.reset();
+    doneCurrent();
+}
+
 void View3DWidget::initializeGL()
 {
     initializeOpenGLFunctions();
@@ -35,38 +58,201 @@ void View3DWidget::initializeGL()
     glEnable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
 
-    Gkm::Solid::ISolid::Ptr solid = g_main_window->getSolid();
-    model = buildModel(solid);
+    // The first initialized view creates shared resources
+    scene->initialize(context());
+    renderer = std::make_unique<ChunkRenderer>();
+    renderer->initialize(scene->hasCellInstances());
 
-    vbo.create();
-    vbo.bind();
-    vbo.allocate(&model->points[0], model->points.size() * sizeof(Eigen::Vector3f));
-
-    QOpenGLShader* vshader = new QOpenGLShader(QOpenGLShader::Vertex, this);
-    const char* vsrc =
-        "attribute highp vec4 vertex;\n"
+    QOpenGLShader* flat_vshader = new QOpenGLShader(QOpenGLShader::Vertex, this);
+    const char* flat_vsrc =
+        "attribute highp vec3 vertex;\n"
         "uniform mediump mat4 matrix;\n"
+        "uniform highp vec4 clip_plane;\n"
+        "varying highp float clip_distance;\n"
         "void main(void)\n"
         "{\n"
-        "    gl_Position = matrix * vertex;\n"
+        "    clip_distance = dot(clip_plane, vec4(vertex, 1.0));\n"
+        "    gl_Position = matrix * vec4(vertex, 1.0);\n"
         "}\n";
-    vshader->compileSourceCode(vsrc);
-
-    QOpenGLShader* fshader = new QOpenGLShader(QOpenGLShader::Fragment, this);
-    const char* fsrc =
+    flat_vshader->compileSourceCode(flat_vsrc);
+    QOpenGLShader* flat_fshader = new QOpenGLShader(QOpenGLShader::Fragment, this);
+    const char* flat_fsrc =
+        "uniform lowp vec4 color;\n"
+        "varying highp float clip_distance;\n"
         "void main(void)\n"
         "{\n"
-        "    gl_FragColor = vec4(1.0, 0.0, 0.0, 1.0);\n"
+        "    if (clip_distance < 0.0)\n"
+        "        discard;\n"
+        "    gl_FragColor = color;\n"
         "}\n";
-    fshader->compileSourceCode(fsrc);
+    flat_fshader->compileSourceCode(flat_fsrc);
+    flat_program = std::make_unique<QOpenGLShaderProgram>();
+    flat_program->addShader(flat_vshader);
+    flat_program->addShader(flat_fshader);
+    flat_program->bindAttributeLocation("vertex", PROGRAM_VERTEX_ATTRIBUTE);
+    flat_program->link();
+    highlight_vbo = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+    highlight_vbo->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    highlight_vbo->create();
+    highlight_vertex_count = 0;
+    hovered_part = -1;
+    section_vbo = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+    section_vbo->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+    section_vbo->create();
+    section_vertex_count = 0;
+
+    scene->load(g_main_window->getSolid());
+    updateSection(false);
+}
+
+void View3DWidget::updateSolid()
+{
+    if (!isValid())
+    {
+        // The solid is loaded when OpenGL is initialized
+        return;
+    }
+    // The scene is shared, so only the first view which is updated rebuilds it
+    makeCurrent();
+    scene->load(g_main_window->getSolid());
+    doneCurrent();
+    // Part indices of the previous solid are not valid anymore
+    setHoveredPart(-1);
+    updateSection(false);
+    update();
+}
+
+void View3DWidget::setCellInstances(bool enabled)
+{
+    if (!isValid())
+    {
+        // The scene is initialized with the option of the main window
+        return;
+    }
+    makeCurrent();
+    scene->setCellInstances(enabled);
+    doneCurrent();
+    updateSolid();
+}
+
+void View3DWidget::getCursorRay(const QPointF& position, Eigen::Vector3d& origin, Eigen::Vector3d& direction) const
+{
+    const QMatrix4x4 inverse_matrix = getViewProjectionMatrix().inverted();
+    const float x = static_cast<float>(2.0 * position.x() / width() - 1.0);
+    const float y = static_cast<float>(1.0 - 2.0 * position.y() / height());
+    const QVector3D near_point = inverse_matrix.map(QVector3D(x, y, -1.0f));
+    const QVector3D far_point = inverse_matrix.map(QVector3D(x, y, 1.0f));
+    origin = Eigen::Vector3d(near_point.x(), near_point.y(), near_point.z());
+    direction = Eigen::Vector3d(far_point.x() - near_point.x(), far_point.y() - near_point.y(), far_point.z() - near_point.z());
+}
+
+void View3DWidget::setHoveredPart(int part)
+{
+    if (part == hovered_part)
+    {
+        return;
+    }
+    hovered_part = part;
+    highlight_vertex_count = 0;
+    const Gkm::Solid::MeshBvh::Ptr bvh = scene->getBvh();
+    if (part >= 0 && bvh)
+    {
+        // Only triangles near the part are visited
+        std::vector<uint32_t> triangles;
+        bvh->queryBox(scene->getParts()[part]->bbox(), triangles);
+        std::vector<Eigen::Vector3f> points;
+        for (uint32_t triangle : triangles)
+        {
+            if (bvh->triangleId(triangle) == static_cast<uint32_t>(part))
+            {
+                for (unsigned i = 0; i < 3; ++i)
+                {
+                    points.push_back(bvh->vertex(triangle, i));
+                }
+            }
+        }
+        makeCurrent();
+        highlight_vbo->bind();
+        highlight_vbo->allocate(points.data(), static_cast<int>(points.size() * sizeof(Eigen::Vector3f)));
+        doneCurrent();
+        highlight_vertex_count = static_cast<GLsizei>(points.size());
+    }
+    update();
+}
 
-    program = std::make_unique<QOpenGLShaderProgram>();
-    program->addShader(vshader);
-    program->addShader(fshader);
-    program->bindAttributeLocation("vertex", PROGRAM_VERTEX_ATTRIBUTE);
-    program->link();
+Eigen::Vector4d View3DWidget::getSectionPlane() const
+{
+    if (!section_enabled)
+    {
+        return Eigen::Vector4d(0.0, 0.0, 0.0, 1.0);
+    }
+    Eigen::Vector4d plane = Eigen::Vector4d::Zero();
+    plane[section_axis] = 1.0;
+    plane.w() = -section_offset;
+    return plane;
+}
+
+void View3DWidget::updateSection(bool dragging)
+{
+    section_vertex_count = 0;
+    const Gkm::Solid::ChunkedModel::Ptr model = scene->getModel();
+    if (!section_enabled || !model || model->chunks.empty())
+    {
+        update();
+        return;
+    }
 
-    program->bind();
+    // Caps are computed from the solid by exact spans along rows, so the model is not rebuilt
+    Gkm::Solid::SectionOptions options;
+    options.row_size = model->chunks.front().cell_size.minCoeff();
+    if (dragging)
+    {
+        options.row_size *= DRAG_SECTION_ROW_CELLS;
+    }
+    const Gkm::Solid::Model::Ptr caps = Gkm::Solid::buildSection(scene->getSolid(), getSectionPlane(), options);
+    makeCurrent();
+    section_vbo->bind();
+    section_vbo->allocate(caps->points.data(), static_cast<int>(caps->points.size() * sizeof(Eigen::Vector3f)));
+    doneCurrent();
+    section_vertex_count = static_cast<GLsizei>(caps->points.size());
+    update();
+}
+
+bool View3DWidget::pick(const QPointF& position, Eigen::Vector3d& point, Gkm::Solid::MeshRayHit& hit) const
+{
+    const Gkm::Solid::MeshBvh::Ptr bvh = scene->getBvh();
+    if (!bvh)
+    {
+        return false;
+    }
+    Eigen::Vector3d origin;
+    Eigen::Vector3d direction;
+    getCursorRay(position, origin, direction);
+
+    // Plane distance along the ray is plane_origin + t * plane_direction, the kept side is positive
+    const Eigen::Vector4d section_plane = getSectionPlane();
+    const double plane_origin = section_plane.head<3>().dot(origin) + section_plane.w();
+    const double plane_direction = section_plane.head<3>().dot(direction);
+    double t_min = 0.0;
+    double t_max = 1.0;
+    if (plane_direction > 0.0)
+    {
+        t_min = std::max(t_min, -plane_origin / plane_direction);
+    }
+    else if (plane_direction < 0.0)
+    {
+        t_max = std::min(t_max, -plane_origin / plane_direction);
+    }
+    else if (plane_origin < 0.0)
+    {
+        return false;
+    }
+    if (t_min > t_max || !bvh->raycast(origin, direction, t_min, t_max, hit))
+    {
+        return false;
+    }
+    point = origin + hit.distance * direction;
+    return true;
 }
 
 void View3DWidget::paintGL()
@@ -74,22 +260,63 @@ void View3DWidget::paintGL()
     glClearColor(0.5, 0.5, 0.5, 1.0);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    QMatrix4x4 projection_matrix;
-    projection_matrix.perspective(50.0f, static_cast<float>(width()) / height(), 0.125f, 1024.0f);
+    const QMatrix4x4 view_projection = getViewProjectionMatrix();
+    const Eigen::Vector4d section_plane = getSectionPlane();
+    const QVector4D clip_plane(static_cast<float>(section_plane.x()), static_cast<float>(section_plane.y()),
+        static_cast<float>(section_plane.z()), static_cast<float>(section_plane.w()));
+    // Level of detail of each chunk is chosen by its error projected to the screen
+    const Eigen::Vector3d viewer_position(viewer_pos.x(), viewer_pos.y(), viewer_pos.z());
+    const double projection_scale = height() / (2.0 * std::tan(qDegreesToRadians(FIELD_OF_VIEW / 2.0)));
+    const double max_pixel_error = left_mouse_pressed || right_mouse_pressed || middle_mouse_pressed ? DRAG_MAX_PIXEL_ERROR : MAX_PIXEL_ERROR;
+    renderer->draw(*scene, view_projection, viewer_position, projection_scale, max_pixel_error, section_plane);
 
-    QMatrix4x4 view_matrix;
-    view_matrix.lookAt(viewer_pos, viewer_target, viewer_up);
-
-    program->setUniformValue("matrix", projection_matrix * view_matrix);
-    program->enableAttributeArray(PROGRAM_VERTEX_ATTRIBUTE);
-    program->setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_FLOAT, 0, 3, 3 * sizeof(GLfloat));
-
-    glDrawArrays(GL_TRIANGLES, 0, model->points.size() / 3);
+    if (section_vertex_count > 0 || highlight_vertex_count > 0)
+    {
+        flat_program->bind();
+        flat_program->setUniformValue("matrix", view_projection);
+        flat_program->enableAttributeArray(PROGRAM_VERTEX_ATTRIBUTE);
+        if (section_vertex_count > 0)
+        {
+            // Caps lie on the section plane, so they are not clipped by it
+            flat_program->setUniformValue("clip_plane", QVector4D(0.0f, 0.0f, 0.0f, 1.0f));
+            flat_program->setUniformValue("color", QVector4D(0.0f, 0.5f, 1.0f, 1.0f));
+            section_vbo->bind();
+            flat_program->setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_FLOAT, 0, 3, sizeof(Eigen::Vector3f));
+            glDrawArrays(GL_TRIANGLES, 0, section_vertex_count);
+        }
+        if (highlight_vertex_count > 0)
+        {
+            // Highlight is pulled towards the viewer to win the depth test against coarser levels of detail
+            flat_program->setUniformValue("clip_plane", clip_plane);
+            flat_program->setUniformValue("color", QVector4D(1.0f, 1.0f, 0.0f, 1.0f));
+            highlight_vbo->bind();
+            flat_program->setAttributeBuffer(PROGRAM_VERTEX_ATTRIBUTE, GL_FLOAT, 0, 3, sizeof(Eigen::Vector3f));
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(-1.0f, -4.0f);
+            glDrawArrays(GL_TRIANGLES, 0, highlight_vertex_count);
+            glDisable(GL_POLYGON_OFFSET_FILL);
+        }
+    }
 }
 
 void View3DWidget::mouseMoveEvent(QMouseEvent* event)
 {
-    if (right_mouse_pressed)
+    if (middle_mouse_pressed)
+    {
+        // Section plane is moved along its axis, caps are coarse until the button is released
+        QPointF current_point = event->localPos();
+        section_offset += (previous_point.y() - current_point.y()) / height() * rotation_radius;
+        previous_point = current_point;
+        updateSection(true);
+    }
+    else if (!left_mouse_pressed && !right_mouse_pressed)
+    {
+        // Hover highlighting
+        Eigen::Vector3d point;
+        Gkm::Solid::MeshRayHit hit;
+        setHoveredPart(pick(event->localPos(), point, hit) ? static_cast<int>(hit.id) : -1);
+    }
+    else if (right_mouse_pressed)
     {
         // Pan mode
         QPointF current_point = event->localPos();
@@ -143,6 +370,11 @@ void View3DWidget::mousePressEvent(QMouseEvent* event)
         right_mouse_pressed = true;
         left_or_right = true;
     }
+    if ((event->buttons() & Qt::MiddleButton) && section_enabled)
+    {
+        middle_mouse_pressed = true;
+        previous_point = event->localPos();
+    }
     if (left_or_right)
     {
         previous_point = event->localPos();
@@ -166,6 +398,11 @@ void View3DWidget::mouseReleaseEvent(QMouseEvent* event)
         right_mouse_pressed = false;
         left_or_right = true;
     }
+    if (middle_mouse_pressed && !(event->buttons() & Qt::MiddleButton))
+    {
+        middle_mouse_pressed = false;
+        updateSection(false);
+    }
     if (left_or_right)
     {
         previous_point = event->localPos();
@@ -176,6 +413,36 @@ void View3DWidget::mouseReleaseEvent(QMouseEvent* event)
     update();
 }
 
+void View3DWidget::mouseDoubleClickEvent(QMouseEvent* event)
+{
+    if (!scene->getBvh() || !(event->buttons() & Qt::LeftButton))
+    {
+        return;
+    }
+
+    Eigen::Vector3d point;
+    Gkm::Solid::MeshRayHit hit;
+    if (!pick(event->localPos(), point, hit))
+    {
+        g_main_window->statusBar()->showMessage(tr("Nothing is picked"));
+        return;
+    }
+    g_main_window->statusBar()->showMessage(tr("Picked part %1 at point (%2, %3, %4), normal (%5, %6, %7)")
+        .arg(hit.id)
+        .arg(point.x()).arg(point.y()).arg(point.z())
+        .arg(hit.normal.x()).arg(hit.normal.y()).arg(hit.normal.z()));
+
+    // Keep the viewer position and orbit around the picked point
+    viewer_target = QVector3D(static_cast<float>(point.x()), static_cast<float>(point.y()), static_cast<float>(point.z()));
+    rotation_radius = std::max(static_cast<double>(viewer_pos.distanceToPoint(viewer_target)), minimum_rotation_radius);
+    auto new_left = QVector3D::crossProduct(viewer_target - viewer_pos, viewer_up);
+    viewer_up = QVector3D::crossProduct(new_left, viewer_target - viewer_pos).normalized();
+    viewer_previous_pos = viewer_pos;
+    viewer_previous_target = viewer_target;
+    viewer_previous_up = viewer_up;
+    update();
+}
+
 void View3DWidget::wheelEvent(QWheelEvent* event)
 {
     QPoint delta = event->angleDelta();
@@ -194,6 +461,40 @@ void View3DWidget::wheelEvent(QWheelEvent* event)
     update();
 }
 
+void View3DWidget::keyPressEvent(QKeyEvent* event)
+{
+    int axis = -1;
+    switch (event->key())
+    {
+    case Qt::Key_X:
+        axis = 0;
+        break;
+    case Qt::Key_Y:
+        axis = 1;
+        break;
+    case Qt::Key_Z:
+        axis = 2;
+        break;
+    default:
+        QOpenGLWidget::keyPressEvent(event);
+        return;
+    }
+    const Gkm::Solid::ISolid::Ptr solid = scene->getSolid();
+    if (section_enabled && axis == section_axis)
+    {
+        section_enabled = false;
+    }
+    else if (solid)
+    {
+        // The new section plane goes through the center of the solid
+        section_enabled = true;
+        section_axis = axis;
+        section_offset = solid->bbox().center()[axis];
+    }
+    middle_mouse_pressed = false;
+    updateSection(false);
+}
+
 void View3DWidget::setDefaultCamera()
 {
     viewer_pos = QVector3D(0, 0, 3);
@@ -206,3 +507,14 @@ void View3DWidget::setDefaultCamera()
     minimum_rotation_radius = 0.1;
     maximum_rotation_radius = 1000.0;
 }
+
+QMatrix4x4 View3DWidget::getViewProjectionMatrix() const
+{
+    QMatrix4x4 projection_matrix;
+    projection_matrix.perspective(FIELD_OF_VIEW, static_cast<float>(width()) / height(), 0.125f, 1024.0f);
+
+    QMatrix4x4 view_matrix;
+    view_matrix.lookAt(viewer_pos, viewer_target, viewer_up);
+
+    return projection_matrix * view_matrix;
+}
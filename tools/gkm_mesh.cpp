@@ -0,0 +1,597 @@
+// Copyright 2020 Petr Petrovich Petrov. All rights reserved.
+// License: https://github.com/PetrPPetrov/gkm-ship-cad/blob/master/LICENSE
+
+// Command line tool which meshes scene files in parallel and writes meshes, it does not depend on Qt
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <climits>
+#include <sys/stat.h>
+#if defined(_WIN32)
+// std::min and std::max are hidden by macros of windows.h otherwise
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include "gkm_solid/gkm_solid.h"
+#include "gkm_solid/gkm_dag.h"
+#include "gkm_solid/gkm_decimator.h"
+#include "gkm_solid/gkm_io.h"
+#include "gkm_solid/gkm_jit.h"
+#include "gkm_solid/gkm_mesh_optimizer.h"
+#include "gkm_solid/gkm_profiler.h"
+#include "gkm_solid/gkm_simplifier.h"
+#include "gkm_solid/gkm_visualizer.h"
+
+namespace
+{
+    // Extension of scene files which are taken from input directories
+    const char* SCENE_EXTENSION = ".gkm";
+    // Profiling pass meshes the scene with cells of this number of tolerances, so it has 512 times fewer cells than the final pass
+    constexpr double PROFILE_TOLERANCE_SCALE = 8.0;
+    // Nodes of the profile report with the largest total time
+    constexpr size_t PROFILE_NODE_COUNT = 10;
+
+    struct Settings
+    {
+        Settings()
+        {
+            // Bricks are evaluated in parallel and do not miss features which are smaller than coarse cells
+            build_options.mode = Gkm::Solid::EBuildMode::Bricks;
+        }
+
+        std::vector<std::string> inputs;
+        // Meshes are written next to their scenes if it is empty
+        std::string output_directory;
+        bool stl = false;
+        Gkm::Solid::BuildOptions build_options;
+        double decimation_error = 0.0;
+        bool optimize = true;
+        // Operands are reordered by statistics of a coarse pass, its report is printed
+        bool profile = false;
+        // Scenes which are meshed at once, zero means the number of hardware threads
+        unsigned job_count = 0;
+        // Threads of each scene, zero divides hardware threads between jobs
+        unsigned thread_count = 0;
+        // Lattice memory of bricks mode of all jobs, it is divided between jobs
+        size_t lattice_memory = Gkm::Solid::BuildOptions().max_lattice_memory;
+    };
+
+    struct SceneResult
+    {
+        std::string input;
+        std::string output;
+        std::string error;
+        std::string profile_report;
+        size_t triangle_count = 0;
+        size_t vertex_count = 0;
+        // Cell size of bricks mode if the tolerance is clamped by the lattice memory, zero otherwise
+        double clamped_tolerance = 0.0;
+        double read_milliseconds = 0.0;
+        double mesh_milliseconds = 0.0;
+        double decimate_milliseconds = 0.0;
+        double optimize_milliseconds = 0.0;
+        double write_milliseconds = 0.0;
+    };
+
+    double millisecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    bool isDirectory(const std::string& path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR) != 0;
+    }
+
+    bool hasSuffix(const std::string& text, const std::string& suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+
+    // Scene files of the directory sorted by name, subdirectories are not visited
+    std::vector<std::string> listScenes(const std::string& directory)
+    {
+        std::vector<std::string> names;
+#if defined(_WIN32)
+        WIN32_FIND_DATAA data;
+        const HANDLE find = FindFirstFileA((directory + "\\*").c_str(), &data);
+        if (find != INVALID_HANDLE_VALUE)
+        {
+            do
+            {
+                names.push_back(data.cFileName);
+            } while (FindNextFileA(find, &data));
+            FindClose(find);
+        }
+#else
+        DIR* dir = opendir(directory.c_str());
+        if (dir)
+        {
+            while (const dirent* entry = readdir(dir))
+            {
+                names.push_back(entry->d_name);
+            }
+            closedir(dir);
+        }
+#endif
+        std::vector<std::string> scenes;
+        for (auto& name : names)
+        {
+            const std::string path = directory + "/" + name;
+            if (hasSuffix(name, SCENE_EXTENSION) && !isDirectory(path))
+            {
+                scenes.push_back(path);
+            }
+        }
+        std::sort(scenes.begin(), scenes.end());
+        return scenes;
+    }
+
+    const char* solidTypeName(Gkm::Solid::ESolidType type)
+    {
+        switch (type)
+        {
+        case Gkm::Solid::ESolidType::Empty:
+            return "empty";
+        case Gkm::Solid::ESolidType::Cube:
+            return "cube";
+        case Gkm::Solid::ESolidType::Sphere:
+            return "sphere";
+        case Gkm::Solid::ESolidType::Union:
+            return "union";
+        case Gkm::Solid::ESolidType::Difference:
+            return "difference";
+        case Gkm::Solid::ESolidType::Intersection:
+            return "intersection";
+        case Gkm::Solid::ESolidType::Transform:
+            return "translate";
+        case Gkm::Solid::ESolidType::MultiUnion:
+            return "multi_union";
+        default:
+            return "custom";
+        }
+    }
+
+    // Nodes of the solid in order of a depth-first walk, shared nodes are listed once
+    void collectNodes(const Gkm::Solid::ISolid::Ptr& solid, std::set<const Gkm::Solid::ISolid*>& visited, std::vector<Gkm::Solid::ISolid::Ptr>& nodes)
+    {
+        if (!visited.insert(solid.get()).second)
+        {
+            return;
+        }
+        nodes.push_back(solid);
+        switch (solid->type())
+        {
+        case Gkm::Solid::ESolidType::Union:
+        case Gkm::Solid::ESolidType::Difference:
+        case Gkm::Solid::ESolidType::Intersection:
+        {
+            const auto boolean_operator = std::static_pointer_cast<Gkm::Solid::IBooleanOperator>(solid);
+            collectNodes(boolean_operator->left, visited, nodes);
+            collectNodes(boolean_operator->right, visited, nodes);
+            break;
+        }
+        case Gkm::Solid::ESolidType::Transform:
+            collectNodes(std::static_pointer_cast<Gkm::Solid::TransformOperator>(solid)->solid, visited, nodes);
+            break;
+        case Gkm::Solid::ESolidType::MultiUnion:
+            for (auto& operand : std::static_pointer_cast<Gkm::Solid::MultiUnionOperator>(solid)->solids)
+            {
+                collectNodes(operand, visited, nodes);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Nodes with the largest total time, times are inclusive, so operators are above their operands
+    std::string profileReport(const Gkm::Solid::ISolid::Ptr& solid, const Gkm::Solid::SolidProfiler& profiler, size_t reordered_count, double milliseconds)
+    {
+        std::set<const Gkm::Solid::ISolid*> visited;
+        std::vector<Gkm::Solid::ISolid::Ptr> nodes;
+        collectNodes(solid, visited, nodes);
+        std::vector<std::pair<Gkm::Solid::NodeStatistics, size_t>> statistics;
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            Gkm::Solid::NodeStatistics node_statistics;
+            if (profiler.getStatistics(nodes[i].get(), node_statistics) && node_statistics.call_count > 0)
+            {
+                statistics.emplace_back(node_statistics, i);
+            }
+        }
+        std::sort(statistics.begin(), statistics.end(), [](const std::pair<Gkm::Solid::NodeStatistics, size_t>& left, const std::pair<Gkm::Solid::NodeStatistics, size_t>& right)
+        {
+            return left.first.nanoseconds > right.first.nanoseconds;
+        });
+
+        char line[160];
+        std::snprintf(line, sizeof(line), "  %zu nodes profiled in %.1f ms, %zu operators reordered\n", nodes.size(), milliseconds, reordered_count);
+        std::string report = line;
+        std::snprintf(line, sizeof(line), "  %6s %-14s %12s %8s %10s %10s\n", "node", "type", "calls", "true %", "avg ns", "total ms");
+        report += line;
+        for (size_t i = 0; i < std::min(statistics.size(), PROFILE_NODE_COUNT); ++i)
+        {
+            const Gkm::Solid::NodeStatistics& node_statistics = statistics[i].first;
+            std::snprintf(line, sizeof(line), "  %6zu %-14s %12llu %8.1f %10.1f %10.1f\n", statistics[i].second, solidTypeName(nodes[statistics[i].second]->type()),
+                static_cast<unsigned long long>(node_statistics.call_count), 100.0 * node_statistics.trueRate(), node_statistics.averageCost(), node_statistics.nanoseconds / 1e6);
+            report += line;
+        }
+        return report;
+    }
+
+    // Absolute path without links, dot segments and repeated separators, so the same file is found by different paths.
+    // The path is kept as it is if it could not be resolved, for instance, if the file does not exist.
+    std::string normalizePath(const std::string& path)
+    {
+#if defined(_WIN32)
+        char full_path[MAX_PATH];
+        const DWORD length = GetFullPathNameA(path.c_str(), MAX_PATH, full_path, nullptr);
+        return length > 0 && length < MAX_PATH ? std::string(full_path, length) : path;
+#else
+        char real_path[PATH_MAX];
+        return realpath(path.c_str(), real_path) ? std::string(real_path) : path;
+#endif
+    }
+
+    std::string outputPath(const std::string& input, const Settings& settings)
+    {
+        const size_t name_start = input.find_last_of("/\\") == std::string::npos ? 0 : input.find_last_of("/\\") + 1;
+        std::string stem = input.substr(name_start);
+        const size_t extension_start = stem.rfind('.');
+        if (extension_start != std::string::npos && extension_start > 0)
+        {
+            stem.erase(extension_start);
+        }
+        const std::string directory = settings.output_directory.empty() ? input.substr(0, name_start) : settings.output_directory + "/";
+        return directory + stem + (settings.stl ? ".stl" : ".obj");
+    }
+
+    SceneResult meshScene(const std::string& input, const Settings& settings, unsigned thread_count)
+    {
+        SceneResult result;
+        result.input = input;
+        result.output = outputPath(input, settings);
+
+        auto start = std::chrono::steady_clock::now();
+        Gkm::Solid::ISolid::Ptr solid = Gkm::Solid::readScene(input, &result.error);
+        if (!solid)
+        {
+            return result;
+        }
+        Gkm::Solid::SolidDag solid_dag;
+        solid = solid_dag.canonicalize(Gkm::Solid::simplify(solid));
+        result.read_milliseconds = millisecondsSince(start);
+
+        if (settings.profile)
+        {
+            // Instrumented nodes are opaque for compiled evaluation, so statistics are collected by a coarse pass
+            start = std::chrono::steady_clock::now();
+            Gkm::Solid::SolidProfiler profiler;
+            Gkm::Solid::BuildOptions profile_options = settings.build_options;
+            profile_options.tolerance *= PROFILE_TOLERANCE_SCALE;
+            profile_options.thread_count = thread_count;
+            Gkm::Solid::buildModel(profiler.instrument(solid), profile_options);
+            size_t reordered_count = 0;
+            const Gkm::Solid::ISolid::Ptr reordered_solid = Gkm::Solid::reorder(solid, profiler, &reordered_count);
+            result.profile_report = profileReport(solid, profiler, reordered_count, millisecondsSince(start));
+            solid = reordered_solid;
+        }
+
+        start = std::chrono::steady_clock::now();
+        Gkm::Solid::BuildOptions build_options = settings.build_options;
+        build_options.thread_count = thread_count;
+        if (build_options.mode == Gkm::Solid::EBuildMode::Bricks)
+        {
+            Gkm::Solid::brickLatticeDepth(solid->bbox(), build_options, &result.clamped_tolerance);
+        }
+        Gkm::Solid::Model::Ptr model = Gkm::Solid::buildModel(solid, build_options);
+        result.mesh_milliseconds = millisecondsSince(start);
+
+        if (settings.decimation_error > 0.0)
+        {
+            start = std::chrono::steady_clock::now();
+            Gkm::Solid::DecimationOptions decimation_options;
+            decimation_options.max_error = settings.decimation_error;
+            // Regions of about 8^3 per model keep all threads busy and borders short
+            decimation_options.region_size = std::max(solid->bbox().sizes().maxCoeff() / 8.0, settings.build_options.tolerance);
+            decimation_options.thread_count = thread_count;
+            model = Gkm::Solid::decimateModel(*model, decimation_options);
+            result.decimate_milliseconds = millisecondsSince(start);
+        }
+
+        bool written = false;
+        result.triangle_count = model->points.size() / 3;
+        if (settings.stl)
+        {
+            result.vertex_count = model->points.size();
+            start = std::chrono::steady_clock::now();
+            written = Gkm::Solid::writeStl(result.output, *model);
+        }
+        else
+        {
+            start = std::chrono::steady_clock::now();
+            Gkm::Solid::IndexedModel::Ptr indexed_model = Gkm::Solid::buildIndexedModel(*model);
+            if (settings.optimize)
+            {
+                Gkm::Solid::optimizeMesh(*indexed_model, Gkm::Solid::MeshOptimizationOptions());
+            }
+            result.optimize_milliseconds = millisecondsSince(start);
+            result.vertex_count = indexed_model->points.size();
+            start = std::chrono::steady_clock::now();
+            written = Gkm::Solid::writeObj(result.output, *indexed_model);
+        }
+        result.write_milliseconds = millisecondsSince(start);
+        if (!written)
+        {
+            result.error = "could not write " + result.output;
+        }
+        return result;
+    }
+
+    double percentile(std::vector<double> values, double fraction)
+    {
+        if (values.empty())
+        {
+            return 0.0;
+        }
+        std::sort(values.begin(), values.end());
+        const size_t index = static_cast<size_t>(std::ceil(fraction * values.size()));
+        return values[std::min(std::max<size_t>(index, 1), values.size()) - 1];
+    }
+
+    void printUsage()
+    {
+        std::printf(
+            "Usage: gkm_mesh [options] <scene file or directory>...\n"
+            "Meshes scene files (*%s in directories) in parallel and writes meshes next to them.\n"
+            "  --output <directory>      Directory of meshes.\n"
+            "  --format obj|stl          Mesh format, default obj.\n"
+            "  --tolerance <size>        Maximal cell size, default %g.\n"
+            "  --surface-tolerance <d>   Maximal deviation of planar patches in top-down mode, zero disables adaptive refinement.\n"
+            "  --mode top-down|bricks    Octree build mode, default bricks.\n"
+            "  --decimate <error>        Maximal decimation error, zero disables decimation.\n"
+            "  --no-optimize             Keeps the mesher order of OBJ triangles and vertices.\n"
+            "  --profile                 Reorders operands by node statistics of a coarse pass and prints them.\n"
+            "  --jobs <count>            Scenes meshed at once, default is the number of hardware threads.\n"
+            "  --threads <count>         Threads of each scene, default divides hardware threads between jobs.\n"
+            "  --memory <MB>             Lattice memory of all jobs in bricks mode, it is divided between jobs, default %zu.\n",
+            SCENE_EXTENSION, Gkm::Solid::BuildOptions().tolerance, Gkm::Solid::BuildOptions().max_lattice_memory >> 20);
+    }
+
+    // Returns false if arguments are wrong
+    bool parseArguments(int argc, char* argv[], Settings& settings)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string argument = argv[i];
+            const bool has_value = i + 1 < argc;
+            if (argument.compare(0, 2, "--") != 0)
+            {
+                settings.inputs.push_back(argument);
+            }
+            else if (argument == "--help")
+            {
+                return false;
+            }
+            else if (argument == "--no-optimize")
+            {
+                settings.optimize = false;
+            }
+            else if (argument == "--profile")
+            {
+                settings.profile = true;
+            }
+            else if (!has_value)
+            {
+                std::fprintf(stderr, "Option %s needs a value\n", argument.c_str());
+                return false;
+            }
+            else if (argument == "--output")
+            {
+                settings.output_directory = argv[++i];
+            }
+            else if (argument == "--format")
+            {
+                const std::string format = argv[++i];
+                if (format != "obj" && format != "stl")
+                {
+                    std::fprintf(stderr, "Unknown format %s\n", format.c_str());
+                    return false;
+                }
+                settings.stl = format == "stl";
+            }
+            else if (argument == "--tolerance")
+            {
+                settings.build_options.tolerance = std::atof(argv[++i]);
+                if (settings.build_options.tolerance <= 0.0)
+                {
+                    std::fprintf(stderr, "Tolerance should be positive\n");
+                    return false;
+                }
+            }
+            else if (argument == "--surface-tolerance")
+            {
+                settings.build_options.surface_tolerance = std::max(std::atof(argv[++i]), 0.0);
+            }
+            else if (argument == "--mode")
+            {
+                const std::string mode = argv[++i];
+                if (mode != "top-down" && mode != "bricks")
+                {
+                    std::fprintf(stderr, "Unknown mode %s\n", mode.c_str());
+                    return false;
+                }
+                settings.build_options.mode = mode == "bricks" ? Gkm::Solid::EBuildMode::Bricks : Gkm::Solid::EBuildMode::TopDown;
+            }
+            else if (argument == "--decimate")
+            {
+                settings.decimation_error = std::max(std::atof(argv[++i]), 0.0);
+            }
+            else if (argument == "--jobs")
+            {
+                settings.job_count = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+            }
+            else if (argument == "--threads")
+            {
+                settings.thread_count = static_cast<unsigned>(std::max(std::atoi(argv[++i]), 0));
+            }
+            else if (argument == "--memory")
+            {
+                const double megabytes = std::atof(argv[++i]);
+                if (megabytes <= 0.0)
+                {
+                    std::fprintf(stderr, "Memory should be positive\n");
+                    return false;
+                }
+                settings.lattice_memory = static_cast<size_t>(megabytes * 1024.0 * 1024.0);
+            }
+            else
+            {
+                std::fprintf(stderr, "Unknown option %s\n", argument.c_str());
+                return false;
+            }
+        }
+        return !settings.inputs.empty();
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Settings settings;
+    if (!parseArguments(argc, argv, settings))
+    {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<std::string> scenes;
+    for (auto& input : settings.inputs)
+    {
+        if (isDirectory(input))
+        {
+            const std::vector<std::string> directory_scenes = listScenes(input);
+            scenes.insert(scenes.end(), directory_scenes.begin(), directory_scenes.end());
+        }
+        else
+        {
+            scenes.push_back(input);
+        }
+    }
+    if (scenes.empty())
+    {
+        std::fprintf(stderr, "No scenes found\n");
+        return 1;
+    }
+    // Jobs should not write the same mesh, scenes which are given twice by any paths are meshed once
+    std::vector<std::string> unique_scenes;
+    std::map<std::string, std::pair<std::string, std::string>> output_scenes;
+    Settings normalized_settings = settings;
+    if (!settings.output_directory.empty())
+    {
+        normalized_settings.output_directory = normalizePath(settings.output_directory);
+    }
+    for (auto& scene : scenes)
+    {
+        const std::string normalized_scene = normalizePath(scene);
+        const auto inserted = output_scenes.emplace(outputPath(normalized_scene, normalized_settings), std::make_pair(normalized_scene, scene));
+        if (inserted.second)
+        {
+            unique_scenes.push_back(scene);
+        }
+        else if (inserted.first->second.first != normalized_scene)
+        {
+            std::fprintf(stderr, "Scenes %s and %s are written to the same mesh %s\n", inserted.first->second.second.c_str(), scene.c_str(), inserted.first->first.c_str());
+            return 2;
+        }
+    }
+    scenes.swap(unique_scenes);
+
+    // Scenes are independent, each job takes the next scene, threads of a job mesh and decimate its scene
+    const unsigned hardware_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    unsigned job_count = settings.job_count ? settings.job_count : hardware_thread_count;
+    job_count = static_cast<unsigned>(std::min<size_t>(job_count, scenes.size()));
+    const unsigned thread_count = settings.thread_count ? settings.thread_count : std::max(hardware_thread_count / job_count, 1u);
+    // Lattices of all jobs could be allocated at the same time, so each job gets its share of the memory
+    settings.build_options.max_lattice_memory = settings.lattice_memory / job_count;
+    // Jobs share one compiler of the run, so identical scenes are compiled once and the cache is released with the run
+    settings.build_options.jit_compiler = std::make_shared<Gkm::Solid::JitCompiler>();
+    std::printf("%zu scenes, %u jobs of %u threads and %.0f MB of lattice memory\n\n", scenes.size(), job_count, thread_count,
+        settings.build_options.max_lattice_memory / (1024.0 * 1024.0));
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<SceneResult> results(scenes.size());
+    std::atomic<size_t> next_scene(0);
+    auto worker = [&]()
+    {
+        for (size_t i = next_scene++; i < scenes.size(); i = next_scene++)
+        {
+            results[i] = meshScene(scenes[i], settings, thread_count);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < job_count; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    const double wall_milliseconds = millisecondsSince(start);
+
+    std::printf("%-32s %10s %10s %9s %9s %9s %9s %9s\n", "scene", "triangles", "vertices", "read ms", "mesh ms", "decim ms", "optim ms", "write ms");
+    size_t failed_count = 0;
+    size_t triangle_count = 0;
+    double stage_milliseconds[5] = { 0.0, 0.0, 0.0, 0.0, 0.0 };
+    std::vector<double> scene_milliseconds;
+    for (auto& result : results)
+    {
+        if (!result.error.empty())
+        {
+            ++failed_count;
+            std::printf("%-32s failed: %s\n", result.input.c_str(), result.error.c_str());
+            continue;
+        }
+        std::printf("%-32s %10zu %10zu %9.1f %9.1f %9.1f %9.1f %9.1f\n", result.input.c_str(), result.triangle_count, result.vertex_count,
+            result.read_milliseconds, result.mesh_milliseconds, result.decimate_milliseconds, result.optimize_milliseconds, result.write_milliseconds);
+        if (result.clamped_tolerance > 0.0)
+        {
+            std::printf("%-32s tolerance is clamped to %g by the lattice memory limit\n", "", result.clamped_tolerance);
+        }
+        if (!result.profile_report.empty())
+        {
+            std::printf("%s", result.profile_report.c_str());
+        }
+        triangle_count += result.triangle_count;
+        const double stages[5] = { result.read_milliseconds, result.mesh_milliseconds, result.decimate_milliseconds, result.optimize_milliseconds, result.write_milliseconds };
+        double total = 0.0;
+        for (unsigned stage = 0; stage < 5; ++stage)
+        {
+            stage_milliseconds[stage] += stages[stage];
+            total += stages[stage];
+        }
+        scene_milliseconds.push_back(total);
+    }
+
+    std::printf("\n%zu meshed, %zu failed, %zu triangles in %.1f ms (%.2f Mtri/s)\n", results.size() - failed_count, failed_count, triangle_count,
+        wall_milliseconds, wall_milliseconds > 0.0 ? triangle_count / (wall_milliseconds * 1000.0) : 0.0);
+    std::printf("Stage totals: read %.1f ms, mesh %.1f ms, decimate %.1f ms, optimize %.1f ms, write %.1f ms\n",
+        stage_milliseconds[0], stage_milliseconds[1], stage_milliseconds[2], stage_milliseconds[3], stage_milliseconds[4]);
+    std::printf("Scene time: p50 %.1f ms, p90 %.1f ms, max %.1f ms\n",
+        percentile(scene_milliseconds, 0.5), percentile(scene_milliseconds, 0.9), percentile(scene_milliseconds, 1.0));
+    return failed_count ? 1 : 0;
+}